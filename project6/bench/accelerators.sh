@@ -0,0 +1,94 @@
+#!/bin/sh
+#
+# accelerators.sh -- compare grids and kd-trees with hierarchies
+#
+# usage: sh bench/accelerators.sh [ray binary] [report.json]
+#
+# Run it from the project6 directory (or use "make accel").  Every line
+# of bench/matrix.txt is rendered with hierarchies (ray -x bvh), then
+# with a uniform grid, a two-level one, and kd-trees over the faces of
+# meshes walked with a stack and along ropes, each with "-d" pointing at
+# the hierarchy's image, so the other runs report how many pixels
+# differ (there should be none).  The report holds all five runs of
+# every line, as written by "ray -b"; their "accelerator" fields tell
+# them apart, and their "accelerators" fields hold what was built of
+# each kind, with its bytes and build seconds.  Parse (which includes
+# building what the meshes walk), build and render seconds, and the
+# bytes what was built of the kind takes, are also printed as they come.
+
+RAY=${1:-./ray}
+REPORT=${2:-bench/accelerators.json}
+THREADS=${BENCH_THREADS:-1}
+KINDS="bvh grid twolevel kdtree ropes"
+
+# Paths handed to ray must be relative: its getopt takes anything
+# starting with '/' for an option.
+WORK=bench/work
+mkdir -p $WORK || exit 1
+
+COMMIT=`git rev-parse --short HEAD 2>/dev/null || echo unknown`
+if [ -n "`git status --porcelain -uno 2>/dev/null`" ]; then
+  COMMIT="$COMMIT-dirty"
+fi
+
+{
+  echo "{"
+  echo "  \"commit\": \"$COMMIT\","
+  echo "  \"date\": \"`date -u +%Y-%m-%dT%H:%M:%SZ`\","
+  echo "  \"threads\": $THREADS,"
+  echo "  \"runs\": ["
+} > $WORK/report.json
+
+# A number out of a report written by ray -b.
+field() {
+  sed -n "s/^  \"$1\": \([^,]*\),*$/\1/p" $2
+}
+
+# The bytes taken by what was built of the kind asked for, or "-" if
+# nothing was (a kd-tree for a scene without meshes).
+bytes() {
+  b=`sed -n "s/^    \"$1\": {.*\"bytes\": \([0-9]*\).*$/\1/p" $2`
+  echo ${b:--}
+}
+
+grep -v '^#' bench/matrix.txt > $WORK/matrix.txt
+first=yes
+failed=0
+while read scene width depth samples; do
+  [ -z "$scene" ] && continue
+  echo "$scene  (width $width, depth $depth, samples $samples)" >&2
+
+  for kind in $KINDS; do
+    diff=
+    [ $kind = bvh ] || diff="-d $WORK/bvh.bmp"
+    if ! "$RAY" -n -w $width -r $depth -s $samples -j $THREADS -x $kind $diff \
+           -b $WORK/$kind.json $scene $WORK/$kind.bmp > $WORK/$kind.txt; then
+      echo "  $kind failed" >&2
+      failed=`expr $failed + 1`
+      [ $kind = bvh ] && break
+      continue
+    fi
+    printf "  %-9s parse %-12s build %-12s render %-12s bytes %-10s %s\n" $kind \
+      `field parse_seconds $WORK/$kind.json` `field build_seconds $WORK/$kind.json` \
+      `field render_seconds $WORK/$kind.json` `bytes $kind $WORK/$kind.json` \
+      "`grep '^against' $WORK/$kind.txt | sed 's/^[^:]*: //'`" >&2
+
+    [ $first = yes ] || echo "    ," >> $WORK/report.json
+    first=no
+    sed 's/^/    /' $WORK/$kind.json >> $WORK/report.json
+  done
+done < $WORK/matrix.txt
+
+{
+  echo "  ]"
+  echo "}"
+} >> $WORK/report.json
+
+mv $WORK/report.json "$REPORT"
+rm -rf $WORK
+echo "wrote $REPORT" >&2
+
+if [ $failed -gt 0 ]; then
+  echo "$failed render(s) failed" >&2
+  exit 1
+fi
@@ -0,0 +1,77 @@
+#!/bin/sh
+#
+# benchmark.sh -- render a fixed set of scenes and report how long it took
+#
+# usage: sh bench/benchmark.sh [ray binary] [report.json]
+#
+# Run it from the project6 directory (or use "make bench").  Every line
+# of bench/matrix.txt is rendered once, and the report is a JSON object
+# holding the commit and time of the run plus one entry per line of the
+# matrix, as written by "ray -b": wall-clock parse, hierarchy build and
+# render times, and rays and rays/second by ray type.
+#
+# Scenes are always parsed from the .ray text (-n), so parse_seconds
+# measures the parser rather than the scene cache.  Set BENCH_THREADS
+# to render (and build hierarchies) with more than one thread,
+# BENCH_BUILDER to build them with something other than the sweep
+# (see ray -B), and BENCH_ACCEL to trace with a grid rather than
+# hierarchies (see ray -x, and accelerators.sh).
+
+RAY=${1:-./ray}
+REPORT=${2:-bench/results.json}
+THREADS=${BENCH_THREADS:-1}
+BUILDER=${BENCH_BUILDER:-sweep}
+ACCEL=${BENCH_ACCEL:-bvh}
+
+# Paths handed to ray must be relative: its getopt takes anything
+# starting with '/' for an option.
+WORK=bench/work
+mkdir -p $WORK || exit 1
+
+COMMIT=`git rev-parse --short HEAD 2>/dev/null || echo unknown`
+if [ -n "`git status --porcelain -uno 2>/dev/null`" ]; then
+  COMMIT="$COMMIT-dirty"
+fi
+
+{
+  echo "{"
+  echo "  \"commit\": \"$COMMIT\","
+  echo "  \"date\": \"`date -u +%Y-%m-%dT%H:%M:%SZ`\","
+  echo "  \"threads\": $THREADS,"
+  echo "  \"builder\": \"$BUILDER\","
+  echo "  \"accelerator\": \"$ACCEL\","
+  echo "  \"runs\": ["
+} > $WORK/report.json
+
+grep -v '^#' bench/matrix.txt > $WORK/matrix.txt
+first=yes
+failed=0
+while read scene width depth samples; do
+  [ -z "$scene" ] && continue
+  echo "$scene  (width $width, depth $depth, samples $samples)" >&2
+
+  if ! "$RAY" -n -w $width -r $depth -s $samples -j $THREADS -B $BUILDER -x $ACCEL \
+         -b $WORK/run.json $scene $WORK/image.bmp > /dev/null; then
+    echo "  failed" >&2
+    failed=`expr $failed + 1`
+    continue
+  fi
+
+  [ $first = yes ] || echo "    ," >> $WORK/report.json
+  first=no
+  sed 's/^/    /' $WORK/run.json >> $WORK/report.json
+done < $WORK/matrix.txt
+
+{
+  echo "  ]"
+  echo "}"
+} >> $WORK/report.json
+
+mv $WORK/report.json "$REPORT"
+rm -rf $WORK
+echo "wrote $REPORT" >&2
+
+if [ $failed -gt 0 ]; then
+  echo "$failed scene(s) failed to render" >&2
+  exit 1
+fi
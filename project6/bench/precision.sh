@@ -0,0 +1,76 @@
+#!/bin/sh
+#
+# precision.sh -- compare float renders with double ones
+#
+# usage: sh bench/precision.sh [double binary] [float binary] [report.json]
+#
+# Run it from the project6 directory (or use "make precision").  Every
+# line of bench/matrix.txt is rendered by the double build, then by the
+# float one (make ray_float) with "-d" pointing at the double image, so
+# the float run reports how many pixels differ, by how much at most, and
+# the RMS difference.  The report holds both runs of every line, as
+# written by "ray -b"; their "precision" fields tell them apart, and the
+# float one carries the "diff".  The differences are also printed as
+# they come.
+
+RAY=${1:-./ray}
+RAY_FLOAT=${2:-./ray_float}
+REPORT=${3:-bench/precision.json}
+THREADS=${BENCH_THREADS:-1}
+
+# Paths handed to ray must be relative: its getopt takes anything
+# starting with '/' for an option.
+WORK=bench/work
+mkdir -p $WORK || exit 1
+
+COMMIT=`git rev-parse --short HEAD 2>/dev/null || echo unknown`
+if [ -n "`git status --porcelain -uno 2>/dev/null`" ]; then
+  COMMIT="$COMMIT-dirty"
+fi
+
+{
+  echo "{"
+  echo "  \"commit\": \"$COMMIT\","
+  echo "  \"date\": \"`date -u +%Y-%m-%dT%H:%M:%SZ`\","
+  echo "  \"threads\": $THREADS,"
+  echo "  \"runs\": ["
+} > $WORK/report.json
+
+grep -v '^#' bench/matrix.txt > $WORK/matrix.txt
+first=yes
+failed=0
+while read scene width depth samples; do
+  [ -z "$scene" ] && continue
+  echo "$scene  (width $width, depth $depth, samples $samples)" >&2
+
+  if ! "$RAY" -n -w $width -r $depth -s $samples -j $THREADS \
+         -b $WORK/double.json $scene $WORK/double.bmp > /dev/null ||
+     ! "$RAY_FLOAT" -n -w $width -r $depth -s $samples -j $THREADS \
+         -d $WORK/double.bmp -b $WORK/float.json $scene $WORK/float.bmp \
+         > $WORK/float.txt; then
+    echo "  failed" >&2
+    failed=`expr $failed + 1`
+    continue
+  fi
+  grep '^against' $WORK/float.txt | sed 's/^[^:]*: /  /' >&2
+
+  [ $first = yes ] || echo "    ," >> $WORK/report.json
+  first=no
+  sed 's/^/    /' $WORK/double.json >> $WORK/report.json
+  echo "    ," >> $WORK/report.json
+  sed 's/^/    /' $WORK/float.json >> $WORK/report.json
+done < $WORK/matrix.txt
+
+{
+  echo "  ]"
+  echo "}"
+} >> $WORK/report.json
+
+mv $WORK/report.json "$REPORT"
+rm -rf $WORK
+echo "wrote $REPORT" >&2
+
+if [ $failed -gt 0 ]; then
+  echo "$failed scene(s) failed to render" >&2
+  exit 1
+fi
@@ -0,0 +1,220 @@
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+
+#include "Animation.h"
+#include "scene/scene.h"
+
+using namespace std;
+
+namespace {
+
+// From direction a to direction b: their lengths are interpolated
+// separately, so that turning doesn't shorten them.
+Vec3r turn( const Vec3r& a, const Vec3r& b, Real t )
+{
+  if( t <= 0.0 )
+    return a;
+  if( t >= 1.0 )
+    return b;
+  Vec3r d = a * (1 - t) + b * t;
+  Real length = d.length();
+  if( length == 0.0 )
+    return d;
+  return d * ((a.length() * (1 - t) + b.length() * t) / length);
+}
+
+template <class Key>
+bool earlier( const Key& a, const Key& b )
+{
+  return a.frame < b.frame;
+}
+
+bool readVec( istringstream& in, Vec3r& v )
+{
+  double x, y, z;
+  if( !(in >> x >> y >> z) )
+    return false;
+  v = Vec3r( x, y, z );
+  return true;
+}
+
+}
+
+bool Animation::load( const char* fileName, Scene* s, string& error )
+{
+  ifstream file( fileName );
+  if( !file ) {
+    error = string( "couldn't read animation '" ) + fileName + "'";
+    return false;
+  }
+
+  scene = s;
+  frames = 0;
+  cameraKeys.clear();
+  tracks.clear();
+
+  const Camera& camera = scene->getCamera();
+  Vec3r viewdir = camera.getViewDir();
+  Vec3r updir = camera.getUpDir();
+
+  string line;
+  int lineNumber = 0;
+  int lastFrame = -1;
+  while( getline( file, line ) ) {
+    ++lineNumber;
+    ostringstream where;
+    where << fileName << ", line " << lineNumber << ": ";
+
+    line = line.substr( 0, line.find( '#' ) );
+    istringstream in( line );
+    string what;
+    if( !(in >> what) )
+      continue;
+
+    if( what == "frames" ) {
+      if( !(in >> frames) || frames < 1 ) {
+        error = where.str() + "expected a frame count";
+        return false;
+      }
+      continue;
+    }
+
+    if( what != "camera" && what != "object" ) {
+      error = where.str() + "expected 'frames', 'camera' or 'object'";
+      return false;
+    }
+
+    string name;
+    if( what == "object" && !(in >> name) ) {
+      error = where.str() + "expected an object name";
+      return false;
+    }
+    int frame;
+    if( !(in >> frame) || frame < 0 ) {
+      error = where.str() + "expected a frame number";
+      return false;
+    }
+    lastFrame = max( lastFrame, frame );
+
+    CameraKey c = { frame, camera.getEye(), viewdir, updir };
+    ObjectKey o = { frame, Vec3r( 0, 0, 0 ), Vec3r( 0, 1, 0 ), 0.0, Vec3r( 1, 1, 1 ) };
+    string field;
+    while( in >> field ) {
+      bool ok;
+      if( what == "camera" && field == "position" )
+        ok = readVec( in, c.position );
+      else if( what == "camera" && field == "viewdir" )
+        ok = readVec( in, c.viewdir );
+      else if( what == "camera" && field == "updir" )
+        ok = readVec( in, c.updir );
+      else if( what == "object" && field == "translate" )
+        ok = readVec( in, o.translate );
+      else if( what == "object" && field == "rotate" ) {
+        double angle;
+        ok = readVec( in, o.axis ) && (in >> angle);
+        o.angle = angle;
+      }
+      else if( what == "object" && field == "scale" )
+        ok = readVec( in, o.scale );
+      else {
+        error = where.str() + "unknown " + what + " field '" + field + "'";
+        return false;
+      }
+      if( !ok ) {
+        error = where.str() + "bad value for '" + field + "'";
+        return false;
+      }
+    }
+
+    if( what == "camera" ) {
+      cameraKeys.push_back( c );
+      continue;
+    }
+    Track* t = track( name );
+    if( !t ) {
+      error = where.str() + "no object is named '" + name + "'";
+      return false;
+    }
+    t->keys.push_back( o );
+  }
+
+  if( frames == 0 )
+    frames = lastFrame + 1;
+  if( frames == 0 ) {
+    error = string( "no keyframes in '" ) + fileName + "'";
+    return false;
+  }
+
+  stable_sort( cameraKeys.begin(), cameraKeys.end(), earlier<CameraKey> );
+  for( size_t k = 0; k < tracks.size(); ++k )
+    stable_sort( tracks[k].keys.begin(), tracks[k].keys.end(), earlier<ObjectKey> );
+  return true;
+}
+
+Animation::Track* Animation::track( const string& name )
+{
+  for( size_t k = 0; k < tracks.size(); ++k )
+    if( tracks[k].name == name )
+      return &tracks[k];
+
+  pair<Scene::NameMap::const_iterator, Scene::NameMap::const_iterator> named =
+    scene->names().equal_range( name );
+  if( named.first == named.second )
+    return 0;
+
+  tracks.push_back( Track() );
+  Track& t = tracks.back();
+  t.name = name;
+  for( Scene::NameMap::const_iterator n = named.first; n != named.second; ++n ) {
+    t.nodes.push_back( n->second );
+    t.parsed.push_back( n->second->localTransform() );
+  }
+  return &t;
+}
+
+template <class Key>
+Real Animation::between( const vector<Key>& keys, int frame, const Key*& a, const Key*& b )
+{
+  size_t next = 0;
+  while( next < keys.size() && keys[next].frame <= frame )
+    ++next;
+  a = &keys[next == 0 ? 0 : next - 1];
+  b = &keys[next == keys.size() ? keys.size() - 1 : next];
+  if( a->frame >= b->frame )
+    return 0.0;
+  return Real( frame - a->frame ) / Real( b->frame - a->frame );
+}
+
+void Animation::apply( int frame )
+{
+  if( !cameraKeys.empty() ) {
+    const CameraKey *a, *b;
+    Real t = between( cameraKeys, frame, a, b );
+    // Handed to setLook as they are, as the parser does with the .ray
+    // file's, so that a key that repeats the file's camera looks the same.
+    Camera& camera = scene->getCamera();
+    camera.setEye( a->position * (1 - t) + b->position * t );
+    camera.setLook( turn( a->viewdir, b->viewdir, t ), turn( a->updir, b->updir, t ) );
+  }
+
+  for( size_t k = 0; k < tracks.size(); ++k ) {
+    const Track& track = tracks[k];
+    if( track.keys.empty() )
+      continue;
+    const ObjectKey *a, *b;
+    Real t = between( track.keys, frame, a, b );
+    Vec3r translate = a->translate * (1 - t) + b->translate * t;
+    Vec3r axis = a->axis * (1 - t) + b->axis * t;
+    Vec3r scale = a->scale * (1 - t) + b->scale * t;
+    Real angle = a->angle * (1 - t) + b->angle * t;
+
+    Mat4r m = Mat4r::createTranslation( translate[0], translate[1], translate[2] ) *
+      Mat4r::createRotation( angle, axis[0], axis[1], axis[2] ) *
+      Mat4r::createScale( scale[0], scale[1], scale[2] );
+    for( size_t n = 0; n < track.nodes.size(); ++n )
+      track.nodes[n]->setLocalTransform( m * track.parsed[n] );
+  }
+
+  scene->refit();
+}
@@ -0,0 +1,88 @@
+#ifndef __ANIMATION_H__
+#define __ANIMATION_H__
+
+// Keyframed motion for rendering a sequence of frames out of one loaded
+// scene (ray -A).  Each frame the camera and the transforms of named
+// objects are moved, and the scene's object hierarchy is refit rather
+// than built again; mesh hierarchies live in the meshes' own space and
+// are never touched.  The keyframes come from a text file:
+//
+//   # comment
+//   frames 48
+//   camera 0   position 0 0 5   viewdir 0 0 -1   updir 0 1 0
+//   camera 47  position 5 0 0   viewdir -1 0 0
+//   object dragon 0   rotate 0 1 0 0
+//   object dragon 47  translate 0 0.5 0   rotate 0 1 0 6.283185
+//
+// A key gives a frame and any of its fields; camera fields left out are
+// the scene's, and an object's are no translation, no rotation and unit
+// scale.  "object" moves every object given that name in the .ray file:
+// its transform becomes translate(rotate(scale(...))) of the keyed
+// values, in the frame of the transforms around the object.  Between
+// keys every field, rotation angles included, is interpolated linearly,
+// so a key from 0 to 2 pi turns a full circle; before the first key and
+// after the last the nearest one holds.
+
+#include <string>
+#include <vector>
+
+#include "vecmath/vec.h"
+#include "vecmath/mat.h"
+
+class Scene;
+class TransformNode;
+
+class Animation
+{
+ public:
+  Animation() : scene( 0 ), frames( 0 ) {}
+
+  // Read the keyframes for scene from fileName.  On failure, returns
+  // false with a message in error.
+  bool load( const char* fileName, Scene* scene, std::string& error );
+
+  int frameCount() const { return frames; }
+
+  // Put the camera and the named objects where they are at frame, and
+  // refit the scene to match.
+  void apply( int frame );
+
+ private:
+  struct CameraKey
+  {
+    int frame;
+    Vec3r position, viewdir, updir;
+  };
+
+  struct ObjectKey
+  {
+    int frame;
+    Vec3r translate;
+    Vec3r axis;
+    Real angle;
+    Vec3r scale;
+  };
+
+  // The nodes of every object with one name, their transforms as parsed,
+  // and the keys that move them.
+  struct Track
+  {
+    std::string name;
+    std::vector<TransformNode*> nodes;
+    std::vector<Mat4r> parsed;
+    std::vector<ObjectKey> keys;
+  };
+
+  Track* track( const std::string& name );
+
+  // The keys around frame, and how far along from a to b it is.
+  template <class Key>
+  static Real between( const std::vector<Key>& keys, int frame, const Key*& a, const Key*& b );
+
+  Scene* scene;
+  int frames;
+  std::vector<CameraKey> cameraKeys;
+  std::vector<Track> tracks;
+};
+
+#endif // __ANIMATION_H__
@@ -3,16 +3,20 @@
 #pragma warning (disable: 4786)
 
 #include "RayTracer.h"
+#include "RenderStats.h"
 #include "scene/light.h"
 #include "scene/material.h"
 #include "scene/ray.h"
 
 #include "parser/Tokenizer.h"
 #include "parser/Parser.h"
+#include "parser/SceneCache.h"
+#include "fileio/mappedfile.h"
 
 #include "ui/TraceUI.h"
 #include <cmath>
 #include <algorithm>
+#include <vector>
 
 extern TraceUI* traceUI;
 
@@ -30,94 +34,128 @@ bool debugMode = false;
 // through the projection plane, and out into the scene.  All we do is
 // enter the main ray-tracing method, getting things started by plugging
 // in an initial ray weight of (0.0,0.0,0.0) and an initial recursion depth of 0.
-Vec3d RayTracer::trace( double x, double y )
+Vec3r RayTracer::trace( Real x, Real y, const SceneObject** hit )
 {
   // Clear out the ray cache in the scene for debugging purposes,
-  scene->intersectCache.clear();
+  if( debugMode )
+    scene->intersectCache.clear();
 
-  ray r( Vec3d(0,0,0), Vec3d(0,0,0), ray::VISIBILITY );
+  ray r( Vec3r(0,0,0), Vec3r(0,0,0), ray::VISIBILITY );
 
   scene->getCamera().rayThrough( x,y,r );
-  Vec3d ret = traceRay( r, Vec3d(1.0,1.0,1.0), 0 );
+  Vec3r ret = traceRay( r, Vec3r(1.0,1.0,1.0), 0, hit );
   ret.clamp();
   return ret;
 }
 
+// Whether a child ray is worth tracing, given the weight its color will
+// be scaled by in the final pixel.  Rays that can't contribute anything
+// are always skipped; beyond that, the user can set a cutoff.
+bool RayTracer::worthTracing( const Vec3r& weight )
+{
+  Real w = max( weight[0], max( weight[1], weight[2] ) );
+  return w > 0.0 && w >= traceUI->getThreshold();
+}
+
+ray RayTracer::reflectedRay( const ray& r, const isect& i )
+{
+  Vec3r ray_dir = -r.getDirection();
+
+  // calculate reflection
+  Vec3r reflection_dir = 2 * (ray_dir * i.N) * i.N - ray_dir;
+
+  return ray(offsetOrigin(r.at(i.t), i.N, reflection_dir), reflection_dir, ray::REFLECTION);
+}
+
+// Under total internal reflection the ray carries on along the normal.
+ray RayTracer::refractedRay( const ray& r, const isect& i )
+{
+  const Material& m = i.getMaterial();
+  Vec3r ray_dir = -r.getDirection();
+  Vec3r transmission_dir;
+
+  // Check are we coming in or going out
+  Real test = ray_dir * i.N;
+
+  Real tranIndex, thetaI, thetaT;
+  
+  if (test > 0) {
+    // calculate transmission direction
+    tranIndex = 1 / m.index(i);
+    thetaI = i.N * ray_dir;
+    thetaT = 1 - pow(tranIndex, 2) * (1 - pow(thetaI, 2));
+    thetaT = sqrt(thetaT);
+    transmission_dir = i.N * (tranIndex * thetaI - thetaT) - ray_dir * tranIndex;
+  } else {
+    // calculate transmission direction
+    tranIndex = m.index(i);
+    thetaI = i.N * ray_dir;
+    thetaT = (1 - pow(tranIndex, 2) * (1 - pow(thetaI, 2)));
+    thetaT = sqrt(thetaT);
+    transmission_dir = i.N * (tranIndex * thetaI + thetaT) - ray_dir * tranIndex;
+  }
+ 
+  // create the transmission ray
+  if (thetaT > 0)
+    return ray(offsetOrigin(r.at(i.t), i.N, transmission_dir), transmission_dir, ray::REFRACTION);
+  return ray(offsetOrigin(r.at(i.t), i.N, i.N), i.N, ray::REFRACTION);
+}
+
 // Do recursive ray tracing!  You'll want to insert a lot of code here
 // (or places called from here) to handle reflection, refraction, etc etc.
-Vec3d RayTracer::traceRay( const ray& r, const Vec3d& thresh, int depth )
+// thresh is the weight this ray's color carries in the pixel: the
+// product of kr and kt over the bounces that led here.
+Vec3r RayTracer::traceRay( const ray& r, const Vec3r& thresh, int depth,
+                           const SceneObject** hit )
 {
   isect i;
 
+  if( hit )
+    *hit = 0;
+
   // if depth > max depth, return background color
   if(depth > traceUI->getDepth())
-    return Vec3d( 0.0, 0.0, 0.0);
+    return Vec3r( 0.0, 0.0, 0.0);
 
+  RenderStats::local().countRay( r.type() );
+  RENDER_STAT( countDepth( depth ) );
   if( scene->intersect( r, i ) ) {
+    if( hit )
+      *hit = i.obj;
         
     const Material& m = i.getMaterial();
 
-    Vec3d iphong = Vec3d(0);
-    Vec3d ireflect = Vec3d(0);
-    Vec3d itransmit = Vec3d(0);
-    Vec3d transmission_dir;
-    ray transmission_ray (r.at(i.t), i.N, ray::REFRACTION);
+    Vec3r iphong = Vec3r(0);
+    Vec3r ireflect = Vec3r(0);
+    Vec3r itransmit = Vec3r(0);
     
     iphong = m.shade(scene,r,i);
 
-    // calculate reflection
-    Vec3d ray_dir = -r.getDirection();
-    Vec3d reflection_dir = 2 * (ray_dir * i.N) * i.N - ray_dir;
-    
-    // create reflection_ray
-    ray reflection_ray (r.at(i.t), reflection_dir, ray::REFLECTION);
-    
+    Vec3r kr = m.kr(i);
+    Vec3r kt = m.kt(i);
+    Vec3r reflectWeight = prod(thresh, kr);
+    Vec3r transmitWeight = prod(thresh, kt);
+
     //recurse the reflection ray
-    ireflect = traceRay(reflection_ray, thresh, depth+1);
+    if (worthTracing(reflectWeight))
+      ireflect = traceRay(reflectedRay(r, i), reflectWeight, depth+1);
 
     // Check for transmissive rays
-    double val = m.kt(i)[0] + m.kt(i)[1] + m.kt(i)[2];
-    if (val > 0) {
-      // Check are we coming in or going out
-      double test = ray_dir * i.N;
-
-      double tranIndex, thetaI, thetaT;
-      
-      if (test > 0) {
-        // calculate transmission direction
-        tranIndex = 1 / m.index(i);
-        thetaI = i.N * ray_dir;
-        thetaT = 1 - pow(tranIndex, 2) * (1 - pow(thetaI, 2));
-        thetaT = sqrt(thetaT);
-        transmission_dir = i.N * (tranIndex * thetaI - thetaT) - ray_dir * tranIndex;
-      } else {
-        // calculate transmission direction
-        tranIndex = m.index(i);
-        thetaI = i.N * ray_dir;
-        thetaT = (1 - pow(tranIndex, 2) * (1 - pow(thetaI, 2)));
-        thetaT = sqrt(thetaT);
-        transmission_dir = i.N * (tranIndex * thetaI + thetaT) - ray_dir * tranIndex;
-      }
-     
-      // create the transmission ray
-      if (thetaT > 0)	{
-        ray temp_ray (r.at(i.t), transmission_dir, ray::REFRACTION);
-        transmission_ray = temp_ray;
-      }
-      
-      itransmit = traceRay(transmission_ray, thresh, depth + 1);
-    }
-    return iphong + prod(m.kr(i), ireflect) + prod(m.kt(i), itransmit);
+    if (worthTracing(transmitWeight))
+      itransmit = traceRay(refractedRay(r, i), transmitWeight, depth + 1);
+
+    return iphong + prod(kr, ireflect) + prod(kt, itransmit);
   } else {
     // No intersection.  This ray travels to infinity, so we color
     // it according to the background color, which in this (simple) case
     // is just black.
-    return Vec3d( 0.0, 0.0, 0.0 );
+    return Vec3r( 0.0, 0.0, 0.0 );
   }
 }
 
 RayTracer::RayTracer()
-    : scene( 0 ), buffer( 0 ), buffer_width( 256 ), buffer_height( 256 ), m_bBufferReady( false )
+    : scene( 0 ), buffer( 0 ), buffer_width( 256 ), buffer_height( 256 ), m_bBufferReady( false ),
+      sampleGeneration( 0 ), parseTime( 0.0 ), buildTime( 0.0 ), fromCache( false )
 {
   
 }
@@ -135,7 +173,7 @@ void RayTracer::getBuffer( unsigned char *&buf, int &w, int &h )
   h = buffer_height;
 }
 
-double RayTracer::aspectRatio()
+Real RayTracer::aspectRatio()
 {
   return sceneLoaded() ? scene->getCamera().getAspectRatio() : 1;
 }
@@ -157,13 +195,33 @@ bool RayTracer::loadScene( char* fn )
   else
     path = path.substr(0, path.find_last_of( "\\/" ));
 
-  // Call this with 'true' for debug output from the tokenizer
-  Tokenizer tokenizer( ifs, false );
-  Parser parser( tokenizer, path );
+  // A binary copy of the parsed scene is kept next to the .ray file, and
+  // used instead of parsing as long as the .ray file is unchanged.
+  MappedFile source;
+  bool mapped = source.open( fn );
+  bool useCache = traceUI->useSceneCache() && mapped;
+  size_t sourceSize = source.size();
+  unsigned long long sourceHash = useCache ? hashBytes( source.data(), source.size() ) : 0;
+
+  // Tokenize straight out of the mapped file when we have it; the
+  // stream is only there for files that can't be mapped.
+  // Call these with 'true' for debug output from the tokenizer
+  auto_ptr<Tokenizer> tokenizer( mapped ? new Tokenizer( source.data(), source.size(), false )
+                                        : new Tokenizer( ifs, false ) );
+  Parser parser( *tokenizer, path, traceUI->useSceneCache() );
+  double start = RenderStats::wallTime();
+  fromCache = false;
   try {
     delete scene;
     scene = 0;
-    scene = parser.parseScene();
+    if( useCache )
+      scene = SceneCache::load( fn, sourceSize, sourceHash );
+    fromCache = scene != 0;
+    if( !scene ) {
+      scene = parser.parseScene();
+      if( useCache )
+        SceneCache::save( scene, fn, sourceSize, sourceHash );
+    }
   } 
   catch( SyntaxErrorException& pe ) {
     traceUI->alert( pe.formattedMessage() );
@@ -186,6 +244,13 @@ bool RayTracer::loadScene( char* fn )
   if( ! sceneLoaded() )
     return false;
 
+  parseTime = RenderStats::wallTime() - start;
+
+  // Everything is in world space now, so the object hierarchy can be built.
+  start = RenderStats::wallTime();
+  scene->buildAccelerator();
+  buildTime = RenderStats::wallTime() - start;
+
   return true;
 }
 
@@ -204,24 +269,30 @@ void RayTracer::traceSetup( int w, int h )
   }
   memset( buffer, 0, w*h*3 );
   m_bBufferReady = true;
+  ++sampleGeneration;
 }
 
 void RayTracer::tracePixel( int i, int j )
 {
-  Vec3d col;
+  Vec3r col;
 
   if( ! sceneLoaded() )
     return;
 
+  if( traceUI->adaptiveSampling() ) {
+    tracePixelAdaptive( i, j );
+    return;
+  }
+
   int numRays = traceUI->getRays();
 
-  double x, y;  
-  double pixelSpacing = 1.0 / numRays;
+  Real x, y;  
+  Real pixelSpacing = 1.0 / numRays;
 
   for (int stepX = 0 * numRays; stepX < numRays; stepX++) {
     for (int stepY = 0 * numRays; stepY < numRays; stepY++) {
-      x = double(i + pixelSpacing * (double(stepX) + 0.5)) / double(buffer_width);
-      y = double(j + pixelSpacing * (double(stepY) + 0.5)) / double(buffer_height);
+      x = Real(i + pixelSpacing * (Real(stepX) + 0.5)) / Real(buffer_width);
+      y = Real(j + pixelSpacing * (Real(stepY) + 0.5)) / Real(buffer_height);
       col = col + trace(x, y);
     }
   }
@@ -235,4 +306,106 @@ void RayTracer::tracePixel( int i, int j )
   pixel[2] = (int)(255.0 * col[2] / numRays);
 }
 
+// Adaptive supersampling.  Samples sit on the corners of a grid that is
+// 'scale' times finer than the pixels, scale being the smallest power of
+// two that is at least the -s sample count.  A pixel starts out as one
+// cell spanning its four corners; a cell whose corners hit different
+// objects, or differ in color by more than the threshold, is split into
+// four and each quarter is handled the same way, down to single grid
+// cells.  The pixel's color is the area-weighted average of its leaf
+// cells.  Flat regions thus cost about one ray per pixel, since every
+// corner is shared by four pixels.
+//
+// Corners are shared through a small cache per thread, indexed by grid
+// position; a sample evicted early is simply traced again.  Tracing is
+// deterministic, so the image doesn't depend on what the cache held.
+struct SampleCache
+{
+  enum { SIZE = 1 << 15 };
+
+  struct Entry
+  {
+    int gx, gy;
+    unsigned generation;	// 0 = empty
+    Vec3r color;
+    const SceneObject* obj;
+  };
+
+  std::vector<Entry> entries;
+
+  SampleCache()
+  {
+    Entry empty;
+    empty.generation = 0;
+    entries.assign( SIZE, empty );
+  }
+
+  Entry& slot( int gx, int gy )
+  {
+    unsigned h = (unsigned)gx * 73856093u ^ (unsigned)gy * 19349663u;
+    return entries[h & (SIZE - 1)];
+  }
+};
+
+static bool colorsDiffer( const Vec3r& a, const Vec3r& b, Real threshold )
+{
+  return fabs( a[0] - b[0] ) > threshold ||
+         fabs( a[1] - b[1] ) > threshold ||
+         fabs( a[2] - b[2] ) > threshold;
+}
+
+void RayTracer::tracePixelAdaptive( int i, int j )
+{
+  static thread_local SampleCache cache;
+
+  int scale = 1;
+  while( scale < traceUI->getRays() )
+    scale *= 2;
+
+  Vec3r col = traceCell( cache, i * scale, j * scale, scale, scale );
+
+  unsigned char *pixel = buffer + ( i + j * buffer_width ) * 3;
+  pixel[0] = (int)(255.0 * col[0]);
+  pixel[1] = (int)(255.0 * col[1]);
+  pixel[2] = (int)(255.0 * col[2]);
+}
+
+// The average color over the cell whose top left grid corner is (gx,gy)
+// and which is 'size' grid steps across.
+Vec3r RayTracer::traceCell( SampleCache& cache, int gx, int gy, int size, int scale )
+{
+  Vec3r color[4];
+  const SceneObject* obj[4];
+
+  for( int k = 0; k < 4; ++k ) {
+    int x = gx + ( k & 1 ? size : 0 );
+    int y = gy + ( k & 2 ? size : 0 );
+    SampleCache::Entry& e = cache.slot( x, y );
+    if( e.generation != sampleGeneration || e.gx != x || e.gy != y ) {
+      e.color = trace( Real( x ) / ( scale * buffer_width ),
+                       Real( y ) / ( scale * buffer_height ), &e.obj );
+      e.gx = x;
+      e.gy = y;
+      e.generation = sampleGeneration;
+    }
+    color[k] = e.color;
+    obj[k] = e.obj;
+  }
 
+  if( size > 1 ) {
+    Real threshold = traceUI->getAdaptiveThreshold();
+    bool split = false;
+    for( int k = 1; k < 4 && !split; ++k )
+      split = obj[k] != obj[0] || colorsDiffer( color[k], color[0], threshold );
+
+    if( split ) {
+      int half = size / 2;
+      return ( traceCell( cache, gx, gy, half, scale ) +
+               traceCell( cache, gx + half, gy, half, scale ) +
+               traceCell( cache, gx, gy + half, half, scale ) +
+               traceCell( cache, gx + half, gy + half, half, scale ) ) / 4.0;
+    }
+  }
+
+  return ( color[0] + color[1] + color[2] + color[3] ) / 4.0;
+}
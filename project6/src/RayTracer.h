@@ -6,6 +6,8 @@
 #include "scene/ray.h"
 
 class Scene;
+class SceneObject;
+struct SampleCache;
 
 class RayTracer
 {
@@ -13,12 +15,20 @@ class RayTracer
   RayTracer();
   ~RayTracer();
 
-  Vec3d trace( double x, double y );
-  Vec3d traceRay( const ray& r, const Vec3d& thresh, int depth );
+  // If hit is given, it is set to the object the first ray hit (0 for
+  // none).
+  Vec3r trace( Real x, Real y, const SceneObject** hit = 0 );
+  Vec3r traceRay( const ray& r, const Vec3r& thresh, int depth,
+                  const SceneObject** hit = 0 );
 
+  // The rays a hit spawns for its reflection and its transmission, and
+  // whether one carrying the given weight is worth tracing at all.
+  static ray reflectedRay( const ray& r, const isect& i );
+  static ray refractedRay( const ray& r, const isect& i );
+  static bool worthTracing( const Vec3r& weight );
 
   void getBuffer( unsigned char *&buf, int &w, int &h );
-  double aspectRatio();
+  Real aspectRatio();
   void traceSetup( int w, int h );
   void tracePixel( int i, int j );
 
@@ -32,8 +42,21 @@ class RayTracer
   { return m_bBufferReady; }
 
   const Scene& getScene() { return *scene; }
+  // For moving things about between frames (see Animation).
+  Scene* getMutableScene() { return scene; }
+
+  // Wall-clock seconds the last loadScene spent reading the scene (from
+  // the .ray file or its cache) and building the object hierarchy.
+  double getParseTime() const { return parseTime; }
+  double getBuildTime() const { return buildTime; }
+  bool loadedFromCache() const { return fromCache; }
 
  private:
+  friend class WavefrontRenderer;
+
+  void tracePixelAdaptive( int i, int j );
+  Vec3r traceCell( SampleCache& cache, int gx, int gy, int size, int scale );
+
   unsigned char *buffer;
   int buffer_width, buffer_height;
   int bufferSize;
@@ -41,6 +64,14 @@ class RayTracer
 
   bool m_bBufferReady;
 
+  // Bumped by every traceSetup, so that adaptive samples cached during
+  // an earlier render are never reused.
+  unsigned sampleGeneration;
+
+  double parseTime;
+  double buildTime;
+  bool fromCache;
+
 
 };
 
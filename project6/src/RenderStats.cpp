@@ -0,0 +1,207 @@
+#include <algorithm>
+#include <chrono>
+#include <iomanip>
+#include <mutex>
+#include <vector>
+
+#include "RenderStats.h"
+
+using namespace std;
+
+// Every live thread's block, plus everything counted by threads that
+// have since exited.
+static mutex registryLock;
+static vector<RenderStats*> liveStats;
+static RenderStats retiredStats;
+
+namespace {
+
+struct ThreadStats
+{
+  RenderStats stats;
+
+  ThreadStats()
+  {
+    lock_guard<mutex> guard( registryLock );
+    liveStats.push_back( &stats );
+  }
+
+  ~ThreadStats()
+  {
+    lock_guard<mutex> guard( registryLock );
+    retiredStats.merge( stats );
+    liveStats.erase( find( liveStats.begin(), liveStats.end(), &stats ) );
+  }
+};
+
+}
+
+void RenderStats::clear()
+{
+  for( int k = 0; k < RAY_TYPES; ++k )
+    rays[k] = 0;
+  packets = 0;
+  packetRays = 0;
+  boxTests = 0;
+  nodesVisited = 0;
+  for( int k = 0; k < PRIMITIVE_CLASSES; ++k )
+    primitiveTests[k] = 0;
+  for( int k = 0; k < DEPTH_BINS; ++k )
+    depths[k] = 0;
+}
+
+void RenderStats::merge( const RenderStats& other )
+{
+  for( int k = 0; k < RAY_TYPES; ++k )
+    rays[k] += other.rays[k];
+  packets += other.packets;
+  packetRays += other.packetRays;
+  boxTests += other.boxTests;
+  nodesVisited += other.nodesVisited;
+  for( int k = 0; k < PRIMITIVE_CLASSES; ++k )
+    primitiveTests[k] += other.primitiveTests[k];
+  for( int k = 0; k < DEPTH_BINS; ++k )
+    depths[k] += other.depths[k];
+}
+
+long long RenderStats::totalRays() const
+{
+  long long n = 0;
+  for( int k = 0; k < RAY_TYPES; ++k )
+    n += rays[k];
+  return n;
+}
+
+const char* RenderStats::rayTypeName( int type )
+{
+  switch( type ) {
+  case ray::VISIBILITY: return "visibility";
+  case ray::REFLECTION: return "reflection";
+  case ray::REFRACTION: return "refraction";
+  case ray::SHADOW:     return "shadow";
+  }
+  return "unknown";
+}
+
+const char* RenderStats::primitiveClassName( int c )
+{
+  switch( c ) {
+  case SPHERE:   return "sphere";
+  case BOX:      return "box";
+  case SQUARE:   return "square";
+  case CYLINDER: return "cylinder";
+  case CONE:     return "cone";
+  case TRIANGLE: return "triangle";
+  case TRIANGLE_GROUP: return "triangle_group";
+  }
+  return "unknown";
+}
+
+bool RenderStats::detailed()
+{
+#ifdef RENDER_STATS_ENABLED
+  return true;
+#else
+  return false;
+#endif
+}
+
+static double perSecond( long long n, double seconds )
+{
+  return seconds > 0 ? n / seconds : 0.0;
+}
+
+void RenderStats::printTable( ostream& out, double seconds ) const
+{
+  out << left << setw( 24 ) << "ray type" << right << setw( 14 ) << "rays"
+      << setw( 14 ) << "rays/s" << endl;
+  for( int k = 0; k < RAY_TYPES; ++k )
+    out << left << setw( 24 ) << rayTypeName( k ) << right << setw( 14 ) << rays[k]
+        << setw( 14 ) << (long long)perSecond( rays[k], seconds ) << endl;
+  out << left << setw( 24 ) << "total" << right << setw( 14 ) << totalRays()
+      << setw( 14 ) << (long long)perSecond( totalRays(), seconds ) << endl;
+  if( packets )
+    out << left << setw( 24 ) << "in packets" << right << setw( 14 ) << packetRays
+        << setw( 14 ) << "(" << packets << " packets)" << endl;
+
+  if( !detailed() ) {
+    out << "(build with RENDER_STATS defined for detailed counters)" << endl;
+    return;
+  }
+
+  out << endl;
+  out << left << setw( 24 ) << "bounding box tests" << right << setw( 14 ) << boxTests << endl;
+  out << left << setw( 24 ) << "BVH boxes tested" << right << setw( 14 ) << nodesVisited << endl;
+
+  out << endl << "primitive tests" << endl;
+  for( int k = 0; k < PRIMITIVE_CLASSES; ++k )
+    if( primitiveTests[k] )
+      out << "  " << left << setw( 22 ) << primitiveClassName( k ) << right << setw( 14 )
+          << primitiveTests[k] << endl;
+
+  out << endl << "rays by recursion depth" << endl;
+  for( int k = 0; k < DEPTH_BINS; ++k )
+    if( depths[k] )
+      out << "  " << setw( 2 ) << k << (k == DEPTH_BINS - 1 ? "+" : " ")
+          << setw( 33 ) << depths[k] << endl;
+}
+
+void RenderStats::printJson( ostream& out, double seconds, const char* indent ) const
+{
+  out << indent << "\"rays\": { ";
+  for( int k = 0; k < RAY_TYPES; ++k )
+    out << "\"" << rayTypeName( k ) << "\": " << rays[k] << ", ";
+  out << "\"total\": " << totalRays() << " }";
+
+  out << ",\n" << indent << "\"rays_per_second\": { ";
+  for( int k = 0; k < RAY_TYPES; ++k )
+    out << "\"" << rayTypeName( k ) << "\": " << perSecond( rays[k], seconds ) << ", ";
+  out << "\"total\": " << perSecond( totalRays(), seconds ) << " }";
+
+  out << ",\n" << indent << "\"packets_traced\": " << packets;
+  out << ",\n" << indent << "\"rays_in_packets\": " << packetRays;
+
+  if( !detailed() )
+    return;
+
+  out << ",\n" << indent << "\"box_tests\": " << boxTests;
+  out << ",\n" << indent << "\"bvh_boxes_tested\": " << nodesVisited;
+
+  out << ",\n" << indent << "\"primitive_tests\": { ";
+  for( int k = 0; k < PRIMITIVE_CLASSES; ++k )
+    out << (k ? ", " : "") << "\"" << primitiveClassName( k ) << "\": " << primitiveTests[k];
+  out << " }";
+
+  out << ",\n" << indent << "\"depth_histogram\": [ ";
+  for( int k = 0; k < DEPTH_BINS; ++k )
+    out << (k ? ", " : "") << depths[k];
+  out << " ]";
+}
+
+RenderStats& RenderStats::local()
+{
+  static thread_local ThreadStats mine;
+  return mine.stats;
+}
+
+RenderStats RenderStats::total()
+{
+  lock_guard<mutex> guard( registryLock );
+  RenderStats sum( retiredStats );
+  for( size_t k = 0; k < liveStats.size(); ++k )
+    sum.merge( *liveStats[k] );
+  return sum;
+}
+
+void RenderStats::reset()
+{
+  lock_guard<mutex> guard( registryLock );
+  retiredStats.clear();
+  for( size_t k = 0; k < liveStats.size(); ++k )
+    liveStats[k]->clear();
+}
+
+double RenderStats::wallTime()
+{
+  return chrono::duration<double>( chrono::steady_clock::now().time_since_epoch() ).count();
+}
@@ -0,0 +1,94 @@
+#ifndef __RENDERSTATS_H__
+#define __RENDERSTATS_H__
+
+// Counts of the work done while rendering.  Every thread that traces
+// rays counts into a block of its own (RenderStats::local()), so the
+// counting needs no locks; total() adds the blocks up once the render
+// is finished.  Blocks of threads that have exited are folded into a
+// running total, so nothing is lost when the worker pool goes away.
+//
+// Rays are always counted, once each, since the benchmark reports
+// rays/second.  The detailed counters below sit in the innermost loops
+// and are only compiled in for debug builds, or when RENDER_STATS is
+// defined; otherwise RENDER_STAT() expands to nothing.
+
+#if defined(_DEBUG) || defined(RENDER_STATS)
+#define RENDER_STATS_ENABLED
+#endif
+
+#ifdef RENDER_STATS_ENABLED
+#define RENDER_STAT( call ) RenderStats::local().call
+#else
+#define RENDER_STAT( call ) ((void)0)
+#endif
+
+#include <iostream>
+
+#include "scene/ray.h"
+
+class RenderStats
+{
+ public:
+  enum { RAY_TYPES = ray::SHADOW + 1 };
+
+  // Geometry classes whose ray tests are counted; a trimesh counts
+  // each triangle it tests in full, and each run of triangles its SIMD
+  // filter tests together as one triangle group.
+  enum PrimitiveClass {
+    SPHERE, BOX, SQUARE, CYLINDER, CONE, TRIANGLE, TRIANGLE_GROUP,
+    PRIMITIVE_CLASSES
+  };
+
+  // Recursion depths past the last bin are counted in the last bin.
+  enum { DEPTH_BINS = 16 };
+
+  RenderStats() { clear(); }
+
+  void clear();
+  void merge( const RenderStats& other );
+
+  void countRay( ray::RayType type ) { ++rays[type]; }
+  void countPacket( int size ) { ++packets; packetRays += size; }
+  void countBoxTest() { ++boxTests; }
+  void countNodeVisits( int n ) { nodesVisited += n; }
+  void countPrimitiveTest( PrimitiveClass c ) { ++primitiveTests[c]; }
+  void countDepth( int depth ) { ++depths[depth < DEPTH_BINS ? depth : DEPTH_BINS - 1]; }
+
+  long long raysOfType( int type ) const { return rays[type]; }
+  long long totalRays() const;
+  long long packetCount() const { return packets; }
+  long long raysInPackets() const { return packetRays; }
+
+  static const char* rayTypeName( int type );
+  static const char* primitiveClassName( int c );
+
+  // Whether the detailed counters are compiled in.
+  static bool detailed();
+
+  // The counters as a table, or as the members of a JSON object (with
+  // each line starting with indent).
+  void printTable( std::ostream& out, double seconds ) const;
+  void printJson( std::ostream& out, double seconds, const char* indent ) const;
+
+  // The calling thread's counters.
+  static RenderStats& local();
+
+  // Sum over all threads since the last reset().  Only meaningful when
+  // no other thread is still counting.
+  static RenderStats total();
+  static void reset();
+
+  // Seconds on a monotonic wall clock, for timing renders.
+  static double wallTime();
+
+ private:
+  long long rays[RAY_TYPES];	// rays cast, by ray::RayType
+  long long packets;		// ray packets traced, and the rays in them
+  long long packetRays;
+  long long boxTests;		// ray/bounding box tests outside the BVH
+  long long nodesVisited;		// BVH child boxes a ray was tested against
+  long long primitiveTests[PRIMITIVE_CLASSES];
+  long long depths[DEPTH_BINS];	// traceRay calls that cast a ray, by depth
+};
+
+#endif // __RENDERSTATS_H__
@@ -3,6 +3,7 @@
 #include <algorithm>
 
 #include "Box.h"
+#include "../RenderStats.h"
 
 using namespace std;
 
@@ -10,12 +11,13 @@ const double HUGE_DOUBLE = 1e100;
 
 bool Box::intersectLocal( const ray& r, isect& i ) const
 {
-        Vec3d p = r.getPosition();
-        Vec3d d = r.getDirection();
+        RENDER_STAT( countPrimitiveTest( RenderStats::BOX ) );
+        Vec3r p = r.getPosition();
+        Vec3r d = r.getDirection();
 //        d.normalize();
 
         int it;
-        double x, y, t, bestT; 
+        Real x, y, t, bestT; 
         int mod0, mod1, mod2, bestIndex;
 
         bestT = HUGE_DOUBLE;
@@ -55,23 +57,57 @@ bool Box::intersectLocal( const ray& r, isect& i ) const
         i.setT(bestT);
         i.setObject(this);
 
-		Vec3d intersect_point = r.at((float)i.t);
+		Vec3r intersect_point = r.at((float)i.t);
 
 		int i1 = (bestIndex + 1) % 3;
 		int i2 = (bestIndex + 2) % 3;
 
         if(bestIndex < 3)
 		{
-                i.setN(Vec3d(-double(bestIndex == 0), -double(bestIndex == 1), -double(bestIndex == 2)));
-				i.setUVCoordinates( Vec2d(	0.5 - intersect_point[ min(i1, i2) ], 
+                i.setN(Vec3r(-Real(bestIndex == 0), -Real(bestIndex == 1), -Real(bestIndex == 2)));
+				i.setUVCoordinates( Vec2r(	0.5 - intersect_point[ min(i1, i2) ], 
 											0.5 + intersect_point[ max(i1, i2) ] ) );
 		}
         else
 		{
-                i.setN(Vec3d(double(bestIndex==3), double(bestIndex == 4), double(bestIndex == 5)));
-				i.setUVCoordinates( Vec2d(	0.5 + intersect_point[ min(i1, i2) ],
+                i.setN(Vec3r(Real(bestIndex==3), Real(bestIndex == 4), Real(bestIndex == 5)));
+				i.setUVCoordinates( Vec2r(	0.5 + intersect_point[ min(i1, i2) ],
 											0.5 + intersect_point[ max(i1, i2) ] ) );
 
 		}
         return true;
 }
+
+// Same slab walk as intersectLocal, but any face in front of tmax will do.
+bool Box::occludedLocal( const ray& r, Real tmax ) const
+{
+        RENDER_STAT( countPrimitiveTest( RenderStats::BOX ) );
+        Vec3r p = r.getPosition();
+        Vec3r d = r.getDirection();
+
+        for(int it=0; it<6; it++){
+                int mod0 = it%3;
+
+                if(d[mod0] == 0){
+                        continue;
+                }
+
+                Real t = ((it/3) - 0.5 - p[mod0]) / d[mod0];
+
+                if(t < RAY_EPSILON || t >= tmax){
+                        continue;
+                }
+
+                int mod1 = (it+1)%3;
+                int mod2 = (it+2)%3;
+                Real x = p[mod1]+t*d[mod1];
+                Real y = p[mod2]+t*d[mod2];
+
+                if(     x<=0.5 && x>=-0.5 &&
+                        y<=0.5 && y>=-0.5)
+                {
+                        return true;
+                }
+        }
+        return false;
+}
@@ -11,13 +11,14 @@ public:
 	}
 
 	virtual bool intersectLocal( const ray& r, isect& i ) const;
+	virtual bool occludedLocal( const ray& r, Real tmax ) const;
 	virtual bool hasBoundingBoxCapability() const { return true; }
 
     virtual BoundingBox ComputeLocalBoundingBox()
     {
         BoundingBox localbounds;
-        localbounds.setMax(Vec3d(0.5, 0.5, 0.5));
-		localbounds.setMin(Vec3d(-0.5, -0.5, -0.5));
+        localbounds.setMax(Vec3r(0.5, 0.5, 0.5));
+		localbounds.setMin(Vec3r(-0.5, -0.5, -0.5));
         return localbounds;
     }
 
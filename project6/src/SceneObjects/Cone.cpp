@@ -1,31 +1,33 @@
 #include <cmath>
 
 #include "Cone.h"
+#include "../RenderStats.h"
 
 using namespace std;
 
 bool Cone::intersectLocal( const ray& r, isect& i ) const
 {
+	RENDER_STAT( countPrimitiveTest( RenderStats::CONE ) );
 	bool ret = false;
 	const int x = 0, y = 1, z = 2;	// For the dumb array indexes for the vectors
 
-	Vec3d normal;
+	Vec3r normal;
 	
-	Vec3d R0 = r.getPosition();
-	Vec3d Rd = r.getDirection();
-	double pz = R0[2];
-	double dz = Rd[2];
+	Vec3r R0 = r.getPosition();
+	Vec3r Rd = r.getDirection();
+	Real pz = R0[2];
+	Real dz = Rd[2];
 	
-	double a = Rd[x]*Rd[x] + Rd[y]*Rd[y] - beta_squared * Rd[z]*Rd[z];
+	Real a = Rd[x]*Rd[x] + Rd[y]*Rd[y] - beta_squared * Rd[z]*Rd[z];
 
 	if( a == 0.0) return false;		// We're in the x-y plane, no intersection
 
-	double b = 2 * (R0[x]*Rd[x] + R0[y]*Rd[y] - beta_squared * ((R0[z] + gamma) * Rd[z]));
-	double c = -beta_squared*(gamma + R0[z])*(gamma + R0[z]) + R0[x] * R0[x] + R0[y] * R0[y];
+	Real b = 2 * (R0[x]*Rd[x] + R0[y]*Rd[y] - beta_squared * ((R0[z] + gamma) * Rd[z]));
+	Real c = -beta_squared*(gamma + R0[z])*(gamma + R0[z]) + R0[x] * R0[x] + R0[y] * R0[y];
 
-	double discriminant = b * b - 4 * a * c;
+	Real discriminant = b * b - 4 * a * c;
 	
-	double farRoot, nearRoot, theRoot = RAY_EPSILON;
+	Real farRoot, nearRoot, theRoot = RAY_EPSILON;
 	bool farGood, nearGood;
 	
 	if(discriminant <= 0) return false;		// No intersection
@@ -42,13 +44,13 @@ bool Cone::intersectLocal( const ray& r, isect& i ) const
 	if(nearGood && (nearRoot > theRoot))
 	{
 		theRoot = nearRoot;
-		normal = Vec3d((r.at(theRoot))[x], (r.at(theRoot))[y], -2.0 * beta_squared * (r.at(theRoot)[z] + gamma));
+		normal = Vec3r((r.at(theRoot))[x], (r.at(theRoot))[y], -2.0 * beta_squared * (r.at(theRoot)[z] + gamma));
 	}
 	farGood = isGoodRoot(r.at(farRoot));
 	if(farGood && ( (nearGood && farRoot < theRoot) || farRoot > RAY_EPSILON) ) 
 	{
 		theRoot = farRoot;
-		normal = Vec3d((r.at(theRoot))[x], (r.at(theRoot))[y], -2.0 * beta_squared * (r.at(theRoot)[z] + gamma));
+		normal = Vec3r((r.at(theRoot))[x], (r.at(theRoot))[y], -2.0 * beta_squared * (r.at(theRoot)[z] + gamma));
 	}
 
 	// In case we are _inside_ the _uncapped_ cone, we need to flip the normal.
@@ -58,10 +60,10 @@ bool Cone::intersectLocal( const ray& r, isect& i ) const
 		normal = -normal;
 
 	// These are to help with finding caps
-	double t1 = (-pz)/dz;
-	double t2 = (height-pz)/dz;
+	Real t1 = (-pz)/dz;
+	Real t2 = (height-pz)/dz;
 	
-	Vec3d p( r.at( t1 ) );
+	Vec3r p( r.at( t1 ) );
 	
 	if(capped) {
 		if( p[0]*p[0] + p[1]*p[1] <=  b_radius*b_radius)
@@ -71,13 +73,13 @@ bool Cone::intersectLocal( const ray& r, isect& i ) const
 				theRoot = t1;
 				if( dz > 0.0 ) {
 					// Intersection with cap at z = 0.
-					normal = Vec3d( 0.0, 0.0, -1.0 );
+					normal = Vec3r( 0.0, 0.0, -1.0 );
 				} else {
-					normal = Vec3d( 0.0, 0.0, 1.0 );
+					normal = Vec3r( 0.0, 0.0, 1.0 );
 				}
 			}
 		}
-		Vec3d q( r.at( t2 ) );
+		Vec3r q( r.at( t2 ) );
 		if( q[0]*q[0] + q[1]*q[1] <=  t_radius*t_radius)
 		{
 			if(t2 < theRoot && t2 > RAY_EPSILON)
@@ -85,9 +87,9 @@ bool Cone::intersectLocal( const ray& r, isect& i ) const
 				theRoot = t2;
 				if( dz > 0.0 ) {
 					// Intersection with interior of cap at z = 1.
-					normal = Vec3d( 0.0, 0.0, 1.0 );
+					normal = Vec3r( 0.0, 0.0, 1.0 );
 				} else {
-					normal = Vec3d( 0.0, 0.0, -1.0 );
+					normal = Vec3r( 0.0, 0.0, -1.0 );
 				}
 			}
 		}
@@ -96,7 +98,6 @@ bool Cone::intersectLocal( const ray& r, isect& i ) const
 	if(theRoot <= RAY_EPSILON) return false;
 	
 	i.setT(theRoot);
-	normal.normalize();
 	i.setN(normal);
 	i.obj = this;
 	return true;
@@ -104,7 +105,7 @@ bool Cone::intersectLocal( const ray& r, isect& i ) const
 	return ret;
 }
 
-bool Cone::isGoodRoot(Vec3d root) const
+bool Cone::isGoodRoot(Vec3r root) const
 {
 
 	if(root[2] < 0 || root[2] > height)
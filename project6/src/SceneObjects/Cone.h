@@ -8,7 +8,7 @@ class Cone
 {
 public:
 	Cone( Scene *scene, Material *mat, 
-			double h = 1.0, double br = 1.0, double tr = 0.0, 
+			Real h = 1.0, Real br = 1.0, Real tr = 0.0, 
 			bool cap = false )
 		: MaterialSceneObject( scene, mat )
 	{
@@ -42,10 +42,10 @@ public:
     virtual BoundingBox ComputeLocalBoundingBox()
     {
         BoundingBox localbounds;
-		double biggest_radius = (b_radius > t_radius)?(b_radius):(t_radius);
+		Real biggest_radius = (b_radius > t_radius)?(b_radius):(t_radius);
 
-		localbounds.setMin(Vec3d(-biggest_radius, -biggest_radius, (height < 0.0f)?(height):(0.0f)));
-		localbounds.setMax(Vec3d(biggest_radius, biggest_radius, (height < 0.0f)?(0.0f):(height)));
+		localbounds.setMin(Vec3r(-biggest_radius, -biggest_radius, (height < 0.0f)?(height):(0.0f)));
+		localbounds.setMax(Vec3r(biggest_radius, biggest_radius, (height < 0.0f)?(0.0f):(height)));
         return localbounds;
     }
 
@@ -53,16 +53,18 @@ public:
 	bool intersectCaps( const ray& r, isect& i ) const;
 
 protected:
-	bool isGoodRoot(Vec3d root) const;
-	double radiusAt(double h) const;
+	friend class SceneCache;
+
+	bool isGoodRoot(Vec3r root) const;
+	Real radiusAt(Real h) const;
     
 	bool capped;
-	double height;
-	double b_radius;
-	double t_radius;
+	Real height;
+	Real b_radius;
+	Real t_radius;
 
-	double beta, beta_squared;
-	double gamma, gamma_squared;
+	Real beta, beta_squared;
+	Real gamma, gamma_squared;
 
 protected:
 	void glDrawLocal(int quality, bool actualMaterials, bool actualTextures) const;
@@ -1,12 +1,14 @@
 #include <cmath>
 
 #include "Cylinder.h"
+#include "../RenderStats.h"
 
 using namespace std;
 
 
 bool Cylinder::intersectLocal( const ray& r, isect& i ) const
 {
+	RENDER_STAT( countPrimitiveTest( RenderStats::CYLINDER ) );
 	i.obj = this;
 
 	if( intersectCaps( r, i ) ) {
@@ -23,16 +25,28 @@ bool Cylinder::intersectLocal( const ray& r, isect& i ) const
 	}
 }
 
+// Either the caps or the body will do, so don't bother finding out
+// which one is closer.
+bool Cylinder::occludedLocal( const ray& r, Real tmax ) const
+{
+	RENDER_STAT( countPrimitiveTest( RenderStats::CYLINDER ) );
+	isect i;
+	if( intersectCaps( r, i ) && i.t < tmax ) {
+		return true;
+	}
+	return intersectBody( r, i ) && i.t < tmax;
+}
+
 bool Cylinder::intersectBody( const ray& r, isect& i ) const
 {
-	double x0 = r.getPosition()[0];
-	double y0 = r.getPosition()[1];
-	double x1 = r.getDirection()[0];
-	double y1 = r.getDirection()[1];
+	Real x0 = r.getPosition()[0];
+	Real y0 = r.getPosition()[1];
+	Real x1 = r.getDirection()[0];
+	Real y1 = r.getDirection()[1];
 
-	double a = x1*x1+y1*y1;
-	double b = 2.0*(x0*x1 + y0*y1);
-	double c = x0*x0 + y0*y0 - 1.0;
+	Real a = x1*x1+y1*y1;
+	Real h = -(x0*x1 + y0*y1);	// -b/2
+	Real c = x0*x0 + y0*y0 - 1.0;
 
 	if( 0.0 == a ) {
 		// This implies that x1 = 0.0 and y1 = 0.0, which further
@@ -41,41 +55,46 @@ bool Cylinder::intersectBody( const ray& r, isect& i ) const
 		return false;
 	}
 
-	double discriminant = b*b - 4.0*a*c;
+	// As for the sphere, the discriminant comes from how far the ray
+	// passes from the axis, and the root nearer zero from dividing, so
+	// that neither is lost to cancellation.
+	Real mx = x0 + (h / a) * x1;
+	Real my = y0 + (h / a) * y1;
+	Real discriminant = a * (1.0 - (mx*mx + my*my));
 
 	if( discriminant < 0.0 ) {
 		return false;
 	}
-	
-	discriminant = sqrt( discriminant );
 
-	double t2 = (-b + discriminant) / (2.0 * a);
+	Real q = h >= 0.0 ? h + sqrt( discriminant ) : h - sqrt( discriminant );
+	Real t1 = 0.0, t2 = 0.0;
+	if( q != 0.0 ) {
+		t1 = min( q / a, c / q );
+		t2 = max( q / a, c / q );
+	}
 
 	if( t2 <= RAY_EPSILON ) {
 		return false;
 	}
 
-	double t1 = (-b - discriminant) / (2.0 * a);
-
 	if( t1 > RAY_EPSILON ) {
 		// Two intersections.
-		Vec3d P = r.at( t1 );
-		double z = P[2];
+		Vec3r P = r.at( t1 );
+		Real z = P[2];
 		if( z >= 0.0 && z <= 1.0 ) {
 			// It's okay.
 			i.t = t1;
-			i.N = Vec3d( P[0], P[1], 0.0 );
-			i.N.normalize();
+			i.N = Vec3r( P[0], P[1], 0.0 );
 			return true;
 		}
 	}
 
-	Vec3d P = r.at( t2 );
-	double z = P[2];
+	Vec3r P = r.at( t2 );
+	Real z = P[2];
 	if( z >= 0.0 && z <= 1.0 ) {
 		i.t = t2;
 
-		Vec3d normal( P[0], P[1], 0.0 );
+		Vec3r normal( P[0], P[1], 0.0 );
 		// In case we are _inside_ the _uncapped_ cone, we need to flip the normal.
 		// Essentially, the cone in this case is a double-sided surface
 		// and has _2_ normals
@@ -83,7 +102,6 @@ bool Cylinder::intersectBody( const ray& r, isect& i ) const
 			normal = -normal;
 
 		i.N = normal;
-		i.N.normalize();
 		return true;
 	}
 
@@ -96,15 +114,15 @@ bool Cylinder::intersectCaps( const ray& r, isect& i ) const
 		return false;
 	}
 
-	double pz = r.getPosition()[2];
-	double dz = r.getDirection()[2];
+	Real pz = r.getPosition()[2];
+	Real dz = r.getDirection()[2];
 
 	if( 0.0 == dz ) {
 		return false;
 	}
 
-	double t1;
-	double t2;
+	Real t1;
+	Real t2;
 
 	if( dz > 0.0 ) {
 		t1 = (-pz)/dz;
@@ -119,27 +137,27 @@ bool Cylinder::intersectCaps( const ray& r, isect& i ) const
 	}
 
 	if( t1 >= RAY_EPSILON ) {
-		Vec3d p( r.at( t1 ) );
+		Vec3r p( r.at( t1 ) );
 		if( (p[0]*p[0] + p[1]*p[1]) <= 1.0 ) {
 			i.t = t1;
 			if( dz > 0.0 ) {
 				// Intersection with cap at z = 0.
-				i.N = Vec3d( 0.0, 0.0, -1.0 );
+				i.N = Vec3r( 0.0, 0.0, -1.0 );
 			} else {
-				i.N = Vec3d( 0.0, 0.0, 1.0 );
+				i.N = Vec3r( 0.0, 0.0, 1.0 );
 			}
 			return true;
 		}
 	}
 
-	Vec3d p( r.at( t2 ) );
+	Vec3r p( r.at( t2 ) );
 	if( (p[0]*p[0] + p[1]*p[1]) <= 1.0 ) {
 		i.t = t2;
 		if( dz > 0.0 ) {
 			// Intersection with interior of cap at z = 1.
-			i.N = Vec3d( 0.0, 0.0, 1.0 );
+			i.N = Vec3r( 0.0, 0.0, 1.0 );
 		} else {
-			i.N = Vec3d( 0.0, 0.0, -1.0 );
+			i.N = Vec3r( 0.0, 0.0, -1.0 );
 		}
 		return true;
 	}
@@ -0,0 +1,32 @@
+#include "Instance.h"
+
+// The ray is already in the mesh's local space, which is the instance's;
+// all that is left is to claim the hit, so that its material is ours.
+bool Instance::intersectLocal( const ray& r, isect& i ) const
+{
+	if( !mesh->intersectLocal( r, i ) ) {
+		return false;
+	}
+
+	i.obj = this;
+	return true;
+}
+
+bool Instance::occludedLocal( const ray& r, Real tmax ) const
+{
+	return mesh->occludedLocal( r, tmax );
+}
+
+int Instance::intersectLocalPacket( const ray* r, int mask, isect* i ) const
+{
+	int found = mesh->intersectLocalPacket( r, mask, i );
+	for( int hits = found; hits; hits &= hits - 1 ) {
+		i[BVH::lowestBit( hits )].obj = this;
+	}
+	return found;
+}
+
+int Instance::occludedLocalPacket( const ray* r, int mask, const Real* tmax ) const
+{
+	return mesh->occludedLocalPacket( r, mask, tmax );
+}
@@ -0,0 +1,39 @@
+#ifndef __INSTANCE_H__
+#define __INSTANCE_H__
+
+#include "../scene/scene.h"
+#include "trimesh.h"
+
+// Another placement of a named trimesh: its own transform and material,
+// but the vertices, faces and face hierarchy are the mesh's, shared with
+// every other placement.  The scene hierarchy sees only the instance's
+// bounds; rays that reach it are taken into the mesh's local space and
+// handed to the mesh's hierarchy, so the scene needs memory for each
+// distinct mesh rather than for each copy.  The mesh belongs to the
+// scene and must outlive its instances.
+class Instance
+	: public MaterialSceneObject
+{
+public:
+	Instance( Scene *scene, Material *mat, const Trimesh *mesh )
+		: MaterialSceneObject( scene, mat ), mesh( mesh )
+	{
+	}
+
+	virtual bool intersectLocal( const ray& r, isect& i ) const;
+	virtual bool occludedLocal( const ray& r, Real tmax ) const;
+	virtual int intersectLocalPacket( const ray* r, int mask, isect* i ) const;
+	virtual int occludedLocalPacket( const ray* r, int mask, const Real* tmax ) const;
+	virtual bool hasBoundingBoxCapability() const { return true; }
+
+	virtual BoundingBox ComputeLocalBoundingBox() { return mesh->getLocalBoundingBox(); }
+
+	const Trimesh* getMesh() const { return mesh; }
+
+protected:
+	void glDrawLocal(int quality, bool actualMaterials, bool actualTextures) const;
+
+private:
+	const Trimesh* mesh;
+};
+#endif // __INSTANCE_H__
@@ -1,41 +1,63 @@
 #include <cmath>
 
 #include "Sphere.h"
+#include "../RenderStats.h"
 
 using namespace std;
 
-
-bool Sphere::intersectLocal( const ray& r, isect& i ) const
+// Where the ray meets the unit sphere, t1 <= t2.  The textbook b*b - a*c
+// cancels badly when the ray starts far from the sphere, and b - root when
+// it starts on it, which float can't afford: secondary rays then hit the
+// sphere they leave.  So the discriminant comes from how far the ray passes
+// from the center, and the root nearer zero from dividing by the other.
+bool Sphere::roots( const ray& r, Real& t1, Real& t2 )
 {
-	Vec3d v = -r.getPosition();
-	double b = v * r.getDirection();
-	double discriminant = b*b - v*v + 1;
+	Vec3r v = -r.getPosition();
+	Vec3r d = r.getDirection();
+	Real a = d * d;
+	Real b = v * d;
+	Vec3r miss = v - (b / a) * d;
+	Real discriminant = a * (1 - miss * miss);
 
 	if( discriminant < 0.0 ) {
 		return false;
 	}
 
-	discriminant = sqrt( discriminant );
-	double t2 = b + discriminant;
+	Real q = b >= 0.0 ? b + sqrt( discriminant ) : b - sqrt( discriminant );
+	if( q == 0.0 ) {
+		t1 = t2 = 0.0;
+		return true;
+	}
+	Real c = v * v - 1;
+	t1 = min( q / a, c / q );
+	t2 = max( q / a, c / q );
+	return true;
+}
 
-	if( t2 <= RAY_EPSILON ) {
+bool Sphere::intersectLocal( const ray& r, isect& i ) const
+{
+	RENDER_STAT( countPrimitiveTest( RenderStats::SPHERE ) );
+	Real t1, t2;
+	if( !roots( r, t1, t2 ) || t2 <= RAY_EPSILON ) {
 		return false;
 	}
 
 	i.obj = this;
 
-	double t1 = b - discriminant;
-
-	if( t1 > RAY_EPSILON ) {
-		i.t = t1;
-		i.N = r.at( t1 );
-		i.N.normalize();
-	} else {
-		i.t = t2;
-		i.N = r.at( t2 );
-		i.N.normalize();
-	}
+	i.t = t1 > RAY_EPSILON ? t1 : t2;
+	i.N = r.at( i.t );
 
 	return true;
 }
 
+
+bool Sphere::occludedLocal( const ray& r, Real tmax ) const
+{
+	RENDER_STAT( countPrimitiveTest( RenderStats::SPHERE ) );
+	Real t1, t2;
+	if( !roots( r, t1, t2 ) ) {
+		return false;
+	}
+
+	return ( t1 > RAY_EPSILON && t1 < tmax ) || ( t2 > RAY_EPSILON && t2 < tmax );
+}
@@ -13,17 +13,21 @@ public:
 	}
     
 	virtual bool intersectLocal( const ray& r, isect& i ) const;
+	virtual bool occludedLocal( const ray& r, Real tmax ) const;
 	virtual bool hasBoundingBoxCapability() const { return true; }
 
     virtual BoundingBox ComputeLocalBoundingBox()
     {
         BoundingBox localbounds;
-		localbounds.setMin(Vec3d(-1.0f, -1.0f, -1.0f));
-		localbounds.setMax(Vec3d(1.0f, 1.0f, 1.0f));
+		localbounds.setMin(Vec3r(-1.0f, -1.0f, -1.0f));
+		localbounds.setMax(Vec3r(1.0f, 1.0f, 1.0f));
         return localbounds;
     }
 
 protected:
 	void glDrawLocal(int quality, bool actualMaterials, bool actualTextures) const;
+
+private:
+	static bool roots( const ray& r, Real& t1, Real& t2 );
 };
 #endif // __SPHERE_H__
@@ -1,6 +1,7 @@
 #include <cmath>
 
 #include "Square.h"
+#include "../RenderStats.h"
 
 using namespace std;
 
@@ -8,20 +9,21 @@ using namespace std;
 //Test
 bool Square::intersectLocal( const ray& r, isect& i ) const
 {
-	Vec3d p = r.getPosition();
-	Vec3d d = r.getDirection();
+	RENDER_STAT( countPrimitiveTest( RenderStats::SQUARE ) );
+	Vec3r p = r.getPosition();
+	Vec3r d = r.getDirection();
 
 	if( d[2] == 0.0 ) {
 		return false;
 	}
 
-	double t = -p[2]/d[2];
+	Real t = -p[2]/d[2];
 
 	if( t <= RAY_EPSILON ) {
 		return false;
 	}
 
-	Vec3d P = r.at( t );
+	Vec3r P = r.at( t );
 
 	if( P[0] < -0.5 || P[0] > 0.5 ) {	
 		return false;
@@ -34,11 +36,32 @@ bool Square::intersectLocal( const ray& r, isect& i ) const
 	i.obj = this;
 	i.t = t;
 	if( d[2] > 0.0 ) {
-		i.N = Vec3d( 0.0, 0.0, -1.0 );
+		i.N = Vec3r( 0.0, 0.0, -1.0 );
 	} else {
-		i.N = Vec3d( 0.0, 0.0, 1.0 );
+		i.N = Vec3r( 0.0, 0.0, 1.0 );
 	}
 
-    i.setUVCoordinates( Vec2d(P[0] + 0.5, P[1] + 0.5) );
+    i.setUVCoordinates( Vec2r(P[0] + 0.5, P[1] + 0.5) );
 	return true;
 }
+
+bool Square::occludedLocal( const ray& r, Real tmax ) const
+{
+	RENDER_STAT( countPrimitiveTest( RenderStats::SQUARE ) );
+	Vec3r p = r.getPosition();
+	Vec3r d = r.getDirection();
+
+	if( d[2] == 0.0 ) {
+		return false;
+	}
+
+	Real t = -p[2]/d[2];
+
+	if( t <= RAY_EPSILON || t >= tmax ) {
+		return false;
+	}
+
+	Vec3r P = r.at( t );
+
+	return P[0] >= -0.5 && P[0] <= 0.5 && P[1] >= -0.5 && P[1] <= 0.5;
+}
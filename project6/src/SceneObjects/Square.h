@@ -13,13 +13,14 @@ public:
 	}
 
 	virtual bool intersectLocal( const ray& r, isect& i ) const;
+	virtual bool occludedLocal( const ray& r, Real tmax ) const;
 	virtual bool hasBoundingBoxCapability() const { return true; }
 
     virtual BoundingBox ComputeLocalBoundingBox()
     {
         BoundingBox localbounds;
-        localbounds.setMin(Vec3d(-0.5f, -0.5f, -RAY_EPSILON));
-		localbounds.setMax(Vec3d(0.5f, 0.5f, RAY_EPSILON));
+        localbounds.setMin(Vec3r(-0.5f, -0.5f, -RAY_EPSILON));
+		localbounds.setMax(Vec3r(0.5f, 0.5f, RAY_EPSILON));
         return localbounds;
     }
 
@@ -1,6 +1,8 @@
 #include <cmath>
 #include <float.h>
+#include <algorithm>
 #include "trimesh.h"
+#include "../RenderStats.h"
 
 
 using namespace std;
@@ -12,7 +14,7 @@ Trimesh::~Trimesh()
 }
 
 // must add vertices, normals, and materials IN ORDER
-void Trimesh::addVertex( const Vec3d &v )
+void Trimesh::addVertex( const Vec3r &v )
 {
   vertices.push_back( v );
 }
@@ -22,7 +24,7 @@ void Trimesh::addMaterial( Material *m )
   materials.push_back( m );
 }
 
-void Trimesh::addNormal( const Vec3d &n )
+void Trimesh::addNormal( const Vec3r &n )
 {
   normals.push_back( n );
 }
@@ -34,12 +36,24 @@ bool Trimesh::addFace( int a, int b, int c )
 
   if( a >= vcnt || b >= vcnt || c >= vcnt ) return false;
 
-  TrimeshFace *newFace = new TrimeshFace( scene, new Material(*this->material), this, a, b, c );
-  newFace->setTransform(this->transform);
-  faces.push_back( newFace );
+  faceIds.push_back( a );
+  faceIds.push_back( b );
+  faceIds.push_back( c );
+  faceA.push_back( vertices[a] );
+  faceAB.push_back( vertices[b] - vertices[a] );
+  faceAC.push_back( vertices[c] - vertices[a] );
   return true;
 }
 
+// Room for n faces in total, when the count is known up front
+void Trimesh::reserveFaces( int n )
+{
+  faceIds.reserve( 3 * n );
+  faceA.reserve( n );
+  faceAB.reserve( n );
+  faceAC.reserve( n );
+}
+
 char *
 Trimesh::doubleCheck()
     // Check to make sure that if we have per-vertex materials or normals
@@ -53,74 +67,346 @@ Trimesh::doubleCheck()
   return 0;
 }
 
+void Trimesh::buildAccelerator()
+{
+  ComputeLocalBoundingBox();
+  int n = faceCount();
+  std::vector<BoundingBox> boxes( n );
+  for( int f = 0; f < n; ++f )
+  {
+    const int* ids = face( f );
+    const Vec3r& a = vertices[ids[0]];
+    const Vec3r& b = vertices[ids[1]];
+    const Vec3r& c = vertices[ids[2]];
+    boxes[f].setMax( maximum( maximum( a, b ), c ) );
+    boxes[f].setMin( minimum( minimum( a, b ), c ) );
+  }
+
+  // A kd-tree clips the faces it splits, so it wants their corners.
+  std::vector<Vec3r> corners;
+  Accelerator::Kind kind = Accelerator::currentKind();
+  if( kind == Accelerator::KD_TREE || kind == Accelerator::KD_ROPES )
+  {
+    corners.resize( 3 * n );
+    for( int f = 0; f < n; ++f )
+      for( int k = 0; k < 3; ++k )
+        corners[3 * f + k] = vertices[face( f )[k]];
+  }
+  accel.build( boxes, TriangleSet::width( TriangleSet::currentKernel() ),
+               corners.empty() ? 0 : &corners );
+  if( !accel.hasLeaves() )
+  {
+    triangles.build( faceA, faceAB, faceAC );
+    return;
+  }
+
+  // Lay the faces out in the order the leaves visit them.
+  std::vector<int> order;
+  accel.hierarchy().linearize( order );
+  std::vector<int> ids( faceIds.size() );
+  Vertices a( n ), ab( n ), ac( n );
+  for( int f = 0; f < n; ++f )
+  {
+    int old = order[f];
+    ids[3 * f] = faceIds[3 * old];
+    ids[3 * f + 1] = faceIds[3 * old + 1];
+    ids[3 * f + 2] = faceIds[3 * old + 2];
+    a[f] = faceA[old];
+    ab[f] = faceAB[old];
+    ac[f] = faceAC[old];
+  }
+  faceIds.swap( ids );
+  faceA.swap( a );
+  faceAB.swap( ab );
+  faceAC.swap( ac );
+  triangles.build( faceA, faceAB, faceAC );
+}
+
+// Leaf callback for the face hierarchy: keep the closest face hit.
+struct ClosestFaceHit
+{
+  const Trimesh& mesh;
+  const ray& r;
+  int face;
+  Real u, v;
+
+  ClosestFaceHit( const Trimesh& m, const ray& rr )
+      : mesh( m ), r( rr ), face( -1 ), u( 0.0 ), v( 0.0 ) {}
+
+  bool operator()( int k, Real& tmax )
+  {
+    Real tval, uu, vv;
+    if( mesh.hitFace( k, r, tval, uu, vv ) &&
+        (tval < tmax || (tval == tmax && face >= 0 && mesh.preferFace( k, face, r ))) )
+    {
+      face = k;
+      u = uu;
+      v = vv;
+      tmax = tval;
+      return true;
+    }
+    return false;
+  }
+};
+
+// The same, a leaf at a time: the SIMD filter picks out the faces in
+// it that the ray may hit, and only those get the full test.
+struct ClosestFaceLeafHit
+{
+  ClosestFaceHit& hit;
+  const TriangleSet& triangles;
+  const TriangleSet::Ray sheared;
+
+  ClosestFaceLeafHit( ClosestFaceHit& h, const TriangleSet& t, const ray& rr )
+      : hit( h ), triangles( t ), sheared( t, rr ) {}
+
+  bool operator()( int first, int count, Real& tmax )
+  {
+    bool found = false;
+    int width = triangles.width();
+    for( int g = first; g < first + count; g += width )
+    {
+      RENDER_STAT( countPrimitiveTest( RenderStats::TRIANGLE_GROUP ) );
+      int mask = triangles.candidates( sheared, g, min( width, first + count - g ), tmax );
+      for( ; mask; mask &= mask - 1 )
+        if( hit( g + BVH::lowestBit( mask ), tmax ) ) found = true;
+    }
+    return found;
+  }
+};
+
+// The face itself is only looked at again once we know which one is
+// closest: that is when the normal gets interpolated.
 bool Trimesh::intersectLocal(const ray&r, isect&i) const
 {
-  double tmin = 0.0;
-  double tmax = 0.0;
-  typedef Faces::const_iterator iter;
-  bool have_one = false;
-  for( iter j = faces.begin(); j != faces.end(); ++j ) {
-    isect cur;
-    if( (*j)->intersectLocal( r, cur ) )
+  ClosestFaceHit hit( *this, r );
+  Real tmax = RAY_INFINITY;
+  if( accel.empty() )
+    for( int k = 0; k < faceCount(); ++k )
+      hit( k, tmax );
+  else if( accel.hasLeaves() && triangles.width() > 1 )
+  {
+    ClosestFaceLeafHit leafHit( hit, triangles, r );
+    accel.hierarchy().intersectLeaves( r, tmax, leafHit );
+  }
+  else
+    accel.intersect( r, tmax, hit );
+
+  if( hit.face < 0 )
+  {
+    i.setT(1000.0);
+    return false;
+  }
+
+  setHit( hit.face, tmax, hit.u, hit.v, i );
+  return true;
+}
+
+void Trimesh::setHit( int f, Real tval, Real u, Real v, isect& i ) const
+{
+  const int* ids = face( f );
+  Vec3r calcNormal = normals[ids[0]] * (1-u-v) + normals[ids[1]]
+     * u + normals[ids[2]] * v;
+
+  i.setN(calcNormal);
+  i.setUVCoordinates(Vec2r(u, v));
+  i.setT(tval);
+  i.setObject(this);
+}
+
+// Packet version of ClosestFaceHit: the closest face for each ray.
+struct ClosestFacePacketHit
+{
+  const Trimesh& mesh;
+  const ray* r;
+  int face[BVH::PACKET_SIZE];
+  Real u[BVH::PACKET_SIZE], v[BVH::PACKET_SIZE];
+
+  ClosestFacePacketHit( const Trimesh& m, const ray* rr )
+      : mesh( m ), r( rr )
+  {
+    for( int j = 0; j < BVH::PACKET_SIZE; ++j )
+      face[j] = -1;
+  }
+
+  void operator()( int k, int mask, Real* tmax )
+  {
+    for( ; mask; mask &= mask - 1 )
     {
-      if( !have_one || (cur.t < i.t) )
+      int j = BVH::lowestBit( mask );
+      Real tval, uu, vv;
+      if( mesh.hitFace( k, r[j], tval, uu, vv ) &&
+          (tval < tmax[j] || (tval == tmax[j] && face[j] >= 0 && mesh.preferFace( k, face[j], r[j] ))) )
       {
-        i = cur;
-        have_one = true;
+        face[j] = k;
+        u[j] = uu;
+        v[j] = vv;
+        tmax[j] = tval;
       }
     }
   }
-  if( !have_one ) i.setT(1000.0);
-  return have_one;
+};
+
+int Trimesh::intersectLocalPacket( const ray* r, int mask, isect* i ) const
+{
+  if( accel.empty() )
+    return Geometry::intersectLocalPacket( r, mask, i );
+
+  ClosestFacePacketHit hit( *this, r );
+  Real tmax[BVH::PACKET_SIZE];
+  for( int j = 0; j < BVH::PACKET_SIZE; ++j )
+    tmax[j] = RAY_INFINITY;
+  accel.intersectPacket( r, mask, tmax, hit );
+
+  int found = 0;
+  for( int j = 0; j < BVH::PACKET_SIZE; ++j )
+  {
+    if( !(mask & (1 << j)) )
+      continue;
+    if( hit.face[j] < 0 )
+    {
+      i[j].setT(1000.0);
+      continue;
+    }
+    setHit( hit.face[j], tmax[j], hit.u[j], hit.v[j], i[j] );
+    found |= 1 << j;
+  }
+  return found;
 }
 
-// Intersect ray r with the triangle abc.  If it hits returns true,
-// and puts the t parameter, barycentric coordinates, normal, object id,
-// and object material in the isect object
-// Using Moller / Trumbore algorithm
-bool TrimeshFace::intersectLocal( const ray& r, isect& i ) const
+// Leaf callback for shadow rays: any face in front of tmax will do.
+struct AnyFaceHit
 {
-  const Vec3d& a = parent->vertices[ids[0]];
-  const Vec3d& b = parent->vertices[ids[1]];
-  const Vec3d& c = parent->vertices[ids[2]];
+  const Trimesh& mesh;
+  const ray& r;
 
-  Vec3d B_A = b - a;
-  Vec3d C_A = c - a;
-  Vec3d PxT = r.getDirection() ^ C_A;
-  Vec3d t = r.getPosition() - a;
-  Vec3d q = t ^ B_A;
+  AnyFaceHit( const Trimesh& m, const ray& rr )
+      : mesh( m ), r( rr ) {}
 
-  double determinant = B_A * PxT;
-  double invertedDet = 1 / determinant;
+  bool operator()( int k, Real tmax )
+  {
+    Real tval, u, v;
+    return mesh.hitFace( k, r, tval, u, v ) && tval < tmax;
+  }
+};
+
+struct AnyFaceLeafHit
+{
+  AnyFaceHit& hit;
+  const TriangleSet& triangles;
+  const TriangleSet::Ray sheared;
 
-  double u = (t * PxT) * invertedDet;
-  double v = (r.getDirection() * q) * invertedDet;
+  AnyFaceLeafHit( AnyFaceHit& h, const TriangleSet& t, const ray& rr )
+      : hit( h ), triangles( t ), sheared( t, rr ) {}
 
-  if (determinant == 0) {
+  bool operator()( int first, int count, Real tmax )
+  {
+    int width = triangles.width();
+    for( int g = first; g < first + count; g += width )
+    {
+      RENDER_STAT( countPrimitiveTest( RenderStats::TRIANGLE_GROUP ) );
+      int mask = triangles.candidates( sheared, g, min( width, first + count - g ), tmax );
+      for( ; mask; mask &= mask - 1 )
+        if( hit( g + BVH::lowestBit( mask ), tmax ) ) return true;
+    }
     return false;
-  } else if (u < 0 || v < 0) {
+  }
+};
+
+bool Trimesh::occludedLocal(const ray& r, Real tmax) const
+{
+  AnyFaceHit hit( *this, r );
+  if( accel.hasLeaves() && triangles.width() > 1 )
+  {
+    AnyFaceLeafHit leafHit( hit, triangles, r );
+    return accel.hierarchy().occludedLeaves( r, tmax, leafHit );
+  }
+  if( !accel.empty() )
+    return accel.occluded( r, tmax, hit );
+  for( int k = 0; k < faceCount(); ++k )
+    if( hit( k, tmax ) ) return true;
+  return false;
+}
+
+struct AnyFacePacketHit
+{
+  const Trimesh& mesh;
+  const ray* r;
+
+  AnyFacePacketHit( const Trimesh& m, const ray* rr )
+      : mesh( m ), r( rr ) {}
+
+  int operator()( int k, int mask, const Real* tmax )
+  {
+    int blocked = 0;
+    Real tval, u, v;
+    for( ; mask; mask &= mask - 1 )
+    {
+      int j = BVH::lowestBit( mask );
+      if( mesh.hitFace( k, r[j], tval, u, v ) && tval < tmax[j] )
+        blocked |= 1 << j;
+    }
+    return blocked;
+  }
+};
+
+int Trimesh::occludedLocalPacket( const ray* r, int mask, const Real* tmax ) const
+{
+  if( accel.empty() )
+    return Geometry::occludedLocalPacket( r, mask, tmax );
+
+  AnyFacePacketHit hit( *this, r );
+  return accel.occludedPacket( r, mask, tmax, hit );
+}
+
+// Intersect ray r with face f.  If it hits returns true, and puts the
+// t parameter and barycentric coordinates in tval, u, v.
+// Using Moller / Trumbore algorithm
+bool Trimesh::hitFace( int f, const ray& r, Real& tval, Real& u, Real& v ) const
+{
+  RENDER_STAT( countPrimitiveTest( RenderStats::TRIANGLE ) );
+  const Vec3r& a = faceA[f];
+  const Vec3r& B_A = faceAB[f];
+  const Vec3r& C_A = faceAC[f];
+
+  Vec3r PxT = r.getDirection() ^ C_A;
+  Vec3r t = r.getPosition() - a;
+  Vec3r q = t ^ B_A;
+
+  Real determinant = B_A * PxT;
+  if (determinant == 0)
+    return false;
+  Real invertedDet = 1 / determinant;
+
+  u = (t * PxT) * invertedDet;
+  v = (r.getDirection() * q) * invertedDet;
+
+  if (u < 0 || v < 0) {
     return false;
   } else if (u + v > 1) {
     return false;
   }
-  double tval = (C_A * q) * invertedDet;
+  tval = (C_A * q) * invertedDet;
   if (tval < RAY_EPSILON){
     return false;
   }
-
-  Vec3d calcNormal = parent->normals[ids[0]] * (1-u-v) + parent->normals[ids[1]]
-     * u + parent->normals[ids[2]] * v;
-
-  i.setN(calcNormal);
-  i.N.normalize();
-  i.setMaterial(*(this->material));
-  i.setUVCoordinates(Vec2d(u, v));
-  i.setT(tval);
-  i.setObject(this);
-
   return true;
 }
 
+// Faces hit at exactly the same distance are the two sides of a thin
+// wall modelled in one place, or faces meeting where the ray crosses an
+// edge.  Which of them is tested first depends on how the faces were
+// laid out for the kernel, so the choice mustn't: keep the one facing
+// the ray, then the one with the lowest vertex indices.
+bool Trimesh::preferFace( int f, int g, const ray& r ) const
+{
+  Real df = r.getDirection() * (faceAB[f] ^ faceAC[f]);
+  Real dg = r.getDirection() * (faceAB[g] ^ faceAC[g]);
+  if( (df < 0.0) != (dg < 0.0) )
+    return df < 0.0;
+  return lexicographical_compare( face( f ), face( f ) + 3, face( g ), face( g ) + 3 );
+}
+
 void Trimesh::generateNormals()
     // Once you've loaded all the verts and faces, we can generate per
     // vertex normals by averaging the normals of the neighboring faces.
@@ -131,14 +417,24 @@ void Trimesh::generateNormals()
   int *numFaces = new int[ cnt ]; // the number of faces assoc. with each vertex
   memset( numFaces, 0, sizeof(int)*cnt );
     
-  for( Faces::iterator fi = faces.begin(); fi != faces.end(); ++fi )
+  for( int f = 0; f < faceCount(); ++f )
   {
-    Vec3d faceNormal = (**fi).getNormal();
-        
+    // Faces with two coincident corners have no normal of their own,
+    // but they still count towards the average.
+    Vec3r faceNormal;
+    Vec3r ab = faceAB[f];
+    Vec3r ac = faceAC[f];
+    if( !( ab.iszero() || ac.iszero() || (ab - ac).iszero() ) )
+    {
+      faceNormal = ab ^ ac;
+      faceNormal.normalize();
+    }
+
+    const int* ids = face( f );
     for( int i = 0; i < 3; ++i )
     {
-      normals[(**fi)[i]] += faceNormal;
-      ++numFaces[(**fi)[i]];
+      normals[ids[i]] += faceNormal;
+      ++numFaces[ids[i]];
     }
   }
 
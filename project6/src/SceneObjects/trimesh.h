@@ -7,22 +7,33 @@
 #include "../scene/ray.h"
 #include "../scene/material.h"
 #include "../scene/scene.h"
-
-class TrimeshFace;
+#include "../scene/triangles.h"
 
 class Trimesh : public MaterialSceneObject
 {
-  friend class TrimeshFace;
-  typedef std::vector<Vec3d> Normals;
-  typedef std::vector<Vec3d> Vertices;
-  typedef std::vector<TrimeshFace*> Faces;
+  friend class SceneCache;
+  friend class MeshCache;
+  typedef std::vector<Vec3r> Normals;
+  typedef std::vector<Vec3r> Vertices;
   typedef std::vector<Material*> Materials;
 
   Vertices vertices;
-  Faces faces;
   Normals normals;
   Materials materials;
   BoundingBox localBounds;
+  Accelerator accel;
+
+  // The faces, stored as parallel arrays rather than one object apiece:
+  // the three vertex indices, plus the first vertex and the two edges
+  // leaving it, which is all the ray/triangle test needs.  Once the
+  // hierarchy is built the faces are kept in the order its leaves
+  // visit them.
+  std::vector<int> faceIds;		// 3 per face
+  Vertices faceA;
+  Vertices faceAB;
+  Vertices faceAC;
+  // The same faces in float, for the SIMD filter in front of hitFace.
+  TriangleSet triangles;
 
  public:
   Trimesh( Scene *scene, Material *mat, TransformNode *transform )
@@ -37,19 +48,31 @@ class Trimesh : public MaterialSceneObject
   bool vertNorms;
 
   bool intersectLocal(const ray& r, isect& i) const;
+  bool occludedLocal(const ray& r, Real tmax) const;
+  int intersectLocalPacket( const ray* r, int mask, isect* i ) const;
+  int occludedLocalPacket( const ray* r, int mask, const Real* tmax ) const;
 
   ~Trimesh();
     
   // must add vertices, normals, and materials IN ORDER
-  void addVertex( const Vec3d & );
+  void addVertex( const Vec3r & );
   void addMaterial( Material *m );
-  void addNormal( const Vec3d & );
+  void addNormal( const Vec3r & );
   bool addFace( int a, int b, int c );
+  void reserveFaces( int n );
+
+  int faceCount() const { return (int)faceA.size(); }
+  const int* face( int f ) const { return &faceIds[3 * f]; }
+  const Vec3r& vertex( int v ) const { return vertices[v]; }
 
   char *doubleCheck();
     
   void generateNormals();
 
+  // Build the face hierarchy in the mesh's local space.  Call once all
+  // the faces have been added.
+  void buildAccelerator();
+
   bool hasBoundingBoxCapability() const { return true; }
       
   BoundingBox ComputeLocalBoundingBox()
@@ -68,79 +91,25 @@ class Trimesh : public MaterialSceneObject
     return localbounds;
   }
 
- protected:
-  void glDrawLocal(int quality, bool actualMaterials, bool actualTextures) const;
-  mutable int displayListWithMaterials;
-  mutable int displayListWithoutMaterials;
-};
+  // The box found by the last ComputeLocalBoundingBox(), which
+  // buildAccelerator() makes sure has run.
+  const BoundingBox& getLocalBoundingBox() const { return localBounds; }
 
-class TrimeshFace : public MaterialSceneObject
-{
-  Trimesh *parent;
-  int ids[3];
-  Vec3d normal;
-  double dist;
+  // Moller / Trumbore test against face f: the t parameter and
+  // barycentric coordinates of the hit, nothing else.
+  bool hitFace( int f, const ray& r, Real& tval, Real& u, Real& v ) const;
 
- public:
-  TrimeshFace( Scene *scene, Material *mat, Trimesh *parent, int a, int b, int c)
-      : MaterialSceneObject( scene, mat )
-  {
-    this->parent = parent;
-    ids[0] = a;
-    ids[1] = b;
-    ids[2] = c;
-
-    // Compute the face normal here, not on the fly
-    Vec3d a_coords = parent->vertices[a];
-    Vec3d b_coords = parent->vertices[b];
-    Vec3d c_coords = parent->vertices[c];
-
-    Vec3d vab = (b_coords - a_coords);
-    Vec3d vac = (c_coords - a_coords);
-    Vec3d vcb = (b_coords - c_coords);
-        
-    if (vab.iszero() || vac.iszero() || vcb.iszero()) degen = true;
-    else {
-      degen = false;
-      normal = ((b_coords - a_coords) ^ (c_coords - a_coords));
-      normal.normalize();
-      dist = normal * a_coords;
-    }
-    localbounds = ComputeLocalBoundingBox();
-    bounds = localbounds;
-  }
+  // Of faces f and g, which r hits at the same distance, whether f is
+  // the one to keep.
+  bool preferFace( int f, int g, const ray& r ) const;
 
-  BoundingBox localbounds;
-  bool degen;
-
-  int operator[]( int i ) const
-  {
-    return ids[i];
-  }
-
-  Vec3d getNormal()
-  {
-    return normal;
-  }
-
-  bool intersect( const ray& r, isect& i ) const;
-  bool intersectLocal( const ray& r, isect& i ) const;
-
-  bool hasBoundingBoxCapability() const { return true; }
-      
-  BoundingBox ComputeLocalBoundingBox()
-  {
-    BoundingBox localbounds;
-    localbounds.setMax(maximum( parent->vertices[ids[0]], parent->vertices[ids[1]]));
-    localbounds.setMin(minimum( parent->vertices[ids[0]], parent->vertices[ids[1]]));
-        
-    localbounds.setMax(maximum( parent->vertices[ids[2]], localbounds.getMax()));
-    localbounds.setMin(minimum( parent->vertices[ids[2]], localbounds.getMin()));
-    return localbounds;
-  }
-
-  const BoundingBox& getBoundingBox() const { return localbounds; }
+  // Fill in i for a hit on face f at tval, with barycentric coordinates u, v.
+  void setHit( int f, Real tval, Real u, Real v, isect& i ) const;
 
+ protected:
+  void glDrawLocal(int quality, bool actualMaterials, bool actualTextures) const;
+  mutable int displayListWithMaterials;
+  mutable int displayListWithoutMaterials;
 };
 
 #endif // TRIMESH_H__
@@ -0,0 +1,95 @@
+#include <thread>
+#include <algorithm>
+
+#include "TileScheduler.h"
+#include "RayTracer.h"
+
+using namespace std;
+
+TileScheduler::TileScheduler( RayTracer* tracer, int w, int h, int size )
+    : raytracer( tracer ), width( w ), height( h ), tileSize( size )
+{
+  if( tileSize < 1 ) tileSize = 1;
+  tilesX = (width + tileSize - 1) / tileSize;
+  tilesY = (height + tileSize - 1) / tileSize;
+}
+
+int TileScheduler::hardwareThreads()
+{
+  int n = (int)thread::hardware_concurrency();
+  return n > 0 ? n : 1;
+}
+
+void TileScheduler::run( int numThreads )
+{
+  if( numThreads <= 0 ) numThreads = hardwareThreads();
+  int numTiles = tilesX * tilesY;
+  if( numThreads > numTiles ) numThreads = max( numTiles, 1 );
+
+  // Give each worker a contiguous run of tiles so that neighbouring
+  // tiles (and the geometry they hit) tend to stay on one core.
+  queues.resize( numThreads );
+  for( int t = 0; t < numThreads; ++t ) {
+    queues[t] = new TileQueue;
+    int begin = (int)((long long)numTiles * t / numThreads);
+    int end = (int)((long long)numTiles * (t + 1) / numThreads);
+    for( int k = begin; k < end; ++k )
+      queues[t]->tiles.push_back( k );
+  }
+
+  vector<thread> pool;
+  for( int t = 1; t < numThreads; ++t )
+    pool.push_back( thread( &TileScheduler::worker, this, t ) );
+  worker( 0 );
+  for( size_t t = 0; t < pool.size(); ++t )
+    pool[t].join();
+
+  for( int t = 0; t < numThreads; ++t )
+    delete queues[t];
+  queues.clear();
+}
+
+void TileScheduler::worker( int id )
+{
+  int tile;
+  while( nextTile( id, tile ) )
+    traceTile( tile );
+}
+
+// Take from the front of our own queue; when it is empty, steal from the
+// back of the others', which is the work their owners would get to last.
+bool TileScheduler::nextTile( int id, int& tile )
+{
+  {
+    lock_guard<mutex> guard( queues[id]->lock );
+    if( !queues[id]->tiles.empty() ) {
+      tile = queues[id]->tiles.front();
+      queues[id]->tiles.pop_front();
+      return true;
+    }
+  }
+
+  int n = (int)queues.size();
+  for( int k = 1; k < n; ++k ) {
+    TileQueue* victim = queues[(id + k) % n];
+    lock_guard<mutex> guard( victim->lock );
+    if( !victim->tiles.empty() ) {
+      tile = victim->tiles.back();
+      victim->tiles.pop_back();
+      return true;
+    }
+  }
+  return false;
+}
+
+void TileScheduler::traceTile( int tile )
+{
+  int x0 = (tile % tilesX) * tileSize;
+  int y0 = (tile / tilesX) * tileSize;
+  int x1 = min( x0 + tileSize, width );
+  int y1 = min( y0 + tileSize, height );
+
+  for( int j = y0; j < y1; ++j )
+    for( int i = x0; i < x1; ++i )
+      raytracer->tracePixel( i, j );
+}
@@ -0,0 +1,45 @@
+#ifndef __TILESCHEDULER_H__
+#define __TILESCHEDULER_H__
+
+// Renders an image with a pool of worker threads.  The image is cut into
+// square tiles which are dealt out to per-thread queues up front; a worker
+// that runs dry steals from the back of someone else's queue.  Every pixel
+// is still produced by RayTracer::tracePixel and written straight into the
+// tracer's buffer, so the result is byte-identical to the serial loop.
+
+#include <deque>
+#include <vector>
+#include <mutex>
+
+class RayTracer;
+
+class TileScheduler
+{
+ public:
+  TileScheduler( RayTracer* tracer, int width, int height, int tileSize = 16 );
+
+  // Trace every pixel using numThreads workers (0 means one per core).
+  void run( int numThreads );
+
+  static int hardwareThreads();
+
+ private:
+  struct TileQueue
+  {
+    std::mutex lock;
+    std::deque<int> tiles;
+  };
+
+  void worker( int id );
+  bool nextTile( int id, int& tile );
+  void traceTile( int tile );
+
+  RayTracer* raytracer;
+  int width, height;
+  int tileSize;
+  int tilesX, tilesY;
+
+  std::vector<TileQueue*> queues;
+};
+
+#endif // __TILESCHEDULER_H__
@@ -0,0 +1,166 @@
+#include <cmath>
+#include <iomanip>
+#include <random>
+#include <vector>
+
+#include "TriangleBench.h"
+#include "RenderStats.h"
+#include "SceneObjects/trimesh.h"
+#include "scene/triangles.h"
+
+using namespace std;
+
+namespace {
+
+Vec3r randomDirection( mt19937& rng )
+{
+  normal_distribution<double> gauss;
+  for( ;; ) {
+    Vec3r d( gauss( rng ), gauss( rng ), gauss( rng ) );
+    double length = d.length();
+    if( length > 1.0e-6 )
+      return d / length;
+  }
+}
+
+Vec3r randomPoint( mt19937& rng, const BoundingBox& box )
+{
+  uniform_real_distribution<double> unit( 0.0, 1.0 );
+  Vec3r lo = box.getMin(), hi = box.getMax();
+  return Vec3r( lo[0] + unit( rng ) * (hi[0] - lo[0]),
+                lo[1] + unit( rng ) * (hi[1] - lo[1]),
+                lo[2] + unit( rng ) * (hi[2] - lo[2]) );
+}
+
+// A point uniformly distributed over a random face.
+Vec3r randomSurfacePoint( mt19937& rng, const Trimesh& mesh )
+{
+  uniform_int_distribution<int> pick( 0, mesh.faceCount() - 1 );
+  uniform_real_distribution<double> unit( 0.0, 1.0 );
+  const int* f = mesh.face( pick( rng ) );
+  double s = sqrt( unit( rng ) ), t = unit( rng );
+  return mesh.vertex( f[0] ) * (1.0 - s) + mesh.vertex( f[1] ) * (s * (1.0 - t))
+      + mesh.vertex( f[2] ) * (s * t);
+}
+
+// The rays, in the mesh's own space: a quarter from outside toward
+// somewhere in the box, a quarter from outside toward a point on the
+// surface, a quarter from a point on the surface as a reflected or
+// shadow ray would leave it, and a quarter anywhere in the box.
+void makeRays( Trimesh& mesh, int numRays, vector<ray>& rays )
+{
+  mt19937 rng( 354 );
+  BoundingBox box = mesh.ComputeLocalBoundingBox();
+  Vec3r center = (box.getMin() + box.getMax()) * 0.5;
+  double radius = (box.getMax() - box.getMin()).length();
+
+  rays.clear();
+  for( int k = 0; k < numRays; ++k ) {
+    if( k % 4 < 2 ) {
+      Vec3r from = center + randomDirection( rng ) * radius;
+      Vec3r to = k % 4 == 0 ? randomPoint( rng, box ) : randomSurfacePoint( rng, mesh );
+      Vec3r d = to - from;
+      d.normalize();
+      rays.push_back( ray( from, d, ray::VISIBILITY ) );
+    } else if( k % 4 == 2 ) {
+      rays.push_back( ray( randomSurfacePoint( rng, mesh ), randomDirection( rng ), ray::REFLECTION ) );
+    } else {
+      rays.push_back( ray( randomPoint( rng, box ), randomDirection( rng ), ray::REFLECTION ) );
+    }
+  }
+}
+
+double megaRaysPerSecond( int rays, double seconds )
+{
+  return seconds > 0.0 ? rays / seconds * 1.0e-6 : 0.0;
+}
+
+}
+
+bool benchmarkTriangles( const Scene& scene, int numRays, ostream& out )
+{
+  BVH::Kernel original = TriangleSet::currentKernel();
+  bool agreed = true;
+  int meshes = 0;
+
+  for( vector<Geometry*>::const_iterator obj = scene.beginObjects();
+       obj != scene.endObjects(); ++obj ) {
+    Trimesh* mesh = dynamic_cast<Trimesh*>( *obj );
+    if( !mesh )
+      continue;
+
+    vector<ray> rays;
+    makeRays( *mesh, numRays, rays );
+    out << "mesh " << meshes++ << ": " << mesh->faceCount() << " faces, "
+        << numRays << " rays" << endl;
+
+    vector<double> scalarT;
+    vector<Vec3r> scalarN;
+    vector<Vec2r> scalarUV;
+    vector<char> scalarBlocked;
+    for( int k = BVH::SCALAR; k <= BVH::bestKernel(); ++k ) {
+      TriangleSet::setKernel( (BVH::Kernel)k );
+      mesh->buildAccelerator();
+
+      // Closest hits.  The t of a miss is left at -1.
+      vector<double> t( numRays, -1.0 );
+      vector<Vec3r> N( numRays );
+      vector<Vec2r> uv( numRays );
+      double start = RenderStats::wallTime();
+      for( int j = 0; j < numRays; ++j ) {
+        isect i;
+        if( mesh->intersectLocal( rays[j], i ) ) {
+          t[j] = i.t;
+          N[j] = i.N;
+          uv[j] = i.uvCoordinates;
+        }
+      }
+      double closest = RenderStats::wallTime() - start;
+
+      // Any hit within the distance to the far side of the box, as a
+      // shadow ray to a point light would ask.
+      vector<char> blocked( numRays );
+      start = RenderStats::wallTime();
+      for( int j = 0; j < numRays; ++j )
+        blocked[j] = mesh->occludedLocal( rays[j], RAY_INFINITY );
+      double any = RenderStats::wallTime() - start;
+
+      long hits = 0;
+      for( int j = 0; j < numRays; ++j )
+        if( t[j] >= 0.0 ) ++hits;
+
+      out << "  " << left << setw( 8 ) << BVH::kernelName( (BVH::Kernel)k ) << right
+          << fixed << setprecision( 3 )
+          << "closest " << setw( 7 ) << closest << " s " << setw( 7 )
+          << megaRaysPerSecond( numRays, closest ) << " Mrays/s   "
+          << "any " << setw( 7 ) << any << " s " << setw( 7 )
+          << megaRaysPerSecond( numRays, any ) << " Mrays/s   "
+          << hits << " hits";
+
+      if( k == BVH::SCALAR ) {
+        scalarT.swap( t );
+        scalarN.swap( N );
+        scalarUV.swap( uv );
+        scalarBlocked.swap( blocked );
+      } else {
+        // The same face must be found, not just one as far away.
+        long differ = 0;
+        for( int j = 0; j < numRays; ++j )
+          if( t[j] != scalarT[j] || N[j] != scalarN[j] || uv[j][0] != scalarUV[j][0]
+              || uv[j][1] != scalarUV[j][1] || blocked[j] != scalarBlocked[j] ) ++differ;
+        out << ", " << differ << " differ from scalar";
+        if( differ )
+          agreed = false;
+      }
+      out << endl;
+      out.unsetf( ios::floatfield );
+    }
+
+    TriangleSet::setKernel( original );
+    mesh->buildAccelerator();
+  }
+
+  if( meshes == 0 )
+    out << "no meshes in the scene" << endl;
+  return agreed;
+}
@@ -0,0 +1,20 @@
+#ifndef __TRIANGLEBENCH_H__
+#define __TRIANGLEBENCH_H__
+
+// A microbenchmark for the ray/triangle kernels (ray -T).  The same
+// random rays are fired at every mesh in the scene once per triangle
+// kernel the CPU has, the scalar one being the plain double test of
+// Trimesh::hitFace.  Half the rays come from outside the mesh and aim
+// into its bounding box, like camera rays; half start inside the box
+// and head anywhere, like reflected and shadow rays.  Each kernel is
+// timed on closest-hit and any-hit queries, and its hits are checked
+// against the scalar ones.
+
+#include <iostream>
+
+class Scene;
+
+// Returns false if any kernel disagreed with the scalar one.
+bool benchmarkTriangles( const Scene& scene, int numRays, std::ostream& out );
+
+#endif // __TRIANGLEBENCH_H__
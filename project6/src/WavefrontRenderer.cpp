@@ -0,0 +1,290 @@
+#include <thread>
+#include <algorithm>
+
+#include "WavefrontRenderer.h"
+#include "TileScheduler.h"
+#include "RayTracer.h"
+#include "RenderStats.h"
+#include "scene/scene.h"
+#include "scene/light.h"
+#include "scene/material.h"
+#include "ui/TraceUI.h"
+
+extern TraceUI* traceUI;
+
+using namespace std;
+
+// About this many samples are traced together; enough for each stage to
+// run over a long queue, few enough that the queues stay in cache.
+static const int BAND_SAMPLES = 1 << 14;
+
+void WavefrontRenderer::RayQueue::clear()
+{
+  px.clear(); py.clear(); pz.clear();
+  dx.clear(); dy.clear(); dz.clear();
+  wr.clear(); wg.clear(); wb.clear();
+  tmax.clear();
+  sample.clear();
+  type.clear();
+}
+
+void WavefrontRenderer::RayQueue::push( const ray& r, const Vec3r& weight, int s, Real t )
+{
+  Vec3r p = r.getPosition();
+  Vec3r d = r.getDirection();
+  px.push_back( p[0] ); py.push_back( p[1] ); pz.push_back( p[2] );
+  dx.push_back( d[0] ); dy.push_back( d[1] ); dz.push_back( d[2] );
+  wr.push_back( weight[0] ); wg.push_back( weight[1] ); wb.push_back( weight[2] );
+  tmax.push_back( t );
+  sample.push_back( s );
+  type.push_back( (unsigned char)r.type() );
+}
+
+ray WavefrontRenderer::RayQueue::get( int k ) const
+{
+  return ray( Vec3r( px[k], py[k], pz[k] ), Vec3r( dx[k], dy[k], dz[k] ),
+              (ray::RayType)type[k] );
+}
+
+// Camera rays are generated in square blocks of pixels this many across.
+static const int BLOCK = 4;
+
+WavefrontRenderer::WavefrontRenderer( RayTracer* tracer, int w, int h, bool packets )
+    : raytracer( tracer ), width( w ), height( h ), usePackets( packets ), nextRow( 0 )
+{
+  numRays = max( traceUI->getRays(), 1 );
+  bandRows = max( BAND_SAMPLES / max( width * numRays * numRays, 1 ), 1 );
+  bandRows = (bandRows + BLOCK - 1) / BLOCK * BLOCK;
+}
+
+void WavefrontRenderer::run( int numThreads )
+{
+  if( !raytracer->sceneLoaded() )
+    return;
+
+  if( numThreads <= 0 ) numThreads = TileScheduler::hardwareThreads();
+  int numBands = (height + bandRows - 1) / bandRows;
+  if( numThreads > numBands ) numThreads = max( numBands, 1 );
+
+  nextRow = 0;
+  vector<thread> pool;
+  for( int t = 1; t < numThreads; ++t )
+    pool.push_back( thread( &WavefrontRenderer::worker, this ) );
+  worker();
+  for( size_t t = 0; t < pool.size(); ++t )
+    pool[t].join();
+}
+
+void WavefrontRenderer::worker()
+{
+  Wave w;
+  for( ;; ) {
+    int y0 = nextRow.fetch_add( bandRows );
+    if( y0 >= height )
+      break;
+    traceBand( w, y0, min( y0 + bandRows, height ) );
+  }
+}
+
+void WavefrontRenderer::traceBand( Wave& w, int y0, int y1 )
+{
+  generate( w, y0, y1 );
+  for( int depth = 0; w.paths.size() > 0; ++depth ) {
+    intersect( w, depth );
+    shade( w, depth );
+    traceShadows( w );
+    swap( w.paths, w.next );
+  }
+  resolve( w, y0, y1 );
+}
+
+// One camera ray per sample, placed the way RayTracer::tracePixel places
+// them.  Samples are numbered pixel by pixel, but queued a block of pixels
+// at a time so that neighbouring rays in the queue are close together.
+void WavefrontRenderer::generate( Wave& w, int y0, int y1 )
+{
+  Camera& camera = raytracer->scene->getCamera();
+  Real pixelSpacing = 1.0 / numRays;
+  int perPixel = numRays * numRays;
+  int samples = (y1 - y0) * width * perPixel;
+
+  w.paths.clear();
+  w.cr.assign( samples, 0.0 );
+  w.cg.assign( samples, 0.0 );
+  w.cb.assign( samples, 0.0 );
+
+  ray r( Vec3r( 0, 0, 0 ), Vec3r( 0, 0, 0 ), ray::VISIBILITY );
+  for( int bj = y0; bj < y1; bj += BLOCK )
+    for( int bi = 0; bi < width; bi += BLOCK )
+      for( int j = bj; j < min( bj + BLOCK, y1 ); ++j )
+        for( int i = bi; i < min( bi + BLOCK, width ); ++i ) {
+          int s = ((j - y0) * width + i) * perPixel;
+          for( int stepX = 0; stepX < numRays; ++stepX )
+            for( int stepY = 0; stepY < numRays; ++stepY ) {
+              Real x = Real(i + pixelSpacing * (Real(stepX) + 0.5)) / Real(width);
+              Real y = Real(j + pixelSpacing * (Real(stepY) + 0.5)) / Real(height);
+              camera.rayThrough( x, y, r );
+              w.paths.push( r, Vec3r( 1.0, 1.0, 1.0 ), s++ );
+            }
+        }
+}
+
+// A packet's rays must all head the same way along every axis, which is
+// what lets the hierarchy be walked once for all of them.
+bool WavefrontRenderer::coherent( const RayQueue& q, int first, int count )
+{
+  bool negX = q.dx[first] < 0.0, negY = q.dy[first] < 0.0, negZ = q.dz[first] < 0.0;
+  for( int k = first + 1; k < first + count; ++k )
+    if( (q.dx[k] < 0.0) != negX || (q.dy[k] < 0.0) != negY || (q.dz[k] < 0.0) != negZ )
+      return false;
+  return true;
+}
+
+void WavefrontRenderer::intersect( Wave& w, int depth )
+{
+  (void)depth;    // only counted by RENDER_STAT
+  const Scene* scene = raytracer->scene;
+  int n = w.paths.size();
+
+  w.hits.resize( n );
+  w.hit.resize( n );
+  RenderStats& stats = RenderStats::local();
+  for( int first = 0; first < n; first += BVH::PACKET_SIZE ) {
+    int count = min( (int)BVH::PACKET_SIZE, n - first );
+    for( int k = first; k < first + count; ++k ) {
+      stats.countRay( (ray::RayType)w.paths.type[k] );
+      RENDER_STAT( countDepth( depth ) );
+    }
+
+    if( usePackets && count > 1 && coherent( w.paths, first, count ) ) {
+      ray rays[BVH::PACKET_SIZE];
+      isect hits[BVH::PACKET_SIZE];
+      for( int k = 0; k < count; ++k )
+        rays[k] = w.paths.get( first + k );
+      int hit = scene->intersectPacket( rays, (1 << count) - 1, hits );
+      for( int k = 0; k < count; ++k ) {
+        w.hits[first + k] = hits[k];
+        w.hit[first + k] = (hit >> k) & 1;
+      }
+      stats.countPacket( count );
+      continue;
+    }
+
+    for( int k = first; k < first + count; ++k )
+      w.hit[k] = scene->intersect( w.paths.get( k ), w.hits[k] );
+  }
+}
+
+// Local lighting for every hit, and the rays it leads to.  Misses are
+// black, so they add nothing.
+void WavefrontRenderer::shade( Wave& w, int depth )
+{
+  Scene* scene = raytracer->scene;
+  int n = w.paths.size();
+  bool recurse = depth + 1 <= traceUI->getDepth();
+
+  w.next.clear();
+  w.shadows.resize( scene->endLights() - scene->beginLights() );
+  for( size_t l = 0; l < w.shadows.size(); ++l )
+    w.shadows[l].clear();
+  for( int k = 0; k < n; ++k ) {
+    if( !w.hit[k] )
+      continue;
+
+    const isect& i = w.hits[k];
+    const Material& m = i.getMaterial();
+    ray r = w.paths.get( k );
+    Vec3r weight = w.paths.weight( k );
+    int s = w.paths.sample[k];
+
+    Vec3r c = prod( weight, m.shadeAmbient( scene, i ) );
+    w.cr[s] += c[0]; w.cg[s] += c[1]; w.cb[s] += c[2];
+
+    Vec3r point = r.at( i.t );
+    int l = 0;
+    for( vector<Light*>::const_iterator litr = scene->beginLights();
+         litr != scene->endLights(); ++litr, ++l ) {
+      Vec3r light = prod( weight, m.shadeLight( scene, *litr, point, i ) );
+      if( light.iszero() )
+        continue;
+      Real tmax;
+      Vec3r origin = offsetOrigin( point, i.N, (*litr)->getDirection( point ) );
+      ray shadow = (*litr)->shadowRay( origin, tmax );
+      w.shadows[l].push( shadow, light, s, tmax );
+    }
+
+    if( !recurse )
+      continue;
+
+    Vec3r reflectWeight = prod( weight, m.kr( i ) );
+    if( RayTracer::worthTracing( reflectWeight ) )
+      w.next.push( RayTracer::reflectedRay( r, i ), reflectWeight, s );
+
+    Vec3r transmitWeight = prod( weight, m.kt( i ) );
+    if( RayTracer::worthTracing( transmitWeight ) )
+      w.next.push( RayTracer::refractedRay( r, i ), transmitWeight, s );
+  }
+}
+
+void WavefrontRenderer::traceShadows( Wave& w )
+{
+  const Scene* scene = raytracer->scene;
+
+  for( size_t l = 0; l < w.shadows.size(); ++l ) {
+    const RayQueue& q = w.shadows[l];
+    int n = q.size();
+    for( int first = 0; first < n; first += BVH::PACKET_SIZE ) {
+      int count = min( (int)BVH::PACKET_SIZE, n - first );
+      int all = (1 << count) - 1;
+      ray rays[BVH::PACKET_SIZE];
+      Vec3r transmission[BVH::PACKET_SIZE];
+      int blocked;
+
+      if( usePackets && count > 1 && coherent( q, first, count ) ) {
+        for( int k = 0; k < count; ++k )
+          rays[k] = q.get( first + k );
+        blocked = scene->occludedPacket( rays, all, &q.tmax[first], transmission );
+        RenderStats::local().countPacket( count );
+      } else {
+        blocked = 0;
+        for( int k = 0; k < count; ++k )
+          if( scene->occluded( q.get( first + k ), q.tmax[first + k], transmission[k] ) )
+            blocked |= 1 << k;
+      }
+
+      for( int k = 0; k < count; ++k ) {
+        if( blocked & (1 << k) )
+          continue;
+        int s = q.sample[first + k];
+        w.cr[s] += q.wr[first + k] * transmission[k][0];
+        w.cg[s] += q.wg[first + k] * transmission[k][1];
+        w.cb[s] += q.wb[first + k] * transmission[k][2];
+      }
+    }
+  }
+}
+
+// Clamp each sample and average them into the pixel, as tracePixel does.
+void WavefrontRenderer::resolve( Wave& w, int y0, int y1 )
+{
+  unsigned char* buffer;
+  int bw, bh;
+  raytracer->getBuffer( buffer, bw, bh );
+
+  int perPixel = numRays * numRays;
+  int s = 0;
+  for( int j = y0; j < y1; ++j )
+    for( int i = 0; i < width; ++i ) {
+      Vec3r col;
+      for( int k = 0; k < perPixel; ++k, ++s ) {
+        Vec3r c( w.cr[s], w.cg[s], w.cb[s] );
+        c.clamp();
+        col = col + c;
+      }
+
+      unsigned char *pixel = buffer + ( i + j * bw ) * 3;
+      pixel[0] = (int)(255.0 * col[0] / perPixel);
+      pixel[1] = (int)(255.0 * col[1] / perPixel);
+      pixel[2] = (int)(255.0 * col[2] / perPixel);
+    }
+}
@@ -0,0 +1,98 @@
+#ifndef __WAVEFRONTRENDERER_H__
+#define __WAVEFRONTRENDERER_H__
+
+// Renders an image without recursion.  Rather than following each camera
+// ray down through its reflections and refractions before starting the
+// next, a band of rows is traced a generation ("wave") at a time:
+//
+//   generate   one camera ray per sample in the band
+//   intersect  every ray in the queue against the scene
+//   shade      every hit: the ambient term goes straight into its sample,
+//              each light that could reach the point emits a shadow ray,
+//              and reflected and refracted rays go on the next wave's queue
+//   shadows    every shadow ray; those that get through add their light
+//
+// and so on until the queue is empty or the depth limit is reached.  Each
+// ray carries the weight its color has in the sample (the thresh that
+// RayTracer::traceRay passes down), so the pipeline adds up the same terms
+// as the recursion, only in a different order; the image matches the
+// recursive one to within rounding.
+//
+// Queues are kept as structures of arrays and reused from band to band.
+// Bands are dealt out to worker threads, each with queues of its own.
+// Sampling is always the uniform -s grid; adaptive sampling needs the
+// recursive tracer.
+//
+// With packets turned on, the intersect and shadow stages hand runs of
+// BVH::PACKET_SIZE rays to the scene together, so that they share the
+// walk through the hierarchy.  Camera rays are generated in 4x4 pixel
+// blocks and shadow rays are queued per light to keep those runs
+// coherent; a run whose rays don't all head the same way (as happens
+// after reflection or refraction) is traced a ray at a time.
+
+#include <atomic>
+#include <vector>
+
+#include "scene/ray.h"
+
+class RayTracer;
+
+class WavefrontRenderer
+{
+ public:
+  WavefrontRenderer( RayTracer* tracer, int width, int height, bool packets = false );
+
+  // Trace every pixel using numThreads workers (0 means one per core).
+  void run( int numThreads );
+
+ private:
+  // Rays waiting to be traced, with the sample each one adds its light
+  // to and the weight it carries there.  tmax is only used by shadow rays.
+  struct RayQueue
+  {
+    std::vector<Real> px, py, pz;
+    std::vector<Real> dx, dy, dz;
+    std::vector<Real> wr, wg, wb;
+    std::vector<Real> tmax;
+    std::vector<int> sample;
+    std::vector<unsigned char> type;
+
+    int size() const { return (int)sample.size(); }
+    void clear();
+    void push( const ray& r, const Vec3r& weight, int s, Real t = 0.0 );
+    ray get( int k ) const;
+    Vec3r weight( int k ) const { return Vec3r( wr[k], wg[k], wb[k] ); }
+  };
+
+  // Everything one worker needs to trace a band.
+  struct Wave
+  {
+    RayQueue paths, next;
+    std::vector<RayQueue> shadows;	// one queue per light
+    std::vector<isect> hits;
+    std::vector<char> hit;
+    std::vector<Real> cr, cg, cb;	// sample colors
+  };
+
+  void worker();
+  void traceBand( Wave& w, int y0, int y1 );
+
+  void generate( Wave& w, int y0, int y1 );
+  void intersect( Wave& w, int depth );
+  void shade( Wave& w, int depth );
+  void traceShadows( Wave& w );
+  void resolve( Wave& w, int y0, int y1 );
+
+  // Whether rays first .. first+count-1 of q make a packet.
+  static bool coherent( const RayQueue& q, int first, int count );
+
+  RayTracer* raytracer;
+  int width, height;
+  int numRays;		// samples per pixel along each axis
+  int bandRows;
+  bool usePackets;
+
+  std::atomic<int> nextRow;
+};
+
+#endif // __WAVEFRONTRENDERER_H__
@@ -0,0 +1,30 @@
+#include "allocstats.h"
+
+#ifdef COUNT_ALLOCATIONS
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+static std::atomic<long> allocations( 0 );
+
+static void* countedAlloc( std::size_t size )
+{
+  ++allocations;
+  void* p = std::malloc( size ? size : 1 );
+  if( !p ) throw std::bad_alloc();
+  return p;
+}
+
+void* operator new( std::size_t size ) { return countedAlloc( size ); }
+void* operator new[]( std::size_t size ) { return countedAlloc( size ); }
+void operator delete( void* p ) throw() { std::free( p ); }
+void operator delete[]( void* p ) throw() { std::free( p ); }
+
+long allocationCount() { return allocations; }
+
+#else
+
+long allocationCount() { return 0; }
+
+#endif
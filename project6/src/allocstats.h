@@ -0,0 +1,10 @@
+#ifndef __ALLOCSTATS_H__
+#define __ALLOCSTATS_H__
+
+// Number of calls to the global operator new so far.  Used to check that
+// tracing rays never touches the allocator.  The counting replacement of
+// operator new is only compiled in when COUNT_ALLOCATIONS is defined;
+// otherwise this always returns 0.
+long allocationCount();
+
+#endif // __ALLOCSTATS_H__
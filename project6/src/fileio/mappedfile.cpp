@@ -0,0 +1,123 @@
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#include "mappedfile.h"
+
+// Empty files can't be mapped; they get this instead.
+static const char emptyFile[1] = { 0 };
+
+MappedFile::MappedFile()
+  : _data(0), _size(0), _open(false)
+{
+#ifdef _WIN32
+  _file = INVALID_HANDLE_VALUE;
+  _mapping = 0;
+#endif
+}
+
+MappedFile::~MappedFile()
+{
+  close();
+}
+
+#ifdef _WIN32
+
+bool MappedFile::open(const char* filename)
+{
+  close();
+  HANDLE file = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, 0,
+                            OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, 0);
+  if (file == INVALID_HANDLE_VALUE) return false;
+
+  LARGE_INTEGER size;
+  if (!GetFileSizeEx(file, &size)) {
+    CloseHandle(file);
+    return false;
+  }
+  _file = file;
+  _size = (size_t)size.QuadPart;
+  _open = true;
+  if (_size == 0) {
+    _data = emptyFile;
+    return true;
+  }
+
+  _mapping = CreateFileMappingA(file, 0, PAGE_READONLY, 0, 0, 0);
+  if (_mapping) _data = (const char*)MapViewOfFile(_mapping, FILE_MAP_READ, 0, 0, 0);
+  if (!_data) {
+    close();
+    return false;
+  }
+  return true;
+}
+
+void MappedFile::close()
+{
+  if (_data && _data != emptyFile) UnmapViewOfFile(_data);
+  if (_mapping) CloseHandle(_mapping);
+  if (_file != INVALID_HANDLE_VALUE) CloseHandle(_file);
+  _data = 0;
+  _size = 0;
+  _open = false;
+  _file = INVALID_HANDLE_VALUE;
+  _mapping = 0;
+}
+
+#else
+
+bool MappedFile::open(const char* filename)
+{
+  close();
+  int fd = ::open(filename, O_RDONLY);
+  if (fd < 0) return false;
+
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    ::close(fd);
+    return false;
+  }
+  _size = (size_t)st.st_size;
+  if (_size == 0) {
+    ::close(fd);
+    _data = emptyFile;
+    _open = true;
+    return true;
+  }
+
+  void* p = mmap(0, _size, PROT_READ, MAP_PRIVATE, fd, 0);
+  // The mapping stays valid after the descriptor is closed.
+  ::close(fd);
+  if (p == MAP_FAILED) {
+    _size = 0;
+    return false;
+  }
+  _data = (const char*)p;
+  _open = true;
+  return true;
+}
+
+void MappedFile::close()
+{
+  if (_data && _data != emptyFile) munmap((void*)_data, _size);
+  _data = 0;
+  _size = 0;
+  _open = false;
+}
+
+#endif
+
+unsigned long long hashBytes(const char* data, size_t size)
+{
+  unsigned long long h = 14695981039346656037ULL;
+  for (size_t k = 0; k < size; ++k) {
+    h ^= (unsigned char)data[k];
+    h *= 1099511628211ULL;
+  }
+  return h;
+}
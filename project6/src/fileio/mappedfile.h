@@ -0,0 +1,40 @@
+#ifndef _MAPPEDFILE_H_
+#define _MAPPEDFILE_H_
+
+/*
+  A read-only view of a whole file, mapped into memory rather than
+  read through a stream.  The contents are only valid while the
+  MappedFile is open.
+*/
+
+#include <stddef.h>
+
+class MappedFile {
+ public:
+  MappedFile();
+  ~MappedFile();
+
+  bool open(const char* filename);	// false if the file can't be mapped
+  void close();
+
+  bool isOpen() const { return _open; }
+  const char* data() const { return _data; }
+  size_t size() const { return _size; }
+
+ private:
+  MappedFile(const MappedFile&);
+  MappedFile& operator=(const MappedFile&);
+
+  const char* _data;
+  size_t _size;
+  bool _open;
+#ifdef _WIN32
+  void* _file;
+  void* _mapping;
+#endif
+};
+
+// 64-bit FNV-1a hash of a block of memory.
+unsigned long long hashBytes(const char* data, size_t size);
+
+#endif
@@ -0,0 +1,162 @@
+#pragma warning (disable: 4786)
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+
+#include "MeshCache.h"
+
+#include "../fileio/mappedfile.h"
+#include "../scene/triangles.h"
+#include "../SceneObjects/trimesh.h"
+
+using namespace std;
+
+// Bump this whenever the layout below changes.
+static const unsigned int MESH_CACHE_VERSION = 1;
+static const char MESH_CACHE_MAGIC[8] = { 'R', 'A', 'Y', 'M', 'E', 'S', 'H', 0 };
+static const unsigned int MESH_CACHE_BYTE_ORDER = 0x01020304;
+
+// Everything ahead of the face ids.
+struct MeshCacheHeader
+{
+  char magic[8];
+  unsigned int version;
+  unsigned int byteOrder;
+  unsigned int realSize;
+  unsigned int triangleKernel;
+  unsigned long long hash;
+  unsigned int vertices;
+  unsigned int faces;
+  unsigned long long check;       // of everything after the header
+};
+
+void MeshCache::buildAccelerator( Trimesh& mesh, const string& dir, bool useCache )
+{
+  if( !useCache || mesh.faceCount() < MIN_FACES ||
+      Accelerator::currentKind() != Accelerator::HIERARCHY )
+  {
+    mesh.buildAccelerator();
+    return;
+  }
+
+  unsigned long long hash = hashMesh( mesh );
+  string file = fileName( dir, hash );
+  if( load( mesh, file, hash ) )
+    return;
+
+  mesh.buildAccelerator();
+  save( mesh, file, hash );
+}
+
+// The vertices exactly as parsed, so the float and double builds,
+// which parse to different bits, keep files of their own.  The faces
+// are summed, not chained, so that the order they come in doesn't
+// matter: the scene cache hands them back in the hierarchy's order.
+unsigned long long MeshCache::hashMesh( const Trimesh& mesh )
+{
+  unsigned long long faces = 0;
+  for( int f = 0; f < mesh.faceCount(); ++f )
+    faces += hashBytes( (const char*)mesh.face( f ), 3 * sizeof(int) );
+  unsigned long long h = hashBytes( (const char*)&mesh.vertices[0],
+                                    mesh.vertices.size() * sizeof(Vec3r) );
+  return h * 1099511628211ULL ^ faces;
+}
+
+string MeshCache::fileName( const string& dir, unsigned long long hash )
+{
+  char name[64];
+  sprintf( name, "mesh-%016llx-%s-%s.bvh", hash, BVH::kernelName( BVH::currentKernel() ),
+           BVH::builderName( BVH::currentBuilder() ) );
+  return dir + "/" + name;
+}
+
+bool MeshCache::load( Trimesh& mesh, const string& file, unsigned long long hash )
+{
+  MappedFile mapped;
+  if( !mapped.open( file.c_str() ) )
+    return false;
+
+  MeshCacheHeader header;
+  int nv = (int)mesh.vertices.size();
+  int nf = mesh.faceCount();
+  size_t idBytes = 3 * (size_t)nf * sizeof(int);
+  if( mapped.size() < sizeof(header) + idBytes )
+    return false;
+  memcpy( &header, mapped.data(), sizeof(header) );
+  if( memcmp( header.magic, MESH_CACHE_MAGIC, sizeof(MESH_CACHE_MAGIC) ) != 0 ||
+      header.version != MESH_CACHE_VERSION ||
+      header.byteOrder != MESH_CACHE_BYTE_ORDER ||
+      header.realSize != sizeof(Real) ||
+      header.triangleKernel != (unsigned int)TriangleSet::currentKernel() ||
+      header.hash != hash ||
+      header.vertices != (unsigned int)nv ||
+      header.faces != (unsigned int)nf ||
+      header.check != hashBytes( mapped.data() + sizeof(header), mapped.size() - sizeof(header) ) )
+    return false;
+
+  // The faces in the order the leaves hold them.
+  vector<int> ids( 3 * nf );
+  memcpy( &ids[0], mapped.data() + sizeof(header), idBytes );
+  for( size_t k = 0; k < ids.size(); ++k )
+    if( ids[k] < 0 || ids[k] >= nv )
+      return false;
+
+  const char* rest = mapped.data() + sizeof(header) + idBytes;
+  size_t restSize = mapped.size() - sizeof(header) - idBytes;
+  if( !mesh.accel.hierarchy().read( rest, restSize, nf, TriangleSet::width( TriangleSet::currentKernel() ) ) )
+    return false;
+
+  // What addFace() works out, for the faces in their new order.
+  mesh.faceIds.swap( ids );
+  for( int f = 0; f < nf; ++f )
+  {
+    const int* face = mesh.face( f );
+    const Vec3r& a = mesh.vertices[face[0]];
+    mesh.faceA[f] = a;
+    mesh.faceAB[f] = mesh.vertices[face[1]] - a;
+    mesh.faceAC[f] = mesh.vertices[face[2]] - a;
+  }
+  mesh.triangles.build( mesh.faceA, mesh.faceAB, mesh.faceAC );
+  mesh.ComputeLocalBoundingBox();
+  return true;
+}
+
+// Written to the side and moved into place, as the scene cache is.
+bool MeshCache::save( const Trimesh& mesh, const string& file, unsigned long long hash )
+{
+  MeshCacheHeader header;
+  memset( &header, 0, sizeof(header) );
+  memcpy( header.magic, MESH_CACHE_MAGIC, sizeof(MESH_CACHE_MAGIC) );
+  header.version = MESH_CACHE_VERSION;
+  header.byteOrder = MESH_CACHE_BYTE_ORDER;
+  header.realSize = sizeof(Real);
+  header.triangleKernel = (unsigned int)TriangleSet::currentKernel();
+  header.hash = hash;
+  header.vertices = (unsigned int)mesh.vertices.size();
+  header.faces = (unsigned int)mesh.faceCount();
+
+  string out( (const char*)&header, sizeof(header) );
+  out.append( (const char*)&mesh.faceIds[0], mesh.faceIds.size() * sizeof(int) );
+  mesh.accel.hierarchy().write( out );
+  header.check = hashBytes( out.data() + sizeof(header), out.size() - sizeof(header) );
+  memcpy( &out[0], &header, sizeof(header) );
+
+  string temp = file + ".tmp";
+  {
+    ofstream ofs( temp.c_str(), ios::out | ios::binary | ios::trunc );
+    if( !ofs ) return false;
+    ofs.write( out.data(), out.size() );
+    if( !ofs ) {
+      ofs.close();
+      remove( temp.c_str() );
+      return false;
+    }
+  }
+  remove( file.c_str() );
+  if( rename( temp.c_str(), file.c_str() ) != 0 ) {
+    remove( temp.c_str() );
+    return false;
+  }
+  return true;
+}
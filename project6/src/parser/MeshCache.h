@@ -0,0 +1,53 @@
+#pragma warning (disable: 4786)
+
+#ifndef __MESHCACHE_H__
+
+#define __MESHCACHE_H__
+
+#include <string>
+
+using std::string;
+
+class Trimesh;
+
+/*
+  class MeshCache:
+    The face hierarchy of a big trimesh, kept on disk so that it
+    is only ever built once.  The file is named after a hash of
+    the mesh's vertex and face arrays as parsed, and lives in
+    the directory of the .ray file, so every scene that uses the
+    same mesh shares it:  dir/mesh-<hash>-<kernel>-<builder>.bvh.
+
+    It holds the order the hierarchy put the faces in and the
+    hierarchy's wide nodes, for the kernel they were collapsed
+    for; the rest of the mesh is parsed as usual.  Loading it is
+    a copy out of a memory-mapped file and a pass to recompute
+    the face edges, with no building at all.
+
+    Like the scene cache, the file records a format version, the
+    size of a Real, and the full hash, and is ignored (and written
+    again) as soon as any of them doesn't match.
+*/
+
+class MeshCache
+{
+  public:
+    // Call in place of mesh.buildAccelerator(), once the faces have
+    // been added.  The hierarchy comes from dir if it has a usable
+    // copy, and is otherwise built and saved there for next time.
+    // Small meshes, meshes that get grids rather than hierarchies
+    // (see Accelerator), and everything when useCache is false, are
+    // simply built.
+    static void buildAccelerator( Trimesh& mesh, const string& dir, bool useCache );
+
+    // Meshes with fewer faces are quicker to build than to look up.
+    static const int MIN_FACES = 4096;
+
+  private:
+    static unsigned long long hashMesh( const Trimesh& mesh );
+    static string fileName( const string& dir, unsigned long long hash );
+    static bool load( Trimesh& mesh, const string& file, unsigned long long hash );
+    static bool save( const Trimesh& mesh, const string& file, unsigned long long hash );
+};
+
+#endif
@@ -7,6 +7,7 @@
 
 #include "Parser.h"
 #include "Tokenizer.h"
+#include "MeshCache.h"
 #include "../scene/scene.h"
 #include "../scene/material.h"
 
@@ -22,12 +23,12 @@ Scene* Parser::parseScene()
 {
   _tokenizer.Read(SBT_RAYTRACER);
 
-  auto_ptr<Token> versionNumber( _tokenizer.Read(SCALAR) );
+  Token versionNumber( _tokenizer.Read(SCALAR) );
 
-  if( versionNumber->value() > 1.1 )
+  if( versionNumber.value() > 1.1 )
   {
     ostringstream ost;
-    ost << "SBT-raytracer version number " << versionNumber->value() << 
+    ost << "SBT-raytracer version number " << versionNumber.value() << 
       " too high; only able to parse v1.1 and below.";
     throw ParserException( ost.str() );
   }
@@ -47,6 +48,7 @@ Scene* Parser::parseScene()
       case CYLINDER:
       case CONE:
       case TRIMESH:
+      case INSTANCE:
       case TRANSLATE:
       case ROTATE:
       case SCALE:
@@ -86,7 +88,7 @@ Scene* Parser::parseScene()
 void Parser::parseCamera( Scene* scene )
 {
   bool hasViewDir( false ), hasUpDir( false );
-  Vec3d viewDir, upDir;
+  Vec3r viewDir, upDir;
 
   _tokenizer.Read( CAMERA );
   _tokenizer.Read( LBRACE );
@@ -95,7 +97,7 @@ void Parser::parseCamera( Scene* scene )
   {
     const Token* t = _tokenizer.Peek();
 
-    Vec4d quaternian;
+    Vec4r quaternian;
     switch( t->kind() )
     {
       case POSITION:
@@ -159,6 +161,7 @@ void Parser::parseTransformableElement( Scene* scene, TransformNode* transform,
       case CYLINDER:
       case CONE:
       case TRIMESH:
+      case INSTANCE:
       case TRANSLATE:
       case ROTATE:
       case SCALE:
@@ -189,6 +192,7 @@ void Parser::parseGroup(Scene* scene, TransformNode* transform, const Material&
       case CYLINDER:
       case CONE:
       case TRIMESH:
+      case INSTANCE:
       case TRANSLATE:
       case ROTATE:
       case SCALE:
@@ -234,6 +238,9 @@ void Parser::parseGeometry(Scene* scene, TransformNode* transform, const Materia
     case TRIMESH:
       parseTrimesh(scene, transform, mat);
       return;
+    case INSTANCE:
+      parseInstance(scene, transform, mat);
+      return;
     case TRANSLATE:
       parseTranslate(scene, transform, mat);
       return;
@@ -265,7 +272,7 @@ void Parser::parseTranslate(Scene* scene, TransformNode* transform, const Materi
 
   // Parse child geometry
   parseTransformableElement( scene, 
-    transform->createChild( Mat4d::createTranslation( x, y, z ) ), mat );
+    transform->createChild( Mat4r::createTranslation( x, y, z ) ), mat );
 
   _tokenizer.Read( RPAREN );
   _tokenizer.CondRead(SEMICOLON);
@@ -288,7 +295,7 @@ void Parser::parseRotate(Scene* scene, TransformNode* transform, const Material&
 
   // Parse child geometry
   parseTransformableElement( scene, 
-    transform->createChild( Mat4d::createRotation( w, x, y, z ) ), mat );
+    transform->createChild( Mat4r::createRotation( w, x, y, z ) ), mat );
 
   _tokenizer.Read( RPAREN );
   _tokenizer.CondRead(SEMICOLON);
@@ -322,7 +329,7 @@ void Parser::parseScale(Scene* scene, TransformNode* transform, const Material&
 
   // Parse child geometry
   parseTransformableElement( scene, 
-    transform->createChild( Mat4d::createScale( x, y, z ) ), mat );
+    transform->createChild( Mat4r::createScale( x, y, z ) ), mat );
 
   _tokenizer.Read( RPAREN );
   _tokenizer.CondRead(SEMICOLON);
@@ -336,17 +343,17 @@ void Parser::parseTransform(Scene* scene, TransformNode* transform, const Materi
   _tokenizer.Read( TRANSFORM );
   _tokenizer.Read( LPAREN );
 
-  Vec4d row1 = parseVec4d();
+  Vec4r row1 = parseVec4d();
   _tokenizer.Read( COMMA );
-  Vec4d row2 = parseVec4d();
+  Vec4r row2 = parseVec4d();
   _tokenizer.Read( COMMA );
-  Vec4d row3 = parseVec4d();
+  Vec4r row3 = parseVec4d();
   _tokenizer.Read( COMMA );
-  Vec4d row4 = parseVec4d();
+  Vec4r row4 = parseVec4d();
   _tokenizer.Read( COMMA );
 
   parseTransformableElement( scene, 
-    transform->createChild( Mat4d(row1, row2, row3, row4) ), mat );
+    transform->createChild( Mat4r(row1, row2, row3, row4) ), mat );
 
   _tokenizer.Read( RPAREN );
   _tokenizer.CondRead(SEMICOLON);
@@ -358,6 +365,7 @@ void Parser::parseSphere(Scene* scene, TransformNode* transform, const Material&
 {
   Sphere* sphere = 0;
   Material* newMat = 0;
+  string name;
 
   _tokenizer.Read( SPHERE );
   _tokenizer.Read( LBRACE );
@@ -373,12 +381,12 @@ void Parser::parseSphere(Scene* scene, TransformNode* transform, const Material&
         newMat = parseMaterialExpression( scene, mat );
         break;
       case NAME:
-        parseIdentExpression();
+        name = parseIdentExpression();
         break;
       case RBRACE:
         _tokenizer.Read( RBRACE );
         sphere = new Sphere(scene, newMat ? newMat : new Material(mat));
-        sphere->setTransform( transform );
+        sphere->setTransform( namedTransform( scene, transform, name ) );
         scene->add( sphere );
         return;
       default:
@@ -396,6 +404,7 @@ void Parser::parseBox(Scene* scene, TransformNode* transform, const Material& ma
   _tokenizer.Read( LBRACE );
 
   Material* newMat = 0;
+  string name;
   for( ;; )
   {
     const Token* t = _tokenizer.Peek();
@@ -407,12 +416,12 @@ void Parser::parseBox(Scene* scene, TransformNode* transform, const Material& ma
         newMat = parseMaterialExpression( scene, mat );
         break;
       case NAME:
-        parseIdentExpression();
+        name = parseIdentExpression();
         break;
       case RBRACE:
          _tokenizer.Read( RBRACE );
         box = new Box(scene, newMat ? newMat : new Material(mat) );
-        box->setTransform( transform );
+        box->setTransform( namedTransform( scene, transform, name ) );
         scene->add( box );
         return;
       default:
@@ -426,6 +435,7 @@ void Parser::parseSquare(Scene* scene, TransformNode* transform, const Material&
 {
   Square* square = 0;
   Material* newMat = 0;
+  string name;
 
   _tokenizer.Read( SQUARE );
   _tokenizer.Read( LBRACE );
@@ -441,12 +451,12 @@ void Parser::parseSquare(Scene* scene, TransformNode* transform, const Material&
         newMat = parseMaterialExpression( scene, mat );
         break;
       case NAME:
-        parseIdentExpression();
+        name = parseIdentExpression();
         break;
       case RBRACE:
          _tokenizer.Read( RBRACE );
         square = new Square(scene, newMat ? newMat : new Material(mat));
-        square->setTransform( transform );
+        square->setTransform( namedTransform( scene, transform, name ) );
         scene->add( square );
         return;
       default:
@@ -460,6 +470,7 @@ void Parser::parseCylinder(Scene* scene, TransformNode* transform, const Materia
 {
   Cylinder* cylinder = 0;
   Material* newMat = 0;
+  string name;
 
   _tokenizer.Read( CYLINDER );
   _tokenizer.Read( LBRACE );
@@ -475,12 +486,12 @@ void Parser::parseCylinder(Scene* scene, TransformNode* transform, const Materia
         newMat = parseMaterialExpression( scene, mat );
         break;
       case NAME:
-        parseIdentExpression();
+        name = parseIdentExpression();
         break;
       case RBRACE:
          _tokenizer.Read( RBRACE );
         cylinder = new Cylinder(scene, newMat ? newMat : new Material(mat));
-        cylinder->setTransform( transform );
+        cylinder->setTransform( namedTransform( scene, transform, name ) );
         scene->add( cylinder );
         return;
       default:
@@ -497,6 +508,7 @@ void Parser::parseCone(Scene* scene, TransformNode* transform, const Material& m
 
   Cone* cone;
   Material* newMat = 0;
+  string name;
 
   double bottomRadius = 1.0;
   double topRadius = 0.0;
@@ -514,7 +526,7 @@ void Parser::parseCone(Scene* scene, TransformNode* transform, const Material& m
         newMat = parseMaterialExpression( scene, mat );
         break;
       case NAME:
-         parseIdentExpression();
+         name = parseIdentExpression();
          break;
       case CAPPED:
         capped = parseBooleanExpression();
@@ -532,7 +544,7 @@ void Parser::parseCone(Scene* scene, TransformNode* transform, const Material& m
         _tokenizer.Read( RBRACE );
         cone = new Cone( scene, newMat ? newMat : new Material(mat), 
           height, bottomRadius, topRadius, capped );
-        cone->setTransform( transform );
+        cone->setTransform( namedTransform( scene, transform, name ) );
         scene->add( cone );
         return;
       default:
@@ -549,7 +561,8 @@ void Parser::parseTrimesh(Scene* scene, TransformNode* transform, const Material
   _tokenizer.Read( LBRACE );
 
   bool generateNormals( true );
-  list<Vec3d> faces;
+  vector<int> faces;		// 3 vertex indices per triangle
+  string name;
 
   char* error;
   for( ;; )
@@ -569,7 +582,7 @@ void Parser::parseTrimesh(Scene* scene, TransformNode* transform, const Material
         break;
 
       case NAME:
-         parseIdentExpression();
+         name = parseIdentExpression();
          break;
 
       case MATERIALS:
@@ -659,13 +672,14 @@ void Parser::parseTrimesh(Scene* scene, TransformNode* transform, const Material
 
         // Now add all the faces into the trimesh, since hopefully
         // the vertices have been parsed out
-        for( list<Vec3d>::const_iterator vitr = faces.begin(); vitr != faces.end(); vitr++ )
+        tmesh->reserveFaces( (int)(faces.size() / 3) );
+        for( size_t f = 0; f < faces.size(); f += 3 )
         {
-          if( !tmesh->addFace( (*vitr)[0], (*vitr)[1], (*vitr)[2] ) )
+          if( !tmesh->addFace( faces[f], faces[f+1], faces[f+2] ) )
           {
             ostringstream oss;
-            oss << "Bad face in trimesh: (" << (*vitr)[0] << ", " << (*vitr)[1] << 
-              ", " << (*vitr)[2] << ")";
+            oss << "Bad face in trimesh: (" << faces[f] << ", " << faces[f+1] << 
+              ", " << faces[f+2] << ")";
             throw ParserException( oss.str() );
           }
         }
@@ -676,7 +690,21 @@ void Parser::parseTrimesh(Scene* scene, TransformNode* transform, const Material
         if( error = tmesh->doubleCheck() )
           throw ParserException( error );
 
+        MeshCache::buildAccelerator( *tmesh, _basePath, _useMeshCache );
+        tmesh->setTransform( namedTransform( scene, transform, name ) );
         scene->add( tmesh );
+
+        // A named mesh can be placed again with instance elements.
+        if( ! name.empty() )
+        {
+           if( meshes.find( name ) != meshes.end() )
+           {
+              ostringstream oss;
+              oss << "Redefinition of trimesh '" << name << "'.";
+              throw SyntaxErrorException( oss.str(), _tokenizer );
+           }
+           meshes[ name ] = tmesh;
+        }
         return;
       }
 
@@ -686,23 +714,89 @@ void Parser::parseTrimesh(Scene* scene, TransformNode* transform, const Material
   }
 }
 
-void Parser::parseFaces( list< Vec3d >& faces )
+// Another placement of a named trimesh, sharing its vertices, faces and
+// hierarchy.  Unless it is given a material of its own it looks like the
+// mesh it copies.
+void Parser::parseInstance(Scene* scene, TransformNode* transform, const Material& mat)
 {
-  list< double > points = parseScalarList();
+  Material* newMat = 0;
+  string name;
+
+  _tokenizer.Read( INSTANCE );
+  _tokenizer.Read( LBRACE );
+
+  for( ;; )
+  {
+    const Token* t = _tokenizer.Peek();
+
+    switch( t->kind() )
+    {
+      case MATERIAL:
+        delete newMat;
+        newMat = parseMaterialExpression( scene, mat );
+        break;
+
+      case NAME:
+        name = parseIdentExpression();
+        break;
+
+      case RBRACE:
+      {
+        meshmap::const_iterator mesh = meshes.find( name );
+        if( mesh == meshes.end() )
+        {
+          delete newMat;
+          ostringstream oss;
+          if( name.empty() )
+            oss << "Expected: 'name'";
+          else
+            oss << "Undefined trimesh '" << name << "'.";
+          throw SyntaxErrorException( oss.str(), _tokenizer );
+        }
+        _tokenizer.Read( RBRACE );
+
+        Instance* instance = new Instance( scene,
+          newMat ? newMat : new Material( mesh->second->getMaterial() ), mesh->second );
+        instance->setTransform( transform );
+        scene->add( instance );
+        return;
+      }
+
+      default:
+        delete newMat;
+        throw SyntaxErrorException( "Expected: instance attributes", _tokenizer );
+    }
+  }
+}
+
+// A named object gets a transform node of its own, so that it can be
+// moved by itself (see Scene::nameTransform); the others share the node
+// of the transform they are in.
+TransformNode* Parser::namedTransform( Scene* scene, TransformNode* transform, const string& name )
+{
+  if( name.empty() )
+    return transform;
+  TransformNode* node = transform->createChild( Mat4r() );
+  scene->nameTransform( name, node );
+  return node;
+}
+
+void Parser::parseFaces( vector<int>& faces )
+{
+  vector<double>& points = _scalars;
+  parseScalarList( points );
 
   // triangulate here and now.  assume the poly is
   // concave and we can triangulate using an arbitrary fan
   if( points.size() < 3 )
      throw SyntaxErrorException( "Faces must have at least 3 vertices.", _tokenizer );
 
-  list<double>::const_iterator i = points.begin();
-  double a = (*i++);
-  double b = (*i++);
-  while( i != points.end() )
+  int a = (int)points[0];
+  for( size_t i = 2; i < points.size(); ++i )
   {
-    double c = (*i++);
-    faces.push_back( Vec3d( a, b, c ) );
-    b = c;
+    faces.push_back( a );
+    faces.push_back( (int)points[i-1] );
+    faces.push_back( (int)points[i] );
   }
 }
 
@@ -724,8 +818,8 @@ void Parser::parseAmbientLight( Scene* scene )
 
 PointLight* Parser::parsePointLight( Scene* scene )
 {
-  Vec3d position;
-  Vec3d color;
+  Vec3r position;
+  Vec3r color;
 
   // Default to the 'default' system
   float constantAttenuationCoefficient = 0.0f;
@@ -787,8 +881,8 @@ PointLight* Parser::parsePointLight( Scene* scene )
 
 DirectionalLight* Parser::parseDirectionalLight( Scene* scene )
 {
-  Vec3d direction;
-  Vec3d color;
+  Vec3r direction;
+  Vec3r color;
 
   bool hasDirection( false ), hasColor( false );
 
@@ -850,20 +944,20 @@ bool Parser::parseBooleanExpression()
   return value;
 }
 
-Vec3d Parser::parseVec3dExpression()
+Vec3r Parser::parseVec3dExpression()
 {
   _tokenizer.Get();
   _tokenizer.Read(EQUALS);
-  Vec3d value( parseVec3d() );
+  Vec3r value( parseVec3d() );
   _tokenizer.CondRead(SEMICOLON);
   return value;
 }
 
-Vec4d Parser::parseVec4dExpression()
+Vec4r Parser::parseVec4dExpression()
 {
   _tokenizer.Get();
   _tokenizer.Read(EQUALS);
-  Vec4d value( parseVec4d() );
+  Vec4r value( parseVec4d() );
   _tokenizer.CondRead(SEMICOLON);
   return value;
 }
@@ -888,22 +982,18 @@ string Parser::parseIdentExpression()
 
 double Parser::parseScalar()
 {
-  auto_ptr<Token> scalar( _tokenizer.Read( SCALAR ) );
-
-  return scalar->value();
+  return _tokenizer.Read( SCALAR ).value();
 }
 
 string Parser::parseIdent()
 {
-  auto_ptr<Token> scalar( _tokenizer.Read( IDENT ) );
-
-  return scalar->ident();
+  return _tokenizer.Read( IDENT ).ident();
 }
 
 
-list<double> Parser::parseScalarList()
+void Parser::parseScalarList( vector<double>& ret )
 {
-  list<double> ret;
+  ret.clear();
 
   _tokenizer.Read( LPAREN );
   if( RPAREN != _tokenizer.Peek()->kind() )
@@ -919,9 +1009,6 @@ list<double> Parser::parseScalarList()
     }
   }
   _tokenizer.Read( RPAREN );
-
-  return ret;
-
 }
 
 bool Parser::parseBoolean()
@@ -940,37 +1027,37 @@ bool Parser::parseBoolean()
   throw SyntaxErrorException( "Expected boolean", _tokenizer );
 }
 
-Vec3d Parser::parseVec3d()
+Vec3r Parser::parseVec3d()
 {
   _tokenizer.Read( LPAREN );
-  auto_ptr<Token> value1( _tokenizer.Read( SCALAR ) );
+  Token value1( _tokenizer.Read( SCALAR ) );
   _tokenizer.Read( COMMA );
-  auto_ptr<Token> value2( _tokenizer.Read( SCALAR ) );
+  Token value2( _tokenizer.Read( SCALAR ) );
   _tokenizer.Read( COMMA );
-  auto_ptr<Token> value3( _tokenizer.Read( SCALAR ) );
+  Token value3( _tokenizer.Read( SCALAR ) );
   _tokenizer.Read( RPAREN );
 
-  return Vec3d( value1->value(), 
-    value2->value(), 
-    value3->value() );
+  return Vec3r( value1.value(), 
+    value2.value(), 
+    value3.value() );
 }
 
-Vec4d Parser::parseVec4d()
+Vec4r Parser::parseVec4d()
 {
   _tokenizer.Read( LPAREN );
-  auto_ptr<Token> value1( _tokenizer.Read( SCALAR ) );
+  Token value1( _tokenizer.Read( SCALAR ) );
   _tokenizer.Read( COMMA );
-  auto_ptr<Token> value2( _tokenizer.Read( SCALAR ) );
+  Token value2( _tokenizer.Read( SCALAR ) );
   _tokenizer.Read( COMMA );
-  auto_ptr<Token> value3( _tokenizer.Read( SCALAR ) );
+  Token value3( _tokenizer.Read( SCALAR ) );
   _tokenizer.Read( COMMA );
-  auto_ptr<Token> value4( _tokenizer.Read( SCALAR ) );
+  Token value4( _tokenizer.Read( SCALAR ) );
   _tokenizer.Read( RPAREN );
 
-  return Vec4d( value1->value(), 
-    value2->value(), 
-    value3->value(),
-    value4->value() );
+  return Vec4r( value1.value(), 
+    value2.value(), 
+    value3.value(),
+    value4.value() );
 }
 
 Material* Parser::parseMaterial( Scene* scene, const Material& parent )
@@ -1033,7 +1120,7 @@ Material* Parser::parseMaterial( Scene* scene, const Material& parent )
 
       case NAME:
          _tokenizer.Read(NAME);
-         name = (_tokenizer.Read(IDENT))->ident();
+         name = _tokenizer.Read(IDENT).ident();
          _tokenizer.Read( SEMICOLON );
          break;
 
@@ -1075,7 +1162,7 @@ MaterialParameter Parser::parseVec3dMaterialParameter( Scene* scene )
   }
   else
   {
-    Vec3d value( parseVec3d() );
+    Vec3r value( parseVec3d() );
     _tokenizer.CondRead(SEMICOLON);
     return MaterialParameter( value );
   }
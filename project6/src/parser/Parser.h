@@ -6,6 +6,7 @@
 
 #include <string>
 #include <map>
+#include <vector>
 
 #include "ParserException.h"
 #include "Tokenizer.h"
@@ -15,6 +16,7 @@
 #include "../SceneObjects/Box.h"
 #include "../SceneObjects/Cone.h"
 #include "../SceneObjects/Cylinder.h"
+#include "../SceneObjects/Instance.h"
 #include "../SceneObjects/Sphere.h"
 #include "../SceneObjects/Square.h"
 #include "../SceneObjects/trimesh.h"
@@ -23,6 +25,7 @@
 #include "../vecmath/mat.h"
 
 typedef std::map<string,Material> mmap;
+typedef std::map<string,const Trimesh*> meshmap;
 
 /*
   class Parser:
@@ -41,9 +44,10 @@ class Parser
 {
   public:
     // We need the path for referencing files from the
-    // base file.
-    Parser( Tokenizer& tokenizer, string basePath )
-      : _tokenizer( tokenizer ), _basePath( basePath )
+    // base file.  The face hierarchies of big trimeshes are
+    // kept there too, unless useMeshCache is false.
+    Parser( Tokenizer& tokenizer, string basePath, bool useMeshCache = true )
+      : _tokenizer( tokenizer ), _basePath( basePath ), _useMeshCache( useMeshCache )
       { }
 
     // Parse the top-level scene
@@ -71,7 +75,9 @@ private:
     void      parseCylinder(Scene* scene, TransformNode* transform, const Material& mat);
     void      parseCone(Scene* scene, TransformNode* transform, const Material& mat);
     void      parseTrimesh(Scene* scene, TransformNode* transform, const Material& mat);
-    void      parseFaces( std::list< Vec3d >& faces );
+    void      parseInstance(Scene* scene, TransformNode* transform, const Material& mat);
+    void      parseFaces( std::vector<int>& faces );
+    TransformNode* namedTransform( Scene* scene, TransformNode* transform, const string& name );
 
     // Parse transforms
     void parseTranslate(Scene* scene, TransformNode* transform, const Material& mat);
@@ -82,8 +88,8 @@ private:
     // Helper functions for parsing expressions of the form:
     //   keyword = value;
     double parseScalarExpression();
-    Vec3d parseVec3dExpression();
-    Vec4d parseVec4dExpression();
+    Vec3r parseVec3dExpression();
+    Vec4r parseVec4dExpression();
     bool parseBooleanExpression();
     Material* parseMaterialExpression(Scene* scene, const Material& mat);
     string parseIdentExpression();
@@ -95,9 +101,9 @@ private:
     // Helper functions for parsing things like vectors
     // and idents.
     double parseScalar();
-    std::list<double> parseScalarList();
-    Vec3d parseVec3d();
-    Vec4d parseVec4d();
+    void parseScalarList( std::vector<double>& values );
+    Vec3r parseVec3d();
+    Vec4r parseVec4d();
     bool parseBoolean();
     Material* parseMaterial(Scene* scene, const Material& parent);
     string parseIdent();
@@ -105,7 +111,10 @@ private:
   private:
     Tokenizer& _tokenizer;
     mmap materials;
+    meshmap meshes;       // named trimeshes, for instance elements
     std::string _basePath;
+    bool _useMeshCache;
+    std::vector<double> _scalars;   // reused by parseFaces
 };
 
 #endif
@@ -0,0 +1,541 @@
+#pragma warning (disable: 4786)
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <vector>
+
+#include "SceneCache.h"
+#include "MeshCache.h"
+
+#include "../fileio/mappedfile.h"
+#include "../scene/scene.h"
+#include "../scene/light.h"
+#include "../SceneObjects/Box.h"
+#include "../SceneObjects/Cone.h"
+#include "../SceneObjects/Cylinder.h"
+#include "../SceneObjects/Instance.h"
+#include "../SceneObjects/Sphere.h"
+#include "../SceneObjects/Square.h"
+#include "../SceneObjects/trimesh.h"
+
+using namespace std;
+
+// Bump this whenever the layout below changes.
+static const unsigned int CACHE_VERSION = 3;
+static const char CACHE_MAGIC[8] = { 'R', 'A', 'Y', 'C', 'A', 'C', 'H', 'E' };
+// Written as-is, so a cache from a machine of the other endianness reads
+// back as a mismatch.
+static const unsigned int CACHE_BYTE_ORDER = 0x01020304;
+
+enum LightKind { DIRECTIONAL_LIGHT_KIND, POINT_LIGHT_KIND };
+enum ObjectKind { SPHERE_KIND, BOX_KIND, SQUARE_KIND, CYLINDER_KIND, CONE_KIND, TRIMESH_KIND,
+                  INSTANCE_KIND };
+
+// Everything is written in the machine's own representation; the cache
+// is only ever read back on the machine that wrote it.  Reals are always
+// written as doubles, so float and double builds can share a cache.
+class CacheWriter
+{
+  public:
+    template <class T>
+    void put( const T& v ) { out.append( (const char*)&v, sizeof(T) ); }
+
+    void putVec( const Vec3r& v ) { put( (double)v[0] ); put( (double)v[1] ); put( (double)v[2] ); }
+
+    void putString( const string& s )
+    {
+      put( (unsigned int)s.size() );
+      out.append( s );
+    }
+
+    string out;
+};
+
+// Reads back what CacheWriter wrote.  Running off the end of the data
+// clears 'ok' and returns zeroes from then on.
+class CacheReader
+{
+  public:
+    CacheReader( const char* data, size_t size )
+      : ok( true ), p( data ), end( data + size ) { }
+
+    bool has( size_t bytes ) const { return (size_t)(end - p) >= bytes; }
+
+    template <class T>
+    T get()
+    {
+      T v = T();
+      if( !has( sizeof(T) ) ) { ok = false; return v; }
+      memcpy( &v, p, sizeof(T) );
+      p += sizeof(T);
+      return v;
+    }
+
+    Vec3r getVec()
+    {
+      double x = get<double>();
+      double y = get<double>();
+      double z = get<double>();
+      return Vec3r( x, y, z );
+    }
+
+    string getString()
+    {
+      unsigned int n = get<unsigned int>();
+      if( !has( n ) ) { ok = false; return string(); }
+      string s( p, n );
+      p += n;
+      return s;
+    }
+
+    // Read an element count, and check that the data could actually hold
+    // that many elements of the given size.
+    unsigned int getCount( size_t elementSize )
+    {
+      unsigned int n = get<unsigned int>();
+      if( !has( (size_t)n * elementSize ) ) { ok = false; return 0; }
+      return n;
+    }
+
+    bool ok;
+
+  private:
+    const char* p;
+    const char* end;
+};
+
+//////////////////////////////////////////////////////////////////////////
+//
+// Writing
+//
+
+static void collectNodes( const TransformNode* node, int parent,
+                          vector<const TransformNode*>& nodes, vector<int>& parents,
+                          map<const TransformNode*, int>& ids )
+{
+  for( TransformNode::child_citer c = node->beginChildren(); c != node->endChildren(); ++c )
+  {
+    int id = (int)nodes.size();
+    ids[*c] = id;
+    nodes.push_back( *c );
+    parents.push_back( parent );
+    collectNodes( *c, id, nodes, parents, ids );
+  }
+}
+
+void SceneCache::putParameter( CacheWriter& w, const MaterialParameter& p )
+{
+  w.put( (unsigned char)p.mapped() );
+  if( p.mapped() )
+    w.putString( p._textureMap->getFilename() );
+  else
+    w.putVec( p._value );
+}
+
+void SceneCache::putMaterial( CacheWriter& w, const Material& m )
+{
+  putParameter( w, m._ke );
+  putParameter( w, m._ka );
+  putParameter( w, m._ks );
+  putParameter( w, m._kd );
+  putParameter( w, m._kr );
+  putParameter( w, m._kt );
+  putParameter( w, m._shininess );
+  putParameter( w, m._index );
+}
+
+void SceneCache::putCamera( CacheWriter& w, const Scene* scene )
+{
+  const Camera& c = scene->getCamera();
+  for( int k = 0; k < 9; ++k )
+    w.put( (double)c.m.n[k] );
+  w.put( (double)c.normalizedHeight );
+  w.put( (double)c.aspectRatio );
+  w.putVec( c.eye );
+  w.putVec( c.look );
+  w.putVec( c.u );
+  w.putVec( c.v );
+}
+
+bool SceneCache::putLight( CacheWriter& w, const Light* light )
+{
+  if( const PointLight* p = dynamic_cast<const PointLight*>( light ) )
+  {
+    w.put( (unsigned char)POINT_LIGHT_KIND );
+    w.putVec( p->position );
+    w.putVec( p->color );
+    w.put( p->constantTerm );
+    w.put( p->linearTerm );
+    w.put( p->quadraticTerm );
+    return true;
+  }
+  if( const DirectionalLight* d = dynamic_cast<const DirectionalLight*>( light ) )
+  {
+    w.put( (unsigned char)DIRECTIONAL_LIGHT_KIND );
+    w.putVec( d->orientation );
+    w.putVec( d->color );
+    return true;
+  }
+  return false;
+}
+
+bool SceneCache::putObject( CacheWriter& w, const Geometry* obj, int node,
+                            const map<const Geometry*, int>& objectIds )
+{
+  const Trimesh* mesh = dynamic_cast<const Trimesh*>( obj );
+  const Cone* cone = dynamic_cast<const Cone*>( obj );
+  const Instance* instance = dynamic_cast<const Instance*>( obj );
+  unsigned char kind;
+  if( mesh ) kind = TRIMESH_KIND;
+  else if( instance ) kind = INSTANCE_KIND;
+  else if( cone ) kind = CONE_KIND;
+  else if( dynamic_cast<const Sphere*>( obj ) ) kind = SPHERE_KIND;
+  else if( dynamic_cast<const Box*>( obj ) ) kind = BOX_KIND;
+  else if( dynamic_cast<const Square*>( obj ) ) kind = SQUARE_KIND;
+  else if( dynamic_cast<const Cylinder*>( obj ) ) kind = CYLINDER_KIND;
+  else return false;
+
+  w.put( kind );
+  w.put( node );
+  putMaterial( w, static_cast<const SceneObject*>( obj )->getMaterial() );
+
+  if( cone )
+  {
+    w.put( (double)cone->height );
+    w.put( (double)cone->b_radius );
+    w.put( (double)cone->t_radius );
+    w.put( (unsigned char)cone->capped );
+  }
+  else if( instance )
+  {
+    // The mesh is always stored ahead of its instances.
+    map<const Geometry*, int>::const_iterator id = objectIds.find( instance->getMesh() );
+    if( id == objectIds.end() ) return false;
+    w.put( id->second );
+  }
+  else if( mesh )
+  {
+    w.put( (unsigned char)mesh->vertNorms );
+    w.put( (unsigned int)mesh->vertices.size() );
+    for( size_t k = 0; k < mesh->vertices.size(); ++k )
+      w.putVec( mesh->vertices[k] );
+    w.put( (unsigned int)mesh->normals.size() );
+    for( size_t k = 0; k < mesh->normals.size(); ++k )
+      w.putVec( mesh->normals[k] );
+    w.put( (unsigned int)mesh->materials.size() );
+    for( size_t k = 0; k < mesh->materials.size(); ++k )
+      putMaterial( w, *mesh->materials[k] );
+    w.put( (unsigned int)mesh->faceCount() );
+    for( size_t k = 0; k < mesh->faceIds.size(); ++k )
+      w.put( mesh->faceIds[k] );
+  }
+  return true;
+}
+
+bool SceneCache::save( const Scene* scene, const string& rayFile,
+                       size_t sourceSize, unsigned long long sourceHash )
+{
+  CacheWriter w;
+  w.out.append( CACHE_MAGIC, sizeof(CACHE_MAGIC) );
+  w.put( CACHE_VERSION );
+  w.put( CACHE_BYTE_ORDER );
+  w.put( (unsigned long long)sourceSize );
+  w.put( sourceHash );
+
+  putCamera( w, scene );
+  w.putVec( scene->ambient() );
+
+  w.put( (unsigned int)(scene->endLights() - scene->beginLights()) );
+  for( Scene::cliter l = scene->beginLights(); l != scene->endLights(); ++l )
+    if( !putLight( w, *l ) ) return false;
+
+  // The tree is stored parents first, each node with its combined
+  // transform; the root is implicitly node -1.
+  vector<const TransformNode*> nodes;
+  vector<int> parents;
+  map<const TransformNode*, int> ids;
+  ids[&scene->transformRoot] = -1;
+  collectNodes( &scene->transformRoot, -1, nodes, parents, ids );
+  w.put( (unsigned int)nodes.size() );
+  for( size_t k = 0; k < nodes.size(); ++k )
+  {
+    w.put( parents[k] );
+    for( int e = 0; e < 16; ++e )
+      w.put( (double)nodes[k]->transform().n[e] );
+  }
+
+  // The names objects gave their nodes.
+  w.put( (unsigned int)scene->names().size() );
+  for( Scene::NameMap::const_iterator n = scene->names().begin(); n != scene->names().end(); ++n )
+  {
+    map<const TransformNode*, int>::const_iterator id = ids.find( n->second );
+    if( id == ids.end() ) return false;
+    w.putString( n->first );
+    w.put( id->second );
+  }
+
+  w.put( (unsigned int)(scene->endObjects() - scene->beginObjects()) );
+  map<const Geometry*, int> objectIds;
+  for( Scene::cgiter g = scene->beginObjects(); g != scene->endObjects(); ++g )
+  {
+    map<const TransformNode*, int>::const_iterator id = ids.find( (*g)->getTransform() );
+    if( id == ids.end() || !putObject( w, *g, id->second, objectIds ) ) return false;
+    int objectId = (int)objectIds.size();
+    objectIds[*g] = objectId;
+  }
+
+  // Write to the side and move it into place, so that nobody ever maps
+  // a half-written cache.
+  string name = cacheName( rayFile );
+  string temp = name + ".tmp";
+  {
+    ofstream ofs( temp.c_str(), ios::out | ios::binary | ios::trunc );
+    if( !ofs ) return false;
+    ofs.write( w.out.data(), w.out.size() );
+    if( !ofs ) {
+      ofs.close();
+      remove( temp.c_str() );
+      return false;
+    }
+  }
+  remove( name.c_str() );
+  if( rename( temp.c_str(), name.c_str() ) != 0 ) {
+    remove( temp.c_str() );
+    return false;
+  }
+  return true;
+}
+
+//////////////////////////////////////////////////////////////////////////
+//
+// Reading
+//
+
+bool SceneCache::getParameter( CacheReader& r, Scene* scene, MaterialParameter& p )
+{
+  if( r.get<unsigned char>() )
+  {
+    string filename = r.getString();
+    if( !r.ok ) return false;
+    p = MaterialParameter( scene->getTexture( filename ) );
+  }
+  else
+    p.setValue( r.getVec() );
+  return r.ok;
+}
+
+Material* SceneCache::getMaterial( CacheReader& r, Scene* scene )
+{
+  auto_ptr<Material> m( new Material );
+  if( getParameter( r, scene, m->_ke ) &&
+      getParameter( r, scene, m->_ka ) &&
+      getParameter( r, scene, m->_ks ) &&
+      getParameter( r, scene, m->_kd ) &&
+      getParameter( r, scene, m->_kr ) &&
+      getParameter( r, scene, m->_kt ) &&
+      getParameter( r, scene, m->_shininess ) &&
+      getParameter( r, scene, m->_index ) )
+    return m.release();
+  return 0;
+}
+
+void SceneCache::getCamera( CacheReader& r, Scene* scene )
+{
+  Camera& c = scene->getCamera();
+  for( int k = 0; k < 9; ++k )
+    c.m.n[k] = r.get<double>();
+  c.normalizedHeight = r.get<double>();
+  c.aspectRatio = r.get<double>();
+  c.eye = r.getVec();
+  c.look = r.getVec();
+  c.u = r.getVec();
+  c.v = r.getVec();
+}
+
+Light* SceneCache::getLight( CacheReader& r, Scene* scene )
+{
+  switch( r.get<unsigned char>() )
+  {
+    case POINT_LIGHT_KIND:
+    {
+      Vec3r position = r.getVec();
+      Vec3r color = r.getVec();
+      float constant = r.get<float>();
+      float linear = r.get<float>();
+      float quadratic = r.get<float>();
+      if( !r.ok ) return 0;
+      return new PointLight( scene, position, color, constant, linear, quadratic );
+    }
+    case DIRECTIONAL_LIGHT_KIND:
+    {
+      Vec3r orientation = r.getVec();
+      Vec3r color = r.getVec();
+      if( !r.ok ) return 0;
+      DirectionalLight* light = new DirectionalLight( scene, orientation, color );
+      // Already normalized once; don't let a second pass round it again.
+      light->orientation = orientation;
+      return light;
+    }
+    default:
+      return 0;
+  }
+}
+
+Geometry* SceneCache::getObject( CacheReader& r, Scene* scene, TransformNode* node,
+                                const string& dir )
+{
+  unsigned char kind = r.get<unsigned char>();
+  r.get<int>();		// the node, already looked up by the caller
+  Material* mat = getMaterial( r, scene );
+  if( !mat ) return 0;
+
+  switch( kind )
+  {
+    case SPHERE_KIND: return new Sphere( scene, mat );
+    case BOX_KIND: return new Box( scene, mat );
+    case SQUARE_KIND: return new Square( scene, mat );
+    case CYLINDER_KIND: return new Cylinder( scene, mat );
+    case CONE_KIND:
+    {
+      double height = r.get<double>();
+      double bottomRadius = r.get<double>();
+      double topRadius = r.get<double>();
+      bool capped = r.get<unsigned char>() != 0;
+      if( !r.ok ) { delete mat; return 0; }
+      return new Cone( scene, mat, height, bottomRadius, topRadius, capped );
+    }
+    case INSTANCE_KIND:
+    {
+      // An index into the objects loaded so far, which the scene
+      // already holds in order.
+      int id = r.get<int>();
+      int loaded = (int)(scene->endObjects() - scene->beginObjects());
+      const Trimesh* mesh = r.ok && id >= 0 && id < loaded
+        ? dynamic_cast<const Trimesh*>( scene->beginObjects()[id] ) : 0;
+      if( !mesh ) { delete mat; return 0; }
+      return new Instance( scene, mat, mesh );
+    }
+    case TRIMESH_KIND:
+    {
+      auto_ptr<Trimesh> mesh( new Trimesh( scene, mat, node ) );
+      mesh->vertNorms = r.get<unsigned char>() != 0;
+
+      unsigned int n = r.getCount( 3 * sizeof(double) );
+      mesh->vertices.reserve( n );
+      for( unsigned int k = 0; k < n; ++k )
+        mesh->addVertex( r.getVec() );
+
+      n = r.getCount( 3 * sizeof(double) );
+      mesh->normals.reserve( n );
+      for( unsigned int k = 0; k < n; ++k )
+        mesh->addNormal( r.getVec() );
+
+      n = r.getCount( 1 );
+      for( unsigned int k = 0; k < n && r.ok; ++k )
+      {
+        Material* m = getMaterial( r, scene );
+        if( !m ) return 0;
+        mesh->addMaterial( m );
+      }
+
+      n = r.getCount( 3 * sizeof(int) );
+      mesh->faceIds.reserve( 3 * n );
+      for( unsigned int k = 0; k < n; ++k )
+      {
+        int a = r.get<int>();
+        int b = r.get<int>();
+        int c = r.get<int>();
+        if( a < 0 || b < 0 || c < 0 || !mesh->addFace( a, b, c ) ) return 0;
+      }
+      if( !r.ok ) return 0;
+
+      MeshCache::buildAccelerator( *mesh, dir, true );
+      return mesh.release();
+    }
+    default:
+      delete mat;
+      return 0;
+  }
+}
+
+Scene* SceneCache::load( const string& rayFile, size_t sourceSize,
+                         unsigned long long sourceHash )
+{
+  MappedFile file;
+  if( !file.open( cacheName( rayFile ).c_str() ) ) return 0;
+  CacheReader r( file.data(), file.size() );
+
+  if( !r.has( sizeof(CACHE_MAGIC) ) || memcmp( file.data(), CACHE_MAGIC, sizeof(CACHE_MAGIC) ) != 0 )
+    return 0;
+  for( size_t k = 0; k < sizeof(CACHE_MAGIC); ++k ) r.get<char>();
+  if( r.get<unsigned int>() != CACHE_VERSION ||
+      r.get<unsigned int>() != CACHE_BYTE_ORDER ||
+      r.get<unsigned long long>() != (unsigned long long)sourceSize ||
+      r.get<unsigned long long>() != sourceHash ||
+      !r.ok )
+    return 0;
+
+  // Mesh hierarchies are kept beside the .ray file too.
+  string dir( rayFile );
+  if( dir.find_last_of( "\\/" ) == string::npos )
+    dir = ".";
+  else
+    dir = dir.substr( 0, dir.find_last_of( "\\/" ) );
+
+  auto_ptr<Scene> scene( new Scene );
+  getCamera( r, scene.get() );
+  scene->addAmbient( r.getVec() );
+
+  unsigned int n = r.getCount( 1 );
+  for( unsigned int k = 0; k < n; ++k )
+  {
+    Light* light = getLight( r, scene.get() );
+    if( !light ) return 0;
+    scene->add( light );
+  }
+
+  n = r.getCount( sizeof(int) + 16 * sizeof(double) );
+  vector<TransformNode*> nodes;
+  nodes.reserve( n );
+  for( unsigned int k = 0; k < n; ++k )
+  {
+    int parent = r.get<int>();
+    Mat4r xform;
+    for( int e = 0; e < 16; ++e )
+      xform.n[e] = r.get<double>();
+    if( parent < -1 || parent >= (int)k ) return 0;
+    TransformNode* p = parent < 0 ? &scene->transformRoot : nodes[parent];
+    nodes.push_back( p->createChildCombined( xform ) );
+  }
+
+  n = r.getCount( sizeof(unsigned int) + sizeof(int) );
+  for( unsigned int k = 0; k < n; ++k )
+  {
+    string name = r.getString();
+    int node = r.get<int>();
+    if( !r.ok || node < -1 || node >= (int)nodes.size() ) return 0;
+    scene->nameTransform( name, node < 0 ? &scene->transformRoot : nodes[node] );
+  }
+
+  n = r.getCount( 1 );
+  for( unsigned int k = 0; k < n; ++k )
+  {
+    // Peek at the node so that trimeshes can be built with it.
+    CacheReader peek = r;
+    peek.get<unsigned char>();
+    int node = peek.get<int>();
+    if( !peek.ok || node < -1 || node >= (int)nodes.size() ) return 0;
+    TransformNode* transform = node < 0 ? &scene->transformRoot : nodes[node];
+
+    Geometry* obj = getObject( r, scene.get(), transform, dir );
+    if( !obj ) return 0;
+    obj->setTransform( transform );
+    scene->add( obj );
+  }
+
+  if( !r.ok ) return 0;
+  return scene.release();
+}
@@ -0,0 +1,75 @@
+#pragma warning (disable: 4786)
+
+#ifndef __SCENECACHE_H__
+
+#define __SCENECACHE_H__
+
+#include <stddef.h>
+#include <map>
+#include <string>
+
+using std::string;
+
+class Scene;
+class Geometry;
+class Light;
+class Material;
+class MaterialParameter;
+class TransformNode;
+class CacheReader;
+class CacheWriter;
+
+/*
+  class SceneCache:
+    A binary copy of a parsed scene, kept next to the .ray file
+    it came from (foo.ray -> foo.ray.cache).  It holds everything
+    the parser builds: camera, lights, the transform tree and the
+    names objects gave their transforms, the objects with their
+    materials, and the vertex, normal and face arrays of every
+    trimesh.  An instance refers back to the trimesh it places,
+    which is stored once.  Loading it is a straight copy out of
+    a memory-mapped file, with no tokenizing at all.  The face
+    hierarchies of big trimeshes are not part of it; they come
+    from the mesh cache (see MeshCache.h) next to it.
+
+    The cache records the size and a hash of the .ray file it was
+    made from, and is ignored as soon as either no longer matches.
+    It also records a format version, so caches written by an
+    older build are ignored too.
+*/
+
+class SceneCache
+{
+  public:
+    // Load the cached copy of rayFile, whose contents hash to
+    // sourceHash.  Returns 0 if there is no usable cache.
+    static Scene* load( const string& rayFile, size_t sourceSize,
+                        unsigned long long sourceHash );
+
+    // Write the cached copy of rayFile.  Returns false, leaving no
+    // cache behind, if the file can't be written or the scene holds
+    // something the format doesn't know about.
+    static bool save( const Scene* scene, const string& rayFile,
+                      size_t sourceSize, unsigned long long sourceHash );
+
+    static string cacheName( const string& rayFile ) { return rayFile + ".cache"; }
+
+  private:
+    // The classes stored here name SceneCache as a friend; these are
+    // the parts that need to see inside them.
+    static void putParameter( CacheWriter& w, const MaterialParameter& p );
+    static void putMaterial( CacheWriter& w, const Material& m );
+    static void putCamera( CacheWriter& w, const Scene* scene );
+    static bool putLight( CacheWriter& w, const Light* light );
+    static bool putObject( CacheWriter& w, const Geometry* obj, int node,
+                           const std::map<const Geometry*, int>& objectIds );
+
+    static bool getParameter( CacheReader& r, Scene* scene, MaterialParameter& p );
+    static Material* getMaterial( CacheReader& r, Scene* scene );
+    static void getCamera( CacheReader& r, Scene* scene );
+    static Light* getLight( CacheReader& r, Scene* scene );
+    static Geometry* getObject( CacheReader& r, Scene* scene, TransformNode* node,
+                                const string& dir );
+};
+
+#endif
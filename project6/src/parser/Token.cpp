@@ -56,6 +56,7 @@ string getNameForToken( const SYMBOL kind )
     tokenNames[ CYLINDER ]          = "cylinder";
     tokenNames[ CONE ]              = "cone";
     tokenNames[ TRIMESH ]           = "trimesh";
+    tokenNames[ INSTANCE ]          = "instance";
     tokenNames[ POSITION ]          = "position";
     tokenNames[ VIEWDIR ]           = "viewdir";
     tokenNames[ UPDIR ]             = "updir";
@@ -137,6 +138,7 @@ SYMBOL lookupReservedWord(const string& ident) {
     reservedWords["gennormals"] = GENNORMALS;
     reservedWords["height"] = HEIGHT;
     reservedWords["index"] = INDEX;
+    reservedWords["instance"] = INSTANCE;
     reservedWords["linear_attenuation_coeff"] = LINEAR_ATTENUATION_COEFF;
     reservedWords["material"] = MATERIAL;
     reservedWords["materials"] = MATERIALS;
@@ -179,7 +181,13 @@ SYMBOL lookupReservedWord(const string& ident) {
 
 string Token::toString() const
 {
-  return getNameForToken( kind() );
+  ostringstream oss;
+  oss << getNameForToken( kind() );
+  if( IDENT == _kind )
+    oss << ": \"" << _ident << "\"";
+  else if( SCALAR == _kind )
+    oss << ": " << _value;
+  return oss.str();
 }
 
 void Token::Print( ostream& out ) const {
@@ -189,16 +197,3 @@ void Token::Print( ostream& out ) const {
 void Token::Print( ) const {
   Print( std::cout );
 }
-
-string IdentToken::toString( ) const {
-  ostringstream oss( Token::toString() );
-  oss << ": \"" << _ident << "\"";
-  return oss.str();
-}
-
-string ScalarToken::toString( ) const {
-  ostringstream oss( Token::toString() );
-  oss << ": " << _value;
-  return oss.str();
-}
- 
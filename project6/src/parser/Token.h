@@ -56,6 +56,7 @@ enum SYMBOL {
   CYLINDER,
   CONE,
   TRIMESH,  
+  INSTANCE,
 
   POSITION, VIEWDIR,		// keywords affecting primitives
   UPDIR, ASPECTRATIO,
@@ -88,53 +89,45 @@ enum SYMBOL {
 string getNameForToken( const SYMBOL kind );
 SYMBOL lookupReservedWord( const string& name );
 
+// Tokens are small values: the tokenizer hands them back by copy rather
+// than allocating one per lexeme.  Only identifiers carry any text.
 class Token {
   public:
-    Token(SYMBOL kind) : _kind( kind ) { }
+    Token(SYMBOL kind = UNKNOWN) : _kind( kind ), _value( 0.0 ) { }
 
     SYMBOL kind() const { return _kind; }
 
     // Note that these errors should not ever be encountered at runtime,
     // and signify parser bugs of some kind.
-    virtual std::string ident() const   
-      { throw ParserFatalException("not an IdentToken"); return std::string(); }
-    virtual double value() const   
-      { throw ParserFatalException("not a ScalarToken"); return 0.0; }
+    const std::string& ident() const   
+      { if( _kind != IDENT ) throw ParserFatalException("not an IdentToken"); return _ident; }
+    double value() const   
+      { if( _kind != SCALAR ) throw ParserFatalException("not a ScalarToken"); return _value; }
 
 
     // Utility functions
-    virtual void Print(std::ostream& out) const;
-    virtual void Print() const;
-    virtual string toString() const;
+    void Print(std::ostream& out) const;
+    void Print() const;
+    string toString() const;
 
-	virtual ~Token() {}
   protected:
-    const SYMBOL _kind;
+    SYMBOL _kind;
+    double _value;
+    std::string _ident;
 };
 
+// These only pick the right constructor; since tokens are passed by
+// value they must not add any members of their own.
 class IdentToken : public Token {
   public:
-    IdentToken(std::string ident) : Token(IDENT), _ident( ident ) { 
+    IdentToken(const std::string& ident) : Token(IDENT) { 
+      _ident = ident;
     }
-
-    std::string ident() const { return _ident; }
-
-    string toString() const;
-
-  protected:
-    const std::string _ident;
 };
 
 class ScalarToken : public Token {
   public:
-    ScalarToken(double value) : Token(SCALAR), _value( value ) { }
-    
-    double value() const { return _value; }
-
-    string toString() const;
-
-  protected:
-    const double _value;
+    ScalarToken(double value) : Token(SCALAR) { _value = value; }
 };
 
 
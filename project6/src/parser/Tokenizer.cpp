@@ -4,6 +4,7 @@
 #include <map>
 #include <sstream>
 #include <cstdlib>
+#include <cctype>
 
 #include "../fileio/buffer.h"
 #include "Tokenizer.h"
@@ -41,8 +42,128 @@ Tokenizer::Tokenizer(istream& fp, bool printTokens)
 { 
     TokenColumn = 0;
     CurrentCh = ' ';
-    UnGetToken = NULL;
+    HasPeekToken = false;
     _printTokens = printTokens;
+
+    _mapped = false;
+    _begin = _end = _cursor = _tokenStart = _countedTo = NULL;
+    _countedLines = 1;
+    _lastPrintedLine = 0;
+}
+
+// The Buffer is never read from in fast mode, but it still wants a stream.
+static istream& noStream()
+{
+  static std::istringstream empty;
+  return empty;
+}
+
+//////////////////////////////////////////////////////////////////////////
+//
+// Tokenizer::Tokenizer(const char*, size_t) constructor
+//
+//   Fast mode.  The whole file is already in memory, so tokens are
+// scanned straight out of it with a pointer.
+//
+
+Tokenizer::Tokenizer(const char* data, size_t size, bool printTokens)
+  : buffer( noStream(), false, false )
+{
+    TokenColumn = 0;
+    CurrentCh = ' ';
+    HasPeekToken = false;
+    _printTokens = printTokens;
+
+    _mapped = true;
+    _begin = _cursor = _tokenStart = _countedTo = data;
+    _end = data + size;
+    _countedLines = 1;
+    _lastPrintedLine = 0;
+}
+
+//////////////////////////////////////////////////////////////////////////
+//
+// double ParseNumber(const char*, const char*)
+//
+//   Converts the longest prefix of [begin,end) that looks like a number,
+// the same way atof() would; the text isn't NUL-terminated, so atof
+// itself can't be used on it.  Scene files are mostly short decimals
+// like 0.25 or -1.5e-3, and those are converted here without any library
+// call: the digits fit exactly in an integer, and a single multiply or
+// divide by an exactly representable power of ten rounds correctly
+// (Clinger's fast path).  Anything longer is handed to strtod.
+//
+
+static double ParseNumber(const char* begin, const char* end)
+{
+  static const double powersOfTen[] = {
+    1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+  };
+
+  const char* p = begin;
+  bool negative = false;
+  if (p != end && '-' == *p) {
+    negative = true;
+    ++p;
+  }
+
+  unsigned long long mantissa = 0;
+  int digits = 0;               // significant digits in mantissa
+  int exponent = 0;
+  bool sawDigit = false;
+
+  for (; p != end && isdigit((unsigned char)*p); ++p) {
+    sawDigit = true;
+    if (mantissa != 0 || *p != '0') {
+      mantissa = mantissa * 10 + (*p - '0');
+      ++digits;
+    }
+  }
+  if (p != end && '.' == *p) {
+    for (++p; p != end && isdigit((unsigned char)*p); ++p) {
+      sawDigit = true;
+      if (mantissa != 0 || *p != '0') {
+        mantissa = mantissa * 10 + (*p - '0');
+        ++digits;
+      }
+      --exponent;
+    }
+  }
+  if (!sawDigit)
+    return 0.0;
+
+  // The exponent only counts if there are digits after the 'e'.
+  if (p != end && 'e' == *p) {
+    const char* q = p + 1;
+    bool negativeExponent = false;
+    if (q != end && '-' == *q) {
+      negativeExponent = true;
+      ++q;
+    }
+    if (q != end && isdigit((unsigned char)*q)) {
+      int e = 0;
+      for (; q != end && isdigit((unsigned char)*q); ++q)
+        if (e < 100000) e = e * 10 + (*q - '0');
+      exponent += negativeExponent ? -e : e;
+      p = q;
+    }
+  }
+
+  if (mantissa == 0)
+    return negative ? -0.0 : 0.0;
+
+  if (digits <= 15 && exponent >= -22 && exponent <= 22) {
+    double value = (double)mantissa;
+    if (exponent < 0)
+      value /= powersOfTen[-exponent];
+    else
+      value *= powersOfTen[exponent];
+    return negative ? -value : value;
+  }
+
+  string text( begin, p );
+  return strtod( text.c_str(), NULL );
 }
 
 //////////////////////////////////////////////////////////////////////////
@@ -51,73 +172,80 @@ Tokenizer::Tokenizer(istream& fp, bool printTokens)
 // last phase to be executed
 // 
 void Tokenizer::ScanProgram() {
-    while (Get()->kind() != EOFSYM) ;
+    while (Get().kind() != EOFSYM) ;
 }
 
+//////////////////////////////////////////////////////////////////////////
+//
+// Token Tokenizer::Get() method
+//
+// Returns the peeked token, if there is one; otherwise scans a new one.
+//
 
-auto_ptr<Token> Tokenizer::Get() {
-  return auto_ptr<Token>(GetNext());
+Token Tokenizer::Get() {
+  if (HasPeekToken) {
+    HasPeekToken = false;
+    return PeekToken;
+  }
+  return GetNext();
 }
 
 //////////////////////////////////////////////////////////////////////////
 //
-// Token* Tokenizer::Get() method
+// Token Tokenizer::GetNext() method
 //
-// Advance through the source to find the next token. Returns peeked token,
-// if there is one.
+// Advance through the source to find the next token.
 //
 
-Token* Tokenizer::GetNext() {
-  Token* T = NULL;
+Token Tokenizer::GetNext() {
+  Token T;
 
-  // First check to see if there is an UnGetToken. If there is, use it.
-  if (UnGetToken != NULL) {
-    T = UnGetToken;
-    UnGetToken = NULL;
-    return T;
-  }
+  if (_mapped) {
+    // Fast mode has a scanner of its own
+    T = ScanMapped();
 
-  // Otherwise, crank up the scanner and get a new token.
+  } else {
 
-  // Get rid of any whitespace
-  SkipWhiteSpace();
+    // Get rid of any whitespace
+    SkipWhiteSpace();
 
-  // test for end of file
-  if (buffer.isEOF()) {
-    T = new Token(EOFSYM);
+    // test for end of file
+    if (buffer.isEOF()) {
+      T = Token(EOFSYM);
 
-  } else {
+    } else {
     
-    // Save the starting position of the symbol in a variable,
-    // so that nicer error messages can be produced.
-    TokenColumn = buffer.CurColumn();
+      // Save the starting position of the symbol in a variable,
+      // so that nicer error messages can be produced.
+      TokenColumn = buffer.CurColumn();
     
-    // Check kind of current character
+      // Check kind of current character
     
-    // Note that _'s are now allowed in identifiers.
-    if (isalpha(CurrentCh) || '_' == CurrentCh) {
-      // grab identifier or reserved word
-      T = GetIdent();
-    } else if ( '"' == CurrentCh)  {
-      T = GetQuotedIdent(); 
-    } else if (isdigit(CurrentCh) || '-' == CurrentCh || '.' == CurrentCh) {
-      T = GetScalar();
-    } else { 
-      //
-      // Check for other tokens
-      //
+      // Note that _'s are now allowed in identifiers.
+      if (isalpha(CurrentCh) || '_' == CurrentCh) {
+        // grab identifier or reserved word
+        T = GetIdent();
+      } else if ( '"' == CurrentCh)  {
+        T = GetQuotedIdent(); 
+      } else if (isdigit(CurrentCh) || '-' == CurrentCh || '.' == CurrentCh) {
+        T = GetScalar();
+      } else { 
+        //
+        // Check for other tokens
+        //
       
-      T = GetPunct();
+        T = GetPunct();
+      }
     }
   }
   
-  if (T == NULL) {
+  if (T.kind() == UNKNOWN) {
     throw ParserFatalException("didn't get a token");
   }
 
   if (_printTokens) {
     std::cout << "Token read: ";
-    T->Print();
+    T.Print();
     std::cout << std::endl;
   }
 
@@ -185,7 +313,7 @@ void Tokenizer::SkipWhiteSpace() {
   }
 }
 
-Token* Tokenizer::GetQuotedIdent() {
+Token Tokenizer::GetQuotedIdent() {
   GetCh();   // Throw out beginning '"'
 
   std::ostringstream ident;
@@ -197,18 +325,18 @@ Token* Tokenizer::GetQuotedIdent() {
     GetCh();
   }
   GetCh();
-  return new IdentToken( ident.str() );
+  return IdentToken( ident.str() );
 }
 
 //////////////////////////////////////////////////////////////////////////
 //
-// Token* Tokenizer::GetIdent method
+// Token Tokenizer::GetIdent method
 //
 //   GetIdent scans an identifier-like token.  It returns an
 //   identifier or a reserved word token.
 //
 
-Token* Tokenizer::GetIdent() {
+Token Tokenizer::GetIdent() {
   // an IDENTIFIER or a RESERVED WORD token
   std::ostringstream ident;
   while (isalnum(CurrentCh) || '_' == CurrentCh || '-' == CurrentCh) { 
@@ -221,39 +349,39 @@ Token* Tokenizer::GetIdent() {
 
 //////////////////////////////////////////////////////////////////////////
 //
-// Token* Tokenizer::GetInt method
+// Token Tokenizer::GetInt method
 //
 //   GetInt scans an integer.  It returns an integer token.
 //
 
-Token* Tokenizer::GetScalar() {
+Token Tokenizer::GetScalar() {
   // an INTEGER token
   string ret( "" );
   while (isdigit(CurrentCh) || '-' == CurrentCh || '.' == CurrentCh || 'e' == CurrentCh ) {
     ret += CurrentCh;
     GetCh();
   }
-  return new ScalarToken( atof( ret.c_str() ) );
+  return ScalarToken( ParseNumber( ret.data(), ret.data() + ret.size() ) );
 }
 
 //////////////////////////////////////////////////////////////////////////
 //
-// Token* Tokenizer::GetPunct() method
+// Token Tokenizer::GetPunct() method
 //
 //   Gets a punctuation token from input stream and returns it.
 //
 
-Token* Tokenizer::GetPunct() {
-  Token* T;
+Token Tokenizer::GetPunct() {
+  Token T;
 
   switch (CurrentCh) {
-  case '(':  GetCh(); T = new Token(LPAREN);     break;
-  case ')':  GetCh(); T = new Token(RPAREN);     break;
-  case '{':  GetCh(); T = new Token(LBRACE);     break;
-  case '}':  GetCh(); T = new Token(RBRACE);     break;
-  case ',':  GetCh(); T = new Token(COMMA);      break;
-  case '=':  GetCh(); T = new Token(EQUALS);     break;
-  case ';':  GetCh(); T = new Token(SEMICOLON);  break;
+  case '(':  GetCh(); T = Token(LPAREN);      break;
+  case ')':  GetCh(); T = Token(RPAREN);      break;
+  case '{':  GetCh(); T = Token(LBRACE);      break;
+  case '}':  GetCh(); T = Token(RBRACE);      break;
+  case ',':  GetCh(); T = Token(COMMA);       break;
+  case '=':  GetCh(); T = Token(EQUALS);      break;
+  case ';':  GetCh(); T = Token(SEMICOLON);   break;
 
   default:
     std::ostringstream ost;
@@ -264,45 +392,32 @@ Token* Tokenizer::GetPunct() {
   return T;
 }
 
-//////////////////////////////////////////////////////////////////////////
-//
-// void Tokenizer::UnGet(Token*) method
-//
-//   UnGet returns the last read token to the input, where it will be
-//   returned for the next Get call.  At most 1 token can be pushed back
-//   at a time this way and this token is pointed to by the pointer
-//   TokenToUnGet.  TokenToUnGet must be non null.
-
-void Tokenizer::UnGet(Token* TokenToUnGet) {
-  if (UnGetToken != NULL) {
-    throw ParserFatalException("trying to UnGet more than one token");
-  }
-  UnGetToken = TokenToUnGet;
-}
-
 //////////////////////////////////////////////////////////////////////////
 //
 // Token* Tokenizer::Peek() method
 //
-//   Peek reads the next token and pushes it back on the token stream
+//   Peek reads the next token and holds on to it, so that the next Get
+//   call returns it again.  At most 1 token is held this way.
 //
 
 const Token* Tokenizer::Peek() {
-  Token* T = GetNext();
-  UnGet(T);
-  return T;
+  if (!HasPeekToken) {
+    PeekToken = GetNext();
+    HasPeekToken = true;
+  }
+  return &PeekToken;
 }
 
 //////////////////////////////////////////////////////////////////////////
 //
-// Token* Tokenizer::Read(SYMBOL) method
+// Token Tokenizer::Read(SYMBOL) method
 //
 //   Read gets the next token and checks that it's of the expected type.
 //
 
-auto_ptr<Token> Tokenizer::Read(SYMBOL kind) {
-  auto_ptr<Token> T( Get() );
-  if (T->kind() != kind) {
+Token Tokenizer::Read(SYMBOL kind) {
+  Token T( Get() );
+  if (T.kind() != kind) {
     string msg( getNameForToken( kind ) );
     msg.append( " expected" );
     throw SyntaxErrorException(msg, *this);
@@ -331,7 +446,7 @@ bool Tokenizer::CondRead(SYMBOL kind) {
 
 //////////////////////////////////////////////////////////////////////////
 //
-// Token* Tokenizer::SearchReserved(const string&) private method
+// Token Tokenizer::SearchReserved(const string&) private method
 //
 //   SearchReserved() maps a character string to an IdentToken or one of
 // several possible reserved word tokens, using a binary search on the
@@ -345,15 +460,15 @@ bool Tokenizer::CondRead(SYMBOL kind) {
 
 typedef std::map<string, SYMBOL> ReservedWordsMap;
 
-Token* Tokenizer::SearchReserved(const string& ident) const {
+Token Tokenizer::SearchReserved(const string& ident) const {
   SYMBOL tokSymbol = lookupReservedWord( ident );
   if( UNKNOWN == tokSymbol )
   {
-    return new IdentToken( ident );
+    return IdentToken( ident );
   }
   else
   {
-    return new Token( tokSymbol );
+    return Token( tokSymbol );
   }
 }
 
@@ -374,3 +489,176 @@ bool Tokenizer::CondReadCh(char c) {
     return false;
   }
 }
+
+//////////////////////////////////////////////////////////////////////////
+//
+// Fast mode scanners
+//
+//   These are the same scanners as above, reading straight out of the
+// file in memory.  Each token is located, converted and returned by
+// value without copying its text anywhere first; identifiers are the
+// only tokens that need any text at all.
+//
+
+Token Tokenizer::ScanMapped() {
+  SkipMappedWhiteSpace();
+
+  _tokenStart = _cursor;
+  if (_cursor == _end)
+    return Token(EOFSYM);
+
+  unsigned char c = *_cursor;
+
+  if (isalpha(c) || '_' == c) {
+    // grab identifier or reserved word
+    const char* start = _cursor;
+    while (_cursor != _end && (isalnum((unsigned char)*_cursor) ||
+                               '_' == *_cursor || '-' == *_cursor))
+      ++_cursor;
+    _text.assign(start, _cursor);
+    return SearchReserved(_text);
+  }
+
+  if ('"' == c) {
+    const char* start = ++_cursor;
+    while (_cursor != _end && '"' != *_cursor) {
+      if ('\n' == *_cursor)
+        break;
+      ++_cursor;
+    }
+    if (_cursor == _end || '"' != *_cursor)
+      throw SyntaxErrorException( "Unterminated string constant", *this );
+    _text.assign(start, _cursor);
+    ++_cursor;
+    return IdentToken(_text);
+  }
+
+  if (isdigit(c) || '-' == c || '.' == c) {
+    const char* start = _cursor;
+    while (_cursor != _end && (isdigit((unsigned char)*_cursor) || '-' == *_cursor ||
+                               '.' == *_cursor || 'e' == *_cursor))
+      ++_cursor;
+    return ScalarToken(ParseNumber(start, _cursor));
+  }
+
+  return ScanMappedPunct();
+}
+
+void Tokenizer::SkipMappedWhiteSpace() {
+  for (;;) {
+    while (_cursor != _end && isspace((unsigned char)*_cursor))
+      ++_cursor;
+
+    if (_cursor == _end || '/' != *_cursor)
+      return;
+
+    // Look for comments; any error in one is reported at its start
+    _tokenStart = _cursor++;
+    if (_cursor != _end && '/' == *_cursor) {
+      // Throw out everything until the end of the line
+      while (_cursor != _end && '\n' != *_cursor)
+        ++_cursor;
+    } else if (_cursor != _end && '*' == *_cursor) {
+      for (++_cursor; ; ++_cursor) {
+        if (_end - _cursor < 2) {
+          std::ostringstream ost;
+          ost << "Unterminated comment in line ";
+          ost << CurLine();
+          throw SyntaxErrorException( ost.str(), *this );
+        }
+        if ('*' == _cursor[0] && '/' == _cursor[1]) {
+          _cursor += 2;
+          break;
+        }
+      }
+    } else {
+      std::ostringstream ost;
+      ost << "unexpected character: '" << (_cursor != _end ? *_cursor : '/') << "'";
+      throw SyntaxErrorException( ost.str(), *this );
+    }
+  }
+}
+
+Token Tokenizer::ScanMappedPunct() {
+  SYMBOL kind;
+
+  switch (*_cursor) {
+  case '(':  kind = LPAREN;     break;
+  case ')':  kind = RPAREN;     break;
+  case '{':  kind = LBRACE;     break;
+  case '}':  kind = RBRACE;     break;
+  case ',':  kind = COMMA;      break;
+  case '=':  kind = EQUALS;     break;
+  case ';':  kind = SEMICOLON;  break;
+
+  default:
+    std::ostringstream ost;
+    ost << "unexpected character: '" << *_cursor << "'";
+    throw SyntaxErrorException(ost.str(), *this);
+  }
+
+  ++_cursor;
+  return Token(kind);
+}
+
+//////////////////////////////////////////////////////////////////////////
+//
+// Source positions
+//
+//   The stream scanner keeps its place in the Buffer as it goes.  Fast
+// mode only remembers where the current token starts, and works out
+// the line and column from that when an error message asks for them.
+//
+
+const char* Tokenizer::TokenPosition() const {
+  // At the end of the file, point at the last line rather than past it.
+  if (_tokenStart == _end && _tokenStart != _begin)
+    return _tokenStart - 1;
+  return _tokenStart;
+}
+
+const char* Tokenizer::LineStart() const {
+  const char* start = TokenPosition();
+  while (start != _begin && '\n' != start[-1])
+    --start;
+  return start;
+}
+
+int Tokenizer::CurLine() const {
+  if (!_mapped)
+    return buffer.CurLine();
+
+  const char* position = TokenPosition();
+  if (position < _countedTo) {
+    _countedTo = _begin;
+    _countedLines = 1;
+  }
+  for (; _countedTo < position; ++_countedTo)
+    if ('\n' == *_countedTo)
+      ++_countedLines;
+  return _countedLines;
+}
+
+int Tokenizer::CurColumn() const {
+  if (!_mapped)
+    return TokenColumn;
+  return (int)(TokenPosition() - LineStart());
+}
+
+void Tokenizer::PrintLine( ostream& out ) const {
+  if (!_mapped) {
+    buffer.PrintLine(out);
+    return;
+  }
+
+  // Print each line only once, as Buffer::PrintLine does
+  int line = CurLine();
+  if (line > _lastPrintedLine) {
+    const char* start = LineStart();
+    const char* stop = start;
+    while (stop != _end && '\n' != *stop)
+      ++stop;
+    out << "# " << string(start, stop) << "\n" << std::endl;
+    _lastPrintedLine = line;
+  }
+}
@@ -5,6 +5,7 @@
 #include "Token.h"
 #include "../fileio/buffer.h"
 
+#include <stddef.h>
 #include <string>
 #include <memory>
 
@@ -33,25 +34,31 @@ class Tokenizer {
   public:
     Tokenizer(istream& fp, bool printTokens);
 
+    // Fast mode: scan a whole file that is already in memory (typically
+    // a MappedFile) with a plain pointer instead of going through a
+    // stream a line at a time.  The memory must outlive the tokenizer.
+    Tokenizer(const char* data, size_t size, bool printTokens);
+
     // destructively read & return the next token, skipping over whitespace
-    auto_ptr<Token> Get();
+    Token Get();
 
-    // non-destructively get the next token, pushing it back to be read again
+    // non-destructively get the next token, pushing it back to be read again.
+    // The pointer is good until the next Get/Peek/Read/CondRead call.
     const Token* Peek();
 
     // Get() the next token, and check that it's of the expected SYMBOL type
-    auto_ptr<Token> Read(SYMBOL expected);
+    Token Read(SYMBOL expected);
 
     // read the next token only if it matches the expected token type.
     // Return whether it matches.
     bool CondRead(SYMBOL expected);
 
     // display the current source line onto the screen.
-    void PrintLine( ostream& out) const { buffer.PrintLine(out); }
+    void PrintLine( ostream& out) const;
 
     // return the column number/line number of the current token.
-    int CurColumn() const { return TokenColumn; }
-    int CurLine() const { return buffer.CurLine(); }
+    int CurColumn() const;
+    int CurLine() const;
 
     // Repeatedly scan tokens and throw them away.  Useful if this is the
     // last phase to be executed
@@ -60,22 +67,26 @@ class Tokenizer {
 protected:
     // private methods:
 
-    // push the argument token back onto the scanner's token stream;
-    // it will be returned by the next Get/Peek/Read/CondRead call
-    Token* GetNext();
-    void UnGet(Token* t);
+    Token GetNext();
 
-    Token* SearchReserved(const string&) const; // Convert ident string into token
+    Token SearchReserved(const string&) const; // Convert ident string into token
 
     void GetCh() { CurrentCh = buffer.GetCh(); }
     bool CondReadCh(char expected);        // consume a character, if it matches
 
     void SkipWhiteSpace();        // skip spaces, tabs, newlines
 
-    Token* GetPunct();            // scan punctuation token
-    Token* GetScalar();           // scan integer token
-    Token* GetIdent();            // scan identifier token
-    Token* GetQuotedIdent();
+    Token GetPunct();             // scan punctuation token
+    Token GetScalar();            // scan integer token
+    Token GetIdent();             // scan identifier token
+    Token GetQuotedIdent();
+
+    // The same scanners for fast mode, working directly on the memory.
+    Token ScanMapped();
+    void SkipMappedWhiteSpace();
+    Token ScanMappedPunct();
+    const char* TokenPosition() const;  // where errors should point
+    const char* LineStart() const;      // start of the line holding it
 
 
     // private data:
@@ -83,13 +94,27 @@ protected:
     Buffer buffer;                // The file buffer
     char CurrentCh;               // The current character in the current line
 
-    Token* UnGetToken;            // The token that has been "ungot"
+    Token PeekToken;              // The token that has been "ungot"
+    bool HasPeekToken;
 
     int TokenColumn;              // The column where the last read token starts,
                                   // for generating error messages
 
     bool _printTokens;            // printing flag
+
+    // Fast mode only: the whole file, the next unread character, and
+    // where the last read token starts.  Line numbers are counted lazily
+    // (they are only needed for error messages), picking up from where
+    // the last count stopped.
+    bool _mapped;
+    const char* _begin;
+    const char* _end;
+    const char* _cursor;
+    const char* _tokenStart;
+    mutable const char* _countedTo;
+    mutable int _countedLines;
+    mutable int _lastPrintedLine;
+    string _text;                 // reused for identifiers, so it stays allocated
 };
 
 #endif
-
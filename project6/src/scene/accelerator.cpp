@@ -0,0 +1,95 @@
+#include <cassert>
+#include <cstring>
+#include <mutex>
+
+#include "accelerator.h"
+
+using namespace std;
+
+Accelerator::Kind Accelerator::activeKind = Accelerator::HIERARCHY;
+
+static mutex statsLock;
+static Accelerator::BuildStats totals[Accelerator::KINDS];
+
+void Accelerator::build( const std::vector<BoundingBox>& boxes, int groupSize,
+	const std::vector<Vec3r>* corners )
+{
+	clear();
+	kind = activeKind;
+	if( (kind == KD_TREE || kind == KD_ROPES) && !corners )
+		kind = HIERARCHY;
+
+	double start = RenderStats::wallTime();
+	long long references, bytes;
+	switch( kind ) {
+	case HIERARCHY:
+		bvh.build( boxes, groupSize );
+		references = boxes.size();
+		bytes = bvh.memory();
+		break;
+	case KD_TREE:
+	case KD_ROPES:
+		kdtree.build( boxes, corners, kind == KD_ROPES );
+		references = kdtree.referenceCount();
+		bytes = kdtree.memory();
+		break;
+	default:
+		grid.build( boxes, kind == TWO_LEVEL_GRID );
+		references = grid.referenceCount();
+		bytes = grid.memory();
+		break;
+	}
+	double seconds = RenderStats::wallTime() - start;
+
+	lock_guard<mutex> guard( statsLock );
+	BuildStats& t = totals[kind];
+	++t.built;
+	t.primitives += boxes.size();
+	t.references += references;
+	t.bytes += bytes;
+	t.seconds += seconds;
+}
+
+void Accelerator::refit( const std::vector<BoundingBox>& boxes )
+{
+	// Kd-trees are only built over a mesh's faces, which never move.
+	assert( kind != KD_TREE && kind != KD_ROPES );
+	if( kind == HIERARCHY )
+		bvh.refit( boxes );
+	else
+		grid.build( boxes, kind == TWO_LEVEL_GRID );
+}
+
+void Accelerator::setKind( Kind k )
+{
+	activeKind = k;
+}
+
+Accelerator::Kind Accelerator::currentKind()
+{
+	return activeKind;
+}
+
+const char* Accelerator::kindName( Kind k )
+{
+	switch( k ) {
+	case HIERARCHY:		return "bvh";
+	case GRID:		return "grid";
+	case TWO_LEVEL_GRID:	return "twolevel";
+	case KD_TREE:		return "kdtree";
+	case KD_ROPES:		return "ropes";
+	default:		return "?";
+	}
+}
+
+Accelerator::BuildStats Accelerator::buildStats( Kind k )
+{
+	lock_guard<mutex> guard( statsLock );
+	return totals[k];
+}
+
+void Accelerator::resetBuildStats()
+{
+	lock_guard<mutex> guard( statsLock );
+	memset( totals, 0, sizeof(totals) );
+}
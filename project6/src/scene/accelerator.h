@@ -0,0 +1,181 @@
+//
+// accelerator.h
+//
+// What the scene and its meshes walk to find the primitives a ray may
+// hit: a BVH, a grid or a kd-tree, chosen for everything at once with
+// setKind().  The walks are the BVH's (see bvh.h), and the others take
+// the same callbacks; packets go through them one ray at a time, and
+// only the hierarchy has leaves to hand out a run of primitives at once.
+//
+// A kd-tree may hand out a primitive more than once, which the scene's
+// shadow rays can't have (they take a transmissive object's colour once
+// per time it is found), so it is only built for triangles; asked for
+// one without them, build() makes a hierarchy instead.
+//
+
+#ifndef __ACCELERATOR_H__
+#define __ACCELERATOR_H__
+
+#include "bvh.h"
+#include "grid.h"
+#include "kdtree.h"
+
+class Accelerator {
+
+public:
+	enum Kind {
+		HIERARCHY,		// a BVH
+		GRID,			// a uniform grid
+		TWO_LEVEL_GRID,		// a grid with grids in its crowded cells
+		KD_TREE,		// a kd-tree, walked with a stack
+		KD_ROPES,		// a kd-tree, walked along its ropes
+		KINDS
+	};
+
+	Accelerator() : kind( HIERARCHY ) {}
+
+	// Build over the given boxes with the current kind; groupSize is
+	// passed on to BVH::build.  corners, if the primitives are triangles,
+	// holds their three corners one after another, for KdTree::build.
+	void build( const std::vector<BoundingBox>& boxes, int groupSize = 1,
+		const std::vector<Vec3r>* corners = 0 );
+
+	// Fit to new boxes for the same primitives: the hierarchy is refit,
+	// and a grid, which has nothing to refit, is built again.  Only for
+	// what the scene walks, never a kd-tree.
+	void refit( const std::vector<BoundingBox>& boxes );
+	void clear() { bvh.clear(); grid.clear(); kdtree.clear(); }
+
+	bool empty() const;
+	Kind builtKind() const { return kind; }
+
+	// The hierarchy, for callers that walk its leaves or keep it on
+	// disk; only built if builtKind() is HIERARCHY.
+	bool hasLeaves() const { return kind == HIERARCHY && !bvh.empty(); }
+	BVH& hierarchy() { return bvh; }
+	const BVH& hierarchy() const { return bvh; }
+
+	// As for the BVH.
+	template <class Hit>
+	bool intersect( const ray& r, Real& tmax, Hit& hit ) const;
+	template <class Blocked>
+	bool occluded( const ray& r, Real tmax, Blocked& blocked ) const;
+	template <class Hit>
+	void intersectPacket( const ray* rays, int mask, Real* tmax, Hit& hit ) const;
+	template <class Blocked>
+	int occludedPacket( const ray* rays, int mask, const Real* tmax, Blocked& blocked ) const;
+
+	// The kind built from now on, HIERARCHY to start with.
+	static void setKind( Kind k );
+	static Kind currentKind();
+	static const char* kindName( Kind k );
+
+	// Totals for each kind over what has been built since the last
+	// resetBuildStats(), so that the kinds can be weighed against each
+	// other for a scene: references counts a primitive once for every
+	// grid cell or kd-tree leaf it is in (and once in a hierarchy), and
+	// bytes is what the structures take.  Hierarchies read back from mesh
+	// files aren't counted.
+	struct BuildStats {
+		int built;
+		long long primitives;
+		long long references;
+		long long bytes;
+		double seconds;
+	};
+	static BuildStats buildStats( Kind k );
+	static void resetBuildStats();
+
+private:
+	// A packet callback made into a one ray callback for ray j, for the
+	// grids and kd-trees.  tmax is tmax[j] of the packet's.
+	template <class Hit>
+	struct RayHit {
+		Hit& hit;
+		int j;
+		Real* tmax;
+
+		RayHit( Hit& h, int jj, Real* t ) : hit( h ), j( jj ), tmax( t ) {}
+
+		bool operator()( int prim, Real& ) {
+			Real before = tmax[j];
+			hit( prim, 1 << j, tmax );
+			return tmax[j] < before;
+		}
+	};
+
+	template <class Blocked>
+	struct RayBlocked {
+		Blocked& blocked;
+		int j;
+		const Real* tmax;
+
+		RayBlocked( Blocked& b, int jj, const Real* t ) : blocked( b ), j( jj ), tmax( t ) {}
+
+		bool operator()( int prim, Real ) {
+			return blocked( prim, 1 << j, tmax ) != 0;
+		}
+	};
+
+	Kind kind;
+	BVH bvh;
+	Grid grid;
+	KdTree kdtree;
+
+	static Kind activeKind;
+};
+
+template <class Hit>
+bool Accelerator::intersect( const ray& r, Real& tmax, Hit& hit ) const
+{
+	if( kind == HIERARCHY ) return bvh.intersect( r, tmax, hit );
+	if( kind == KD_TREE || kind == KD_ROPES ) return kdtree.intersect( r, tmax, hit );
+	return grid.intersect( r, tmax, hit );
+}
+
+template <class Blocked>
+bool Accelerator::occluded( const ray& r, Real tmax, Blocked& blocked ) const
+{
+	if( kind == HIERARCHY ) return bvh.occluded( r, tmax, blocked );
+	if( kind == KD_TREE || kind == KD_ROPES ) return kdtree.occluded( r, tmax, blocked );
+	return grid.occluded( r, tmax, blocked );
+}
+
+template <class Hit>
+void Accelerator::intersectPacket( const ray* rays, int mask, Real* tmax, Hit& hit ) const
+{
+	if( kind == HIERARCHY ) {
+		bvh.intersectPacket( rays, mask, tmax, hit );
+		return;
+	}
+	for( ; mask; mask &= mask - 1 ) {
+		int j = BVH::lowestBit( mask );
+		RayHit<Hit> one( hit, j, tmax );
+		intersect( rays[j], tmax[j], one );
+	}
+}
+
+template <class Blocked>
+int Accelerator::occludedPacket( const ray* rays, int mask, const Real* tmax, Blocked& blocked ) const
+{
+	if( kind == HIERARCHY ) return bvh.occludedPacket( rays, mask, tmax, blocked );
+	int result = 0;
+	for( ; mask; mask &= mask - 1 ) {
+		int j = BVH::lowestBit( mask );
+		RayBlocked<Blocked> one( blocked, j, tmax );
+		if( occluded( rays[j], tmax[j], one ) ) result |= 1 << j;
+	}
+	return result;
+}
+
+inline bool Accelerator::empty() const
+{
+	switch( kind ) {
+	case HIERARCHY:	return bvh.empty();
+	case KD_TREE:
+	case KD_ROPES:	return kdtree.empty();
+	default:	return grid.empty();
+	}
+}
+
+#endif // __ACCELERATOR_H__
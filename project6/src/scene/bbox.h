@@ -1,39 +1,41 @@
 #pragma once
 
+#include "../RenderStats.h"
+
 class BoundingBox {
 	
 	bool bEmpty;
 	bool dirty;
-	Vec3d bmin;
-	Vec3d bmax;
-	double bArea;
-	double bVolume;
+	Vec3r bmin;
+	Vec3r bmax;
+	Real bArea;
+	Real bVolume;
 
 public:
 
 	BoundingBox() : bEmpty(true) {}
-	BoundingBox(Vec3d bMin, Vec3d bMax) : bmin(bMin), bmax(bMax), bEmpty(false), dirty(true) {}
+	BoundingBox(Vec3r bMin, Vec3r bMax) : bmin(bMin), bmax(bMax), bEmpty(false), dirty(true) {}
 
-	Vec3d getMin() const { return bmin; }
-	Vec3d getMax() const { return bmax; }
+	Vec3r getMin() const { return bmin; }
+	Vec3r getMax() const { return bmax; }
 	bool isEmpty() { return bEmpty; }
 
-	void setMin(Vec3d bMin) {
+	void setMin(Vec3r bMin) {
 		bmin = bMin;
 		dirty = true;
 		bEmpty = false;
 	}
-	void setMax(Vec3d bMax) {
+	void setMax(Vec3r bMax) {
 		bmax = bMax;
 		dirty = true;
 		bEmpty = false;
 	}
-	void setMin(int i, double val) {
+	void setMin(int i, Real val) {
 		if (i == 0) { bmin[0] = val; bEmpty = false; }
 		else if (i == 1) { bmin[1] = val; bEmpty = false; }
 			else if (i == 2) { bmin[2] = val; bEmpty = false; }
 	}
-	void setMax(int i, double val) {
+	void setMax(int i, Real val) {
 		if (i == 0) { bmax[0] = val; bEmpty = false; }
 		else if (i == 1) { bmax[1] = val; bEmpty = false; }
 			else if (i == 2) { bmax[2] = val; bEmpty = false; }
@@ -50,7 +52,7 @@ public:
 	}
 
 	// does the box contain this point?
-	bool intersects(const Vec3d& point) const {
+	bool intersects(const Vec3r& point) const {
 		return ((point[0] + RAY_EPSILON >= bmin[0]) && (point[1] + RAY_EPSILON >= bmin[1]) && (point[2] + RAY_EPSILON >= bmin[2]) &&
 			(point[0] - RAY_EPSILON <= bmax[0]) && (point[1] - RAY_EPSILON <= bmax[1]) && (point[2] - RAY_EPSILON <= bmax[2]));
 	}
@@ -59,22 +61,23 @@ public:
 	// closest to the origin in tMin and the "t" value of the far intersection
 	// in tMax and return true, else return false.
 	// Using Kay/Kajiya algorithm.
-	bool intersect(const ray& r, double& tMin, double& tMax) const {
-		Vec3d R0 = r.getPosition();
-		Vec3d Rd = r.getDirection();
-		tMin = -1.0e308; // 1.0e308 is close to infinity... close enough for us!
-		tMax = 1.0e308;
-		double ttemp;
+	bool intersect(const ray& r, Real& tMin, Real& tMax) const {
+		RENDER_STAT( countBoxTest() );
+		Vec3r R0 = r.getPosition();
+		Vec3r Rd = r.getDirection();
+		tMin = -RAY_INFINITY;
+		tMax = RAY_INFINITY;
+		Real ttemp;
 	
 		for (int currentaxis = 0; currentaxis < 3; currentaxis++) {
-			double vd = Rd[currentaxis];
+			Real vd = Rd[currentaxis];
 			// if the ray is parallel to the face's plane (=0.0)
 			if( vd == 0.0 ) continue;
-			double v1 = bmin[currentaxis] - R0[currentaxis];
-			double v2 = bmax[currentaxis] - R0[currentaxis];
+			Real v1 = bmin[currentaxis] - R0[currentaxis];
+			Real v2 = bmax[currentaxis] - R0[currentaxis];
 			// two slab intersections
-			double t1 = v1/vd;
-			double t2 = v2/vd;
+			Real t1 = v1/vd;
+			Real t2 = v2/vd;
 			if ( t1 > t2 ) { // swap t1 & t2
 				ttemp = t1;
 				t1 = t2;
@@ -97,7 +100,7 @@ public:
 		bEmpty = target.bEmpty;
 	}
 
-	double area() {
+	Real area() {
 		if (bEmpty) return 0.0;
 		else if (dirty) {
 			bArea = 2.0 * ((bmax[0] - bmin[0]) * (bmax[1] - bmin[1]) + (bmax[1] - bmin[1]) * (bmax[2] - bmin[2]) + (bmax[2] - bmin[2]) * (bmax[0] - bmin[0]));
@@ -106,7 +109,7 @@ public:
 		return bArea;
 	}
 
-	double volume() {
+	Real volume() {
 		if (bEmpty) return 0.0;
 		else if (dirty) {
 			bVolume = ((bmax[0] - bmin[0]) * (bmax[1] - bmin[1]) * (bmax[2] - bmin[2]));
@@ -0,0 +1,818 @@
+#include <cmath>
+#include <cstring>
+#include <climits>
+#include <algorithm>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#include "bvh.h"
+
+#ifdef BVH_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+// The AVX kernel is compiled for AVX on its own, so the rest of the
+// program still runs on CPUs without it.
+#if defined(BVH_X86) && defined(__GNUC__)
+#define TARGET_AVX __attribute__((target("avx")))
+#else
+#define TARGET_AVX
+#endif
+
+using namespace std;
+
+// Cost of stepping into a node relative to testing one primitive (or
+// one group of them).
+static const double TRAVERSAL_COST = 0.125;
+// Leaves never get bigger than this unless the primitives can't be told apart.
+static const int MAX_LEAF_SIZE = 4;
+// Past this depth stop trusting the heuristic and split by count, which
+// keeps the tree (and the traversal stack) logarithmic.
+static const int MAX_SAH_DEPTH = 64;
+
+// Bins per axis, for BINNED.
+static const int BINS = 16;
+// Subtrees smaller than this are never handed to another thread.
+static const int MIN_TASK_SIZE = 1024;
+
+static mutex statsLock;
+static BVH::BuildStats totals;
+
+static double surfaceArea( const Vec3r& bmin, const Vec3r& bmax )
+{
+	Vec3r d = bmax - bmin;
+	return 2.0 * (d[0] * d[1] + d[1] * d[2] + d[2] * d[0]);
+}
+
+struct CentroidLess {
+	int axis;
+	CentroidLess( int a ) : axis( a ) {}
+	template <class P>
+	bool operator()( const P& a, const P& b ) const {
+		return a.centroid[axis] < b.centroid[axis];
+	}
+};
+
+// Whether a centroid falls in a bin below the split, as binnedSplit
+// counted them.
+struct BinLess {
+	int axis, bin;
+	double lo, scale;
+	BinLess( int a, int b, double l, double s ) : axis( a ), bin( b ), lo( l ), scale( s ) {}
+	template <class P>
+	bool operator()( const P& p ) const {
+		return min( BINS - 1, (int)((p.centroid[axis] - lo) * scale) ) < bin;
+	}
+};
+
+// Ties go by index, so the order doesn't depend on the sort.
+struct MortonLess {
+	template <class P>
+	bool operator()( const P& a, const P& b ) const {
+		return a.code < b.code || (a.code == b.code && a.index < b.index);
+	}
+};
+
+// The low 10 bits of v, moved to every third bit.
+static unsigned int spreadBits( unsigned int v )
+{
+	v = (v * 0x00010001u) & 0xFF0000FFu;
+	v = (v * 0x00000101u) & 0x0F00F00Fu;
+	v = (v * 0x00000011u) & 0xC30C30C3u;
+	v = (v * 0x00000005u) & 0x49249249u;
+	return v;
+}
+
+// Hands subtrees out to a pool of threads.  A task builds its subtree,
+// passing any first half of at least grain primitives on as a task of its
+// own and carrying on with the second; the pool is done once no task is
+// queued or running.  Tasks work on disjoint ranges of build, so they
+// need no locking beyond the queue's.
+class BVH::BuildTasks {
+public:
+	BuildTasks( const BVH& b, vector<BuildPrim>& p, int g )
+		: grain( g ), bvh( b ), build( p ), running( 0 ) {}
+	~BuildTasks() { for( size_t k = 0; k < trees.size(); ++k ) delete trees[k]; }
+
+	// Work through the queue with this thread and threads - 1 others.
+	void run( int threads );
+	// Queue build[begin, end) up as a subtree, and return its number.
+	int spawn( int begin, int end, int depth );
+
+	int grain;
+	vector<Subtree*> trees;
+
+private:
+	void worker();
+
+	const BVH& bvh;
+	vector<BuildPrim>& build;
+	mutex lock;
+	condition_variable wake;
+	deque<int> queue;
+	int running;
+};
+
+void BVH::build( const vector<BoundingBox>& boxes, int group )
+{
+	double start = RenderStats::wallTime();
+	clear();
+	groupSize = max( group, 1 );
+	if( boxes.empty() ) return;
+
+	vector<BuildPrim> build( boxes.size() );
+	for( size_t k = 0; k < boxes.size(); ++k ) {
+		build[k].bmin = boxes[k].getMin();
+		build[k].bmax = boxes[k].getMax();
+		build[k].centroid = (build[k].bmin + build[k].bmax) * 0.5;
+		build[k].index = (int)k;
+		build[k].code = 0;
+	}
+	if( activeBuilder == MORTON )
+		sortMorton( build );
+
+	// No more threads than there are tasks' worth of primitives.
+	int n = (int)build.size();
+	int threads = buildThreads > 0 ? buildThreads : (int)thread::hardware_concurrency();
+	threads = max( 1, min( threads, n / MIN_TASK_SIZE ) );
+	BuildTasks tasks( *this, build, threads > 1 ? max( MIN_TASK_SIZE, n / (8 * threads) ) : INT_MAX );
+	tasks.spawn( 0, n, 0 );
+	tasks.run( threads );
+
+	nodes.reserve( 2 * boxes.size() );
+	prims.reserve( boxes.size() );
+	splice( tasks.trees, 0, 0 );
+
+	kernel = activeKernel;
+	if( kernel == AVX )
+		collapse( wide8 );
+	else
+		collapse( wide4 );
+
+	double seconds = RenderStats::wallTime() - start;
+	double cost = sahCost();
+	lock_guard<mutex> guard( statsLock );
+	++totals.built;
+	totals.primitives += n;
+	totals.nodes += (long long)nodes.size();
+	totals.seconds += seconds;
+	if( n > totals.largest ) {
+		totals.largest = n;
+		totals.largestCost = cost;
+	}
+}
+
+// Children are stored after their parents, so one pass from the back
+// sees every node's children before the node itself.
+void BVH::refit( const vector<BoundingBox>& boxes )
+{
+	if( nodes.empty() ) return;
+
+	for( int me = (int)nodes.size() - 1; me >= 0; --me ) {
+		Node& n = nodes[me];
+		Vec3r bmin, bmax;
+		if( n.count > 0 ) {
+			bmin = boxes[prims[n.offset]].getMin();
+			bmax = boxes[prims[n.offset]].getMax();
+			for( int k = 1; k < n.count; ++k ) {
+				bmin = minimum( bmin, boxes[prims[n.offset + k]].getMin() );
+				bmax = maximum( bmax, boxes[prims[n.offset + k]].getMax() );
+			}
+		} else {
+			bmin = minimum( nodes[me + 1].bmin, nodes[n.offset].bmin );
+			bmax = maximum( nodes[me + 1].bmax, nodes[n.offset].bmax );
+		}
+
+		// The same padding as buildRecursive; for interior nodes it comes
+		// on top of their children's, which only errs on the safe side.
+		Vec3r pad = (bmax - bmin) * 1.0e-9 + Vec3r( RAY_EPSILON, RAY_EPSILON, RAY_EPSILON );
+		n.bmin = bmin - pad;
+		n.bmax = bmax + pad;
+	}
+
+	if( kernel == AVX )
+		collapse( wide8 );
+	else
+		collapse( wide4 );
+}
+
+void BVH::linearize( vector<int>& order )
+{
+	order = prims;
+	for( size_t k = 0; k < prims.size(); ++k )
+		prims[k] = (int)k;
+}
+
+// Every node is paid for by the rays that reach it, which by the
+// heuristic is in proportion to its surface area.
+double BVH::sahCost() const
+{
+	if( nodes.empty() ) return 0.0;
+
+	double cost = 0.0;
+	for( size_t k = 0; k < nodes.size(); ++k ) {
+		const Node& n = nodes[k];
+		cost += surfaceArea( n.bmin, n.bmax ) * (n.count > 0 ? groups( n.count ) : TRAVERSAL_COST);
+	}
+	double root = surfaceArea( nodes[0].bmin, nodes[0].bmax );
+	return root > 0.0 ? cost / root : 0.0;
+}
+
+// The kernel and group size, then the wide nodes as they sit in memory.
+// The reader is on the same machine (see MeshCache), so no byte swapping.
+void BVH::write( string& out ) const
+{
+	int header[3] = { (int)kernel, groupSize, 0 };
+	if( kernel == AVX ) {
+		header[2] = (int)wide8.size();
+		out.append( (const char*)header, sizeof(header) );
+		out.append( (const char*)&wide8[0], wide8.size() * sizeof(WideNode<8>) );
+	} else {
+		header[2] = (int)wide4.size();
+		out.append( (const char*)header, sizeof(header) );
+		out.append( (const char*)&wide4[0], wide4.size() * sizeof(WideNode<4>) );
+	}
+}
+
+bool BVH::read( const char* data, size_t size, int numPrims, int group )
+{
+	clear();
+	int header[3];
+	if( size < sizeof(header) ) return false;
+	memcpy( header, data, sizeof(header) );
+	if( header[0] != (int)activeKernel || header[1] != max( group, 1 ) ) return false;
+	kernel = activeKernel;
+	groupSize = header[1];
+
+	data += sizeof(header);
+	size -= sizeof(header);
+	bool ok = kernel == AVX ? readWide( wide8, data, size, numPrims )
+	                        : readWide( wide4, data, size, numPrims );
+	if( header[2] != (int)(kernel == AVX ? wide8.size() : wide4.size()) ) ok = false;
+	if( !ok ) {
+		clear();
+		return false;
+	}
+
+	// Leaves were laid out in order by linearize().
+	prims.resize( numPrims );
+	for( int k = 0; k < numPrims; ++k ) prims[k] = k;
+
+	lock_guard<mutex> guard( statsLock );
+	++totals.read;
+	return true;
+}
+
+// Every child has to come after its parent, so that a bad file can't send
+// traversal round in circles, and every leaf has to stay within the
+// primitives.
+template <int W>
+bool BVH::readWide( vector< WideNode<W> >& wide, const char* data, size_t size, int numPrims )
+{
+	if( size == 0 || size % sizeof(WideNode<W>) != 0 ) return false;
+	wide.resize( size / sizeof(WideNode<W>) );
+	memcpy( &wide[0], data, size );
+
+	int n = (int)wide.size();
+	for( int me = 0; me < n; ++me ) {
+		const WideNode<W>& w = wide[me];
+		if( w.valid <= 0 || w.valid >= (1 << W) || (w.valid & (w.valid + 1)) ) return false;
+		for( int k = 0; k < W; ++k ) {
+			if( !(w.valid & (1 << k)) ) continue;
+			if( w.count[k] > 0 ) {
+				if( w.child[k] < 0 || w.count[k] > numPrims - w.child[k] ) return false;
+			} else if( w.count[k] < 0 || w.child[k] <= me || w.child[k] >= n ) {
+				return false;
+			}
+		}
+	}
+	return true;
+}
+
+void BVH::BuildTasks::run( int threads )
+{
+	vector<thread> pool;
+	for( int t = 1; t < threads; ++t )
+		pool.push_back( thread( &BuildTasks::worker, this ) );
+	worker();
+	for( size_t t = 0; t < pool.size(); ++t )
+		pool[t].join();
+}
+
+int BVH::BuildTasks::spawn( int begin, int end, int depth )
+{
+	Subtree* s = new Subtree;
+	s->begin = begin;
+	s->end = end;
+	s->depth = depth;
+
+	lock_guard<mutex> guard( lock );
+	trees.push_back( s );
+	queue.push_back( (int)trees.size() - 1 );
+	wake.notify_one();
+	return (int)trees.size() - 1;
+}
+
+void BVH::BuildTasks::worker()
+{
+	unique_lock<mutex> guard( lock );
+	for( ;; ) {
+		while( queue.empty() && running > 0 )
+			wake.wait( guard );
+		if( queue.empty() ) break;
+
+		Subtree* s = trees[queue.front()];
+		queue.pop_front();
+		++running;
+		guard.unlock();
+		bvh.buildRecursive( build, s->begin, s->end, s->depth, *s, this );
+		guard.lock();
+		--running;
+	}
+	// Whoever leaves first found nothing left to do; the others may be
+	// waiting to find that out.
+	wake.notify_all();
+}
+
+int BVH::buildRecursive( vector<BuildPrim>& build, int begin, int end, int depth,
+	Subtree& out, BuildTasks* tasks ) const
+{
+	int me = (int)out.nodes.size();
+	out.nodes.push_back( Node() );
+
+	Vec3r bmin = build[begin].bmin;
+	Vec3r bmax = build[begin].bmax;
+	Vec3r cmin = build[begin].centroid;
+	Vec3r cmax = build[begin].centroid;
+	for( int k = begin + 1; k < end; ++k ) {
+		bmin = minimum( bmin, build[k].bmin );
+		bmax = maximum( bmax, build[k].bmax );
+		cmin = minimum( cmin, build[k].centroid );
+		cmax = maximum( cmax, build[k].centroid );
+	}
+
+	// Pad the node a hair so that rounding in the slab test can never cull
+	// something the primitive's own test would have hit.
+	Vec3r pad = (bmax - bmin) * 1.0e-9 + Vec3r( RAY_EPSILON, RAY_EPSILON, RAY_EPSILON );
+	out.nodes[me].bmin = bmin - pad;
+	out.nodes[me].bmax = bmax + pad;
+
+	int axis, mid;
+	if( !split( build, begin, end, depth, bmin, bmax, cmin, cmax, axis, mid ) ) {
+		out.nodes[me].offset = (int)out.prims.size();
+		out.nodes[me].count = end - begin;
+		out.nodes[me].axis = 0;
+		for( int k = begin; k < end; ++k ) out.prims.push_back( build[k].index );
+		return me;
+	}
+
+	out.nodes[me].count = 0;
+	out.nodes[me].axis = axis;
+	if( tasks && mid >= tasks->grain ) {
+		Node stub;
+		stub.offset = tasks->spawn( begin, begin + mid, depth + 1 );
+		stub.count = -1;
+		stub.axis = 0;
+		out.nodes.push_back( stub );
+	} else {
+		buildRecursive( build, begin, begin + mid, depth + 1, out, tasks );
+	}
+	int second = buildRecursive( build, begin + mid, end, depth + 1, out, tasks );
+	out.nodes[me].offset = second;
+	return me;
+}
+
+// Copy a node of one of the subtrees, and everything under it, onto the
+// end of the tree, following stubs into the subtrees they stand for.
+// Returns where the node went.
+int BVH::splice( const vector<Subtree*>& trees, int tree, int node )
+{
+	const Subtree& s = *trees[tree];
+	const Node& n = s.nodes[node];
+	if( n.count < 0 ) return splice( trees, n.offset, 0 );
+
+	int me = (int)nodes.size();
+	nodes.push_back( n );
+	if( n.count > 0 ) {
+		nodes[me].offset = (int)prims.size();
+		prims.insert( prims.end(), s.prims.begin() + n.offset, s.prims.begin() + n.offset + n.count );
+	} else {
+		splice( trees, tree, node + 1 );
+		int second = splice( trees, tree, n.offset );
+		nodes[me].offset = second;
+	}
+	return me;
+}
+
+bool BVH::split( vector<BuildPrim>& build, int begin, int end, int depth,
+	const Vec3r& bmin, const Vec3r& bmax, const Vec3r& cmin, const Vec3r& cmax,
+	int& axis, int& mid ) const
+{
+	int n = end - begin;
+	if( n <= 1 ) return false;
+	if( activeBuilder == MORTON )
+		return mortonSplit( build, begin, end, axis, mid );
+
+	if( depth < MAX_SAH_DEPTH ) {
+		bool found = activeBuilder == BINNED
+			? binnedSplit( build, begin, end, bmin, bmax, cmin, cmax, axis, mid )
+			: sweepSplit( build, begin, end, bmin, bmax, cmin, cmax, axis, mid );
+		// The heuristic may rather keep everything, but if the leaf would
+		// be too big, fall back to a median split.
+		if( found || n <= max( MAX_LEAF_SIZE, groupSize ) ) return found;
+	}
+
+	Vec3r extent = cmax - cmin;
+	axis = 0;
+	if( extent[1] > extent[axis] ) axis = 1;
+	if( extent[2] > extent[axis] ) axis = 2;
+	mid = n / 2;
+	nth_element( build.begin() + begin, build.begin() + begin + mid,
+		build.begin() + end, CentroidLess( axis ) );
+	return true;
+}
+
+// Full sweep over every candidate split along every axis.
+bool BVH::sweepSplit( vector<BuildPrim>& build, int begin, int end,
+	const Vec3r& bmin, const Vec3r& bmax, const Vec3r& cmin, const Vec3r& cmax,
+	int& bestAxis, int& bestSplit ) const
+{
+	int n = end - begin;
+	Vec3r extent = cmax - cmin;
+	double parentArea = surfaceArea( bmin, bmax );
+	double bestCost = groups( n );	// cost of making this a leaf
+	bestAxis = -1;
+	vector<double> rightArea( n );
+	for( int axis = 0; axis < 3; ++axis ) {
+		if( extent[axis] <= 0.0 ) continue;
+		sort( build.begin() + begin, build.begin() + end, CentroidLess( axis ) );
+
+		Vec3r rmin = build[end - 1].bmin;
+		Vec3r rmax = build[end - 1].bmax;
+		for( int k = n - 1; k > 0; --k ) {
+			rmin = minimum( rmin, build[begin + k].bmin );
+			rmax = maximum( rmax, build[begin + k].bmax );
+			rightArea[k] = surfaceArea( rmin, rmax );
+		}
+
+		Vec3r lmin = build[begin].bmin;
+		Vec3r lmax = build[begin].bmax;
+		for( int k = 1; k < n; ++k ) {
+			double cost = TRAVERSAL_COST +
+				(surfaceArea( lmin, lmax ) * groups( k ) + rightArea[k] * groups( n - k )) / parentArea;
+			if( cost < bestCost ) {
+				bestCost = cost;
+				bestAxis = axis;
+				bestSplit = k;
+			}
+			lmin = minimum( lmin, build[begin + k].bmin );
+			lmax = maximum( lmax, build[begin + k].bmax );
+		}
+	}
+	if( bestAxis < 0 ) return false;
+
+	// The last axis swept is not necessarily the one we want.
+	nth_element( build.begin() + begin, build.begin() + begin + bestSplit,
+		build.begin() + end, CentroidLess( bestAxis ) );
+	return true;
+}
+
+// The same, with the centroids dropped into BINS bins along each axis and
+// only the boundaries between bins tried: one pass over the primitives
+// per axis, and no sorting.
+bool BVH::binnedSplit( vector<BuildPrim>& build, int begin, int end,
+	const Vec3r& bmin, const Vec3r& bmax, const Vec3r& cmin, const Vec3r& cmax,
+	int& bestAxis, int& mid ) const
+{
+	int n = end - begin;
+	Vec3r extent = cmax - cmin;
+	double parentArea = surfaceArea( bmin, bmax );
+	double bestCost = groups( n );	// cost of making this a leaf
+	double scale[3];
+	int bestBin = -1;
+	bestAxis = -1;
+	for( int axis = 0; axis < 3; ++axis ) {
+		if( extent[axis] <= 0.0 ) continue;
+		scale[axis] = BINS * (1.0 - 1.0e-9) / extent[axis];
+
+		int count[BINS];
+		Vec3r lo[BINS], hi[BINS];
+		for( int b = 0; b < BINS; ++b ) count[b] = 0;
+		for( int k = begin; k < end; ++k ) {
+			const BuildPrim& p = build[k];
+			int b = min( BINS - 1, (int)((p.centroid[axis] - cmin[axis]) * scale[axis]) );
+			if( count[b]++ == 0 ) {
+				lo[b] = p.bmin;
+				hi[b] = p.bmax;
+			} else {
+				lo[b] = minimum( lo[b], p.bmin );
+				hi[b] = maximum( hi[b], p.bmax );
+			}
+		}
+
+		// rightArea[b] and rightCount[b] are of bins b and up.
+		double rightArea[BINS];
+		int rightCount[BINS];
+		Vec3r rmin, rmax;
+		int right = 0;
+		for( int b = BINS - 1; b > 0; --b ) {
+			if( count[b] > 0 ) {
+				rmin = right > 0 ? minimum( rmin, lo[b] ) : lo[b];
+				rmax = right > 0 ? maximum( rmax, hi[b] ) : hi[b];
+				right += count[b];
+			}
+			rightArea[b] = right > 0 ? surfaceArea( rmin, rmax ) : 0.0;
+			rightCount[b] = right;
+		}
+
+		Vec3r lmin, lmax;
+		int left = 0;
+		for( int b = 1; b < BINS; ++b ) {
+			if( count[b - 1] > 0 ) {
+				lmin = left > 0 ? minimum( lmin, lo[b - 1] ) : lo[b - 1];
+				lmax = left > 0 ? maximum( lmax, hi[b - 1] ) : hi[b - 1];
+				left += count[b - 1];
+			}
+			if( left == 0 || rightCount[b] == 0 ) continue;
+			double cost = TRAVERSAL_COST +
+				(surfaceArea( lmin, lmax ) * groups( left ) + rightArea[b] * groups( rightCount[b] )) / parentArea;
+			if( cost < bestCost ) {
+				bestCost = cost;
+				bestAxis = axis;
+				bestBin = b;
+			}
+		}
+	}
+	if( bestAxis < 0 ) return false;
+
+	BuildPrim* split = partition( &build[0] + begin, &build[0] + end, BinLess( bestAxis, bestBin,
+		cmin[bestAxis], scale[bestAxis] ) );
+	mid = (int)(split - &build[begin]);
+	return true;
+}
+
+// The primitives are in Morton order (see sortMorton), so the codes of a
+// range agree down to some bit, and those with that bit clear all come
+// first.  The bit halves a cell of the centroid bounds along one axis,
+// so splitting there is splitting space down the middle.
+bool BVH::mortonSplit( vector<BuildPrim>& build, int begin, int end,
+	int& axis, int& mid ) const
+{
+	int n = end - begin;
+	if( groups( n ) <= 1 ) return false;
+
+	unsigned int first = build[begin].code;
+	unsigned int last = build[end - 1].code;
+	if( first == last ) {
+		// Nothing left to tell them apart by.
+		if( n <= max( MAX_LEAF_SIZE, groupSize ) ) return false;
+		axis = 0;
+		mid = n / 2;
+		return true;
+	}
+
+	int bit = 31;
+	while( !(((first ^ last) >> bit) & 1) ) --bit;
+	axis = 2 - bit % 3;
+	int lo = begin, hi = end - 1;		// the first with the bit set is in (lo, hi]
+	while( hi - lo > 1 ) {
+		int k = (lo + hi) / 2;
+		if( (build[k].code >> bit) & 1 ) hi = k;
+		else lo = k;
+	}
+	mid = hi - begin;
+	return true;
+}
+
+// Give every primitive the Morton code of its centroid, 10 bits an axis
+// across the centroid bounds of the set, and sort them by it.
+void BVH::sortMorton( vector<BuildPrim>& build )
+{
+	Vec3r cmin = build[0].centroid;
+	Vec3r cmax = build[0].centroid;
+	for( size_t k = 1; k < build.size(); ++k ) {
+		cmin = minimum( cmin, build[k].centroid );
+		cmax = maximum( cmax, build[k].centroid );
+	}
+
+	Vec3r extent = cmax - cmin;
+	double scale[3];
+	for( int axis = 0; axis < 3; ++axis )
+		scale[axis] = extent[axis] > 0.0 ? 1024.0 * (1.0 - 1.0e-9) / extent[axis] : 0.0;
+	for( size_t k = 0; k < build.size(); ++k ) {
+		unsigned int code = 0;
+		for( int axis = 0; axis < 3; ++axis ) {
+			int q = (int)((build[k].centroid[axis] - cmin[axis]) * scale[axis]);
+			code |= spreadBits( (unsigned int)min( max( q, 0 ), 1023 ) ) << (2 - axis);
+		}
+		build[k].code = code;
+	}
+	sort( build.begin(), build.end(), MortonLess() );
+}
+
+// Each wide node takes the place of a binary node and the W nearest of
+// its descendants: starting from its two children, the one with the
+// biggest surface area is opened up until W are found or only leaves are
+// left.  The float boxes are rounded outward, and grown by a margin that
+// covers the rounding of the ray's origin as well, so that a ray that
+// hits a node's binary box always hits its float one too.
+template <int W>
+void BVH::collapse( vector< WideNode<W> >& wide ) const
+{
+	const Node& root = nodes[0];
+	Real scale = 0.0;
+	for( int axis = 0; axis < 3; ++axis )
+		scale = max( scale, max( fabs( root.bmin[axis] ), fabs( root.bmax[axis] ) ) );
+
+	wide.clear();
+	wide.reserve( nodes.size() / 2 + 1 );
+	collapseNode( wide, 0, scale * 1.0e-6 );
+}
+
+// A leaf at the root gets a wide node of its own, with one child.
+template <int W>
+int BVH::collapseNode( vector< WideNode<W> >& wide, int node, Real margin ) const
+{
+	int children[W];
+	int n = 0;
+	if( nodes[node].count > 0 ) {
+		children[n++] = node;
+	} else {
+		children[n++] = node + 1;
+		children[n++] = nodes[node].offset;
+	}
+
+	while( n < W ) {
+		int open = -1;
+		double openArea = -1.0;
+		for( int k = 0; k < n; ++k ) {
+			const Node& c = nodes[children[k]];
+			if( c.count > 0 ) continue;
+			double area = surfaceArea( c.bmin, c.bmax );
+			if( area > openArea ) {
+				open = k;
+				openArea = area;
+			}
+		}
+		if( open < 0 ) break;
+		int c = children[open];
+		children[open] = c + 1;
+		children[n++] = nodes[c].offset;
+	}
+
+	int me = (int)wide.size();
+	wide.push_back( WideNode<W>() );
+	WideNode<W> w;
+	w.valid = (1 << n) - 1;
+	for( int k = 0; k < W; ++k ) {
+		if( k < n ) {
+			const Node& c = nodes[children[k]];
+			for( int axis = 0; axis < 3; ++axis ) {
+				w.bmin[axis][k] = nextafterf( (float)(c.bmin[axis] - margin), -FLT_MAX );
+				w.bmax[axis][k] = nextafterf( (float)(c.bmax[axis] + margin), FLT_MAX );
+			}
+			w.count[k] = c.count;
+			w.child[k] = c.count > 0 ? c.offset : collapseNode( wide, children[k], margin );
+		} else {
+			for( int axis = 0; axis < 3; ++axis )
+				w.bmin[axis][k] = w.bmax[axis][k] = 0.0f;
+			w.count[k] = 0;
+			w.child[k] = 0;
+		}
+	}
+	wide[me] = w;
+	return me;
+}
+
+#ifdef BVH_X86
+TARGET_AVX int BVH::hits8AVX( const WideNode<8>& n, const WideRay& r, float tmax, float* tnear )
+{
+	__m256 tNear = _mm256_setzero_ps();
+	__m256 tFar = _mm256_set1_ps( tmax );
+	for( int axis = 0; axis < 3; ++axis ) {
+		__m256 org = _mm256_set1_ps( r.org[axis] );
+		__m256 inv = _mm256_set1_ps( r.inv[axis] );
+		__m256 t1 = _mm256_mul_ps( _mm256_sub_ps( _mm256_loadu_ps( n.bmin[axis] ), org ), inv );
+		__m256 t2 = _mm256_mul_ps( _mm256_sub_ps( _mm256_loadu_ps( n.bmax[axis] ), org ), inv );
+		tNear = _mm256_max_ps( tNear, _mm256_min_ps( t1, t2 ) );
+		tFar = _mm256_min_ps( tFar, _mm256_max_ps( t1, t2 ) );
+	}
+	_mm256_storeu_ps( tnear, tNear );
+	return _mm256_movemask_ps( _mm256_cmp_ps( tNear, tFar, _CMP_LE_OQ ) ) & n.valid;
+}
+#else
+// Never selected; see supported().
+int BVH::hits8AVX( const WideNode<8>& n, const WideRay& r, float tmax, float* tnear )
+{
+	return 0;
+}
+#endif
+
+static bool cpuHasAVX()
+{
+#if defined(BVH_X86) && defined(__GNUC__)
+	__builtin_cpu_init();
+	return __builtin_cpu_supports( "avx" ) != 0;
+#elif defined(BVH_X86) && defined(_MSC_VER)
+	// AVX, and the OS saving the YMM registers across context switches.
+	int info[4];
+	__cpuid( info, 1 );
+	if( !(info[2] & (1 << 27)) || !(info[2] & (1 << 28)) ) return false;
+	return (_xgetbv( 0 ) & 6) == 6;
+#else
+	return false;
+#endif
+}
+
+bool BVH::supported( Kernel k )
+{
+	switch( k ) {
+	case SCALAR: return true;
+#ifdef BVH_SSE
+	case SSE: return true;
+#endif
+	case AVX: return cpuHasAVX();
+	default: return false;
+	}
+}
+
+BVH::Kernel BVH::bestKernel()
+{
+	static const Kernel best = supported( AVX ) ? AVX : supported( SSE ) ? SSE : SCALAR;
+	return best;
+}
+
+BVH::Kernel BVH::activeKernel = BVH::bestKernel();
+
+void BVH::setKernel( Kernel k )
+{
+	while( k > SCALAR && !supported( k ) )
+		k = (Kernel)(k - 1);
+	activeKernel = k;
+}
+
+BVH::Kernel BVH::currentKernel()
+{
+	return activeKernel;
+}
+
+const char* BVH::kernelName( Kernel k )
+{
+	switch( k ) {
+	case SCALAR: return "scalar";
+	case SSE:    return "sse";
+	case AVX:    return "avx";
+	default:     return "unknown";
+	}
+}
+
+BVH::Builder BVH::activeBuilder = BVH::SWEEP;
+int BVH::buildThreads = 1;
+
+void BVH::setBuilder( Builder b )
+{
+	activeBuilder = b;
+}
+
+BVH::Builder BVH::currentBuilder()
+{
+	return activeBuilder;
+}
+
+const char* BVH::builderName( Builder b )
+{
+	switch( b ) {
+	case SWEEP:  return "sweep";
+	case BINNED: return "binned";
+	case MORTON: return "morton";
+	default:     return "unknown";
+	}
+}
+
+void BVH::setBuildThreads( int n )
+{
+	buildThreads = n;
+}
+
+size_t BVH::memory() const
+{
+	return nodes.size() * sizeof(Node) + prims.size() * sizeof(int) +
+		wide4.size() * sizeof(WideNode<4>) + wide8.size() * sizeof(WideNode<8>);
+}
+
+BVH::BuildStats BVH::buildStats()
+{
+	lock_guard<mutex> guard( statsLock );
+	return totals;
+}
+
+void BVH::resetBuildStats()
+{
+	lock_guard<mutex> guard( statsLock );
+	memset( &totals, 0, sizeof(totals) );
+}
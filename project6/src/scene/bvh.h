@@ -0,0 +1,767 @@
+//
+// bvh.h
+//
+// A bounding volume hierarchy over an indexed set of primitives.  The
+// hierarchy only knows about boxes and indices; what a "primitive" is
+// (a scene object, a triangle of a mesh, ...) is up to the caller, who
+// supplies the actual intersection test at traversal time.
+//
+// The hierarchy is built as a binary tree and then collapsed into a wide
+// one, each node holding the boxes of up to 4 or 8 children side by side
+// as floats, so that a ray can be tested against all of them at once with
+// SSE or AVX.  Which kernel to use is decided at run time from what the
+// CPU supports; there is a plain C++ version for everything else.
+//
+
+#ifndef __BVH_H__
+#define __BVH_H__
+
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <float.h>
+#include <math.h>
+
+// BVH_X86: the AVX kernel can be compiled, and used if the CPU has AVX.
+// BVH_SSE: the compiler targets SSE2, so every CPU we run on has it.
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define BVH_X86
+#endif
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define BVH_SSE
+#include <emmintrin.h>
+#endif
+
+#include "ray.h"
+#include "bbox.h"
+
+#include "../RenderStats.h"
+
+#include "../vecmath/vec.h"
+
+class BVH {
+
+public:
+	// Nodes are stored depth-first in a flat array: the first child of an
+	// interior node immediately follows it, the second child lives at
+	// 'offset'.  For leaves, 'offset' indexes into the primitive list.
+	struct Node {
+		Vec3r bmin;
+		Vec3r bmax;
+		int offset;
+		int count;		// number of primitives; 0 for interior nodes
+		int axis;		// split axis
+	};
+
+	// The ray/box test used for traversal, and so the width of the nodes.
+	enum Kernel {
+		SCALAR,		// 4-wide nodes, plain C++
+		SSE,		// 4-wide nodes, SSE
+		AVX,		// 8-wide nodes, AVX
+		KERNELS
+	};
+
+	BVH() : kernel( SCALAR ), groupSize( 1 ) {}
+
+	// Build the hierarchy over the given boxes, with the current builder
+	// (see setBuilder).  The primitive index handed back during traversal
+	// is the position of its box in this vector.  A caller that tests
+	// groupSize primitives at once (see intersectLeaves) gets leaves
+	// costed by the group and allowed to grow to a full group.
+	void build( const std::vector<BoundingBox>& boxes, int groupSize = 1 );
+
+	// Fit an already built hierarchy to new boxes for the same primitives,
+	// as when they have moved: each leaf keeps the primitives it had, and
+	// only the node boxes change.  Far cheaper than building again, but the
+	// tree gets worse the further things move from where it was built.
+	void refit( const std::vector<BoundingBox>& boxes );
+	void clear() { nodes.clear(); prims.clear(); wide4.clear(); wide8.clear(); }
+
+	// Renumber the primitives in the order the leaves hold them, so that a
+	// leaf's primitives are simply offset .. offset+count-1.  order[j] is
+	// the old index of what is now primitive j; callers that keep their
+	// primitives in arrays permute them to match, and then each leaf's
+	// primitives sit side by side in memory.
+	void linearize( std::vector<int>& order );
+
+	bool empty() const { return wide4.empty() && wide8.empty(); }
+	int nodeCount() const { return (int)nodes.size(); }
+
+	// The bytes the binary tree (while it is kept) and the wide nodes take.
+	size_t memory() const;
+
+	// What a ray costs on the way through the binary tree by the surface
+	// area heuristic, counting a test of one primitive (or group) as 1:
+	// a measure of how good the tree is, lower being better.  0 for a
+	// hierarchy that has been read back, which has no binary tree.
+	double sahCost() const;
+
+	// The part of a linearized hierarchy that traversal uses, as bytes,
+	// for keeping it on disk (see MeshCache).  read() takes back what
+	// write() gave for numPrims primitives, and returns false, leaving the
+	// hierarchy empty, if it was written for another kernel or group size
+	// or doesn't hold together.  The binary tree isn't kept, so a
+	// hierarchy that has been read back can't be refit.
+	void write( std::string& out ) const;
+	bool read( const char* data, size_t size, int numPrims, int groupSize );
+
+	// Walk the hierarchy front-to-back, calling hit( prim, tmax ) for every
+	// primitive whose leaf the ray reaches before tmax.  The callback returns
+	// true if it found a hit, and is responsible for shrinking tmax to the
+	// new closest distance so that farther subtrees get culled.
+	template <class Hit>
+	bool intersect( const ray& r, Real& tmax, Hit& hit ) const;
+
+	// Any-hit version for shadow rays: tmax stays put, and the walk stops
+	// as soon as blocked( prim, tmax ) returns true.
+	template <class Blocked>
+	bool occluded( const ray& r, Real tmax, Blocked& blocked ) const;
+
+	// The same walks, calling hit( first, count, tmax ) and
+	// blocked( first, count, tmax ) once per leaf with the leaf's
+	// primitives first .. first+count-1, so the caller can test them
+	// together.  Only for hierarchies that have been linearized.
+	template <class Hit>
+	bool intersectLeaves( const ray& r, Real& tmax, Hit& hit ) const;
+	template <class Blocked>
+	bool occludedLeaves( const ray& r, Real tmax, Blocked& blocked ) const;
+
+	// Packet walks, for up to PACKET_SIZE rays that head roughly the same
+	// way.  Ray k takes part if bit k of mask is set, and has its own
+	// tmax[k].  The callbacks are handed a primitive and the mask of rays
+	// that reached its leaf: hit( prim, mask, tmax ) shrinks tmax[k] for
+	// every ray it finds a closer hit for, blocked( prim, mask, tmax )
+	// returns the mask of rays the primitive blocks.  occludedPacket
+	// returns the mask of rays blocked by anything.
+	enum { PACKET_SIZE = 16 };
+
+	template <class Hit>
+	void intersectPacket( const ray* rays, int mask, Real* tmax, Hit& hit ) const;
+	template <class Blocked>
+	int occludedPacket( const ray* rays, int mask, const Real* tmax, Blocked& blocked ) const;
+
+	// For walking ray masks: how many rays, and the index of the first.
+	static int bitCount( int mask );
+	static int lowestBit( int mask );
+
+	// The kernel hierarchies built from now on use.  It starts out as the
+	// best one the CPU supports; asking for one it doesn't support gets
+	// the best one it does.
+	static void setKernel( Kernel k );
+	static Kernel currentKernel();
+	static Kernel bestKernel();
+	static const char* kernelName( Kernel k );
+
+	// How build() decides where to split: by the surface area heuristic
+	// over every possible split (the best trees), by it over 16 bins per
+	// axis (nearly as good, and far quicker), or at the top bit where the
+	// primitives' Morton codes differ, as an LBVH does (quicker still, and
+	// the worst trees).
+	enum Builder {
+		SWEEP,
+		BINNED,
+		MORTON,
+		BUILDERS
+	};
+
+	// The builder hierarchies built from now on use, SWEEP to start with.
+	static void setBuilder( Builder b );
+	static Builder currentBuilder();
+	static const char* builderName( Builder b );
+
+	// Threads build() hands subtrees out to, 1 to start with; 0 means one
+	// per core.  The tree comes out the same however many there are.
+	static void setBuildThreads( int n );
+
+	// Totals over the hierarchies built (or read back) since the last
+	// resetBuildStats().
+	struct BuildStats {
+		int built;
+		int read;
+		long long primitives;	// in the hierarchies built
+		long long nodes;	// binary nodes
+		double seconds;		// building them
+		int largest;		// primitives in the biggest one built
+		double largestCost;	// and its sahCost()
+	};
+	static BuildStats buildStats();
+	static void resetBuildStats();
+
+private:
+	struct BuildPrim {
+		Vec3r bmin;
+		Vec3r bmax;
+		Vec3r centroid;
+		int index;
+		unsigned int code;	// Morton code of the centroid, for MORTON
+	};
+
+	// A piece of the binary tree, built by one task, with offsets into its
+	// own arrays.  A node with count < 0 stands for the subtree numbered
+	// offset, built by some other task; the pieces are spliced into one
+	// depth-first tree once they are all done.
+	struct Subtree {
+		int begin, end, depth;
+		std::vector<Node> nodes;
+		std::vector<int> prims;
+	};
+	class BuildTasks;
+
+	// A collapsed node: the boxes of its children as structures of arrays,
+	// then where each child is.  A child with count > 0 is a leaf whose
+	// primitives start at child[k]; otherwise child[k] is another node.
+	template <int W>
+	struct WideNode {
+		float bmin[3][W];
+		float bmax[3][W];
+		int child[W];
+		int count[W];
+		int valid;		// bit k set if slot k is in use
+	};
+
+	// The ray as the kernels want it.  Directions parallel to an axis get
+	// a huge but finite inverse (positive even for -0), so that no slab
+	// ever produces a NaN.
+	struct WideRay {
+		float org[3];
+		float inv[3];
+		WideRay() {}
+		WideRay( const ray& r );
+	};
+
+	// The range of origins and inverse directions over a packet.  Since
+	// rounding is monotonic, the slab distances it gives bound those of
+	// every ray in the packet, as computed by the kernels.
+	struct IntervalRay {
+		float orgLo[3], orgHi[3];
+		float invLo[3], invHi[3];
+		IntervalRay( const WideRay* rays, int mask );
+	};
+
+	struct PacketEntry {
+		int ref;
+		int count;
+		int mask;		// rays that reached it
+		float t;		// nearest any of them enters its box
+	};
+
+	// Where the walk goes next: a node, or a leaf's primitives, and how far
+	// along the ray its box starts.
+	struct StackEntry {
+		int ref;
+		int count;
+		float t;
+	};
+
+	// Leaf callbacks for intersect and occluded: hand the leaf's
+	// primitives over one at a time.
+	template <class Hit>
+	struct EachHit {
+		const int* prims;
+		Hit& hit;
+		EachHit( const int* p, Hit& h ) : prims( p ), hit( h ) {}
+		bool operator()( int first, int count, Real& tmax ) {
+			bool found = false;
+			for( int k = 0; k < count; ++k )
+				if( hit( prims[first + k], tmax ) ) found = true;
+			return found;
+		}
+	};
+	template <class Blocked>
+	struct EachBlocked {
+		const int* prims;
+		Blocked& blocked;
+		EachBlocked( const int* p, Blocked& b ) : prims( p ), blocked( b ) {}
+		bool operator()( int first, int count, Real tmax ) {
+			for( int k = 0; k < count; ++k )
+				if( blocked( prims[first + k], tmax ) ) return true;
+			return false;
+		}
+	};
+
+	int buildRecursive( std::vector<BuildPrim>& build, int begin, int end, int depth,
+		Subtree& out, BuildTasks* tasks ) const;
+	int splice( const std::vector<Subtree*>& trees, int tree, int node );
+
+	// Choose where to split build[begin, end), which has the given bounds
+	// and centroid bounds, and partition it there: the first half goes
+	// to begin .. begin+mid-1.  Returns false to make it a leaf.
+	bool split( std::vector<BuildPrim>& build, int begin, int end, int depth,
+		const Vec3r& bmin, const Vec3r& bmax, const Vec3r& cmin, const Vec3r& cmax,
+		int& axis, int& mid ) const;
+	bool sweepSplit( std::vector<BuildPrim>& build, int begin, int end,
+		const Vec3r& bmin, const Vec3r& bmax, const Vec3r& cmin, const Vec3r& cmax,
+		int& axis, int& mid ) const;
+	bool binnedSplit( std::vector<BuildPrim>& build, int begin, int end,
+		const Vec3r& bmin, const Vec3r& bmax, const Vec3r& cmin, const Vec3r& cmax,
+		int& axis, int& mid ) const;
+	bool mortonSplit( std::vector<BuildPrim>& build, int begin, int end,
+		int& axis, int& mid ) const;
+	static void sortMorton( std::vector<BuildPrim>& build );
+
+	// How many tests it takes to get through n primitives.
+	int groups( int n ) const { return (n + groupSize - 1) / groupSize; }
+
+	template <int W>
+	void collapse( std::vector< WideNode<W> >& wide ) const;
+	template <int W>
+	int collapseNode( std::vector< WideNode<W> >& wide, int node, Real margin ) const;
+	template <int W>
+	bool readWide( std::vector< WideNode<W> >& wide, const char* data, size_t size, int numPrims );
+
+	// Test the ray against every child of n, returning a bit per child hit
+	// and where along the ray each hit box starts.
+	static int hits4Scalar( const WideNode<4>& n, const WideRay& r, float tmax, float* tnear );
+	static int hits4SSE( const WideNode<4>& n, const WideRay& r, float tmax, float* tnear );
+	static int hits8AVX( const WideNode<8>& n, const WideRay& r, float tmax, float* tnear );
+
+	// Whether any ray of the packet can hit each child of n.
+	template <int W>
+	static int hitsInterval( const WideNode<W>& n, const IntervalRay& r, float tmax );
+
+	template <int W, int (*hits)( const WideNode<W>&, const WideRay&, float, float* ), class Hit>
+	void intersectPacketWide( const std::vector< WideNode<W> >& wide,
+		const ray* rays, int mask, Real* tmax, Hit& hit ) const;
+	template <int W, int (*hits)( const WideNode<W>&, const WideRay&, float, float* ), class Blocked>
+	int occludedPacketWide( const std::vector< WideNode<W> >& wide,
+		const ray* rays, int mask, const Real* tmax, Blocked& blocked ) const;
+
+	// t as a float that is never less than it.
+	static float roundUp( Real t );
+	static bool supported( Kernel k );
+
+	// The walks, for each kernel.  The kernel is a template argument so
+	// that it can be inlined into the loop.
+	template <int W, int (*hits)( const WideNode<W>&, const WideRay&, float, float* ), class Hit>
+	bool intersectWide( const std::vector< WideNode<W> >& wide,
+		const ray& r, Real& tmax, Hit& hit ) const;
+	template <int W, int (*hits)( const WideNode<W>&, const WideRay&, float, float* ), class Blocked>
+	bool occludedWide( const std::vector< WideNode<W> >& wide,
+		const ray& r, Real tmax, Blocked& blocked ) const;
+
+	std::vector<Node> nodes;
+	std::vector<int> prims;
+
+	Kernel kernel;		// what this hierarchy was collapsed for
+	int groupSize;		// primitives the caller tests at once
+	std::vector< WideNode<4> > wide4;
+	std::vector< WideNode<8> > wide8;
+
+	static Kernel activeKernel;
+	static Builder activeBuilder;
+	static int buildThreads;
+
+	// Enough for 7 entries per level of a tree as deep as the builder's
+	// depth limit allows.
+	enum { STACK_SIZE = 1024 };
+};
+
+inline BVH::WideRay::WideRay( const ray& r )
+{
+	Vec3r o = r.getPosition();
+	Vec3r d = r.getDirection();
+	for( int axis = 0; axis < 3; ++axis ) {
+		org[axis] = (float)o[axis];
+		Real inverse = d[axis] == 0.0 ? FLT_MAX : 1.0 / d[axis];
+		if( inverse > FLT_MAX ) inv[axis] = FLT_MAX;
+		else if( inverse < -FLT_MAX ) inv[axis] = -FLT_MAX;
+		else inv[axis] = (float)inverse;
+	}
+}
+
+// Starting tNear at 0 folds the "box not behind the ray" test into the
+// overlap test.
+inline int BVH::hits4Scalar( const WideNode<4>& n, const WideRay& r, float tmax, float* tnear )
+{
+	int mask = 0;
+	for( int k = 0; k < 4; ++k ) {
+		float tNear = 0.0f;
+		float tFar = tmax;
+		for( int axis = 0; axis < 3; ++axis ) {
+			float t1 = (n.bmin[axis][k] - r.org[axis]) * r.inv[axis];
+			float t2 = (n.bmax[axis][k] - r.org[axis]) * r.inv[axis];
+			if( t1 > t2 ) { float ttemp = t1; t1 = t2; t2 = ttemp; }
+			if( t1 > tNear ) tNear = t1;
+			if( t2 < tFar ) tFar = t2;
+		}
+		tnear[k] = tNear;
+		if( tNear <= tFar ) mask |= 1 << k;
+	}
+	return mask & n.valid;
+}
+
+#ifdef BVH_SSE
+inline int BVH::hits4SSE( const WideNode<4>& n, const WideRay& r, float tmax, float* tnear )
+{
+	__m128 tNear = _mm_setzero_ps();
+	__m128 tFar = _mm_set1_ps( tmax );
+	for( int axis = 0; axis < 3; ++axis ) {
+		__m128 org = _mm_set1_ps( r.org[axis] );
+		__m128 inv = _mm_set1_ps( r.inv[axis] );
+		__m128 t1 = _mm_mul_ps( _mm_sub_ps( _mm_loadu_ps( n.bmin[axis] ), org ), inv );
+		__m128 t2 = _mm_mul_ps( _mm_sub_ps( _mm_loadu_ps( n.bmax[axis] ), org ), inv );
+		tNear = _mm_max_ps( tNear, _mm_min_ps( t1, t2 ) );
+		tFar = _mm_min_ps( tFar, _mm_max_ps( t1, t2 ) );
+	}
+	_mm_storeu_ps( tnear, tNear );
+	return _mm_movemask_ps( _mm_cmple_ps( tNear, tFar ) ) & n.valid;
+}
+#else
+inline int BVH::hits4SSE( const WideNode<4>& n, const WideRay& r, float tmax, float* tnear )
+{
+	return hits4Scalar( n, r, tmax, tnear );
+}
+#endif
+
+template <class Hit>
+bool BVH::intersect( const ray& r, Real& tmax, Hit& hit ) const
+{
+	EachHit<Hit> each( prims.empty() ? 0 : &prims[0], hit );
+	return intersectLeaves( r, tmax, each );
+}
+
+template <class Blocked>
+bool BVH::occluded( const ray& r, Real tmax, Blocked& blocked ) const
+{
+	EachBlocked<Blocked> each( prims.empty() ? 0 : &prims[0], blocked );
+	return occludedLeaves( r, tmax, each );
+}
+
+template <class Hit>
+bool BVH::intersectLeaves( const ray& r, Real& tmax, Hit& hit ) const
+{
+	if( empty() ) return false;
+
+	switch( kernel ) {
+	case AVX: return intersectWide<8, hits8AVX>( wide8, r, tmax, hit );
+	case SSE: return intersectWide<4, hits4SSE>( wide4, r, tmax, hit );
+	default:  return intersectWide<4, hits4Scalar>( wide4, r, tmax, hit );
+	}
+}
+
+template <class Blocked>
+bool BVH::occludedLeaves( const ray& r, Real tmax, Blocked& blocked ) const
+{
+	if( empty() ) return false;
+
+	switch( kernel ) {
+	case AVX: return occludedWide<8, hits8AVX>( wide8, r, tmax, blocked );
+	case SSE: return occludedWide<4, hits4SSE>( wide4, r, tmax, blocked );
+	default:  return occludedWide<4, hits4Scalar>( wide4, r, tmax, blocked );
+	}
+}
+
+// Stepping up by a relative FLT_EPSILON is at least one ulp, and cheaper
+// than nextafterf.
+inline float BVH::roundUp( Real t )
+{
+	float f = (float)t;
+	return f < t ? f * (1.0f + FLT_EPSILON) + FLT_MIN : f;
+}
+
+inline int BVH::lowestBit( int mask )
+{
+#if defined(__GNUC__)
+	return __builtin_ctz( mask );
+#else
+	int k = 0;
+	for( ; !(mask & 1); mask >>= 1 ) ++k;
+	return k;
+#endif
+}
+
+inline int BVH::bitCount( int mask )
+{
+	int n = 0;
+	for( ; mask; mask &= mask - 1 ) ++n;
+	return n;
+}
+
+template <int W, int (*hits)( const BVH::WideNode<W>&, const BVH::WideRay&, float, float* ), class Hit>
+bool BVH::intersectWide( const std::vector< WideNode<W> >& wide,
+	const ray& r, Real& tmax, Hit& hit ) const
+{
+	WideRay wr( r );
+
+	StackEntry stack[STACK_SIZE];
+	int sp = 0;
+	StackEntry current = { 0, 0, 0.0f };
+	bool found = false;
+
+	for( ;; ) {
+		if( current.count > 0 ) {
+			if( hit( current.ref, current.count, tmax ) ) found = true;
+		} else {
+			const WideNode<W>& n = wide[current.ref];
+			float tnear[W];
+			int mask = hits( n, wr, roundUp( tmax ), tnear );
+			RENDER_STAT( countNodeVisits( bitCount( n.valid ) ) );
+
+			// Push the children hit far to near, so the nearest comes off
+			// the stack first.
+			int first = sp;
+			for( int k = 0; k < W; ++k ) {
+				if( !(mask & (1 << k)) ) continue;
+				StackEntry e = { n.child[k], n.count[k], tnear[k] };
+				int j = sp++;
+				for( ; j > first && stack[j - 1].t < e.t; --j )
+					stack[j] = stack[j - 1];
+				stack[j] = e;
+			}
+		}
+
+		// Skip whatever starts beyond the closest hit found since it was
+		// pushed.
+		do {
+			if( sp == 0 ) return found;
+			current = stack[--sp];
+		} while( current.t > tmax );
+	}
+}
+
+template <int W, int (*hits)( const BVH::WideNode<W>&, const BVH::WideRay&, float, float* ), class Blocked>
+bool BVH::occludedWide( const std::vector< WideNode<W> >& wide,
+	const ray& r, Real tmax, Blocked& blocked ) const
+{
+	WideRay wr( r );
+	float ftmax = roundUp( tmax );
+
+	StackEntry stack[STACK_SIZE];
+	int sp = 0;
+	StackEntry current = { 0, 0, 0.0f };
+
+	for( ;; ) {
+		if( current.count > 0 ) {
+			if( blocked( current.ref, current.count, tmax ) ) return true;
+		} else {
+			// Any hit will do, so the order doesn't matter.
+			const WideNode<W>& n = wide[current.ref];
+			float tnear[W];
+			int mask = hits( n, wr, ftmax, tnear );
+			RENDER_STAT( countNodeVisits( bitCount( n.valid ) ) );
+			for( int k = 0; k < W; ++k ) {
+				if( !(mask & (1 << k)) ) continue;
+				StackEntry e = { n.child[k], n.count[k], tnear[k] };
+				stack[sp++] = e;
+			}
+		}
+
+		if( sp == 0 ) return false;
+		current = stack[--sp];
+	}
+}
+
+inline BVH::IntervalRay::IntervalRay( const WideRay* rays, int mask )
+{
+	for( int axis = 0; axis < 3; ++axis ) {
+		orgLo[axis] = invLo[axis] = FLT_MAX;
+		orgHi[axis] = invHi[axis] = -FLT_MAX;
+	}
+	for( int k = 0; k < PACKET_SIZE; ++k ) {
+		if( !(mask & (1 << k)) ) continue;
+		for( int axis = 0; axis < 3; ++axis ) {
+			orgLo[axis] = std::min( orgLo[axis], rays[k].org[axis] );
+			orgHi[axis] = std::max( orgHi[axis], rays[k].org[axis] );
+			invLo[axis] = std::min( invLo[axis], rays[k].inv[axis] );
+			invHi[axis] = std::max( invHi[axis], rays[k].inv[axis] );
+		}
+	}
+}
+
+// Packets only hold rays that head the same way along each axis, so the
+// inverse directions along an axis all have one sign, and which plane of
+// a slab is the near one is the same for every ray.  The nearest any ray
+// can enter is then the near plane's distance taken with the origin and
+// inverse direction at the ends of their ranges that make it smallest,
+// and likewise for the farthest any ray can leave.
+template <int W>
+int BVH::hitsInterval( const WideNode<W>& n, const IntervalRay& r, float tmax )
+{
+	float tNear[W], tFar[W];
+	for( int k = 0; k < W; ++k ) {
+		tNear[k] = 0.0f;
+		tFar[k] = tmax;
+	}
+	for( int axis = 0; axis < 3; ++axis ) {
+		bool positive = r.invLo[axis] >= 0.0f;
+		if( !positive && r.invHi[axis] >= 0.0f ) return n.valid;
+		const float* nearPlane = positive ? n.bmin[axis] : n.bmax[axis];
+		const float* farPlane = positive ? n.bmax[axis] : n.bmin[axis];
+		// Distances to the planes shrink as the origin moves towards them.
+		float orgNear = positive ? r.orgHi[axis] : r.orgLo[axis];
+		float orgFar = positive ? r.orgLo[axis] : r.orgHi[axis];
+		float lo = r.invLo[axis], hi = r.invHi[axis];
+		for( int k = 0; k < W; ++k ) {
+			// Whichever way the ray goes, the product is smallest with the
+			// lowest inverse when the distance is positive, and with the
+			// highest when it is negative; the other way round for biggest.
+			float dn = nearPlane[k] - orgNear;
+			float df = farPlane[k] - orgFar;
+			float tn = dn * (dn >= 0.0f ? lo : hi);
+			float tf = df * (df >= 0.0f ? hi : lo);
+			tNear[k] = std::max( tNear[k], tn );
+			tFar[k] = std::min( tFar[k], tf );
+		}
+	}
+	int mask = 0;
+	for( int k = 0; k < W; ++k )
+		if( tNear[k] <= tFar[k] ) mask |= 1 << k;
+	return mask & n.valid;
+}
+
+template <class Hit>
+void BVH::intersectPacket( const ray* rays, int mask, Real* tmax, Hit& hit ) const
+{
+	if( empty() ) return;
+
+	switch( kernel ) {
+	case AVX: intersectPacketWide<8, hits8AVX>( wide8, rays, mask, tmax, hit ); break;
+	case SSE: intersectPacketWide<4, hits4SSE>( wide4, rays, mask, tmax, hit ); break;
+	default:  intersectPacketWide<4, hits4Scalar>( wide4, rays, mask, tmax, hit ); break;
+	}
+}
+
+template <class Blocked>
+int BVH::occludedPacket( const ray* rays, int mask, const Real* tmax, Blocked& blocked ) const
+{
+	if( empty() ) return 0;
+
+	switch( kernel ) {
+	case AVX: return occludedPacketWide<8, hits8AVX>( wide8, rays, mask, tmax, blocked );
+	case SSE: return occludedPacketWide<4, hits4SSE>( wide4, rays, mask, tmax, blocked );
+	default:  return occludedPacketWide<4, hits4Scalar>( wide4, rays, mask, tmax, blocked );
+	}
+}
+
+// A node is first tested against the packet as a whole; only if some of
+// its children might be hit is each ray tested on its own.  A child is
+// visited with the rays that hit its box, nearest child first.
+template <int W, int (*hits)( const BVH::WideNode<W>&, const BVH::WideRay&, float, float* ), class Hit>
+void BVH::intersectPacketWide( const std::vector< WideNode<W> >& wide,
+	const ray* rays, int mask, Real* tmax, Hit& hit ) const
+{
+	WideRay wr[PACKET_SIZE];
+	for( int m = mask; m; m &= m - 1 ) {
+		int k = lowestBit( m );
+		wr[k] = WideRay( rays[k] );
+	}
+	IntervalRay interval( wr, mask );
+
+	PacketEntry stack[STACK_SIZE];
+	int sp = 0;
+	PacketEntry current = { 0, 0, mask, 0.0f };
+
+	for( ;; ) {
+		if( current.count > 0 ) {
+			for( int k = 0; k < current.count; ++k )
+				hit( prims[current.ref + k], current.mask, tmax );
+		} else {
+			const WideNode<W>& n = wide[current.ref];
+			int any = n.valid;
+			if( current.mask & (current.mask - 1) ) {
+				Real farthest = 0.0;
+				for( int m = current.mask; m; m &= m - 1 )
+					farthest = std::max( farthest, tmax[lowestBit( m )] );
+				any = hitsInterval( n, interval, roundUp( farthest ) );
+			}
+
+			int childMask[W];
+			float childNear[W];
+			for( int c = 0; c < W; ++c ) {
+				childMask[c] = 0;
+				childNear[c] = FLT_MAX;
+			}
+			for( int m = any ? current.mask : 0; m; m &= m - 1 ) {
+				int k = lowestBit( m );
+				float tnear[W];
+				int h = hits( n, wr[k], roundUp( tmax[k] ), tnear ) & any;
+				RENDER_STAT( countNodeVisits( bitCount( n.valid ) ) );
+				for( ; h; h &= h - 1 ) {
+					int c = lowestBit( h );
+					childMask[c] |= 1 << k;
+					childNear[c] = std::min( childNear[c], tnear[c] );
+				}
+			}
+
+			int first = sp;
+			for( int c = 0; c < W; ++c ) {
+				if( !childMask[c] ) continue;
+				PacketEntry e = { n.child[c], n.count[c], childMask[c], childNear[c] };
+				int j = sp++;
+				for( ; j > first && stack[j - 1].t < e.t; --j )
+					stack[j] = stack[j - 1];
+				stack[j] = e;
+			}
+		}
+
+		// Drop the rays that have found something closer than where the
+		// entry starts.
+		do {
+			if( sp == 0 ) return;
+			current = stack[--sp];
+			for( int m = current.mask; m; m &= m - 1 ) {
+				int k = lowestBit( m );
+				if( tmax[k] < current.t ) current.mask &= ~(1 << k);
+			}
+		} while( !current.mask );
+	}
+}
+
+template <int W, int (*hits)( const BVH::WideNode<W>&, const BVH::WideRay&, float, float* ), class Blocked>
+int BVH::occludedPacketWide( const std::vector< WideNode<W> >& wide,
+	const ray* rays, int mask, const Real* tmax, Blocked& blocked ) const
+{
+	WideRay wr[PACKET_SIZE];
+	Real farthest = 0.0;
+	for( int m = mask; m; m &= m - 1 ) {
+		int k = lowestBit( m );
+		wr[k] = WideRay( rays[k] );
+		farthest = std::max( farthest, tmax[k] );
+	}
+	IntervalRay interval( wr, mask );
+	float intervalMax = roundUp( farthest );
+
+	PacketEntry stack[STACK_SIZE];
+	int sp = 0;
+	PacketEntry current = { 0, 0, mask, 0.0f };
+	int active = mask;
+
+	for( ;; ) {
+		if( current.count > 0 ) {
+			for( int k = 0; k < current.count && current.mask; ++k ) {
+				int b = blocked( prims[current.ref + k], current.mask, tmax );
+				active &= ~b;
+				current.mask &= ~b;
+			}
+			if( !active ) return mask;
+		} else {
+			const WideNode<W>& n = wide[current.ref];
+			int any = current.mask & (current.mask - 1) ?
+				hitsInterval( n, interval, intervalMax ) : n.valid;
+			int childMask[W];
+			for( int c = 0; c < W; ++c )
+				childMask[c] = 0;
+			for( int m = any ? current.mask : 0; m; m &= m - 1 ) {
+				int k = lowestBit( m );
+				float tnear[W];
+				int h = hits( n, wr[k], roundUp( tmax[k] ), tnear ) & any;
+				RENDER_STAT( countNodeVisits( bitCount( n.valid ) ) );
+				for( ; h; h &= h - 1 )
+					childMask[lowestBit( h )] |= 1 << k;
+			}
+			for( int c = 0; c < W; ++c ) {
+				if( !childMask[c] ) continue;
+				PacketEntry e = { n.child[c], n.count[c], childMask[c], 0.0f };
+				stack[sp++] = e;
+			}
+		}
+
+		do {
+			if( sp == 0 ) return mask & ~active;
+			current = stack[--sp];
+			current.mask &= active;
+		} while( !current.mask );
+	}
+}
+
+#endif // __BVH_H__
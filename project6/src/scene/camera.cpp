@@ -10,32 +10,32 @@ Camera::Camera()
     aspectRatio = 1;
     normalizedHeight = 1;
     
-    eye = Vec3d(0,0,0);
-    u = Vec3d( 1,0,0 );
-    v = Vec3d( 0,1,0 );
-    look = Vec3d( 0,0,-1 );
+    eye = Vec3r(0,0,0);
+    u = Vec3r( 1,0,0 );
+    v = Vec3r( 0,1,0 );
+    look = Vec3r( 0,0,-1 );
 }
 
 void
-Camera::rayThrough( double x, double y, ray &r )
+Camera::rayThrough( Real x, Real y, ray &r )
 // Ray through normalized window point x,y.  In normalized coordinates
 // the camera's x and y vary both vary from 0 to 1.
 {
     x -= 0.5;
     y -= 0.5;
-    Vec3d dir = look + x * u + y * v;
+    Vec3r dir = look + x * u + y * v;
 	dir.normalize();
     r = ray( eye, dir, ray::VISIBILITY );
 }
 
 void
-Camera::setEye( const Vec3d &eye )
+Camera::setEye( const Vec3r &eye )
 {
     this->eye = eye;
 }
 
 void
-Camera::setLook( double r, double i, double j, double k )
+Camera::setLook( Real r, Real i, Real j, Real k )
 // Set the direction for the camera to look using a quaternion.  The
 // default camera looks down the neg z axis with the pos y axis as up.
 // We derive the new look direction by rotating the camera by the
@@ -58,19 +58,19 @@ Camera::setLook( double r, double i, double j, double k )
 }
 
 void
-Camera::setLook( const Vec3d &viewDir, const Vec3d &upDir )
+Camera::setLook( const Vec3r &viewDir, const Vec3r &upDir )
 {
-    Vec3d z = -viewDir;          // this is where the z axis should end up
-    const Vec3d &y = upDir;      // where the y axis should end up
-    Vec3d x = y ^ z;               // lah,
+    Vec3r z = -viewDir;          // this is where the z axis should end up
+    const Vec3r &y = upDir;      // where the y axis should end up
+    Vec3r x = y ^ z;               // lah,
 
-    m = Mat3d( x[0],x[1],x[2],y[0],y[1],y[2],z[0],z[1],z[2] ).transpose();
+    m = Mat3r( x[0],x[1],x[2],y[0],y[1],y[2],z[0],z[1],z[2] ).transpose();
 
     update();
 }
 
 void
-Camera::setFOV( double fov )
+Camera::setFOV( Real fov )
 // fov - field of view (height) in degrees    
 {
     fov /= (180.0 / PI);      // convert to radians
@@ -79,7 +79,7 @@ Camera::setFOV( double fov )
 }
 
 void
-Camera::setAspectRatio( double ar )
+Camera::setAspectRatio( Real ar )
 // ar - ratio of width to height
 {
     aspectRatio = ar;
@@ -89,9 +89,9 @@ Camera::setAspectRatio( double ar )
 void
 Camera::update()
 {
-    u = m * Vec3d( 1,0,0 ) * normalizedHeight*aspectRatio;
-    v = m * Vec3d( 0,1,0 ) * normalizedHeight;
-    look = m * Vec3d( 0,0,-1 );
+    u = m * Vec3r( 1,0,0 ) * normalizedHeight*aspectRatio;
+    v = m * Vec3r( 0,1,0 ) * normalizedHeight;
+    look = m * Vec3r( 0,0,-1 );
 }
 
 
@@ -7,29 +7,36 @@ class Camera
 {
 public:
     Camera();
-    void rayThrough( double x, double y, ray &r );
-    void setEye( const Vec3d &eye );
-    void setLook( double, double, double, double );
-    void setLook( const Vec3d &viewDir, const Vec3d &upDir );
-    void setFOV( double );
-    void setAspectRatio( double );
+    void rayThrough( Real x, Real y, ray &r );
+    void setEye( const Vec3r &eye );
+    void setLook( Real, Real, Real, Real );
+    void setLook( const Vec3r &viewDir, const Vec3r &upDir );
+    void setFOV( Real );
+    void setAspectRatio( Real );
 
-    double getAspectRatio() { return aspectRatio; }
+    Real getAspectRatio() { return aspectRatio; }
 
-	const Vec3d& getEye() const			{ return eye; }
-	const Vec3d& getLook() const		{ return look; }
-	const Vec3d& getU() const			{ return u; }
-	const Vec3d& getV() const			{ return v; }
+	const Vec3r& getEye() const			{ return eye; }
+	const Vec3r& getLook() const		{ return look; }
+	const Vec3r& getU() const			{ return u; }
+	const Vec3r& getV() const			{ return v; }
+
+	// The directions last handed to setLook( viewDir, upDir ), or what
+	// the quaternion one worked out.
+	Vec3r getViewDir() const			{ return Vec3r( -m[0][2], -m[1][2], -m[2][2] ); }
+	Vec3r getUpDir() const				{ return Vec3r( m[0][1], m[1][1], m[2][1] ); }
 private:
-    Mat3d m;                     // rotation matrix
-    double normalizedHeight;    // dimensions of image place at unit dist from eye
-    double aspectRatio;
+    friend class SceneCache;
+
+    Mat3r m;                     // rotation matrix
+    Real normalizedHeight;    // dimensions of image place at unit dist from eye
+    Real aspectRatio;
     
     void update();              // using the above three values calculate look,u,v
     
-    Vec3d eye;
-    Vec3d look;                  // direction to look
-    Vec3d u,v;                   // u and v in the 
+    Vec3r eye;
+    Vec3r look;                  // direction to look
+    Vec3r u,v;                   // u and v in the 
 };
 
 #endif
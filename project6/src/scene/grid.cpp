@@ -0,0 +1,215 @@
+#include <cmath>
+#include <algorithm>
+
+#include "grid.h"
+
+using namespace std;
+
+// The cube root of the cells per primitive, for a one-level grid (and
+// the grids in a two-level one's cells) and for the top of a two-level
+// one.
+static const double CELL_DENSITY = 3.0;
+static const double TOP_CELL_DENSITY = 2.0;
+// Top cells with fewer primitives inside them than this don't get grids
+// of their own.
+static const int MIN_SUB_PRIMS = 16;
+
+// Cells a side for a box of the given extent: cubes, as many as will
+// make no more than density^3 cells for each of count primitives.  The
+// count is worked out by bisection rather than from the volume, so that
+// flat boxes (a wall, a floor, a scene laid out on one) get as many
+// cells as deep ones.
+static int cellsFor( const Vec3r& extent, double cellsPerUnit, int maxResolution, int* res )
+{
+	int cells = 1;
+	for( int axis = 0; axis < 3; ++axis ) {
+		int r = (int)floor( extent[axis] * cellsPerUnit + 0.5 );
+		res[axis] = max( 1, min( r, maxResolution ) );
+		cells *= res[axis];
+	}
+	return cells;
+}
+
+static void resolution( const Vec3r& extent, int count, double density, int maxResolution, int* res )
+{
+	double target = density * density * density * count;
+	double widest = max( extent[0], max( extent[1], extent[2] ) );
+	double lo = 0.0;
+	double hi = maxResolution / widest;
+	for( int k = 0; k < 32; ++k ) {
+		double mid = 0.5 * (lo + hi);
+		if( cellsFor( extent, mid, maxResolution, res ) <= target )
+			lo = mid;
+		else
+			hi = mid;
+	}
+	cellsFor( extent, lo, maxResolution, res );
+}
+
+Grid::Range Grid::cellRange( const Level& l, const Vec3r& lo, const Vec3r& hi )
+{
+	Range b;
+	for( int axis = 0; axis < 3; ++axis ) {
+		int first = (int)floor( (lo[axis] - l.bmin[axis]) * l.invCellSize[axis] );
+		int last = (int)floor( (hi[axis] - l.bmin[axis]) * l.invCellSize[axis] );
+		b.first[axis] = max( 0, min( first, l.res[axis] - 1 ) );
+		b.last[axis] = max( 0, min( last, l.res[axis] - 1 ) );
+	}
+	return b;
+}
+
+void Grid::build( const vector<BoundingBox>& boxes, bool twoLevel )
+{
+	clear();
+	int n = (int)boxes.size();
+	if( n == 0 ) return;
+
+	// Pad the boxes a little, so that a ray that grazes a primitive
+	// still finds it in a cell it walks through, and so that flat
+	// primitives (and flat meshes) have some thickness to grid.
+	Real scale = 0.0;
+	for( int k = 0; k < n; ++k )
+		for( int axis = 0; axis < 3; ++axis )
+			scale = max( scale, max( fabs( boxes[k].getMin()[axis] ), fabs( boxes[k].getMax()[axis] ) ) );
+	Real margin = scale * 1e-6 + RAY_EPSILON;
+	Vec3r pad( margin, margin, margin );
+
+	vector<Vec3r> lo( n ), hi( n );
+	Vec3r bmin = boxes[0].getMin() - pad;
+	Vec3r bmax = boxes[0].getMax() + pad;
+	for( int k = 0; k < n; ++k ) {
+		lo[k] = boxes[k].getMin() - pad;
+		hi[k] = boxes[k].getMax() + pad;
+		bmin = minimum( bmin, lo[k] );
+		bmax = maximum( bmax, hi[k] );
+	}
+
+	ranges.resize( n );
+	vector<int> all( n );
+	for( int k = 0; k < n; ++k )
+		all[k] = k;
+	levels.push_back( Level() );
+	setLevel( levels[0], bmin, bmax, n,
+		twoLevel ? TOP_CELL_DENSITY : CELL_DENSITY, MAX_RESOLUTION );
+	for( int k = 0; k < n; ++k )
+		ranges[k] = cellRange( levels[0], lo[k], hi[k] );
+	if( !twoLevel ) {
+		fillLevel( levels[0], all );
+		return;
+	}
+
+	// The primitives that lie inside one top cell, cell by cell.
+	int cells = levels[0].res[0] * levels[0].res[1] * levels[0].res[2];
+	vector<int> inside( cells, 0 );
+	for( int k = 0; k < n; ++k ) {
+		const Range& b = ranges[k];
+		if( b.first[0] == b.last[0] && b.first[1] == b.last[1] && b.first[2] == b.last[2] )
+			++inside[b.first[0] + levels[0].res[0] * (b.first[1] + levels[0].res[1] * b.first[2])];
+	}
+
+	// Those of crowded cells go to the cell's own grid; everything else
+	// stays in the top one.
+	vector<int> top;
+	vector< vector<int> > crowded( cells );
+	for( int k = 0; k < n; ++k ) {
+		const Range& b = ranges[k];
+		int c = b.first[0] + levels[0].res[0] * (b.first[1] + levels[0].res[1] * b.first[2]);
+		if( b.first[0] == b.last[0] && b.first[1] == b.last[1] && b.first[2] == b.last[2] &&
+			inside[c] >= MIN_SUB_PRIMS )
+			crowded[c].push_back( k );
+		else
+			top.push_back( k );
+	}
+	fillLevel( levels[0], top );
+
+	for( int c = 0; c < cells; ++c ) {
+		if( crowded[c].empty() ) continue;
+		const vector<int>& prims = crowded[c];
+		Vec3r smin = lo[prims[0]];
+		Vec3r smax = hi[prims[0]];
+		for( size_t k = 1; k < prims.size(); ++k ) {
+			smin = minimum( smin, lo[prims[k]] );
+			smax = maximum( smax, hi[prims[k]] );
+		}
+
+		Level sub;
+		setLevel( sub, smin, smax, (int)prims.size(), CELL_DENSITY, MAX_SUB_RESOLUTION );
+		for( size_t k = 0; k < prims.size(); ++k )
+			ranges[prims[k]] = cellRange( sub, lo[prims[k]], hi[prims[k]] );
+		fillLevel( sub, prims );
+		levels[0].cellSub[c] = (int)levels.size();
+		levels.push_back( sub );
+	}
+}
+
+void Grid::setLevel( Level& l, const Vec3r& bmin, const Vec3r& bmax, int count,
+	double density, int maxResolution )
+{
+	l.bmin = bmin;
+	l.bmax = bmax;
+	Vec3r extent = bmax - bmin;
+	resolution( extent, count, density, maxResolution, l.res );
+	for( int axis = 0; axis < 3; ++axis ) {
+		l.cellSize[axis] = extent[axis] / l.res[axis];
+		l.invCellSize[axis] = l.res[axis] / extent[axis];
+	}
+}
+
+// Two passes over the primitives' ranges, as a counting sort: how many
+// go in each cell, then where.
+void Grid::fillLevel( Level& l, const vector<int>& prims ) const
+{
+	int cells = l.res[0] * l.res[1] * l.res[2];
+	l.cellStart.assign( cells + 1, 0 );
+	l.cellSub.assign( cells, -1 );
+	for( int pass = 0; pass < 2; ++pass ) {
+		for( size_t k = 0; k < prims.size(); ++k ) {
+			const Range& b = ranges[prims[k]];
+			for( int z = b.first[2]; z <= b.last[2]; ++z )
+				for( int y = b.first[1]; y <= b.last[1]; ++y )
+					for( int x = b.first[0]; x <= b.last[0]; ++x ) {
+						int c = x + l.res[0] * (y + l.res[1] * z);
+						if( pass == 0 )
+							++l.cellStart[c + 1];
+						else
+							l.cellPrims[l.cellStart[c]++] = prims[k];
+					}
+		}
+		if( pass == 0 ) {
+			for( int c = 0; c < cells; ++c )
+				l.cellStart[c + 1] += l.cellStart[c];
+			l.cellPrims.resize( l.cellStart[cells] );
+		} else {
+			// Each cell's start has moved on to the next one's.
+			for( int c = cells; c > 0; --c )
+				l.cellStart[c] = l.cellStart[c - 1];
+			l.cellStart[0] = 0;
+		}
+	}
+}
+
+int Grid::cellCount() const
+{
+	int cells = 0;
+	for( size_t k = 0; k < levels.size(); ++k )
+		cells += levels[k].res[0] * levels[k].res[1] * levels[k].res[2];
+	return cells;
+}
+
+int Grid::referenceCount() const
+{
+	int refs = 0;
+	for( size_t k = 0; k < levels.size(); ++k )
+		refs += (int)levels[k].cellPrims.size();
+	return refs;
+}
+
+size_t Grid::memory() const
+{
+	size_t bytes = ranges.size() * sizeof(Range) + levels.size() * sizeof(Level);
+	for( size_t k = 0; k < levels.size(); ++k ) {
+		const Level& l = levels[k];
+		bytes += (l.cellStart.size() + l.cellPrims.size() + l.cellSub.size()) * sizeof(int);
+	}
+	return bytes;
+}
@@ -0,0 +1,256 @@
+//
+// grid.h
+//
+// A uniform grid over an indexed set of primitives, the alternative to
+// the BVH for scenes of many primitives of about the same size.  Like the
+// BVH it only knows about boxes and indices, and hands primitives back
+// to the caller's callbacks during a walk, which here is a 3D-DDA
+// (Amanatides and Woo) from cell to cell along the ray.
+//
+// The two-level version gives the crowded cells of a coarser grid grids
+// of their own, so that a dense cluster somewhere in a big empty scene
+// neither turns into long cell lists nor makes the whole grid fine.
+//
+// A primitive that overlaps several cells is only handed out once per
+// walk: the cells a walk visits step one axis at a time and never back,
+// so the cells it visits out of a primitive's block of cells come one
+// after another, and the primitive is handed out at the first of them,
+// the one whose predecessor lies outside the block.  That is exact,
+// which matters to callers that add something up along the ray, such as
+// the transmission of a shadow ray, and needs no per-thread mailboxes.
+//
+
+#ifndef __GRID_H__
+#define __GRID_H__
+
+#include <vector>
+#include <math.h>
+
+#include "ray.h"
+#include "bbox.h"
+
+#include "../RenderStats.h"
+
+#include "../vecmath/vec.h"
+
+class Grid {
+
+public:
+	Grid() {}
+
+	// Build the grid over the given boxes, with cubic cells, about 27 for
+	// every primitive (but no more than MAX_RESOLUTION a side).  The
+	// primitive index handed back during a walk is the position of its
+	// box in this vector.  With twoLevel, the top grid has about 8 cells
+	// a primitive, and cells with 16 or more primitives lying entirely
+	// inside them get grids of their own over those (of no more than
+	// MAX_SUB_RESOLUTION a side).
+	void build( const std::vector<BoundingBox>& boxes, bool twoLevel );
+	void clear() { levels.clear(); ranges.clear(); }
+
+	bool empty() const { return levels.empty(); }
+
+	// Cells (in every level), primitives in cells (counting each
+	// primitive once for every cell it is in), and the bytes they and the
+	// primitive lists take.
+	int cellCount() const;
+	int referenceCount() const;
+	size_t memory() const;
+
+	// As for BVH::intersect and BVH::occluded.
+	template <class Hit>
+	bool intersect( const ray& r, Real& tmax, Hit& hit ) const;
+	template <class Blocked>
+	bool occluded( const ray& r, Real tmax, Blocked& blocked ) const;
+
+	enum { MAX_RESOLUTION = 128, MAX_SUB_RESOLUTION = 32 };
+
+private:
+	// One grid: levels[0] is the top, and the rest are the grids inside
+	// its cells.  Cell (x, y, z) is x + res[0] * (y + res[1] * z); its
+	// primitives are cellPrims[cellStart[c] .. cellStart[c+1]-1], and
+	// cellSub[c] is the level inside it, or -1.
+	struct Level {
+		Vec3r bmin, bmax;
+		Vec3r cellSize;
+		Vec3r invCellSize;
+		int res[3];
+		std::vector<int> cellStart;
+		std::vector<int> cellPrims;
+		std::vector<int> cellSub;
+	};
+
+	// The block of cells of one level a primitive was put in, from
+	// first[axis] to last[axis] along each axis.  Every primitive is in
+	// exactly one level: the top one, or the grid of the one top cell it
+	// lies inside.
+	struct Range {
+		int first[3];
+		int last[3];
+	};
+
+	static Range cellRange( const Level& l, const Vec3r& lo, const Vec3r& hi );
+	bool inCells( int prim, const int* cell ) const;
+
+	// Size level l to cover bmin .. bmax with about density^3 cells for
+	// each of count primitives; then put the primitives in it, once
+	// their ranges have been worked out.
+	static void setLevel( Level& l, const Vec3r& bmin, const Vec3r& bmax, int count,
+		double density, int maxResolution );
+	void fillLevel( Level& l, const std::vector<int>& prims ) const;
+
+	// Step through the cells of level l that r passes between t0 and
+	// tmax, calling visit( l, cell, prev, tExit ) for each: the cell's
+	// coordinates, those of the cell before it (or 0 for the first),
+	// and where r leaves it.  Stops, returning true, as soon as visit
+	// does.  visit may shrink tmax.
+	template <class Visit>
+	bool walk( const Level& l, const ray& r, Real t0, const Real& tmax, Visit& visit ) const;
+
+	template <class Hit> struct ClosestVisit;
+	template <class Blocked> struct AnyVisit;
+
+	std::vector<Level> levels;
+	std::vector<Range> ranges;	// for each primitive
+};
+
+inline bool Grid::inCells( int prim, const int* cell ) const
+{
+	const Range& b = ranges[prim];
+	return cell[0] >= b.first[0] && cell[0] <= b.last[0] &&
+		cell[1] >= b.first[1] && cell[1] <= b.last[1] &&
+		cell[2] >= b.first[2] && cell[2] <= b.last[2];
+}
+
+template <class Visit>
+bool Grid::walk( const Level& l, const ray& r, Real t0, const Real& tmax, Visit& visit ) const
+{
+	const Vec3r& o = r.getPosition();
+	const Vec3r& d = r.getDirection();
+
+	// Clip the ray to the grid.
+	Real tNear = t0;
+	Real tFar = tmax;
+	for( int axis = 0; axis < 3; ++axis ) {
+		if( d[axis] == 0.0 ) {
+			if( o[axis] < l.bmin[axis] || o[axis] > l.bmax[axis] ) return false;
+			continue;
+		}
+		Real inv = 1.0 / d[axis];
+		Real ta = (l.bmin[axis] - o[axis]) * inv;
+		Real tb = (l.bmax[axis] - o[axis]) * inv;
+		if( ta > tb ) std::swap( ta, tb );
+		if( ta > tNear ) tNear = ta;
+		if( tb < tFar ) tFar = tb;
+	}
+	if( tNear > tFar ) return false;
+
+	int cell[3], step[3], stop[3];
+	Real next[3], delta[3];
+	for( int axis = 0; axis < 3; ++axis ) {
+		Real p = o[axis] + d[axis] * tNear;
+		int c = (int)floor( (p - l.bmin[axis]) * l.invCellSize[axis] );
+		cell[axis] = c < 0 ? 0 : (c >= l.res[axis] ? l.res[axis] - 1 : c);
+		if( d[axis] > 0.0 ) {
+			step[axis] = 1;
+			stop[axis] = l.res[axis];
+			next[axis] = (l.bmin[axis] + (cell[axis] + 1) * l.cellSize[axis] - o[axis]) / d[axis];
+			delta[axis] = l.cellSize[axis] / d[axis];
+		} else if( d[axis] < 0.0 ) {
+			step[axis] = -1;
+			stop[axis] = -1;
+			next[axis] = (l.bmin[axis] + cell[axis] * l.cellSize[axis] - o[axis]) / d[axis];
+			delta[axis] = -l.cellSize[axis] / d[axis];
+		} else {
+			step[axis] = 0;
+			stop[axis] = -1;
+			next[axis] = RAY_INFINITY;
+			delta[axis] = RAY_INFINITY;
+		}
+	}
+
+	int prev[3];
+	const int* before = 0;
+	for( ;; ) {
+		int axis = next[0] < next[1] ? 0 : 1;
+		if( next[2] < next[axis] ) axis = 2;
+		RENDER_STAT( countNodeVisits( 1 ) );
+		if( visit( l, cell, before, next[axis] ) ) return true;
+		if( next[axis] > tmax ) return false;
+
+		prev[0] = cell[0];
+		prev[1] = cell[1];
+		prev[2] = cell[2];
+		before = prev;
+		cell[axis] += step[axis];
+		if( cell[axis] == stop[axis] ) return false;
+		next[axis] += delta[axis];
+	}
+}
+
+// A cell's own primitives, then the grid inside it, if any.  Nothing
+// further along can be closer once a hit is found before the ray
+// leaves the cell.
+template <class Hit>
+struct Grid::ClosestVisit {
+	const Grid& grid;
+	const ray& r;
+	Real& tmax;
+	Hit& hit;
+	bool found;
+
+	ClosestVisit( const Grid& g, const ray& rr, Real& t, Hit& h )
+		: grid( g ), r( rr ), tmax( t ), hit( h ), found( false ) {}
+
+	bool operator()( const Level& l, const int* cell, const int* prev, Real tExit ) {
+		int c = cell[0] + l.res[0] * (cell[1] + l.res[1] * cell[2]);
+		for( int k = l.cellStart[c]; k < l.cellStart[c + 1]; ++k ) {
+			int prim = l.cellPrims[k];
+			if( prev && grid.inCells( prim, prev ) ) continue;
+			if( hit( prim, tmax ) ) found = true;
+		}
+		if( l.cellSub[c] >= 0 )
+			grid.walk( grid.levels[l.cellSub[c]], r, 0.0, tmax, *this );
+		return tmax <= tExit;
+	}
+};
+
+template <class Blocked>
+struct Grid::AnyVisit {
+	const Grid& grid;
+	const ray& r;
+	Real tmax;
+	Blocked& blocked;
+
+	AnyVisit( const Grid& g, const ray& rr, Real t, Blocked& b )
+		: grid( g ), r( rr ), tmax( t ), blocked( b ) {}
+
+	bool operator()( const Level& l, const int* cell, const int* prev, Real ) {
+		int c = cell[0] + l.res[0] * (cell[1] + l.res[1] * cell[2]);
+		for( int k = l.cellStart[c]; k < l.cellStart[c + 1]; ++k ) {
+			int prim = l.cellPrims[k];
+			if( prev && grid.inCells( prim, prev ) ) continue;
+			if( blocked( prim, tmax ) ) return true;
+		}
+		return l.cellSub[c] >= 0 && grid.walk( grid.levels[l.cellSub[c]], r, 0.0, tmax, *this );
+	}
+};
+
+template <class Hit>
+bool Grid::intersect( const ray& r, Real& tmax, Hit& hit ) const
+{
+	if( empty() ) return false;
+	ClosestVisit<Hit> visit( *this, r, tmax, hit );
+	walk( levels[0], r, 0.0, tmax, visit );
+	return visit.found;
+}
+
+template <class Blocked>
+bool Grid::occluded( const ray& r, Real tmax, Blocked& blocked ) const
+{
+	if( empty() ) return false;
+	AnyVisit<Blocked> visit( *this, r, tmax, blocked );
+	return walk( levels[0], r, 0.0, tmax, visit );
+}
+
+#endif // __GRID_H__
@@ -0,0 +1,310 @@
+#include <cmath>
+#include <algorithm>
+
+#include "kdtree.h"
+
+using namespace std;
+
+// Cost of stepping through a node relative to testing one primitive.
+static const double TRAVERSAL_COST = 1.0;
+// How much cheaper a split that cuts off empty space is made to look.
+static const double EMPTY_BONUS = 0.2;
+
+void KdTree::clear()
+{
+	nodes.clear();
+	leaves.clear();
+	ropes.clear();
+	prims.clear();
+	roped = false;
+}
+
+void KdTree::build( const vector<BoundingBox>& boxes, const vector<Vec3r>* corners, bool withRopes )
+{
+	clear();
+	int n = (int)boxes.size();
+	if( n == 0 ) return;
+
+	// As for the grid: a little room for rounding around every clipped
+	// triangle, and around the tree.
+	Real scale = 0.0;
+	for( int k = 0; k < n; ++k )
+		for( int axis = 0; axis < 3; ++axis )
+			scale = max( scale, max( fabs( boxes[k].getMin()[axis] ), fabs( boxes[k].getMax()[axis] ) ) );
+	margin = scale * 1e-6 + RAY_EPSILON;
+	Vec3r pad( margin, margin, margin );
+
+	vector<Ref> refs( n );
+	bmin = boxes[0].getMin();
+	bmax = boxes[0].getMax();
+	for( int k = 0; k < n; ++k ) {
+		refs[k].prim = k;
+		refs[k].bmin = boxes[k].getMin();
+		refs[k].bmax = boxes[k].getMax();
+		bmin = minimum( bmin, refs[k].bmin );
+		bmax = maximum( bmax, refs[k].bmax );
+	}
+	bmin -= pad;
+	bmax += pad;
+
+	// As pbrt does, deep enough for a logarithmic tree with some to spare.
+	int depth = min( (int)MAX_DEPTH, (int)floor( 8 + 1.3 * log( (double)n ) / log( 2.0 ) + 0.5 ) );
+	buildNode( refs, bmin, bmax, depth, corners );
+
+	if( withRopes ) {
+		roped = true;
+		ropes.resize( leaves.size() );
+		int none[6] = { -1, -1, -1, -1, -1, -1 };
+		linkRopes( 0, bmin, bmax, none );
+	}
+}
+
+// The split with the lowest cost by the surface area heuristic, over
+// every place along each axis where a primitive (clipped to the node)
+// starts or ends; or a leaf, if none is cheaper than testing them all.
+// A primitive lying in the split plane goes below it.
+int KdTree::buildNode( vector<Ref>& refs, const Vec3r& lo, const Vec3r& hi, int depth,
+	const vector<Vec3r>* corners )
+{
+	int index = (int)nodes.size();
+	nodes.push_back( Node() );
+	int n = (int)refs.size();
+
+	double bestCost = n;
+	int bestAxis = -1;
+	Real bestSplit = 0.0;
+	Vec3r extent = hi - lo;
+	double area = extent[0] * extent[1] + extent[1] * extent[2] + extent[2] * extent[0];
+	if( depth > 0 && n > 1 && area > 0.0 ) {
+		vector<Real> mins( n ), maxs( n ), planar;
+		vector<Real> candidates;
+		planar.reserve( n );
+		candidates.reserve( 2 * n );
+		for( int axis = 0; axis < 3; ++axis ) {
+			if( extent[axis] <= 0.0 ) continue;
+			planar.clear();
+			for( int k = 0; k < n; ++k ) {
+				mins[k] = refs[k].bmin[axis];
+				maxs[k] = refs[k].bmax[axis];
+				if( mins[k] == maxs[k] ) planar.push_back( mins[k] );
+			}
+			sort( mins.begin(), mins.end() );
+			sort( maxs.begin(), maxs.end() );
+			sort( planar.begin(), planar.end() );
+			candidates.clear();
+			merge( mins.begin(), mins.end(), maxs.begin(), maxs.end(), back_inserter( candidates ) );
+
+			int o1 = (axis + 1) % 3, o2 = (axis + 2) % 3;
+			double side = extent[o1] * extent[o2];
+			double around = extent[o1] + extent[o2];
+			int starts = 0, ends = 0, flat = 0;
+			for( size_t c = 0; c < candidates.size(); ++c ) {
+				Real p = candidates[c];
+				if( c > 0 && p == candidates[c - 1] ) continue;
+				if( p <= lo[axis] || p >= hi[axis] ) continue;
+				while( starts < n && mins[starts] < p ) ++starts;
+				while( ends < n && maxs[ends] <= p ) ++ends;
+				while( flat < (int)planar.size() && planar[flat] < p ) ++flat;
+				int inPlane = 0;
+				while( flat + inPlane < (int)planar.size() && planar[flat + inPlane] == p ) ++inPlane;
+
+				int below = starts + inPlane;
+				int above = n - ends;
+				double areaBelow = side + (p - lo[axis]) * around;
+				double areaAbove = side + (hi[axis] - p) * around;
+				double bonus = (below == 0 || above == 0) ? EMPTY_BONUS : 0.0;
+				double cost = TRAVERSAL_COST + (1.0 - bonus) * (areaBelow * below + areaAbove * above) / area;
+				if( cost < bestCost ) {
+					bestCost = cost;
+					bestAxis = axis;
+					bestSplit = p;
+				}
+			}
+		}
+	}
+
+	if( bestAxis < 0 ) {
+		nodes[index].split = 0.0;
+		nodes[index].axis = LEAF;
+		nodes[index].offset = makeLeaf( refs );
+		return index;
+	}
+
+	Vec3r belowMax = hi;
+	Vec3r aboveMin = lo;
+	belowMax[bestAxis] = bestSplit;
+	aboveMin[bestAxis] = bestSplit;
+	vector<Ref> below, above;
+	below.reserve( n );
+	above.reserve( n );
+	for( int k = 0; k < n; ++k ) {
+		const Ref& ref = refs[k];
+		Real rmin = ref.bmin[bestAxis], rmax = ref.bmax[bestAxis];
+		if( rmax <= bestSplit )
+			below.push_back( ref );
+		else if( rmin >= bestSplit )
+			above.push_back( ref );
+		else {
+			clip( ref, lo, belowMax, corners, below );
+			clip( ref, aboveMin, hi, corners, above );
+		}
+	}
+	vector<Ref>().swap( refs );
+
+	nodes[index].split = bestSplit;
+	nodes[index].axis = bestAxis;
+	buildNode( below, lo, belowMax, depth - 1, corners );
+	int second = buildNode( above, aboveMin, hi, depth - 1, corners );
+	nodes[index].offset = second;
+	return index;
+}
+
+int KdTree::makeLeaf( const vector<Ref>& refs )
+{
+	Leaf leaf;
+	leaf.first = (int)prims.size();
+	leaf.count = (int)refs.size();
+	for( size_t k = 0; k < refs.size(); ++k )
+		prims.push_back( refs[k].prim );
+	leaves.push_back( leaf );
+	return (int)leaves.size() - 1;
+}
+
+// Sutherland-Hodgman: the part of polygon in (n corners) on one side of
+// a plane, into out.  Returns its corner count.
+static int clipPolygon( const Vec3r* in, int n, Vec3r* out, int axis, Real plane, bool keepBelow )
+{
+	int m = 0;
+	for( int k = 0; k < n; ++k ) {
+		const Vec3r& a = in[k];
+		const Vec3r& b = in[(k + 1) % n];
+		bool aIn = keepBelow ? a[axis] <= plane : a[axis] >= plane;
+		bool bIn = keepBelow ? b[axis] <= plane : b[axis] >= plane;
+		if( aIn ) out[m++] = a;
+		if( aIn != bIn ) {
+			Real t = (plane - a[axis]) / (b[axis] - a[axis]);
+			Vec3r p = a + (b - a) * t;
+			p[axis] = plane;
+			out[m++] = p;
+		}
+	}
+	return m;
+}
+
+// Put the part of ref inside lo .. hi in out, unless a triangle turns
+// out not to reach in there at all.  The triangle is clipped to a box a
+// little bigger than the node's, so that rounding never loses a corner
+// of it, and what comes out is then held to the node.
+void KdTree::clip( const Ref& ref, const Vec3r& lo, const Vec3r& hi,
+	const vector<Vec3r>* corners, vector<Ref>& out ) const
+{
+	Ref part;
+	part.prim = ref.prim;
+	part.bmin = maximum( ref.bmin, lo );
+	part.bmax = minimum( ref.bmax, hi );
+
+	if( corners ) {
+		Vec3r poly[2][12];
+		int count = 3;
+		for( int k = 0; k < 3; ++k )
+			poly[0][k] = (*corners)[3 * ref.prim + k];
+		int cur = 0;
+		for( int axis = 0; axis < 3 && count > 0; ++axis ) {
+			count = clipPolygon( poly[cur], count, poly[1 - cur], axis, lo[axis] - margin, false );
+			cur = 1 - cur;
+			if( count == 0 ) break;
+			count = clipPolygon( poly[cur], count, poly[1 - cur], axis, hi[axis] + margin, true );
+			cur = 1 - cur;
+		}
+		if( count == 0 ) return;
+
+		Vec3r cmin = poly[cur][0], cmax = poly[cur][0];
+		for( int k = 1; k < count; ++k ) {
+			cmin = minimum( cmin, poly[cur][k] );
+			cmax = maximum( cmax, poly[cur][k] );
+		}
+		part.bmin = maximum( part.bmin, cmin );
+		part.bmax = minimum( part.bmax, cmax );
+	}
+
+	for( int axis = 0; axis < 3; ++axis ) {
+		part.bmin[axis] = min( part.bmin[axis], hi[axis] );
+		part.bmax[axis] = max( part.bmax[axis], lo[axis] );
+		if( part.bmin[axis] > part.bmax[axis] ) part.bmax[axis] = part.bmin[axis];
+	}
+	out.push_back( part );
+}
+
+// Hand every node the ropes of its parent, the two children each other
+// across the split, and at the leaves push each rope down to the
+// smallest node that still covers the face.
+void KdTree::linkRopes( int n, const Vec3r& lo, const Vec3r& hi, const int* rope )
+{
+	const Node& node = nodes[n];
+	if( node.axis == LEAF ) {
+		Ropes& r = ropes[node.offset];
+		r.bmin = lo;
+		r.bmax = hi;
+		for( int face = 0; face < 6; ++face )
+			r.node[face] = rope[face] >= 0 ? lowerRope( rope[face], face, lo, hi ) : -1;
+		return;
+	}
+
+	int axis = node.axis;
+	int below = n + 1, above = node.offset;
+	Vec3r belowMax = hi, aboveMin = lo;
+	belowMax[axis] = node.split;
+	aboveMin[axis] = node.split;
+
+	int r[6];
+	copy( rope, rope + 6, r );
+	r[2 * axis + 1] = above;
+	linkRopes( below, lo, belowMax, r );
+	copy( rope, rope + 6, r );
+	r[2 * axis] = below;
+	linkRopes( above, aboveMin, hi, r );
+}
+
+int KdTree::lowerRope( int n, int face, const Vec3r& lo, const Vec3r& hi ) const
+{
+	int axis = face / 2;
+	bool high = (face & 1) != 0;
+	while( nodes[n].axis != LEAF ) {
+		const Node& node = nodes[n];
+		if( node.axis == axis )
+			n = high ? n + 1 : node.offset;
+		else if( node.split >= hi[node.axis] )
+			n = n + 1;
+		else if( node.split <= lo[node.axis] )
+			n = node.offset;
+		else
+			break;
+	}
+	return n;
+}
+
+bool KdTree::clipRay( const ray& r, Real& tnear, Real& tfar ) const
+{
+	const Vec3r& o = r.getPosition();
+	const Vec3r& d = r.getDirection();
+	tnear = 0.0;
+	tfar = RAY_INFINITY;
+	for( int axis = 0; axis < 3; ++axis ) {
+		if( d[axis] == 0.0 ) {
+			if( o[axis] < bmin[axis] || o[axis] > bmax[axis] ) return false;
+			continue;
+		}
+		Real ta = (bmin[axis] - o[axis]) / d[axis];
+		Real tb = (bmax[axis] - o[axis]) / d[axis];
+		if( ta > tb ) swap( ta, tb );
+		if( ta > tnear ) tnear = ta;
+		if( tb < tfar ) tfar = tb;
+	}
+	return tnear <= tfar;
+}
+
+size_t KdTree::memory() const
+{
+	return nodes.size() * sizeof(Node) + leaves.size() * sizeof(Leaf) +
+		ropes.size() * sizeof(Ropes) + prims.size() * sizeof(int);
+}
@@ -0,0 +1,290 @@
+//
+// kdtree.h
+//
+// A kd-tree over an indexed set of primitives, the alternative to the
+// BVH for meshes of long, thin triangles.  A BVH partitions the
+// triangles, and the boxes of thin ones lying across each other overlap
+// whichever way they are split; a kd-tree partitions space instead, and
+// a triangle that a split plane cuts goes to both sides, clipped to
+// each (the "perfect splits" of Wald and Havran), so that it is only
+// found where it actually is.  The planes are chosen by the surface
+// area heuristic, over every place a clipped primitive starts or ends.
+//
+// Like the BVH it only knows about boxes and indices, and hands the
+// primitives in the leaves a ray reaches to the caller's callbacks.  A
+// primitive may be in more than one leaf, and be handed out once for
+// each, so the callbacks must not count what they find; that is fine
+// for a mesh's faces, but not for a scene's transmissive objects.
+//
+// It is walked either with a small stack, front to back, or along
+// ropes (Popov et al.): each leaf keeps its box and, for each of its
+// six faces, the smallest node on the other side covering the face, and
+// the walk goes from leaf to leaf through the faces the ray leaves by,
+// with no stack at all.
+//
+
+#ifndef __KDTREE_H__
+#define __KDTREE_H__
+
+#include <vector>
+#include <math.h>
+
+#include "ray.h"
+#include "bbox.h"
+
+#include "../RenderStats.h"
+
+#include "../vecmath/vec.h"
+
+class KdTree {
+
+public:
+	KdTree() : roped( false ) {}
+
+	// Build the tree over the given boxes.  The primitive index handed
+	// back during a walk is the position of its box in this vector.  If
+	// the primitives are triangles, corners holds their three corners,
+	// one after another, and triangles cut by a split are clipped to its
+	// sides; other primitives are only bounded by their boxes.  With
+	// ropes, the leaves get the boxes and ropes walkRopes() needs.
+	void build( const std::vector<BoundingBox>& boxes, const std::vector<Vec3r>* corners, bool ropes );
+	void clear();
+
+	bool empty() const { return nodes.empty(); }
+	bool hasRopes() const { return roped; }
+
+	// Nodes, primitives in leaves (counting each primitive once for
+	// every leaf it is in), and the bytes the tree takes.
+	int nodeCount() const { return (int)nodes.size(); }
+	int referenceCount() const { return (int)prims.size(); }
+	size_t memory() const;
+
+	// As for BVH::intersect and BVH::occluded, walking the ropes if the
+	// tree has them.
+	template <class Hit>
+	bool intersect( const ray& r, Real& tmax, Hit& hit ) const;
+	template <class Blocked>
+	bool occluded( const ray& r, Real tmax, Blocked& blocked ) const;
+
+	// Trees are never deeper than this.
+	enum { MAX_DEPTH = 48 };
+
+private:
+	// Nodes are stored depth-first: the child below an interior node's
+	// split follows it, the one above lives at 'offset'.  For leaves,
+	// 'offset' indexes leaves.
+	struct Node {
+		Real split;
+		int axis;		// split axis, or LEAF
+		int offset;
+	};
+	enum { LEAF = 3 };
+
+	struct Leaf {
+		int first;		// into prims
+		int count;
+	};
+
+	// What the ropes walk needs of a leaf: its box, and the node on the
+	// far side of each face, 2 * axis for the low one and 2 * axis + 1
+	// for the high one, or -1 where the face is on the tree's boundary.
+	struct Ropes {
+		Vec3r bmin;
+		Vec3r bmax;
+		int node[6];
+	};
+
+	// A primitive in a node, bounded by the part of it inside the node.
+	struct Ref {
+		int prim;
+		Vec3r bmin;
+		Vec3r bmax;
+	};
+
+	int buildNode( std::vector<Ref>& refs, const Vec3r& bmin, const Vec3r& bmax, int depth,
+		const std::vector<Vec3r>* corners );
+	int makeLeaf( const std::vector<Ref>& refs );
+	void clip( const Ref& ref, const Vec3r& bmin, const Vec3r& bmax,
+		const std::vector<Vec3r>* corners, std::vector<Ref>& out ) const;
+	void linkRopes( int node, const Vec3r& bmin, const Vec3r& bmax, const int* rope );
+	int lowerRope( int node, int face, const Vec3r& bmin, const Vec3r& bmax ) const;
+
+	// The ray's stretch inside the tree's box, if any.
+	bool clipRay( const ray& r, Real& tnear, Real& tfar ) const;
+
+	template <class Visit>
+	bool walkStack( const ray& r, const Real& tmax, Visit& visit ) const;
+	template <class Visit>
+	bool walkRopes( const ray& r, const Real& tmax, Visit& visit ) const;
+
+	template <class Hit> struct ClosestVisit;
+	template <class Blocked> struct AnyVisit;
+
+	std::vector<Node> nodes;
+	std::vector<Leaf> leaves;
+	std::vector<Ropes> ropes;	// for each leaf, if roped
+	std::vector<int> prims;
+	Vec3r bmin, bmax;
+	Real margin;			// how much the clipping pads, which the walks allow for too
+	bool roped;
+};
+
+// Both walks call visit( leaf, tExit ) for every leaf the ray passes
+// through before tmax, front to back, with where the ray leaves it, and
+// stop as soon as it returns true.  visit may shrink tmax.
+
+template <class Visit>
+bool KdTree::walkStack( const ray& r, const Real& tmax, Visit& visit ) const
+{
+	Real tnear, tfar;
+	if( !clipRay( r, tnear, tfar ) ) return false;
+
+	const Vec3r& o = r.getPosition();
+	const Vec3r& d = r.getDirection();
+
+	struct Todo {
+		int node;
+		Real tmin, tmax;
+	} todo[MAX_DEPTH + 1];
+	int pending = 0;
+
+	int n = 0;
+	Real tmin = tnear;
+	Real tend = tfar;
+	for( ;; ) {
+		if( tmin > tmax ) return false;
+		const Node& node = nodes[n];
+		RENDER_STAT( countNodeVisits( 1 ) );
+		if( node.axis != LEAF ) {
+			int axis = node.axis;
+			bool belowFirst = o[axis] < node.split || (o[axis] == node.split && d[axis] <= 0.0);
+			int first = belowFirst ? n + 1 : node.offset;
+			int second = belowFirst ? node.offset : n + 1;
+			Real tplane = d[axis] != 0.0 ? (node.split - o[axis]) / d[axis] : RAY_INFINITY;
+			if( tplane > tend || tplane <= 0.0 )
+				n = first;
+			else if( tplane < tmin )
+				n = second;
+			else {
+				todo[pending].node = second;
+				todo[pending].tmin = tplane;
+				todo[pending].tmax = tend;
+				++pending;
+				n = first;
+				tend = tplane;
+			}
+			continue;
+		}
+
+		if( visit( leaves[node.offset], tend ) ) return true;
+		if( pending == 0 ) return false;
+		--pending;
+		n = todo[pending].node;
+		tmin = todo[pending].tmin;
+		tend = todo[pending].tmax;
+	}
+}
+
+template <class Visit>
+bool KdTree::walkRopes( const ray& r, const Real& tmax, Visit& visit ) const
+{
+	Real tnear, tfar;
+	if( !clipRay( r, tnear, tfar ) ) return false;
+
+	const Vec3r& o = r.getPosition();
+	const Vec3r& d = r.getDirection();
+
+	int n = 0;
+	Real t = tnear;
+	for( ;; ) {
+		// Down to the leaf where the ray is at t, going with the ray
+		// where it is on a split.
+		Vec3r p = o + d * t;
+		while( nodes[n].axis != LEAF ) {
+			const Node& node = nodes[n];
+			RENDER_STAT( countNodeVisits( 1 ) );
+			int axis = node.axis;
+			bool below = p[axis] < node.split || (p[axis] == node.split && d[axis] < 0.0);
+			n = below ? n + 1 : node.offset;
+		}
+		RENDER_STAT( countNodeVisits( 1 ) );
+
+		// Out through the nearest of the faces ahead.
+		int leaf = nodes[n].offset;
+		const Ropes& rp = ropes[leaf];
+		Real texit = RAY_INFINITY;
+		int face = -1;
+		for( int axis = 0; axis < 3; ++axis ) {
+			if( d[axis] == 0.0 ) continue;
+			Real plane = d[axis] > 0.0 ? rp.bmax[axis] : rp.bmin[axis];
+			Real tp = (plane - o[axis]) / d[axis];
+			if( tp < texit ) {
+				texit = tp;
+				face = 2 * axis + (d[axis] > 0.0 ? 1 : 0);
+			}
+		}
+		if( texit < t ) texit = t;
+
+		if( visit( leaves[leaf], texit ) ) return true;
+		if( texit >= tmax || texit >= tfar || face < 0 || rp.node[face] < 0 ) return false;
+		n = rp.node[face];
+		t = texit;
+	}
+}
+
+// A leaf's primitives.  Nothing further along can be closer once a hit
+// is found before the ray leaves the leaf.
+template <class Hit>
+struct KdTree::ClosestVisit {
+	const std::vector<int>& prims;
+	Real& tmax;
+	Hit& hit;
+	bool found;
+
+	ClosestVisit( const std::vector<int>& p, Real& t, Hit& h )
+		: prims( p ), tmax( t ), hit( h ), found( false ) {}
+
+	bool operator()( const Leaf& leaf, Real tExit ) {
+		for( int k = leaf.first; k < leaf.first + leaf.count; ++k )
+			if( hit( prims[k], tmax ) ) found = true;
+		return tmax <= tExit;
+	}
+};
+
+template <class Blocked>
+struct KdTree::AnyVisit {
+	const std::vector<int>& prims;
+	Real tmax;
+	Blocked& blocked;
+
+	AnyVisit( const std::vector<int>& p, Real t, Blocked& b )
+		: prims( p ), tmax( t ), blocked( b ) {}
+
+	bool operator()( const Leaf& leaf, Real ) {
+		for( int k = leaf.first; k < leaf.first + leaf.count; ++k )
+			if( blocked( prims[k], tmax ) ) return true;
+		return false;
+	}
+};
+
+template <class Hit>
+bool KdTree::intersect( const ray& r, Real& tmax, Hit& hit ) const
+{
+	if( empty() ) return false;
+	ClosestVisit<Hit> visit( prims, tmax, hit );
+	if( roped )
+		walkRopes( r, tmax, visit );
+	else
+		walkStack( r, tmax, visit );
+	return visit.found;
+}
+
+template <class Blocked>
+bool KdTree::occluded( const ray& r, Real tmax, Blocked& blocked ) const
+{
+	if( empty() ) return false;
+	AnyVisit<Blocked> visit( prims, tmax, blocked );
+	return roped ? walkRopes( r, tmax, visit ) : walkStack( r, tmax, visit );
+}
+
+#endif // __KDTREE_H__
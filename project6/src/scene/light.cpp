@@ -7,7 +7,7 @@
 
 using namespace std;
 
-double min(double a, double b)
+Real min(Real a, Real b)
 {
   if (a < b)
     return a;
@@ -15,72 +15,73 @@ double min(double a, double b)
     return b;
 }
 
-double DirectionalLight::distanceAttenuation( const Vec3d& P ) const
+Vec3r Light::shadowAttenuation( const Vec3r& P ) const
+{
+  // Check to see if anything blocks the way to the light.
+  Real tmax;
+  ray r = shadowRay(P, tmax);
+  Vec3r transmission;
+
+  if (scene->occluded(r, tmax, transmission)) {
+    return Vec3r(0,0,0);
+  }
+  return transmission;
+}
+
+Real DirectionalLight::distanceAttenuation( const Vec3r& P ) const
 {
   // distance to light is infinite, so f(di) goes to 0.  Return 1.
   return 1.0;
 }
 
 
-Vec3d DirectionalLight::shadowAttenuation( const Vec3d& P ) const
+ray DirectionalLight::shadowRay( const Vec3r& P, Real& tmax ) const
 {
-  // Check to see if blocked
-  isect i;
-  ray r (P, -orientation, ray::SHADOW);
-
-  if (scene->intersect(r, i)) {
-    return ( prod(Vec3d(1,1,1), i.getMaterial().kt(i)) );
-  } else {
-    return Vec3d(1,1,1);
-  }
+  // The light is infinitely far away.
+  tmax = RAY_INFINITY;
+  return ray(P, -orientation, ray::SHADOW);
 }
 
-Vec3d DirectionalLight::getColor( const Vec3d& P ) const
+Vec3r DirectionalLight::getColor( const Vec3r& P ) const
 {
   // Color doesn't depend on P 
   return color;
 }
 
-Vec3d DirectionalLight::getDirection( const Vec3d& P ) const
+Vec3r DirectionalLight::getDirection( const Vec3r& P ) const
 {
   return -orientation;
 }
 
-double PointLight::distanceAttenuation( const Vec3d& P ) const
+Real PointLight::distanceAttenuation( const Vec3r& P ) const
 {
   // These three values are the a, b, and c in the distance
   // attenuation function (from the slide labelled 
   // "Intensity drop-off with distance"):
   // f(d) = min( 1, 1/( a + b d + c d^2 ) )
-  Vec3d ans = P - position;
-  double d = sqrt(pow(ans[0],2) + pow(ans[1],2) + pow(ans[2],2));
+  Vec3r ans = P - position;
+  Real d = sqrt(pow(ans[0],2) + pow(ans[1],2) + pow(ans[2],2));
   
   return min( 1, 1/(constantTerm + linearTerm * d + quadraticTerm * pow(d,2)));
 }
 
-Vec3d PointLight::getColor( const Vec3d& P ) const
+Vec3r PointLight::getColor( const Vec3r& P ) const
 {
   // Color doesn't depend on P 
   return color;
 }
 
-Vec3d PointLight::getDirection( const Vec3d& P ) const
+Vec3r PointLight::getDirection( const Vec3r& P ) const
 {
-  Vec3d ret = position - P;
+  Vec3r ret = position - P;
   ret.normalize();
   return ret;
 }
 
 
-Vec3d PointLight::shadowAttenuation(const Vec3d& P) const
+ray PointLight::shadowRay( const Vec3r& P, Real& tmax ) const
 {
-  // Check to see if blocked
-  isect i;
-  ray r (P, position - P, ray::SHADOW);
-
-  if (scene->intersect(r, i) && i.t < 1 && i.t > 0) {
-    return ( prod(Vec3d(1,1,1), i.getMaterial().kt(i)) );
-  } else {
-    return Vec3d(1,1,1);
-  }
+  // The direction isn't normalized, so the light sits at t = 1.
+  tmax = 1.0;
+  return ray(P, position - P, ray::SHADOW);
 }
@@ -13,16 +13,18 @@ class Light
     : public SceneElement
 {
  public:
-  virtual Vec3d shadowAttenuation(const Vec3d& P) const = 0;
-  virtual double distanceAttenuation( const Vec3d& P ) const = 0;
-  virtual Vec3d getColor( const Vec3d& P ) const = 0;
-  virtual Vec3d getDirection( const Vec3d& P ) const = 0;
+  virtual Vec3r shadowAttenuation(const Vec3r& P) const;
+  // The ray from P toward the light, and how far along it the light is.
+  virtual ray shadowRay( const Vec3r& P, Real& tmax ) const = 0;
+  virtual Real distanceAttenuation( const Vec3r& P ) const = 0;
+  virtual Vec3r getColor( const Vec3r& P ) const = 0;
+  virtual Vec3r getDirection( const Vec3r& P ) const = 0;
 
  protected:
-  Light( Scene *scene, const Vec3d& col )
+  Light( Scene *scene, const Vec3r& col )
       : SceneElement( scene ), color( col ) {}
 
-  Vec3d 		color;
+  Vec3r 		color;
 
  public:
   virtual void glDraw(GLenum lightID) const { }
@@ -33,15 +35,17 @@ class DirectionalLight
     : public Light
 {
  public:
-  DirectionalLight( Scene *scene, const Vec3d& orien, const Vec3d& color )
+  DirectionalLight( Scene *scene, const Vec3r& orien, const Vec3r& color )
       : Light( scene, color ), orientation( orien ) { orientation.normalize(); }
-  virtual Vec3d shadowAttenuation(const Vec3d& P) const;
-  virtual double distanceAttenuation( const Vec3d& P ) const;
-  virtual Vec3d getColor( const Vec3d& P ) const;
-  virtual Vec3d getDirection( const Vec3d& P ) const;
+  virtual ray shadowRay( const Vec3r& P, Real& tmax ) const;
+  virtual Real distanceAttenuation( const Vec3r& P ) const;
+  virtual Vec3r getColor( const Vec3r& P ) const;
+  virtual Vec3r getDirection( const Vec3r& P ) const;
 
  protected:
-  Vec3d 		orientation;
+  friend class SceneCache;
+
+  Vec3r 		orientation;
 
  public:
   void glDraw(GLenum lightID) const;
@@ -52,7 +56,7 @@ class PointLight
     : public Light
 {
  public:
-  PointLight( Scene *scene, const Vec3d& pos, const Vec3d& color,
+  PointLight( Scene *scene, const Vec3r& pos, const Vec3r& color,
               float constantAttenuationTerm, float linearAttenuationTerm,
               float quadraticAttenuationTerm )
       : Light( scene, color ), position( pos ),
@@ -61,10 +65,10 @@ class PointLight
         quadraticTerm(quadraticAttenuationTerm) 
   {}
 
-  virtual Vec3d shadowAttenuation(const Vec3d& P) const;
-  virtual double distanceAttenuation( const Vec3d& P ) const;
-  virtual Vec3d getColor( const Vec3d& P ) const;
-  virtual Vec3d getDirection( const Vec3d& P ) const;
+  virtual ray shadowRay( const Vec3r& P, Real& tmax ) const;
+  virtual Real distanceAttenuation( const Vec3r& P ) const;
+  virtual Vec3r getColor( const Vec3r& P ) const;
+  virtual Vec3r getDirection( const Vec3r& P ) const;
 
   void setAttenuationConstants( float a, float b, float c )
   {
@@ -74,7 +78,9 @@ class PointLight
   }
 
  protected:
-  Vec3d position;
+  friend class SceneCache;
+
+  Vec3r position;
 
   // These three values are the a, b, and c in the distance
   // attenuation function (from the slide labelled 
@@ -8,7 +8,7 @@
 using namespace std;
 extern bool debugMode;
 
-double max(double a, double b)
+Real max(Real a, Real b)
 {
   if (a > b)
     return a;
@@ -19,37 +19,53 @@ double max(double a, double b)
 // Apply the phong model to this point on the surface of the object, returning
 // the color of that point. Uses shaddowAttenuation which sends a shadow ray
 // to check if there is an intersection that blocks the light sources.
-Vec3d Material::shade( Scene *scene, const ray& r, const isect& i ) const
+Vec3r Material::shade( Scene *scene, const ray& r, const isect& i ) const
 {
-  Vec3d retVal = ke(i) + prod(ka(i), scene->ambient());
+  Vec3r retVal = shadeAmbient(scene, i);
   
   // Applies calculations for each light source
   for (vector<Light*>::const_iterator litr = scene->beginLights(); 
        litr != scene->endLights(); ++litr) {
-    Vec3d point = r.getPosition() + r.getDirection() * i.t;
+    Vec3r point = r.getPosition() + r.getDirection() * i.t;
     Light* pLight = *litr;
-  
-    Vec3d reflectionAngle = 2 * (i.N * pLight->getDirection(point)) * i.N - pLight->getDirection(point);
-
-    Vec3d diffIntensity = kd(i) * (max(0, i.N * pLight->getDirection(point)));
-
-    Vec3d viewerAngle = scene->getCamera().getEye() - point;
-    viewerAngle.normalize();
-    Vec3d specIntensity = ks(i) * pow(max(0, viewerAngle * reflectionAngle), shininess(i));
-
-    Vec3d lcolor = pLight->getColor(point);
 
-    Vec3d totalColor = prod(diffIntensity + specIntensity, lcolor);
-    totalColor = totalColor * pLight->distanceAttenuation(point);
-    totalColor = prod(totalColor, pLight->shadowAttenuation(point));
+    Vec3r totalColor = shadeLight(scene, pLight, point, i);
+    Vec3r origin = offsetOrigin(point, i.N, pLight->getDirection(point));
+    totalColor = prod(totalColor, pLight->shadowAttenuation(origin));
 
     retVal = retVal + totalColor;	
   }
   return retVal;
 }
 
+Vec3r Material::shadeAmbient( Scene *scene, const isect& i ) const
+{
+  return ke(i) + prod(ka(i), scene->ambient());
+}
+
+// Diffuse and specular light from pLight at point, as if nothing stood
+// in its way.
+Vec3r Material::shadeLight( Scene *scene, const Light* pLight, const Vec3r& point,
+                            const isect& i ) const
+{
+  Vec3r reflectionAngle = 2 * (i.N * pLight->getDirection(point)) * i.N - pLight->getDirection(point);
+
+  Vec3r diffIntensity = kd(i) * (max(0, i.N * pLight->getDirection(point)));
+
+  Vec3r viewerAngle = scene->getCamera().getEye() - point;
+  viewerAngle.normalize();
+  Vec3r specIntensity = ks(i) * pow(max(0, viewerAngle * reflectionAngle), shininess(i));
+
+  Vec3r lcolor = pLight->getColor(point);
+
+  Vec3r totalColor = prod(diffIntensity + specIntensity, lcolor);
+  return totalColor * pLight->distanceAttenuation(point);
+}
+
 TextureMap::TextureMap( string filename ) {
 
+  this->filename = filename;
+
   int start = filename.find_last_of('.');
   int end = filename.size() - 1;
   if (start >= 0 && start < end) {
@@ -57,7 +73,7 @@ TextureMap::TextureMap( string filename ) {
     if (!ext.compare(".png")) {
       png_cleanup(1);
       if (!png_init(filename.c_str(), width, height)) {
-        double gamma = 2.2;
+        Real gamma = 2.2;
         int channels, rowBytes;
         unsigned char* indata = png_get_image(gamma, channels, rowBytes);
         int bufsize = rowBytes * height;
@@ -83,21 +99,21 @@ TextureMap::TextureMap( string filename ) {
   }
 }
 
-Vec3d TextureMap::getMappedValue( const Vec2d& coord ) const
+Vec3r TextureMap::getMappedValue( const Vec2r& coord ) const
 {
   int x = coord[0] * width;
   int y = coord[1] * height;
 
-  return Vec3d(getPixelAt(x,y));
+  return Vec3r(getPixelAt(x,y));
 }
 
 
-Vec3d TextureMap::getPixelAt( int x, int y ) const
+Vec3r TextureMap::getPixelAt( int x, int y ) const
 {
   // This keeps it from crashing if it can't load
   // the texture, but the person tries to render anyway.
   if (0 == data)
-    return Vec3d(1.0, 1.0, 1.0);
+    return Vec3r(1.0, 1.0, 1.0);
 
   if( x >= width )
     x = width - 1;
@@ -106,12 +122,12 @@ Vec3d TextureMap::getPixelAt( int x, int y ) const
 
   // Find the position in the big data array...
   int pos = (y * width + x) * 3;
-  return Vec3d( double(data[pos]) / 255.0, 
-                double(data[pos+1]) / 255.0,
-                double(data[pos+2]) / 255.0 );
+  return Vec3r( Real(data[pos]) / 255.0, 
+                Real(data[pos+1]) / 255.0,
+                Real(data[pos+2]) / 255.0 );
 }
 
-Vec3d MaterialParameter::value( const isect& is ) const
+Vec3r MaterialParameter::value( const isect& is ) const
 {
   if( 0 != _textureMap )
     return _textureMap->getMappedValue( is.uvCoordinates );
@@ -119,11 +135,11 @@ Vec3d MaterialParameter::value( const isect& is ) const
     return _value;
 }
 
-double MaterialParameter::intensityValue( const isect& is ) const
+Real MaterialParameter::intensityValue( const isect& is ) const
 {
   if( 0 != _textureMap )
   {
-    Vec3d value( _textureMap->getMappedValue( is.uvCoordinates ) );
+    Vec3r value( _textureMap->getMappedValue( is.uvCoordinates ) );
     return (0.299 * value[0]) + (0.587 * value[1]) + (0.114 * value[2]);
   }
   else
@@ -14,6 +14,7 @@
 class Scene;
 class ray;
 class isect;
+class Light;
 
 using std::string;
 
@@ -32,7 +33,9 @@ class TextureMap
   // is assumed to be within the parametrization space:
   // [0, 1] x [0, 1]
   // (i.e., {(u, v): 0 <= u <= 1 and 0 <= v <= 1}
-  Vec3d getMappedValue( const Vec2d& coord ) const;
+  Vec3r getMappedValue( const Vec2r& coord ) const;
+
+  const string& getFilename() const { return filename; }
   ~TextureMap()
   { delete data; }
 
@@ -41,7 +44,7 @@ class TextureMap
   // (with integer coordinates) in the bitmap.
   // Should be called from getMappedValue in order to
   // do bilinear interpolation.
-  Vec3d getPixelAt( int x, int y ) const;
+  Vec3r getPixelAt( int x, int y ) const;
 
   string filename;
   int width;
@@ -78,11 +81,11 @@ class TextureMapException
 class MaterialParameter
 {
  public:
-  explicit MaterialParameter( const Vec3d& par )
+  explicit MaterialParameter( const Vec3r& par )
       : _value( par ), _textureMap( 0 )
   { }
 
-  explicit MaterialParameter( const double par )
+  explicit MaterialParameter( const Real par )
       : _value( par, par, par ), _textureMap( 0 )
   { }
 
@@ -100,7 +103,7 @@ class MaterialParameter
     return *this;
   }
 
-  Vec3d& operator*=( const Vec3d& rhs )
+  Vec3r& operator*=( const Vec3r& rhs )
   {
     _value[0] *= rhs[0];
     _value[1] *= rhs[1];
@@ -108,7 +111,7 @@ class MaterialParameter
     return _value;
   }
 
-  Vec3d& operator*=( const double rhs )
+  Vec3r& operator*=( const Real rhs )
   {
     _value[0] *= rhs;
     _value[1] *= rhs;
@@ -122,13 +125,13 @@ class MaterialParameter
     return *this;
   }
 
-  void setValue( const Vec3d& rhs )
+  void setValue( const Vec3r& rhs )
   {
     _value = rhs;
     _textureMap = 0;
   }
 
-  void setValue( const double rhs )
+  void setValue( const Real rhs )
   {
     _value[0] = rhs;
     _value[1] = rhs;
@@ -136,21 +139,29 @@ class MaterialParameter
     _textureMap = 0;
   }
 
-  Vec3d& operator+=( const Vec3d& rhs )
+  Vec3r& operator+=( const Vec3r& rhs )
   {
     _value += rhs;
     return _value;
   }
 
-  Vec3d value( const isect& is ) const;
-  double intensityValue( const isect& is ) const;
+  Vec3r value( const isect& is ) const;
+  Real intensityValue( const isect& is ) const;
 
   // Use this to determine if the particular parameter is
   // mapped; use this to determine if we need to somehow renormalize.
   bool mapped() const { return _textureMap != 0; }
 
+  // True if the parameter is zero everywhere, i.e. unmapped and black.
+  bool isZero() const
+  {
+    return !_textureMap && _value[0] == 0.0 && _value[1] == 0.0 && _value[2] == 0.0;
+  }
+
  private:
-  Vec3d _value;
+  friend class SceneCache;
+
+  Vec3r _value;
   TextureMap* _textureMap;
 };
 
@@ -159,21 +170,28 @@ class Material
 
  public:
   Material()
-      : _ke( Vec3d( 0.0, 0.0, 0.0 ) )
-      , _ka( Vec3d( 0.0, 0.0, 0.0 ) )
-      , _ks( Vec3d( 0.0, 0.0, 0.0 ) )
-      , _kd( Vec3d( 0.0, 0.0, 0.0 ) )
-      , _kr( Vec3d( 0.0, 0.0, 0.0 ) )
-      , _kt( Vec3d( 0.0, 0.0, 0.0 ) )
+      : _ke( Vec3r( 0.0, 0.0, 0.0 ) )
+      , _ka( Vec3r( 0.0, 0.0, 0.0 ) )
+      , _ks( Vec3r( 0.0, 0.0, 0.0 ) )
+      , _kd( Vec3r( 0.0, 0.0, 0.0 ) )
+      , _kr( Vec3r( 0.0, 0.0, 0.0 ) )
+      , _kt( Vec3r( 0.0, 0.0, 0.0 ) )
       , _shininess( 0.0 ) 
       , _index(1.0) {}
 
-  Material( const Vec3d& e, const Vec3d& a, const Vec3d& s, 
-            const Vec3d& d, const Vec3d& r, const Vec3d& t, double sh, double in)
+  Material( const Vec3r& e, const Vec3r& a, const Vec3r& s, 
+            const Vec3r& d, const Vec3r& r, const Vec3r& t, Real sh, Real in)
       : _ke( e ), _ka( a ), _ks( s ), _kd( d ), _kr( r ), _kt( t ), 
-        _shininess( Vec3d(sh,sh,sh) ), _index( Vec3d(in,in,in) ) {}
+        _shininess( Vec3r(sh,sh,sh) ), _index( Vec3r(in,in,in) ) {}
+
+  virtual Vec3r shade( Scene *scene, const ray& r, const isect& i ) const;
 
-  virtual Vec3d shade( Scene *scene, const ray& r, const isect& i ) const;
+  // The two halves of shade(): the light the surface gives off or picks
+  // up from the ambient term, and what one light contributes to the
+  // point before shadowing is taken into account.
+  Vec3r shadeAmbient( Scene *scene, const isect& i ) const;
+  Vec3r shadeLight( Scene *scene, const Light* pLight, const Vec3r& point,
+                    const isect& i ) const;
 
 
     
@@ -191,19 +209,23 @@ class Material
     return *this;
   }
 
-  friend Material operator*( double d, Material m );
+  friend Material operator*( Real d, Material m );
 
   // Accessor functions; we pass in an isect& for cases where
   // the parameter is dependent on, for example, world-space
   // coordinates (i.e., solid textures) or parametrized coordinates
   // (i.e., mapped textures)
-  Vec3d ke( const isect& i ) const { return _ke.value(i); }
-  Vec3d ka( const isect& i ) const { return _ka.value(i); }
-  Vec3d ks( const isect& i ) const { return _ks.value(i); }
-  Vec3d kd( const isect& i ) const { return _kd.value(i); }
-  Vec3d kr( const isect& i ) const { return _kr.value(i); }
-  Vec3d kt( const isect& i ) const { return _kt.value(i); }
-  double shininess( const isect& i ) const
+  Vec3r ke( const isect& i ) const { return _ke.value(i); }
+  Vec3r ka( const isect& i ) const { return _ka.value(i); }
+  Vec3r ks( const isect& i ) const { return _ks.value(i); }
+  Vec3r kd( const isect& i ) const { return _kd.value(i); }
+  Vec3r kr( const isect& i ) const { return _kr.value(i); }
+  Vec3r kt( const isect& i ) const { return _kt.value(i); }
+
+  // Whether any light can get through; shadow rays stop at the first
+  // surface for which this is false.
+  bool transmissive() const { return !_kt.isZero(); }
+  Real shininess( const isect& i ) const
   {
     // Have to renormalize into the range 0-128 if it's texture mapped.
     return _shininess.mapped() ? 
@@ -211,18 +233,18 @@ class Material
         _shininess.intensityValue(i);
   }
 
-  double index( const isect& i ) const { return _index.intensityValue(i); }
+  Real index( const isect& i ) const { return _index.intensityValue(i); }
 
-  // setting functions accepting primitives (Vec3d and double)
-  void setEmissive( const Vec3d& ke )     { _ke.setValue( ke ); }
-  void setAmbient( const Vec3d& ka )      { _ka.setValue( ka ); }
-  void setSpecular( const Vec3d& ks )     { _ks.setValue( ks ); }
-  void setDiffuse( const Vec3d& kd )      { _kd.setValue( kd ); }
-  void setReflective( const Vec3d& kr )   { _kr.setValue( kr ); }
-  void setTransmissive( const Vec3d& kt ) { _kt.setValue( kt ); }
-  void setShininess( double shininess )   
+  // setting functions accepting primitives (Vec3r and Real)
+  void setEmissive( const Vec3r& ke )     { _ke.setValue( ke ); }
+  void setAmbient( const Vec3r& ka )      { _ka.setValue( ka ); }
+  void setSpecular( const Vec3r& ks )     { _ks.setValue( ks ); }
+  void setDiffuse( const Vec3r& kd )      { _kd.setValue( kd ); }
+  void setReflective( const Vec3r& kr )   { _kr.setValue( kr ); }
+  void setTransmissive( const Vec3r& kt ) { _kt.setValue( kt ); }
+  void setShininess( Real shininess )   
   { _shininess.setValue( shininess ); }
-  void setIndex( double index )           { _index.setValue( index ); }
+  void setIndex( Real index )           { _index.setValue( index ); }
 
 
   // setting functions taking MaterialParameters
@@ -237,6 +259,8 @@ class Material
   void setIndex( const MaterialParameter& index )            { _index = index; }
 
  private:
+  friend class SceneCache;
+
   MaterialParameter _ke;                    // emissive
   MaterialParameter _ka;                    // ambient
   MaterialParameter _ks;                    // specular
@@ -251,7 +275,7 @@ class Material
 
 // This doesn't necessarily make sense for mapped materials
 inline Material
-operator*( double d, Material m )
+operator*( Real d, Material m )
 {
   m._ke *= d;
   m._ka *= d;
@@ -10,6 +10,10 @@
 // who the hell cares if my identifiers are longer than 255 characters:
 #pragma warning(disable : 4786)
 
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
 #include "../vecmath/vec.h"
 #include "../vecmath/mat.h"
 #include "material.h"
@@ -30,30 +34,34 @@ public:
 	};
 
 
-	ray( const Vec3d& pp, const Vec3d& dd, RayType tt = VISIBILITY )
+	ray()
+		: p(), d(), t( VISIBILITY ) {}
+	ray( const Vec3r& pp, const Vec3r& dd, RayType tt = VISIBILITY )
 		: p( pp ), d( dd ), t( tt ) {}
 	ray( const ray& other ) 
 		: p( other.p ), d( other.d ), t( other.t ) {}
 	~ray() {}
 
 	ray& operator =( const ray& other ) 
-	{ p = other.p; d = other.d; return *this; }
+	{ p = other.p; d = other.d; t = other.t; return *this; }
 
-	Vec3d at( double t ) const
+	Vec3r at( Real t ) const
 	{ return p + (t*d); }
 
-	Vec3d getPosition() const { return p; }
-	Vec3d getDirection() const { return d; }
+	Vec3r getPosition() const { return p; }
+	Vec3r getDirection() const { return d; }
 
 	RayType type() const	{ return t; }
 
 protected:
-	Vec3d p;
-	Vec3d d;
+	Vec3r p;
+	Vec3r d;
 	RayType t; 
 };
 
-// The description of an intersection point.
+// The description of an intersection point.  This gets copied around a
+// lot in the innermost loops, so it owns nothing: the material pointer
+// refers to storage that lives at least as long as the scene.
 
 class isect
 {
@@ -61,77 +69,56 @@ public:
     isect()
         : obj( NULL ), t( 0.0 ), N(), material(0) {}
 
-    ~isect()
-    {
-        delete material;
-    }
-    
     void setObject( const SceneObject *o ) { obj = o; }
-    void setT( double tt ) { t = tt; }
-    void setN( const Vec3d& n ) { N = n; }
+    void setT( Real tt ) { t = tt; }
+    void setN( const Vec3r& n ) { N = n; }
     void setMaterial( const Material& m ) 
-      { if(material) *material = m; else material = new Material(m); }
-    void setUVCoordinates( const Vec2d& coords )
+      { material = &m; }
+    void setUVCoordinates( const Vec2r& coords )
       { uvCoordinates = coords; }
-    void setBary( const Vec3d& weights )
+    void setBary( const Vec3r& weights )
       { bary = weights; }
-    void setBary( const double alpha, const double beta, const double gamma )
+    void setBary( const Real alpha, const Real beta, const Real gamma )
       { bary[0] = alpha; bary[1] = beta; bary[2] = gamma; }
- 
-    isect( const isect& other )
-    {
-        obj = other.obj;
-        t = other.t;
-        N = other.N;
-		bary = other.bary;
-        uvCoordinates = other.uvCoordinates;
-        if( other.material )
-          material = new Material( *other.material );
-        else
-          material = 0;
-
-    }
-   
-    isect& operator =( const isect& other )
-    {
-        if( this != &other )
-        {
-            obj = other.obj;
-            t = other.t;
-            N = other.N;
-			bary = other.bary;
-            uvCoordinates = other.uvCoordinates;
-//            material = other.material ? new Material( *(other.material) ) : 0;
-			if( other.material )
-            {
-                if( material )
-                    *material = *other.material;
-                else
-                    material = new Material(*other.material );
-            }
-            else
-            {
-                delete material;
-                material = 0;
-            }
-        }
-        return *this;
-    }
 
 public:
     const SceneObject *obj;
-    double t;
-    Vec3d N;
-    Vec2d uvCoordinates;
-    Vec3d bary;
-    Material *material;         // if this intersection has its own material
-                                // (as opposed to one in its associated object)
-                                // as in the case where the material was interpolated
+    Real t;
+    Vec3r N;
+    Vec2r uvCoordinates;
+    Vec3r bary;
+    const Material *material;   // if this intersection has its own material
+                                // (as opposed to one in its associated object);
+                                // not owned by the isect
 
     const Material &getMaterial() const;
     // Other info here.
 };
 
-const double RAY_EPSILON = 0.00000001;
+// Hits closer than RAY_EPSILON along a ray don't count.  float can't
+// place a hit anywhere near as finely as double, so its epsilon is
+// coarser; secondary rays don't rely on it anyway (see offsetOrigin).
+#ifdef RAY_FLOAT
+const Real RAY_EPSILON = 0.00001f;
+#else
+const Real RAY_EPSILON = 0.00000001;
+#endif
+
+// A tmax that no hit is beyond.
+const Real RAY_INFINITY = std::numeric_limits<Real>::max();
+
+// Where a ray leaving the surface at p, with normal n, in direction d
+// should start.  p is only as good as the arithmetic that found it, so
+// it is pushed off the surface, to the side d leaves by, further than
+// that arithmetic can be off: 64 units in the last place of p's largest
+// coordinate.  That keeps the ray from hitting the surface it leaves
+// without an epsilon that only suits one scale of scene.
+inline Vec3r offsetOrigin( const Vec3r& p, const Vec3r& n, const Vec3r& d )
+{
+	Real largest = std::max( std::max( Real( 1 ), std::fabs( p[0] ) ),
+		std::max( std::fabs( p[1] ), std::fabs( p[2] ) ) );
+	Real offset = 64 * std::numeric_limits<Real>::epsilon() * largest;
+	return p + n * ( d * n < 0 ? -offset : offset );
+}
 
 #endif // __RAY_H__
@@ -2,30 +2,123 @@
 
 #include "scene.h"
 #include "light.h"
+#include "../RenderStats.h"
 #include "../ui/TraceUI.h"
 extern TraceUI* traceUI;
+extern bool debugMode;
 
 using namespace std;
 
+// Identity, translation and uniform scale are told apart exactly, and
+// their inverses worked out directly rather than read off the general
+// 4x4 one, so the common unit shape moved into place loses nothing.
+void TransformNode::classify() {
+	const Real* m = xform.n;
+	bool diagonal = m[1] == 0.0 && m[2] == 0.0 && m[4] == 0.0 &&
+		m[6] == 0.0 && m[8] == 0.0 && m[9] == 0.0;
+	bool uniform = diagonal && m[0] == m[5] && m[0] == m[10] && m[0] != 0.0;
+	Vec3r translation( m[3], m[7], m[11] );
+
+	scale = 1.0;
+	if( uniform && m[0] == 1.0 ) {
+		kind = translation.iszero() ? IDENTITY : TRANSLATION;
+		offset = -translation;
+	} else if( uniform ) {
+		kind = UNIFORM_SCALE;
+		scale = 1.0 / m[0];
+		offset = -translation * scale;
+	} else {
+		kind = AFFINE;
+		linear = inverse.upper33();
+		offset = Vec3r( inverse.n[3], inverse.n[7], inverse.n[11] );
+	}
+}
+
+void TransformNode::setLocalTransform(const Mat4r& xform) {
+	local = xform;
+	update();
+}
+
+void TransformNode::update() {
+	xform = parent == NULL ? local : parent->xform * local;
+	inverse = xform.inverse();
+	normi = xform.upper33().inverse().transpose();
+	classify();
+	for( child_iter c = children.begin(); c != children.end(); ++c )
+		(*c)->update();
+}
+
 bool Geometry::intersect(const ray&r, isect&i) const {
-	double tmin, tmax;
+	Real tmin, tmax;
 	if (hasBoundingBoxCapability() && !(bounds.intersect(r, tmin, tmax))) return false;
-	// Transform the ray into the object's local coordinate space
-	Vec3d pos = transform->globalToLocalCoords(r.getPosition());
-	Vec3d dir = transform->globalToLocalCoords(r.getPosition() + r.getDirection()) - pos;
-	double length = dir.length();
-	dir /= length;
-
-	ray localRay( pos, dir, r.type() );
-
-	if (intersectLocal(localRay, i)) {
-		// Transform the intersection point & normal returned back into global space.
-		i.N = transform->localToGlobalCoordsNormal(i.N);
-		i.t /= length;
+
+	// Distances along the local ray are the global ones (see
+	// TransformNode::globalToLocal), so only the normal goes back.
+	if (intersectLocal(transform->globalToLocal(r), i)) {
+		i.N = transform->localToGlobalNormal(i.N);
 		return true;
 	} else return false;
 }
 
+bool Geometry::occluded(const ray& r, Real tmax) const {
+	Real tnear, tfar;
+	if (hasBoundingBoxCapability() && !(bounds.intersect(r, tnear, tfar) && tnear < tmax)) return false;
+	return occludedLocal(transform->globalToLocal(r), tmax);
+}
+
+// Rays that miss the bounding box are dropped before the others are
+// taken into local space, as intersect() does for one ray.
+int Geometry::intersectPacket( const ray* r, int mask, isect* i ) const {
+	ray local[BVH::PACKET_SIZE];
+	int live = 0;
+	for( int k = 0; k < BVH::PACKET_SIZE; ++k ) {
+		if( !(mask & (1 << k)) ) continue;
+		Real tmin, tmax;
+		if (hasBoundingBoxCapability() && !(bounds.intersect(r[k], tmin, tmax))) continue;
+		local[k] = transform->globalToLocal(r[k]);
+		live |= 1 << k;
+	}
+	if( !live ) return 0;
+
+	int hit = intersectLocalPacket( local, live, i );
+	for( int k = 0; k < BVH::PACKET_SIZE; ++k )
+		if( hit & (1 << k) )
+			i[k].N = transform->localToGlobalNormal(i[k].N);
+	return hit;
+}
+
+int Geometry::occludedPacket( const ray* r, int mask, const Real* tmax ) const {
+	ray local[BVH::PACKET_SIZE];
+	int live = 0;
+	for( int k = 0; k < BVH::PACKET_SIZE; ++k ) {
+		if( !(mask & (1 << k)) ) continue;
+		Real tnear, tfar;
+		if (hasBoundingBoxCapability() && !(bounds.intersect(r[k], tnear, tfar) && tnear < tmax[k])) continue;
+		local[k] = transform->globalToLocal(r[k]);
+		live |= 1 << k;
+	}
+	return live ? occludedLocalPacket( local, live, tmax ) : 0;
+}
+
+int Geometry::intersectLocalPacket( const ray* r, int mask, isect* i ) const {
+	int hit = 0;
+	for( int k = 0; k < BVH::PACKET_SIZE; ++k )
+		if( (mask & (1 << k)) && intersectLocal( r[k], i[k] ) ) hit |= 1 << k;
+	return hit;
+}
+
+int Geometry::occludedLocalPacket( const ray* r, int mask, const Real* tmax ) const {
+	int blocked = 0;
+	for( int k = 0; k < BVH::PACKET_SIZE; ++k )
+		if( (mask & (1 << k)) && occludedLocal( r[k], tmax[k] ) ) blocked |= 1 << k;
+	return blocked;
+}
+
+bool Geometry::occludedLocal(const ray& r, Real tmax) const {
+	isect i;
+	return intersectLocal(r, i) && i.t < tmax;
+}
+
 bool Geometry::hasBoundingBoxCapability() const {
 	// by default, primitives do not have to specify a bounding box.
 	// If this method returns true for a primitive, then either the ComputeBoundingBox() or
@@ -47,14 +140,61 @@ Scene::~Scene() {
 	for( t = textureCache.begin(); t != textureCache.end(); t++ ) delete (*t).second;
 }
 
+void Scene::buildAccelerator() {
+	vector<BoundingBox> boxes;
+	boxes.reserve( boundedobjects.size() );
+	for( cgiter j = boundedobjects.begin(); j != boundedobjects.end(); ++j )
+		boxes.push_back( (*j)->getBoundingBox() );
+	accel.build( boxes );
+}
+
+void Scene::refit() {
+	sceneBounds = BoundingBox();
+	for( giter j = objects.begin(); j != objects.end(); ++j ) {
+		(*j)->ComputeBoundingBox();
+		if( (*j)->hasBoundingBoxCapability() )
+			sceneBounds.merge( (*j)->getBoundingBox() );
+	}
+	if( accel.empty() ) return;
+
+	vector<BoundingBox> boxes;
+	boxes.reserve( boundedobjects.size() );
+	for( cgiter j = boundedobjects.begin(); j != boundedobjects.end(); ++j )
+		boxes.push_back( (*j)->getBoundingBox() );
+	accel.refit( boxes );
+}
+
+// Leaf callback for the BVH: test one bounded object and keep the hit if
+// it is the closest so far.
+struct ClosestObjectHit {
+	const vector<Geometry*>& objects;
+	const ray& r;
+	isect& i;
+	bool& have_one;
+
+	ClosestObjectHit( const vector<Geometry*>& o, const ray& rr, isect& ii, bool& h )
+		: objects( o ), r( rr ), i( ii ), have_one( h ) {}
+
+	bool operator()( int k, Real& tmax ) {
+		isect cur;
+		if( objects[k]->intersect( r, cur ) ) {
+			if( !have_one || (cur.t < i.t) ) {
+				i = cur;
+				have_one = true;
+				tmax = cur.t;
+				return true;
+			}
+		}
+		return false;
+	}
+};
+
 // Get any intersection with an object.  Return information about the 
 // intersection through the reference parameter.
 bool Scene::intersect( const ray& r, isect& i ) const {
-	double tmin = 0.0;
-	double tmax = 0.0;
 	bool have_one = false;
 	typedef vector<Geometry*>::const_iterator iter;
-	for( iter j = objects.begin(); j != objects.end(); ++j ) {
+	for( iter j = nonboundedobjects.begin(); j != nonboundedobjects.end(); ++j ) {
 		isect cur;
 		if( (*j)->intersect( r, cur ) ) {
 			if( !have_one || (cur.t < i.t) ) {
@@ -63,12 +203,161 @@ bool Scene::intersect( const ray& r, isect& i ) const {
 			}
 		}
 	}
+
+	ClosestObjectHit hit( boundedobjects, r, i, have_one );
+	if( !accel.empty() ) {
+		Real tmax = have_one ? i.t : RAY_INFINITY;
+		accel.intersect( r, tmax, hit );
+	} else {
+		Real tmax = RAY_INFINITY;
+		for( int k = 0; k < (int)boundedobjects.size(); ++k ) hit( k, tmax );
+	}
 	if( !have_one ) i.setT(1000.0);
 
-	intersectCache.push_back( std::make_pair(r,i) );
+	// Only record rays for the debugging view when tracing a single ray;
+	// the renderer proper may be calling this from several threads.
+	if( debugMode )
+		intersectCache.record( r, i );
 	return have_one;
 }
 
+// Leaf callback for the packet walk: the same as ClosestObjectHit, for
+// each ray that reached the object's leaf.
+struct ClosestObjectPacketHit {
+	const vector<Geometry*>& objects;
+	const ray* r;
+	isect* i;
+	int& found;
+
+	ClosestObjectPacketHit( const vector<Geometry*>& o, const ray* rr, isect* ii, int& f )
+		: objects( o ), r( rr ), i( ii ), found( f ) {}
+
+	void operator()( int k, int mask, Real* tmax ) {
+		isect cur[BVH::PACKET_SIZE];
+		int hit = objects[k]->intersectPacket( r, mask, cur );
+		for( int j = 0; j < BVH::PACKET_SIZE; ++j ) {
+			if( !(hit & (1 << j)) ) continue;
+			if( !(found & (1 << j)) || (cur[j].t < i[j].t) ) {
+				i[j] = cur[j];
+				found |= 1 << j;
+				tmax[j] = cur[j].t;
+			}
+		}
+	}
+};
+
+int Scene::intersectPacket( const ray* r, int mask, isect* i ) const {
+	int found = 0;
+	ClosestObjectPacketHit hit( nonboundedobjects, r, i, found );
+	Real tmax[BVH::PACKET_SIZE];
+	for( int k = 0; k < (int)nonboundedobjects.size(); ++k ) hit( k, mask, tmax );
+
+	ClosestObjectPacketHit boundedHit( boundedobjects, r, i, found );
+	for( int k = 0; k < BVH::PACKET_SIZE; ++k )
+		tmax[k] = (found & (1 << k)) ? i[k].t : RAY_INFINITY;
+	if( !accel.empty() )
+		accel.intersectPacket( r, mask, tmax, boundedHit );
+	else
+		for( int k = 0; k < (int)boundedobjects.size(); ++k ) boundedHit( k, mask, tmax );
+
+	for( int k = 0; k < BVH::PACKET_SIZE; ++k )
+		if( (mask & (1 << k)) && !(found & (1 << k)) ) i[k].setT(1000.0);
+	return found;
+}
+
+// Does this object stop the shadow ray?  Opaque objects only need the
+// any-hit test; transmissive ones are intersected properly so that their
+// (possibly texture mapped) kt can be folded into the transmission.
+static bool blocksShadow( const Geometry* obj, const ray& r, Real tmax, Vec3r& transmission )
+{
+	if( obj->isOpaque() ) return obj->occluded( r, tmax );
+
+	isect i;
+	if( obj->intersect( r, i ) && i.t < tmax ) {
+		transmission = prod( transmission, i.getMaterial().kt( i ) );
+		return transmission.iszero();
+	}
+	return false;
+}
+
+struct ShadowBlocked {
+	const vector<Geometry*>& objects;
+	const ray& r;
+	Vec3r& transmission;
+
+	ShadowBlocked( const vector<Geometry*>& o, const ray& rr, Vec3r& t )
+		: objects( o ), r( rr ), transmission( t ) {}
+
+	bool operator()( int k, Real tmax ) {
+		return blocksShadow( objects[k], r, tmax, transmission );
+	}
+};
+
+bool Scene::occluded( const ray& r, Real tmax, Vec3r& transmission ) const {
+	RenderStats::local().countRay( r.type() );
+
+	// The debugging view wants to see where shadow rays stop, which the
+	// any-hit walk doesn't know; trace the ray the slow way for it.
+	if( debugMode ) {
+		isect i;
+		intersect( r, i );
+	}
+
+	transmission = Vec3r( 1.0, 1.0, 1.0 );
+	typedef vector<Geometry*>::const_iterator iter;
+	for( iter j = nonboundedobjects.begin(); j != nonboundedobjects.end(); ++j )
+		if( blocksShadow( *j, r, tmax, transmission ) ) return true;
+
+	ShadowBlocked blocked( boundedobjects, r, transmission );
+	if( !accel.empty() ) return accel.occluded( r, tmax, blocked );
+	for( int k = 0; k < (int)boundedobjects.size(); ++k )
+		if( blocked( k, tmax ) ) return true;
+	return false;
+}
+
+// Packet version of ShadowBlocked.  Opaque objects can take the whole
+// packet; transmissive ones are done a ray at a time.
+struct ShadowBlockedPacket {
+	const vector<Geometry*>& objects;
+	const ray* r;
+	Vec3r* transmission;
+
+	ShadowBlockedPacket( const vector<Geometry*>& o, const ray* rr, Vec3r* t )
+		: objects( o ), r( rr ), transmission( t ) {}
+
+	int operator()( int k, int mask, const Real* tmax ) {
+		const Geometry* obj = objects[k];
+		if( obj->isOpaque() ) return obj->occludedPacket( r, mask, tmax );
+
+		int blocked = 0;
+		for( int j = 0; j < BVH::PACKET_SIZE; ++j )
+			if( (mask & (1 << j)) && blocksShadow( obj, r[j], tmax[j], transmission[j] ) )
+				blocked |= 1 << j;
+		return blocked;
+	}
+};
+
+int Scene::occludedPacket( const ray* r, int mask, const Real* tmax, Vec3r* transmission ) const {
+	for( int k = 0; k < BVH::PACKET_SIZE; ++k ) {
+		if( !(mask & (1 << k)) ) continue;
+		RenderStats::local().countRay( r[k].type() );
+		transmission[k] = Vec3r( 1.0, 1.0, 1.0 );
+	}
+
+	int blocked = 0;
+	ShadowBlockedPacket unbounded( nonboundedobjects, r, transmission );
+	for( int k = 0; k < (int)nonboundedobjects.size(); ++k )
+		blocked |= unbounded( k, mask & ~blocked, tmax );
+
+	int live = mask & ~blocked;
+	if( !live ) return blocked;
+	ShadowBlockedPacket bounded( boundedobjects, r, transmission );
+	if( !accel.empty() ) return blocked | accel.occludedPacket( r, live, tmax, bounded );
+	for( int k = 0; k < (int)boundedobjects.size() && live; ++k )
+		live &= ~bounded( k, live, tmax );
+	return mask & ~live;
+}
+
 TextureMap* Scene::getTexture( string name ) {
 	tmap::const_iterator itr = textureCache.find( name );
 	if( itr == textureCache.end() ) {
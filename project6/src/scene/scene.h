@@ -20,6 +20,7 @@
 #include "material.h"
 #include "camera.h"
 #include "bbox.h"
+#include "accelerator.h"
 
 #include "../vecmath/vec.h"
 #include "../vecmath/mat.h"
@@ -46,12 +47,31 @@ protected:
 
 class TransformNode {
 
+public:
+	// What the transformation does, as far as taking rays into local space
+	// is concerned; globalToLocal() does the least it can for each.
+	enum Kind {
+		IDENTITY,
+		TRANSLATION,
+		UNIFORM_SCALE,		// and translation
+		AFFINE
+	};
+
 protected:
 
-	// information about this node's transformation
-	Mat4d    xform;
-	Mat4d    inverse;
-	Mat3d    normi;
+	// information about this node's transformation: its own, relative to
+	// its parent, and combined with every transformation above it
+	Mat4r    local;
+	Mat4r    xform;
+	Mat4r    inverse;
+	Mat3r    normi;
+
+	// The inverse again, as local = linear * global + offset; for a
+	// uniform scale, linear is scale times the identity.
+	Kind     kind;
+	Mat3r    linear;
+	Vec3r    offset;
+	Real     scale;
 
 	// information about parent & children
 	TransformNode *parent;
@@ -65,43 +85,98 @@ public:
 		for(child_iter c = children.begin(); c != children.end(); ++c ) delete (*c);
 	}
 
-	TransformNode *createChild(const Mat4d& xform) {
+	TransformNode *createChild(const Mat4r& xform) {
 		TransformNode *child = new TransformNode(this, xform);
 		children.push_back(child);
 		return child;
 	}
 
 	// Coordinate-Space transformation
-	Vec3d globalToLocalCoords(const Vec3d &v) { return inverse * v; }
+	Vec3r globalToLocalCoords(const Vec3r &v) { return inverse * v; }
 
-	Vec3d localToGlobalCoords(const Vec3d &v) { return xform * v; }
+	Vec3r localToGlobalCoords(const Vec3r &v) { return xform * v; }
 
-	Vec4d localToGlobalCoords(const Vec4d &v) { return xform * v; }
+	Vec4r localToGlobalCoords(const Vec4r &v) { return xform * v; }
 
-	Vec3d localToGlobalCoordsNormal(const Vec3d &v) {
-		Vec3d ret = normi * v;
+	Vec3r localToGlobalCoordsNormal(const Vec3r &v) {
+		Vec3r ret = normi * v;
 		ret.normalize();
 		return ret;
 	}
 
-	const Mat4d& transform() const		{ return xform; }
+	// The ray in local space.  Its direction is left unnormalized, so a
+	// point t along it is the point t along r: hits found in local space
+	// need no rescaling on the way back.
+	ray globalToLocal( const ray& r ) const {
+		switch( kind ) {
+		case IDENTITY:
+			return r;
+		case TRANSLATION:
+			return ray( r.getPosition() + offset, r.getDirection(), r.type() );
+		case UNIFORM_SCALE:
+			return ray( r.getPosition() * scale + offset, r.getDirection() * scale, r.type() );
+		default:
+			return ray( linear * r.getPosition() + offset, linear * r.getDirection(), r.type() );
+		}
+	}
+
+	// A local normal, of any length, as a unit normal in global space.
+	Vec3r localToGlobalNormal( const Vec3r& n ) const {
+		Vec3r ret = kind == AFFINE ? normi * n : scale < 0.0 ? -n : n;
+		ret.normalize();
+		return ret;
+	}
+
+	Kind transformKind() const			{ return kind; }
+	const Mat4r& transform() const		{ return xform; }
+	const Mat4r& localTransform() const	{ return local; }
+
+	// Replace this node's own transformation, as when animating; the
+	// combined transformations of the node and everything below it are
+	// worked out again.  The objects under it keep their old bounds until
+	// Scene::refit() is called.
+	void setLocalTransform(const Mat4r& xform);
+
+	child_citer beginChildren() const { return children.begin(); }
+	child_citer endChildren() const { return children.end(); }
+
+	// Add a child whose combined transform is already known, as when
+	// reloading a cached scene.
+	TransformNode *createChildCombined(const Mat4r& combined) {
+		TransformNode *child = new TransformNode(this, Mat4r());
+		child->local = inverse * combined;
+		child->xform = combined;
+		child->inverse = combined.inverse();
+		child->normi = combined.upper33().inverse().transpose();
+		child->classify();
+		children.push_back(child);
+		return child;
+	}
 
 protected:
 	// protected so that users can't directly construct one of these...
 	// force them to use the createChild() method.  Note that they CAN
 	// directly create a TransformRoot object.
-	TransformNode(TransformNode *parent, const Mat4d& xform ) : children() {
+	TransformNode(TransformNode *parent, const Mat4r& xform ) : children() {
 		this->parent = parent;
+		this->local = xform;
 		if (parent == NULL) this->xform = xform;
 		else this->xform = parent->xform * xform;  
 		inverse = this->xform.inverse();
 		normi = this->xform.upper33().inverse().transpose();
+		classify();
 	}
+
+	// Work out kind, linear, offset and scale from xform and inverse.
+	void classify();
+
+	// Recombine local with the parent's transformation, here and below.
+	void update();
 };
 
 class TransformRoot : public TransformNode {
 public:
-	TransformRoot() : TransformNode(NULL, Mat4d()) {}
+	TransformRoot() : TransformNode(NULL, Mat4r()) {}
 };
 
 // A Geometry object is anything that has extent in three dimensions.
@@ -112,15 +187,44 @@ class Geometry : public SceneElement {
 protected:
 	// intersections performed in the object's local coordinate space
 	// do not call directly - this should only be called by intersect()
+	// The ray's direction is not normalized, and i.t is measured in
+	// multiples of it.  i.N need not be normalized either: intersect()
+	// does that once it is back in global space.
 	virtual bool intersectLocal( const ray& r, isect& i ) const = 0;
 
+	// Is there any hit with RAY_EPSILON < t < tmax?  Only called by
+	// occluded().  The default finds the closest hit and checks it; shapes
+	// that can answer more cheaply (without normals, or without finding
+	// the closest of several hits) override this.
+	virtual bool occludedLocal( const ray& r, Real tmax ) const;
+
+	// Local space versions of the packet queries below.  The defaults take
+	// the rays one at a time; objects with hierarchies of their own trace
+	// them together.
+	virtual int intersectLocalPacket( const ray* r, int mask, isect* i ) const;
+	virtual int occludedLocalPacket( const ray* r, int mask, const Real* tmax ) const;
+
 public:
 	// intersections performed in the global coordinate space.
 	bool intersect(const ray&r, isect&i) const;
 
+	// Any-hit query for shadow rays: does the object cross r between
+	// RAY_EPSILON and tmax?
+	bool occluded(const ray& r, Real tmax) const;
+
+	// intersect() and occluded() for a packet of rays: ray k is traced if
+	// bit k of mask is set (see BVH::PACKET_SIZE).  Returns the mask of
+	// rays that hit the object, or that it blocks.
+	int intersectPacket( const ray* r, int mask, isect* i ) const;
+	int occludedPacket( const ray* r, int mask, const Real* tmax ) const;
+
+	// Shadow rays may stop at the first opaque object they meet; everything
+	// else needs a full intersection so that its kt can be looked up.
+	virtual bool isOpaque() const { return true; }
+
 	virtual bool hasBoundingBoxCapability() const;
 	const BoundingBox& getBoundingBox() const { return bounds; }
-	Vec3d getNormal() { return Vec3d(1.0, 0.0, 0.0); }
+	Vec3r getNormal() { return Vec3r(1.0, 0.0, 0.0); }
 
 	virtual void ComputeBoundingBox() {
 		// take the object's local bounding box, transform all 8 points on it,
@@ -128,38 +232,38 @@ public:
 
 		BoundingBox localBounds = ComputeLocalBoundingBox();
 
-		Vec3d min = localBounds.getMin();
-		Vec3d max = localBounds.getMax();
+		Vec3r min = localBounds.getMin();
+		Vec3r max = localBounds.getMax();
 
-		Vec4d v, newMax, newMin;
+		Vec4r v, newMax, newMin;
 
-		v = transform->localToGlobalCoords( Vec4d(min[0], min[1], min[2], 1) );
+		v = transform->localToGlobalCoords( Vec4r(min[0], min[1], min[2], 1) );
 		newMax = v;
 		newMin = v;
-		v = transform->localToGlobalCoords( Vec4d(max[0], min[1], min[2], 1) );
+		v = transform->localToGlobalCoords( Vec4r(max[0], min[1], min[2], 1) );
 		newMax = maximum(newMax, v);
 		newMin = minimum(newMin, v);
-		v = transform->localToGlobalCoords( Vec4d(min[0], max[1], min[2], 1) );
+		v = transform->localToGlobalCoords( Vec4r(min[0], max[1], min[2], 1) );
 		newMax = maximum(newMax, v);
 		newMin = minimum(newMin, v);
-		v = transform->localToGlobalCoords( Vec4d(max[0], max[1], min[2], 1) );
+		v = transform->localToGlobalCoords( Vec4r(max[0], max[1], min[2], 1) );
 		newMax = maximum(newMax, v);
 		newMin = minimum(newMin, v);
-		v = transform->localToGlobalCoords( Vec4d(min[0], min[1], max[2], 1) );
+		v = transform->localToGlobalCoords( Vec4r(min[0], min[1], max[2], 1) );
 		newMax = maximum(newMax, v);
 		newMin = minimum(newMin, v);
-		v = transform->localToGlobalCoords( Vec4d(max[0], min[1], max[2], 1) );
+		v = transform->localToGlobalCoords( Vec4r(max[0], min[1], max[2], 1) );
 		newMax = maximum(newMax, v);
 		newMin = minimum(newMin, v);
-		v = transform->localToGlobalCoords( Vec4d(min[0], max[1], max[2], 1) );
+		v = transform->localToGlobalCoords( Vec4r(min[0], max[1], max[2], 1) );
 		newMax = maximum(newMax, v);
 		newMin = minimum(newMin, v);
-		v = transform->localToGlobalCoords( Vec4d(max[0], max[1], max[2], 1) );
+		v = transform->localToGlobalCoords( Vec4r(max[0], max[1], max[2], 1) );
 		newMax = maximum(newMax, v);
 		newMin = minimum(newMin, v);
 
-		bounds.setMax(Vec3d(newMax));
-		bounds.setMin(Vec3d(newMin));
+		bounds.setMax(Vec3r(newMax));
+		bounds.setMin(Vec3r(newMin));
 	}
 
 	// default method for ComputeLocalBoundingBox returns a bogus bounding box;
@@ -167,6 +271,7 @@ public:
 	virtual BoundingBox ComputeLocalBoundingBox() { return BoundingBox(); }
 
 	void setTransform(TransformNode *transform) { this->transform = transform; };
+	TransformNode *getTransform() const { return transform; }
 
 	Geometry(Scene *scene) : SceneElement( scene ) {}
 
@@ -192,6 +297,8 @@ public:
 	virtual const Material& getMaterial() const = 0;
 	virtual void setMaterial( Material *m ) = 0;
 
+	virtual bool isOpaque() const { return !getMaterial().transmissive(); }
+
 	void glDraw(int quality, bool actualMaterials, bool actualTextures) const;
 
 protected:
@@ -215,6 +322,41 @@ protected:
 	Material* material;
 };
 
+// The rays traced for one pixel, and what they hit, captured for the
+// debugging view.  The capacity is fixed so that a deep recursive trace
+// can't make it grow without bound; once it is full the oldest entries are
+// overwritten.  Storage is only allocated the first time something is
+// recorded.
+class IntersectCache {
+
+public:
+	typedef std::pair<ray, isect> Entry;
+
+	IntersectCache( size_t cap = 4096 ) : capacity( cap ), head( 0 ) {}
+
+	void clear() { entries.clear(); head = 0; }
+
+	void record( const ray& r, const isect& i ) {
+		if( entries.size() < capacity ) {
+			if( entries.capacity() < capacity ) entries.reserve( capacity );
+			entries.push_back( Entry( r, i ) );
+		} else {
+			entries[head] = Entry( r, i );
+			head = (head + 1) % capacity;
+		}
+	}
+
+	size_t size() const { return entries.size(); }
+
+	// Entries in the order they were recorded, oldest first.
+	const Entry& operator[]( size_t k ) const { return entries[(head + k) % entries.size()]; }
+
+private:
+	std::vector<Entry> entries;
+	size_t capacity;
+	size_t head;		// oldest entry, once the buffer has wrapped
+};
+
 class Scene {
 
 public:
@@ -230,13 +372,46 @@ public:
 
 	void add( Geometry* obj ) {
 		obj->ComputeBoundingBox();
-		sceneBounds.merge(obj->getBoundingBox());
 		objects.push_back( obj );
+		if( obj->hasBoundingBoxCapability() ) {
+			sceneBounds.merge(obj->getBoundingBox());
+			boundedobjects.push_back( obj );
+		} else nonboundedobjects.push_back( obj );
 	}
 	void add( Light* light ) { lights.push_back( light ); }
 
+	// Build the acceleration structure over the bounded objects.  Call this
+	// once the scene is fully parsed; until then intersect() falls back to
+	// testing every object.
+	void buildAccelerator();
+
+	// After transform nodes have been changed: work out every object's
+	// bounds again, and refit the object hierarchy to them without changing
+	// its shape.  The hierarchies inside meshes are in the meshes' own
+	// space, so they are left alone.
+	void refit();
+
+	// An object given a name in the .ray file sits in a transform node of
+	// its own, kept here under the name so that it can be moved.  Several
+	// objects may share a name.
+	typedef std::multimap< std::string, TransformNode* > NameMap;
+	void nameTransform( const std::string& name, TransformNode* node ) {
+		if( !name.empty() ) namedTransforms.insert( NameMap::value_type( name, node ) );
+	}
+	const NameMap& names() const { return namedTransforms; }
+
 	bool intersect( const ray& r, isect& i ) const;
 
+	// Shadow query along r up to tmax.  Returns true as soon as an opaque
+	// object is found.  Otherwise every transmissive object in the way
+	// multiplies its kt into 'transmission', which starts at (1,1,1).
+	bool occluded( const ray& r, Real tmax, Vec3r& transmission ) const;
+
+	// The same for a packet of rays that head roughly the same way, with
+	// results and masks as for Geometry::intersectPacket.
+	int intersectPacket( const ray* r, int mask, isect* i ) const;
+	int occludedPacket( const ray* r, int mask, const Real* tmax, Vec3r* transmission ) const;
+
 	std::vector<Light*>::const_iterator beginLights() const { return lights.begin(); }
 	std::vector<Light*>::const_iterator endLights() const { return lights.end(); }
 
@@ -254,8 +429,8 @@ public:
 	// These two functions are for handling ambient light; in the Phong model,
 	// the "ambient" light is considered a property of the _scene_ as a whole
 	// and hence should be set here.
-	Vec3d ambient() const	{ return ambientIntensity; }
-	void addAmbient( const Vec3d& ambient ) { ambientIntensity += ambient; }
+	Vec3r ambient() const	{ return ambientIntensity; }
+	void addAmbient( const Vec3r& ambient ) { ambientIntensity += ambient; }
 
 	void glDraw(int quality, bool actualMaterials, bool actualTextures) const;
 
@@ -266,23 +441,27 @@ private:
 	std::vector<Geometry*> nonboundedobjects;
 	std::vector<Geometry*> boundedobjects;
 	std::vector<Light*> lights;
+	Accelerator accel;
 	Camera camera;
 
 	// This is the total amount of ambient light in the scene
 	// (used as the I_a in the Phong shading model)
-	Vec3d ambientIntensity;
+	Vec3r ambientIntensity;
 
 	typedef std::map< std::string, TextureMap* > tmap;
 	tmap textureCache;
 
+	NameMap namedTransforms;
+
 	// Each object in the scene, provided that it has hasBoundingBoxCapability(),
 	// must fall within this bounding box.  Objects that don't have hasBoundingBoxCapability()
 	// are exempt from this requirement.
 	BoundingBox sceneBounds;
 
 public:
-	// This is used for debugging purposes only.
-	mutable std::vector< std::pair<ray, isect> > intersectCache;
+	// This is used for debugging purposes only, and is only filled in
+	// while debugMode is set (i.e. when tracing a single ray from the UI).
+	mutable IntersectCache intersectCache;
 };
 
 #endif // __SCENE_H__
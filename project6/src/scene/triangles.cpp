@@ -0,0 +1,231 @@
+#include <cmath>
+#include <algorithm>
+
+#include "triangles.h"
+
+#ifdef BVH_X86
+#include <immintrin.h>
+#endif
+
+// As in bvh.cpp, the AVX kernel is compiled for AVX on its own.
+#if defined(BVH_X86) && defined(__GNUC__)
+#define TARGET_AVX __attribute__((target("avx")))
+#else
+#define TARGET_AVX
+#endif
+
+using namespace std;
+
+// Slack for the rounding of a product of two sheared coordinates, as a
+// fraction of it: 2^-18, a few dozen float ulps.
+static const float PRODUCT_SLACK = 1.0f / 262144.0f;
+
+BVH::Kernel TriangleSet::activeKernel = BVH::bestKernel();
+
+void TriangleSet::setKernel( BVH::Kernel k )
+{
+	activeKernel = min( k, BVH::bestKernel() );
+}
+
+BVH::Kernel TriangleSet::currentKernel()
+{
+	return activeKernel;
+}
+
+int TriangleSet::width( BVH::Kernel k )
+{
+	switch( k ) {
+	case BVH::AVX: return 8;
+	case BVH::SSE: return 4;
+	default:       return 1;
+	}
+}
+
+void TriangleSet::clear()
+{
+	for( int c = 0; c < 3; ++c )
+		for( int axis = 0; axis < 3; ++axis )
+			corner[c][axis].clear();
+	scale = 0.0f;
+}
+
+void TriangleSet::build( const vector<Vec3r>& a, const vector<Vec3r>& ab,
+	const vector<Vec3r>& ac )
+{
+	clear();
+	kernel = activeKernel;
+	if( width() == 1 ) return;
+
+	int n = (int)a.size();
+	for( int c = 0; c < 3; ++c )
+		for( int axis = 0; axis < 3; ++axis )
+			corner[c][axis].assign( n + width(), 0.0f );
+
+	Real largest = 0.0;
+	for( int f = 0; f < n; ++f ) {
+		Vec3r p[3] = { a[f], a[f] + ab[f], a[f] + ac[f] };
+		for( int c = 0; c < 3; ++c )
+			for( int axis = 0; axis < 3; ++axis ) {
+				corner[c][axis][f] = (float)p[c][axis];
+				largest = max( largest, fabs( p[c][axis] ) );
+			}
+	}
+	scale = (float)largest;
+}
+
+TriangleSet::Ray::Ray( const TriangleSet& set, const ray& r )
+{
+	Vec3r o = r.getPosition();
+	Vec3r d = r.getDirection();
+
+	kz = 0;
+	if( fabs( d[1] ) > fabs( d[kz] ) ) kz = 1;
+	if( fabs( d[2] ) > fabs( d[kz] ) ) kz = 2;
+	kx = (kz + 1) % 3;
+	ky = (kx + 1) % 3;
+	// Keep the winding of the projected faces.
+	if( d[kz] < 0.0 ) std::swap( kx, ky );
+
+	sx = (float)(d[kx] / d[kz]);
+	sy = (float)(d[ky] / d[kz]);
+	sz = (float)(1.0 / d[kz]);
+
+	Real largest = set.scale;
+	for( int axis = 0; axis < 3; ++axis ) {
+		org[axis] = (float)o[axis];
+		largest = max( largest, fabs( o[axis] ) );
+	}
+	// Each sheared coordinate is a handful of roundings of numbers no
+	// bigger than this, with |sx|, |sy| <= 1; 64 ulps covers it easily.
+	err = (float)(64.0 * FLT_EPSILON * largest);
+	errZ = err * fabs( sz );
+}
+
+#ifdef BVH_SSE
+static inline __m128 abs4( __m128 x )
+{
+	return _mm_andnot_ps( _mm_set1_ps( -0.0f ), x );
+}
+
+int TriangleSet::candidates4SSE( const TriangleSet& set, const Ray& r, int first, float tmax )
+{
+	const __m128 sx = _mm_set1_ps( r.sx );
+	const __m128 sy = _mm_set1_ps( r.sy );
+	const __m128 sz = _mm_set1_ps( r.sz );
+
+	// The corners relative to the origin, sheared.
+	__m128 px[3], py[3], pz[3];
+	for( int c = 0; c < 3; ++c ) {
+		__m128 x = _mm_sub_ps( _mm_loadu_ps( &set.corner[c][r.kx][first] ), _mm_set1_ps( r.org[r.kx] ) );
+		__m128 y = _mm_sub_ps( _mm_loadu_ps( &set.corner[c][r.ky][first] ), _mm_set1_ps( r.org[r.ky] ) );
+		__m128 z = _mm_sub_ps( _mm_loadu_ps( &set.corner[c][r.kz][first] ), _mm_set1_ps( r.org[r.kz] ) );
+		px[c] = _mm_sub_ps( x, _mm_mul_ps( sx, z ) );
+		py[c] = _mm_sub_ps( y, _mm_mul_ps( sy, z ) );
+		pz[c] = _mm_mul_ps( sz, z );
+	}
+
+	__m128 u = _mm_sub_ps( _mm_mul_ps( px[2], py[1] ), _mm_mul_ps( py[2], px[1] ) );
+	__m128 v = _mm_sub_ps( _mm_mul_ps( px[0], py[2] ), _mm_mul_ps( py[0], px[2] ) );
+	__m128 w = _mm_sub_ps( _mm_mul_ps( px[1], py[0] ), _mm_mul_ps( py[1], px[0] ) );
+
+	// How far off each edge function can be.
+	__m128 err = _mm_set1_ps( r.err );
+	__m128 size = _mm_add_ps( _mm_add_ps( _mm_add_ps( abs4( px[0] ), abs4( py[0] ) ),
+		_mm_add_ps( abs4( px[1] ), abs4( py[1] ) ) ), _mm_add_ps( abs4( px[2] ), abs4( py[2] ) ) );
+	__m128 tol = _mm_add_ps( _mm_mul_ps( size,
+		_mm_add_ps( err, _mm_mul_ps( size, _mm_set1_ps( PRODUCT_SLACK ) ) ) ), _mm_mul_ps( err, err ) );
+	__m128 ntol = _mm_sub_ps( _mm_setzero_ps(), tol );
+
+	// Inside if the edge functions all have one sign, either one.
+	__m128 inside = _mm_or_ps(
+		_mm_and_ps( _mm_and_ps( _mm_cmpge_ps( u, ntol ), _mm_cmpge_ps( v, ntol ) ), _mm_cmpge_ps( w, ntol ) ),
+		_mm_and_ps( _mm_and_ps( _mm_cmple_ps( u, tol ), _mm_cmple_ps( v, tol ) ), _mm_cmple_ps( w, tol ) ) );
+
+	// t = T / det, within [0, tmax], without dividing.
+	__m128 det = _mm_add_ps( _mm_add_ps( u, v ), w );
+	__m128 t = _mm_add_ps( _mm_add_ps( _mm_mul_ps( u, pz[0] ), _mm_mul_ps( v, pz[1] ) ), _mm_mul_ps( w, pz[2] ) );
+	__m128 sizeUVW = _mm_add_ps( _mm_add_ps( abs4( u ), abs4( v ) ), abs4( w ) );
+	__m128 sizeZ = _mm_add_ps( _mm_add_ps( abs4( pz[0] ), abs4( pz[1] ) ), abs4( pz[2] ) );
+	__m128 tolT = _mm_add_ps( _mm_mul_ps( sizeUVW,
+		_mm_add_ps( _mm_set1_ps( r.errZ ), _mm_mul_ps( sizeZ, _mm_set1_ps( PRODUCT_SLACK ) ) ) ),
+		_mm_mul_ps( sizeZ, tol ) );
+	__m128 absDet = abs4( det );
+	__m128 signedT = _mm_xor_ps( t, _mm_and_ps( det, _mm_set1_ps( -0.0f ) ) );
+	__m128 inRange = _mm_and_ps( _mm_cmpge_ps( signedT, _mm_sub_ps( _mm_setzero_ps(), tolT ) ),
+		_mm_cmple_ps( signedT, _mm_add_ps( _mm_mul_ps( _mm_set1_ps( tmax ), absDet ), tolT ) ) );
+	// Too close to edge-on to trust the sign of det.
+	__m128 flat = _mm_cmple_ps( absDet, _mm_mul_ps( _mm_set1_ps( 3.0f ), tol ) );
+
+	return _mm_movemask_ps( _mm_and_ps( inside, _mm_or_ps( inRange, flat ) ) );
+}
+#else
+// Without SSE every face is a candidate.
+int TriangleSet::candidates4SSE( const TriangleSet& set, const Ray& r, int first, float tmax )
+{
+	return 0xf;
+}
+#endif
+
+#ifdef BVH_X86
+static inline TARGET_AVX __m256 abs8( __m256 x )
+{
+	return _mm256_andnot_ps( _mm256_set1_ps( -0.0f ), x );
+}
+
+TARGET_AVX int TriangleSet::candidates8AVX( const TriangleSet& set, const Ray& r, int first, float tmax )
+{
+	const __m256 sx = _mm256_set1_ps( r.sx );
+	const __m256 sy = _mm256_set1_ps( r.sy );
+	const __m256 sz = _mm256_set1_ps( r.sz );
+
+	__m256 px[3], py[3], pz[3];
+	for( int c = 0; c < 3; ++c ) {
+		__m256 x = _mm256_sub_ps( _mm256_loadu_ps( &set.corner[c][r.kx][first] ), _mm256_set1_ps( r.org[r.kx] ) );
+		__m256 y = _mm256_sub_ps( _mm256_loadu_ps( &set.corner[c][r.ky][first] ), _mm256_set1_ps( r.org[r.ky] ) );
+		__m256 z = _mm256_sub_ps( _mm256_loadu_ps( &set.corner[c][r.kz][first] ), _mm256_set1_ps( r.org[r.kz] ) );
+		px[c] = _mm256_sub_ps( x, _mm256_mul_ps( sx, z ) );
+		py[c] = _mm256_sub_ps( y, _mm256_mul_ps( sy, z ) );
+		pz[c] = _mm256_mul_ps( sz, z );
+	}
+
+	__m256 u = _mm256_sub_ps( _mm256_mul_ps( px[2], py[1] ), _mm256_mul_ps( py[2], px[1] ) );
+	__m256 v = _mm256_sub_ps( _mm256_mul_ps( px[0], py[2] ), _mm256_mul_ps( py[0], px[2] ) );
+	__m256 w = _mm256_sub_ps( _mm256_mul_ps( px[1], py[0] ), _mm256_mul_ps( py[1], px[0] ) );
+
+	__m256 err = _mm256_set1_ps( r.err );
+	__m256 size = _mm256_add_ps( _mm256_add_ps( _mm256_add_ps( abs8( px[0] ), abs8( py[0] ) ),
+		_mm256_add_ps( abs8( px[1] ), abs8( py[1] ) ) ), _mm256_add_ps( abs8( px[2] ), abs8( py[2] ) ) );
+	__m256 tol = _mm256_add_ps( _mm256_mul_ps( size,
+		_mm256_add_ps( err, _mm256_mul_ps( size, _mm256_set1_ps( PRODUCT_SLACK ) ) ) ), _mm256_mul_ps( err, err ) );
+	__m256 ntol = _mm256_sub_ps( _mm256_setzero_ps(), tol );
+
+	__m256 inside = _mm256_or_ps(
+		_mm256_and_ps( _mm256_and_ps( _mm256_cmp_ps( u, ntol, _CMP_GE_OQ ), _mm256_cmp_ps( v, ntol, _CMP_GE_OQ ) ),
+			_mm256_cmp_ps( w, ntol, _CMP_GE_OQ ) ),
+		_mm256_and_ps( _mm256_and_ps( _mm256_cmp_ps( u, tol, _CMP_LE_OQ ), _mm256_cmp_ps( v, tol, _CMP_LE_OQ ) ),
+			_mm256_cmp_ps( w, tol, _CMP_LE_OQ ) ) );
+
+	__m256 det = _mm256_add_ps( _mm256_add_ps( u, v ), w );
+	__m256 t = _mm256_add_ps( _mm256_add_ps( _mm256_mul_ps( u, pz[0] ), _mm256_mul_ps( v, pz[1] ) ),
+		_mm256_mul_ps( w, pz[2] ) );
+	__m256 sizeUVW = _mm256_add_ps( _mm256_add_ps( abs8( u ), abs8( v ) ), abs8( w ) );
+	__m256 sizeZ = _mm256_add_ps( _mm256_add_ps( abs8( pz[0] ), abs8( pz[1] ) ), abs8( pz[2] ) );
+	__m256 tolT = _mm256_add_ps( _mm256_mul_ps( sizeUVW,
+		_mm256_add_ps( _mm256_set1_ps( r.errZ ), _mm256_mul_ps( sizeZ, _mm256_set1_ps( PRODUCT_SLACK ) ) ) ),
+		_mm256_mul_ps( sizeZ, tol ) );
+	__m256 absDet = abs8( det );
+	__m256 signedT = _mm256_xor_ps( t, _mm256_and_ps( det, _mm256_set1_ps( -0.0f ) ) );
+	__m256 inRange = _mm256_and_ps(
+		_mm256_cmp_ps( signedT, _mm256_sub_ps( _mm256_setzero_ps(), tolT ), _CMP_GE_OQ ),
+		_mm256_cmp_ps( signedT, _mm256_add_ps( _mm256_mul_ps( _mm256_set1_ps( tmax ), absDet ), tolT ), _CMP_LE_OQ ) );
+	__m256 flat = _mm256_cmp_ps( absDet, _mm256_mul_ps( _mm256_set1_ps( 3.0f ), tol ), _CMP_LE_OQ );
+
+	return _mm256_movemask_ps( _mm256_and_ps( inside, _mm256_or_ps( inRange, flat ) ) );
+}
+#else
+// Never selected; see setKernel().
+int TriangleSet::candidates8AVX( const TriangleSet& set, const Ray& r, int first, float tmax )
+{
+	return 0xff;
+}
+#endif
@@ -0,0 +1,85 @@
+//
+// triangles.h
+//
+// A mesh's faces again, as floats laid out for SIMD: one array per
+// corner and axis, in the same order as the mesh keeps its faces.  A
+// kernel takes one ray and a run of 4 (SSE) or 8 (AVX) consecutive
+// faces, which after BVH::linearize is a leaf, and tells which of them
+// the ray may hit.
+//
+// The test is the watertight one of Woop, Benthin and Wald: the ray is
+// sheared onto the +z axis, and each edge's 2D edge function says which
+// side of it the ray passes.  It needs no division and shares edges
+// exactly between neighbouring faces.  Since the renderer measures hits
+// in Real, double unless built with RAY_FLOAT, the float test is used as
+// a filter: its bounds on U, V, W and t are widened by the rounding error
+// float could have made, so that every face the exact test
+// (Trimesh::hitFace) hits is let through, and only those go on to be
+// measured.
+//
+
+#ifndef __TRIANGLES_H__
+#define __TRIANGLES_H__
+
+#include <vector>
+
+#include "bvh.h"
+
+class TriangleSet {
+
+public:
+	TriangleSet() : kernel( BVH::SCALAR ), scale( 0.0f ) {}
+
+	// Copy the faces with corners a[f], a[f] + ab[f] and a[f] + ac[f],
+	// for the kernel currently selected.
+	void build( const std::vector<Vec3r>& a, const std::vector<Vec3r>& ab,
+		const std::vector<Vec3r>& ac );
+	void clear();
+
+	// Faces a kernel tests at once.  The scalar kernel has no float test
+	// at all: the mesh goes straight to its double one.
+	static int width( BVH::Kernel k );
+	int width() const { return width( kernel ); }
+
+	// The ray, sheared.  The axes are permuted so that z is the one the
+	// ray runs along fastest, and err bounds how far off a sheared corner
+	// can be from rounding.
+	struct Ray {
+		int kx, ky, kz;
+		float org[3];
+		float sx, sy, sz;
+		float err, errZ;
+		Ray( const TriangleSet& set, const ray& r );
+	};
+
+	// Bit k set if the ray may hit face first+k before tmax; count is at
+	// most width().
+	int candidates( const Ray& r, int first, int count, Real tmax ) const;
+
+	// The kernel sets built from now on use.  As for BVH::setKernel,
+	// asking for one the CPU lacks gets the best one it has.
+	static void setKernel( BVH::Kernel k );
+	static BVH::Kernel currentKernel();
+
+private:
+	static int candidates4SSE( const TriangleSet& set, const Ray& r, int first, float tmax );
+	static int candidates8AVX( const TriangleSet& set, const Ray& r, int first, float tmax );
+
+	BVH::Kernel kernel;		// what the set was built for
+	float scale;			// largest coordinate of any corner
+	// corner[c][axis][f]: corner c of face f, padded by a run's worth
+	// of empty faces so a kernel can always load a full one.
+	std::vector<float> corner[3][3];
+
+	static BVH::Kernel activeKernel;
+};
+
+inline int TriangleSet::candidates( const Ray& r, int first, int count, Real tmax ) const
+{
+	float ftmax = (float)tmax * (1.0f + FLT_EPSILON);
+	int mask = kernel == BVH::AVX ? candidates8AVX( *this, r, first, ftmax )
+		: candidates4SSE( *this, r, first, ftmax );
+	return mask & ((1 << count) - 1);
+}
+
+#endif // __TRIANGLES_H__
@@ -1,6 +1,12 @@
 #include <iostream>
+#include <fstream>
+#include <iomanip>
 #include <time.h>
 #include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <math.h>
 
 #include <assert.h>
 
@@ -8,6 +14,15 @@
 #include "../fileio/bitmap.h"
 
 #include "../RayTracer.h"
+#include "../TileScheduler.h"
+#include "../WavefrontRenderer.h"
+#include "../RenderStats.h"
+#include "../scene/bvh.h"
+#include "../scene/accelerator.h"
+#include "../scene/triangles.h"
+#include "../TriangleBench.h"
+#include "../Animation.h"
+#include "../allocstats.h"
 
 using namespace std;
 
@@ -32,8 +47,15 @@ CommandLineUI::CommandLineUI( int argc, char** argv )
 	int i;
 
 	progName=argv[0];
+	reportName=0;
+	printStats=false;
+	wavefront=false;
+	packets=false;
+	benchmarkRays=0;
+	diffName=0;
+	animationName=0;
 
-	while( (i = getopt( argc, argv, "tr:w:h:" )) != EOF )
+	while( (i = getopt( argc, argv, "tr:w:h:s:j:nb:Sa:c:WPk:B:x:T:d:A:" )) != EOF )
 	{
 		switch( i )
 		{
@@ -43,10 +65,80 @@ CommandLineUI::CommandLineUI( int argc, char** argv )
 
 			case 'w':
 				m_nSize = atoi( optarg );
+				break;
 
 			case 's':
 				m_nRays = atoi( optarg );
 				break;
+
+			case 'j':
+				m_nThreads = atoi( optarg );
+				break;
+
+			case 'n':
+				m_bSceneCache = false;
+				break;
+
+			case 'b':
+				reportName = optarg;
+				break;
+
+			case 'S':
+				printStats = true;
+				break;
+
+			case 'a':
+				m_dAdaptiveThreshold = atof( optarg );
+				break;
+
+			case 'c':
+				m_dThreshold = atof( optarg );
+				break;
+
+			case 'W':
+				wavefront = true;
+				break;
+
+			case 'P':
+				wavefront = true;
+				packets = true;
+				break;
+
+			case 'k':
+				if( !setKernel( optarg ) ) {
+					std::cerr << "Unknown kernel '" << optarg << "'." << std::endl;
+					usage();
+					exit(1);
+				}
+				break;
+
+			case 'B':
+				if( !setBuilder( optarg ) ) {
+					std::cerr << "Unknown builder '" << optarg << "'." << std::endl;
+					usage();
+					exit(1);
+				}
+				break;
+
+			case 'x':
+				if( !setAccelerator( optarg ) ) {
+					std::cerr << "Unknown accelerator '" << optarg << "'." << std::endl;
+					usage();
+					exit(1);
+				}
+				break;
+
+			case 'T':
+				benchmarkRays = atoi( optarg );
+				break;
+
+			case 'd':
+				diffName = optarg;
+				break;
+
+			case 'A':
+				animationName = optarg;
+				break;
 			default:
 			// Oops; unknown argument
 			std::cerr << "Invalid argument: '" << i << "'." << std::endl;
@@ -55,47 +147,148 @@ CommandLineUI::CommandLineUI( int argc, char** argv )
 		}
 	}
 
-	if( optind >= argc-1 )
+	// The benchmark writes no image.
+	if( optind >= argc - (benchmarkRays > 0 ? 0 : 1) )
 	{
 		std::cerr << "no input and/or output name." << std::endl;
 		exit(1);
 	}
 
+	if( animationName && diffName )
+	{
+		std::cerr << "-d compares one image; it can't be used with -A." << std::endl;
+		exit(1);
+	}
+
 	rayName = argv[optind];
-	imgName = argv[optind+1];
+	imgName = benchmarkRays > 0 ? 0 : argv[optind+1];
+}
+
+// The hierarchies loadScene() built, for -S: the scene's and the
+// trimeshes'.  Those of trimeshes read from mesh files weren't built.
+static void printBuildStats( ostream& out )
+{
+	BVH::BuildStats b = BVH::buildStats();
+	out << left << setw( 24 ) << "hierarchies built" << right << setw( 14 ) << b.built
+		<< "  (" << BVH::builderName( BVH::currentBuilder() ) << ")" << endl;
+	if( b.read )
+		out << left << setw( 24 ) << "hierarchies read" << right << setw( 14 ) << b.read << endl;
+	out << left << setw( 24 ) << "primitives" << right << setw( 14 ) << b.primitives << endl;
+	out << left << setw( 24 ) << "binary nodes" << right << setw( 14 ) << b.nodes << endl;
+	out << left << setw( 24 ) << "build seconds" << right << setw( 14 ) << b.seconds << endl;
+	if( b.built )
+		out << left << setw( 24 ) << "SAH cost of largest" << right << setw( 14 ) << b.largestCost
+			<< "  (" << b.largest << " primitives)" << endl;
+}
+
+// What each kind of accelerator built cost, for -S: one row for each
+// kind that was built, to weigh them against each other for a scene.
+static void printAcceleratorStats( ostream& out )
+{
+	out << left << setw( 12 ) << "accelerator" << right << setw( 8 ) << "built"
+		<< setw( 14 ) << "primitives" << setw( 14 ) << "references"
+		<< setw( 14 ) << "bytes" << setw( 14 ) << "seconds" << endl;
+	for( int k = 0; k < Accelerator::KINDS; ++k ) {
+		Accelerator::BuildStats a = Accelerator::buildStats( (Accelerator::Kind)k );
+		if( !a.built ) continue;
+		out << left << setw( 12 ) << Accelerator::kindName( (Accelerator::Kind)k ) << right
+			<< setw( 8 ) << a.built << setw( 14 ) << a.primitives << setw( 14 ) << a.references
+			<< setw( 14 ) << a.bytes << setw( 14 ) << a.seconds << endl;
+	}
 }
 
 int CommandLineUI::run()
 {
 	assert( raytracer != 0 );
+	BVH::setBuildThreads( m_nThreads );
+	BVH::resetBuildStats();
+	Accelerator::resetBuildStats();
 	raytracer->loadScene( rayName );
 
+	if( raytracer->sceneLoaded() && benchmarkRays > 0 )
+		return benchmarkTriangles( raytracer->getScene(), benchmarkRays, std::cout ) ? 0 : 1;
+
 	if( raytracer->sceneLoaded() )
 	{
+		Animation animation;
+		int frames = 1;
+		if( animationName ) {
+			string error;
+			if( !animation.load( animationName, raytracer->getMutableScene(), error ) ) {
+				std::cerr << error << std::endl;
+				return 1;
+			}
+			frames = animation.frameCount();
+		}
+
 		int width = m_nSize;
 		int height = (int)(width / raytracer->aspectRatio() + 0.5);
 
-		raytracer->traceSetup( width, height );
-
+		RenderStats::reset();
 		clock_t start, end;
 		start = clock();
+		double wallStart = RenderStats::wallTime();
+		long allocations = allocationCount();
 
-		for( int j = 0; j < height; ++j )
-			for( int i = 0; i < width; ++i )
-				raytracer->tracePixel(i,j);
+		for( int frame = 0; frame < frames; ++frame )
+		{
+			double frameStart = RenderStats::wallTime();
+			if( animationName )
+				animation.apply( frame );
+			double refit = RenderStats::wallTime() - frameStart;
 
-		end=clock();
+			raytracer->traceSetup( width, height );
+
+			if( wavefront ) {
+				WavefrontRenderer renderer( raytracer, width, height, packets );
+				renderer.run( m_nThreads );
+			} else if( m_nThreads == 1 ) {
+				for( int j = 0; j < height; ++j )
+					for( int i = 0; i < width; ++i )
+						raytracer->tracePixel(i,j);
+			} else {
+				TileScheduler scheduler( raytracer, width, height );
+				scheduler.run( m_nThreads );
+			}
+
+			// save image
+			unsigned char* buf;
 
-		// save image
-		unsigned char* buf;
+			raytracer->getBuffer(buf, width, height);
 
-		raytracer->getBuffer(buf, width, height);
+			string name = animationName ? frameName( imgName, frame ) : string( imgName );
+			if (buf)
+				writeBMP(name.c_str(), width, height, buf);
+			if( animationName )
+				std::cout << name << ": " << RenderStats::wallTime() - frameStart
+					<< " seconds, refit " << refit << std::endl;
+			if( buf && diffName && !compareImage( buf, width, height ) ) {
+				std::cerr << "couldn't compare with '" << diffName << "'" << std::endl;
+				return 1;
+			}
+		}
 
-		if (buf)
-			writeBMP(imgName, width, height, buf);
+		end=clock();
+		double wall = RenderStats::wallTime() - wallStart;
+		allocations = allocationCount() - allocations;
 
 		double t=(double)(end-start)/CLOCKS_PER_SEC;
-		std::cout << "total time = " << t << " seconds" << std::endl;
+		std::cout << "total time = " << wall << " seconds" << std::endl;
+#ifdef COUNT_ALLOCATIONS
+		std::cout << "heap allocations during trace = " << allocations << std::endl;
+#endif
+		if( printStats ) {
+			std::cout << std::endl;
+			RenderStats::total().printTable( std::cout, wall );
+			std::cout << std::endl;
+			printBuildStats( std::cout );
+			std::cout << std::endl;
+			printAcceleratorStats( std::cout );
+		}
+		if( reportName && !writeReport( width, height, wall, t ) ) {
+			std::cerr << "couldn't write report '" << reportName << "'" << std::endl;
+			return 1;
+		}
         return 0;
 	}
 	else
@@ -105,6 +298,18 @@ int CommandLineUI::run()
 	}
 }
 
+// Frame 7 of out.bmp is out0007.bmp.
+string CommandLineUI::frameName( const char* name, int frame )
+{
+	string s( name );
+	size_t dot = s.find_last_of( '.' );
+	if( dot == string::npos || dot < s.find_last_of( "/\\" ) + 1 )
+		dot = s.size();
+	char number[16];
+	sprintf( number, "%04d", frame );
+	return s.substr( 0, dot ) + number + s.substr( dot );
+}
+
 void CommandLineUI::alert( const string& msg )
 {
 	std::cerr << msg << std::endl;
@@ -114,6 +319,174 @@ void CommandLineUI::usage()
 {
 	std::cerr << "usage: " << progName << " [options] [input.ray output.bmp]" << std::endl;
 	std::cerr << "  -r <#>      set recursion level (default " << m_nDepth << ")" << std::endl; 
+	std::cerr << "  -c <#>      don't trace reflected or refracted rays that contribute less than #" << std::endl;
+	std::cerr << "              to the pixel (default " << m_dThreshold << ")" << std::endl;
 	std::cerr << "  -w <#>      set output image width (default " << m_nSize << ")" << std::endl;
 	std::cerr << "  -s <#>      set number of samples per pixel (default " << m_nRays << ")" << std::endl;
+	std::cerr << "  -a <#>      sample adaptively, subdividing where colors differ by more than #;" << std::endl;
+	std::cerr << "              -s then sets the finest subdivision" << std::endl;
+	std::cerr << "  -W          trace a wave of rays at a time instead of recursing (no -a)" << std::endl;
+	std::cerr << "  -P          as -W, tracing coherent rays in packets of " << BVH::PACKET_SIZE << std::endl;
+	std::cerr << "  -j <#>      set number of render threads, 0 for one per core (default " << m_nThreads << ")" << std::endl;
+	std::cerr << "  -k <name>   ray/box and ray/triangle kernels: scalar, sse or avx (default "
+		<< BVH::kernelName( BVH::bestKernel() ) << ")" << std::endl;
+	std::cerr << "  -B <name>   how hierarchies are built: sweep (best trees), binned or" << std::endl;
+	std::cerr << "              morton (quickest) (default " << BVH::builderName( BVH::currentBuilder() ) << ")" << std::endl;
+	std::cerr << "  -x <name>   what rays walk to find objects and faces: bvh, grid," << std::endl;
+	std::cerr << "              twolevel (grids in a grid's crowded cells), or for the faces" << std::endl;
+	std::cerr << "              of meshes kdtree or ropes (a kd-tree walked without a stack)" << std::endl;
+	std::cerr << "              (default " << Accelerator::kindName( Accelerator::currentKind() ) << ")" << std::endl;
+	std::cerr << "  -T <#>      time the ray/triangle kernels on # random rays at each mesh" << std::endl;
+	std::cerr << "              of input.ray, instead of rendering" << std::endl;
+	std::cerr << "  -n          don't read or write the binary scene cache (input.ray.cache)" << std::endl;
+	std::cerr << "              or the hierarchies of big meshes (mesh-*.bvh beside it)" << std::endl;
+	std::cerr << "  -d <file>   compare the image with file, a render of the same scene, and" << std::endl;
+	std::cerr << "              print how much they differ" << std::endl;
+	std::cerr << "  -A <file>   render the frames keyed in file, moving the camera and named" << std::endl;
+	std::cerr << "              objects, to output0000.bmp, output0001.bmp, ..." << std::endl;
+	std::cerr << "  -b <file>   write timings and ray counts to file as JSON" << std::endl;
+	std::cerr << "  -S          print ray counts and render statistics" << std::endl;
+}
+
+bool CommandLineUI::setBuilder( const char* name )
+{
+	for( int b = 0; b < BVH::BUILDERS; ++b )
+		if( !strcmp( name, BVH::builderName( (BVH::Builder)b ) ) ) {
+			BVH::setBuilder( (BVH::Builder)b );
+			return true;
+		}
+	return false;
+}
+
+bool CommandLineUI::setAccelerator( const char* name )
+{
+	for( int k = 0; k < Accelerator::KINDS; ++k )
+		if( !strcmp( name, Accelerator::kindName( (Accelerator::Kind)k ) ) ) {
+			Accelerator::setKind( (Accelerator::Kind)k );
+			return true;
+		}
+	return false;
+}
+
+// Falls back to the best kernel the CPU has if it lacks the one asked for.
+bool CommandLineUI::setKernel( const char* name )
+{
+	for( int k = 0; k < BVH::KERNELS; ++k )
+		if( !strcmp( name, BVH::kernelName( (BVH::Kernel)k ) ) ) {
+			BVH::setKernel( (BVH::Kernel)k );
+			TriangleSet::setKernel( (BVH::Kernel)k );
+			return true;
+		}
+	return false;
+}
+
+// The reference has to be the same size.  Pixels are compared channel by
+// channel; PSNR is against a peak of 255.
+bool CommandLineUI::compareImage( const unsigned char* buf, int width, int height )
+{
+	int refWidth, refHeight;
+	unsigned char* ref = readBMP( diffName, refWidth, refHeight );
+	if( !ref )
+		return false;
+	if( refWidth != width || refHeight != height ) {
+		delete [] ref;
+		return false;
+	}
+
+	diff.pixels = 0;
+	diff.largest = 0;
+	double squares = 0.0;
+	for( int k = 0; k < width * height; ++k ) {
+		bool differs = false;
+		for( int c = 0; c < 3; ++c ) {
+			int d = abs( (int)buf[3*k + c] - (int)ref[3*k + c] );
+			if( d > 0 ) differs = true;
+			if( d > diff.largest ) diff.largest = d;
+			squares += d * d;
+		}
+		if( differs ) ++diff.pixels;
+	}
+	diff.rmse = sqrt( squares / (3.0 * width * height) );
+	delete [] ref;
+
+	std::cout << "against " << diffName << ": " << diff.pixels << " of " << width * height
+		<< " pixels differ, by at most " << diff.largest << ", rmse " << diff.rmse << ", psnr ";
+	if( diff.rmse > 0.0 )
+		std::cout << 20.0 * log10( 255.0 / diff.rmse ) << " dB" << std::endl;
+	else
+		std::cout << "inf" << std::endl;
+	return true;
+}
+
+static void writeJsonString( ostream& out, const char* s )
+{
+	out << '"';
+	for( ; *s; ++s ) {
+		if( *s == '"' || *s == '\\' ) out << '\\';
+		out << *s;
+	}
+	out << '"';
+}
+
+// One JSON object describing the render just finished; bench/benchmark.sh
+// collects these into a report.
+bool CommandLineUI::writeReport( int width, int height, double wall, double cpu )
+{
+	ofstream out( reportName );
+	if( !out ) return false;
+
+	RenderStats stats = RenderStats::total();
+	BVH::BuildStats build = BVH::buildStats();
+
+	out << "{\n  \"scene\": ";
+	writeJsonString( out, rayName );
+	out << ",\n  \"width\": " << width
+		<< ",\n  \"height\": " << height
+		<< ",\n  \"depth\": " << m_nDepth
+		<< ",\n  \"samples\": " << m_nRays
+		<< ",\n  \"wavefront\": " << (wavefront ? "true" : "false")
+		<< ",\n  \"packets\": " << (packets ? "true" : "false")
+		<< ",\n  \"bvh_kernel\": \"" << BVH::kernelName( BVH::currentKernel() ) << "\""
+		<< ",\n  \"bvh_builder\": \"" << BVH::builderName( BVH::currentBuilder() ) << "\""
+		<< ",\n  \"accelerator\": \"" << Accelerator::kindName( Accelerator::currentKind() ) << "\""
+		<< ",\n  \"triangle_kernel\": \"" << BVH::kernelName( TriangleSet::currentKernel() ) << "\""
+		<< ",\n  \"precision\": \"" << (sizeof(Real) == sizeof(float) ? "float" : "double") << "\""
+		<< ",\n  \"threads\": " << (m_nThreads > 0 ? m_nThreads : TileScheduler::hardwareThreads())
+		<< ",\n  \"scene_cache\": " << (raytracer->loadedFromCache() ? "true" : "false")
+		<< ",\n  \"parse_seconds\": " << raytracer->getParseTime()
+		<< ",\n  \"build_seconds\": " << raytracer->getBuildTime()
+		<< ",\n  \"bvh_build\": { \"built\": " << build.built
+		<< ", \"read\": " << build.read
+		<< ", \"primitives\": " << build.primitives
+		<< ", \"nodes\": " << build.nodes
+		<< ", \"seconds\": " << build.seconds
+		<< ", \"largest\": " << build.largest
+		<< ", \"largest_sah_cost\": " << build.largestCost << " }"
+		<< ",\n  \"accelerators\": {";
+	const char* comma = "";
+	for( int k = 0; k < Accelerator::KINDS; ++k ) {
+		Accelerator::BuildStats a = Accelerator::buildStats( (Accelerator::Kind)k );
+		if( !a.built ) continue;
+		out << comma << "\n    \"" << Accelerator::kindName( (Accelerator::Kind)k ) << "\": { \"built\": " << a.built
+			<< ", \"primitives\": " << a.primitives
+			<< ", \"references\": " << a.references
+			<< ", \"bytes\": " << a.bytes
+			<< ", \"seconds\": " << a.seconds << " }";
+		comma = ",";
+	}
+	out << "\n  }"
+		<< ",\n  \"render_seconds\": " << wall
+		<< ",\n  \"cpu_seconds\": " << cpu;
+	if( diffName ) {
+		out << ",\n  \"diff\": { \"reference\": ";
+		writeJsonString( out, diffName );
+		out << ", \"pixels\": " << diff.pixels
+			<< ", \"largest\": " << diff.largest
+			<< ", \"rmse\": " << diff.rmse << " }";
+	}
+
+	out << ",\n";
+	stats.printJson( out, wall, "  " );
+	out << "\n}\n";
+	return !!out;
 }
@@ -21,10 +21,30 @@ public:
 
 private:
 	void		usage();
+	bool		writeReport( int width, int height, double wall, double cpu );
+	bool		setKernel( const char* name );
+	bool		setBuilder( const char* name );
+	bool		setAccelerator( const char* name );
+	bool		compareImage( const unsigned char* buf, int width, int height );
+	static string	frameName( const char* name, int frame );
 
 	char*	rayName;
 	char*	imgName;
 	char*	progName;
+	char*	reportName;		// -b: where to write the JSON report
+	bool	printStats;		// -S: print RenderStats after the render
+	bool	wavefront;		// -W: render with WavefrontRenderer
+	bool	packets;		// -P: ... with ray packets
+	int		benchmarkRays;	// -T: run the triangle benchmark instead
+	char*	diffName;		// -d: the image to compare the render with
+	char*	animationName;	// -A: keyframes to render a sequence from
+
+	// What compareImage found.
+	struct ImageDiff {
+		long	pixels;			// pixels with any channel different
+		int		largest;		// largest difference in any channel
+		double	rmse;			// over all channels, in 0..255 units
+	} diff;
 };
 
 #endif
@@ -23,7 +23,8 @@ class RayTracer;
 class TraceUI {
 public:
 	TraceUI()
-		: m_nDepth(0), m_nSize(150), m_nRays(1), 
+		: m_nDepth(0), m_nSize(150), m_nRays(1), m_nThreads(1),
+		m_bSceneCache( true ), m_dAdaptiveThreshold( 0.0 ), m_dThreshold( 0.0 ),
 		m_displayDebuggingInfo( false ),
 		raytracer( 0 )
 	{ }
@@ -41,6 +42,11 @@ public:
 	int		getSize() const { return m_nSize; }
 	int		getDepth() const { return m_nDepth; }
   int   getRays() const { return m_nRays; }
+	int		getThreads() const { return m_nThreads; }
+	bool	useSceneCache() const { return m_bSceneCache; }
+	bool	adaptiveSampling() const { return m_dAdaptiveThreshold > 0.0; }
+	double	getAdaptiveThreshold() const { return m_dAdaptiveThreshold; }
+	double	getThreshold() const { return m_dThreshold; }
 
 protected:
 	RayTracer*	raytracer;
@@ -48,6 +54,12 @@ protected:
 	int			m_nSize;				// Size of the traced image
 	int			m_nDepth;				// Max depth of recursion
   int     m_nRays;        // Sqrt of # of rays per pixel
+	int			m_nThreads;				// Render threads (0 = one per core)
+	bool		m_bSceneCache;			// Read and write .ray.cache files
+	double		m_dAdaptiveThreshold;	// Color difference that makes adaptive
+										// sampling subdivide (0 = uniform sampling)
+	double		m_dThreshold;			// Reflected/refracted rays whose weight in the
+										// pixel is below this aren't traced
 
 	// Determines whether or not to show debugging information
 	// for individual rays.  Disabled by default for efficiency
@@ -178,7 +178,7 @@ void DebuggingView::resetCamera()
 
 	const Scene& scene = raytracer->getScene();
 
-	Vec3d maxVec = maximum( scene.bounds().getMax(), scene.bounds().getMin() );
+	Vec3r maxVec = maximum( scene.bounds().getMax(), scene.bounds().getMin() );
 	maxVec = maximum( scene.getCamera().getEye(), maxVec );
 	maxVec = maximum( scene.getCamera().getEye() + scene.getCamera().getLook(), maxVec );
 	maxDist = max( max( maxVec[0], maxVec[1] ), maxVec[2] );
@@ -227,9 +227,9 @@ void DebuggingView::draw()
 	// lines up with the scene camera, initially, and to correct for our 
 	// definition of "up."
 
-	Vec3d uAxis = raytracer->getScene().getCamera().getU();
-	Vec3d vAxis = raytracer->getScene().getCamera().getV();
-	Vec3d wAxis = uAxis ^ vAxis;
+	Vec3r uAxis = raytracer->getScene().getCamera().getU();
+	Vec3r vAxis = raytracer->getScene().getCamera().getV();
+	Vec3r wAxis = uAxis ^ vAxis;
 	uAxis = wAxis ^ vAxis;
 
 	uAxis.normalize();
@@ -450,11 +450,11 @@ void DebuggingView::drawRays()
 {
 	glDisable( GL_LIGHTING );
 	// Now draw all the rays
-	for( std::vector< std::pair<ray, isect> >::const_iterator rayItr = 
-		raytracer->getScene().intersectCache.begin();
-		rayItr != raytracer->getScene().intersectCache.end();
-		++rayItr )
+	const IntersectCache& cache = raytracer->getScene().intersectCache;
+	for( size_t k = 0; k < cache.size(); ++k )
 	{
+		const IntersectCache::Entry* rayItr = &cache[k];
+
 		switch( rayItr->first.type() )
 		{
 		case ray::VISIBILITY:
@@ -477,16 +477,16 @@ void DebuggingView::drawRays()
 			glColor4f( 0.20f, 0.45f, 0.72f, 1.0f );
 			break;
 		}
-		Vec3d p = rayItr->first.getPosition();
-		Vec3d d = rayItr->first.getDirection();
-		Vec3d isectPoint = p + rayItr->second.t*d;
+		Vec3r p = rayItr->first.getPosition();
+		Vec3r d = rayItr->first.getDirection();
+		Vec3r isectPoint = p + rayItr->second.t*d;
 
 		glEnable( GL_LINE_STIPPLE );
 		glLineStipple( 1, 0x3333 );
 
 		glBegin( GL_LINES );
-			glVertex3dv( p.getPointer() );
-			glVertex3dv( isectPoint.getPointer() );
+			p.glVertex();
+			isectPoint.glVertex();
 		glEnd();
 
 		glDisable(GL_LINE_STIPPLE);
@@ -498,7 +498,7 @@ void DebuggingView::drawRays()
 				glBegin( GL_LINES );
 					glColor4f( 0.5f, 1.0f, 0.5f, 1.0f );
 					glVertex3d( 0.0, 0.0, 0.0 );
-					glVertex3dv( rayItr->second.N.getPointer() );
+					rayItr->second.N.glVertex();
 				glEnd();
 			glPopMatrix();
 		}
@@ -546,21 +546,21 @@ void DebuggingView::drawCamera()
 		// Now need to draw the camera.
 		glBegin( GL_LINES );
 			glVertex3d(0,0,0);
-			glVertex3dv( (sceneCamera.getLook() 
+			(sceneCamera.getLook() 
 				+ 0.5*sceneCamera.getU() 
-				+ 0.5*sceneCamera.getV()).getPointer() );
+				+ 0.5*sceneCamera.getV()).glVertex();
 			glVertex3d(0,0,0);
-			glVertex3dv( (sceneCamera.getLook() 
+			(sceneCamera.getLook() 
 				+ 0.5*sceneCamera.getU() 
-				- 0.5*sceneCamera.getV()).getPointer() );
+				- 0.5*sceneCamera.getV()).glVertex();
 			glVertex3d(0,0,0);
-			glVertex3dv( (sceneCamera.getLook() 
+			(sceneCamera.getLook() 
 				- 0.5*sceneCamera.getU() 
-				+ 0.5*sceneCamera.getV()).getPointer() );
+				+ 0.5*sceneCamera.getV()).glVertex();
 			glVertex3d(0,0,0);
-			glVertex3dv( (sceneCamera.getLook() 
+			(sceneCamera.getLook() 
 				- 0.5*sceneCamera.getU() 
-				- 0.5*sceneCamera.getV()).getPointer() );
+				- 0.5*sceneCamera.getV()).glVertex();
 		glEnd();
 
 		glTranslated( (sceneCamera.getLook())[0],
@@ -582,27 +582,27 @@ void DebuggingView::drawCamera()
 		glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 		glBegin( GL_QUADS );
 			glTexCoord2f(0.0, 0.0);
-			glVertex3dv((-0.5*sceneCamera.getU() - 0.5*sceneCamera.getV()).getPointer());
+			(-0.5*sceneCamera.getU() - 0.5*sceneCamera.getV()).glVertex();
 
 			glTexCoord2f(0.0, 1.0);
-			glVertex3dv((-0.5*sceneCamera.getU() + 0.5*sceneCamera.getV()).getPointer());
+			(-0.5*sceneCamera.getU() + 0.5*sceneCamera.getV()).glVertex();
 
 			glTexCoord2f(1.0, 1.0);
-			glVertex3dv((0.5*sceneCamera.getU() + 0.5*sceneCamera.getV()).getPointer());
+			(0.5*sceneCamera.getU() + 0.5*sceneCamera.getV()).glVertex();
 
 			glTexCoord2f(1.0, 0.0);
-			glVertex3dv((0.5*sceneCamera.getU() - 0.5*sceneCamera.getV()).getPointer());
+			(0.5*sceneCamera.getU() - 0.5*sceneCamera.getV()).glVertex();
 		glEnd();
 		glDisable(GL_TEXTURE_2D);
 		glDisable(GL_BLEND);
 
 		glColor4f( 1.0f, 1.0f, 1.0f, 1.0f );
 		glBegin( GL_LINE_STRIP );
-			glVertex3dv((-0.51*sceneCamera.getU() - 0.51*sceneCamera.getV()).getPointer());
-			glVertex3dv((-0.51*sceneCamera.getU() + 0.51*sceneCamera.getV()).getPointer());
-			glVertex3dv((0.51*sceneCamera.getU() + 0.51*sceneCamera.getV()).getPointer());
-			glVertex3dv((0.51*sceneCamera.getU() - 0.51*sceneCamera.getV()).getPointer());
-			glVertex3dv((-0.51*sceneCamera.getU() - 0.51*sceneCamera.getV()).getPointer());
+			(-0.51*sceneCamera.getU() - 0.51*sceneCamera.getV()).glVertex();
+			(-0.51*sceneCamera.getU() + 0.51*sceneCamera.getV()).glVertex();
+			(0.51*sceneCamera.getU() + 0.51*sceneCamera.getV()).glVertex();
+			(0.51*sceneCamera.getU() - 0.51*sceneCamera.getV()).glVertex();
+			(-0.51*sceneCamera.getU() - 0.51*sceneCamera.getV()).glVertex();
 		glEnd();
 
 
@@ -12,6 +12,7 @@
 #include "../SceneObjects/Box.h"
 #include "../SceneObjects/Cone.h"
 #include "../SceneObjects/Cylinder.h"
+#include "../SceneObjects/Instance.h"
 #include "../SceneObjects/Sphere.h"
 #include "../SceneObjects/Square.h"
 #include "../SceneObjects/trimesh.h"
@@ -37,14 +38,15 @@ void Geometry::glDraw(int quality, bool actualMaterials, bool actualTextures) co
 {
 	glPushMatrix();
 	{
-		Mat4d colMajor = transform->transform().transpose();
-		glMultMatrixd( colMajor.n );
+		GLfloat colMajor[16];
+		transform->transform().getGLMatrixF( colMajor );
+		glMultMatrixf( colMajor );
 		glDrawLocal(quality, actualMaterials, actualTextures);
 	}
 	glPopMatrix();
 }
 
-void setMaterialProperty( GLenum property, Vec3d value )
+void setMaterialProperty( GLenum property, Vec3r value )
 {
 	GLfloat val[4];
 	val[0] = GLfloat(value[0]);
@@ -70,8 +72,9 @@ void SceneObject::glDraw(int quality, bool actualMaterials, bool actualTextures)
 {
 	glPushMatrix();
 	{
-		Mat4d colMajor = transform->transform().transpose();
-		glMultMatrixd( colMajor.n );
+		GLfloat colMajor[16];
+		transform->transform().getGLMatrixF( colMajor );
+		glMultMatrixf( colMajor );
 
 		if( actualMaterials )
 		{
@@ -354,43 +357,43 @@ void Trimesh::glDrawLocal(int quality, bool actualMaterials, bool actualTextures
 		glNewList( displayList, GL_COMPILE );
 
 		glBegin( GL_TRIANGLES );
-		for( Faces::const_iterator itr = faces.begin(); itr != faces.end(); ++itr )
+		for( int f = 0; f < faceCount(); ++f )
 		{
-			const int vert1 = (*(*itr))[0];
-			const int vert2 = (*(*itr))[1];
-			const int vert3 = (*(*itr))[2];
+			const int vert1 = face(f)[0];
+			const int vert2 = face(f)[1];
+			const int vert3 = face(f)[2];
 
 			if( normals.empty() )
 			{
-				const Vec3d& a = vertices[vert1];
-				const Vec3d& b = vertices[vert2];
-				const Vec3d& c = vertices[vert3];
+				const Vec3r& a = vertices[vert1];
+				const Vec3r& b = vertices[vert2];
+				const Vec3r& c = vertices[vert3];
 
-				Vec3d cv=(b - a) ^ (c - a);
+				Vec3r cv=(b - a) ^ (c - a);
 
 				// there exists some bad triangles such that two vertices coincide
 				// check this before normalize
 				if (!cv.iszero())
-					glNormal3dv( cv.getPointer() );
+					cv.glNormal();
 			}
 
 			if( ! normals.empty() )
-				glNormal3dv( normals[vert1].getPointer() );
+				normals[vert1].glNormal();
 			if( !materials.empty() && actualMaterials )
-				setGLMaterial( *materials[vert1], *itr );
-			glVertex3dv( vertices[vert1].getPointer() );
+				setGLMaterial( *materials[vert1], this );
+			vertices[vert1].glVertex();
 
 			if( ! normals.empty() )
-				glNormal3dv( normals[vert2].getPointer() );
+				normals[vert2].glNormal();
 			if( !materials.empty() && actualMaterials )
-				setGLMaterial( *materials[vert2], *itr );
-			glVertex3dv( vertices[vert2].getPointer() );
+				setGLMaterial( *materials[vert2], this );
+			vertices[vert2].glVertex();
 
 			if( ! normals.empty() )
-				glNormal3dv( normals[vert3].getPointer() );
+				normals[vert3].glNormal();
 			if( !materials.empty() && actualMaterials )
-				setGLMaterial( *materials[vert3], *itr );
-			glVertex3dv( vertices[vert3].getPointer() );
+				setGLMaterial( *materials[vert3], this );
+			vertices[vert3].glVertex();
 		}
 		glEnd();
 
@@ -400,6 +403,13 @@ void Trimesh::glDrawLocal(int quality, bool actualMaterials, bool actualTextures
 	glCallList(displayList);
 }
 
+// Geometry::glDrawLocal is public, so this reaches the mesh's display
+// lists: they are shared by every instance, as the mesh itself is.
+void Instance::glDrawLocal(int quality, bool actualMaterials, bool actualTextures) const
+{
+	static_cast<const Geometry*>( mesh )->glDrawLocal( quality, actualMaterials, actualTextures );
+}
+
 void PointLight::glDraw(GLenum lightID) const
 {
 
@@ -553,31 +563,31 @@ void DirectionalLight::glDraw() const
 
 		// We essentially want to find the spherical bounding volume for
 		// the scene so we can put our directional lights just outside it.
-		Vec3d maxVec = maximum( scene->bounds().getMax(), scene->bounds().getMin() );
+		Vec3r maxVec = maximum( scene->bounds().getMax(), scene->bounds().getMin() );
 		maxVec = maximum( scene->getCamera().getEye(), maxVec );
 		maxVec = maximum( scene->getCamera().getEye() + scene->getCamera().getLook(), maxVec );
 		maxDist = max( max( maxVec[0], maxVec[1] ), maxVec[2] );
 
-		Vec3d uAxis = orientation;
+		Vec3r uAxis = orientation;
 		uAxis.normalize();
 
 		// The first thing we need is the light's coordinate system (u,v,w).  To do this,
 		// we will cross the light's orientation vector with the three coordinate
 		// axes and find the 'best conditioned' one -- that is, the cross product
 		// with the largest length (so we can normalize it w/o numerical error).
-		Vec3d vAxis = uAxis ^ Vec3d(1.0,0.0,0.0);
+		Vec3r vAxis = uAxis ^ Vec3r(1.0,0.0,0.0);
 		{
-			Vec3d test = uAxis ^ Vec3d(0.0,1.0,0.0);
+			Vec3r test = uAxis ^ Vec3r(0.0,1.0,0.0);
 			if( test.length2() > vAxis.length2() )
 				vAxis = test;
 
-			test = uAxis ^ Vec3d(0.0,0.0,1.0);
+			test = uAxis ^ Vec3r(0.0,0.0,1.0);
 			if( test.length2() > vAxis.length2() )
 				vAxis = test;
 		}
 		vAxis.normalize();
 
-		Vec3d wAxis = uAxis ^ vAxis;
+		Vec3r wAxis = uAxis ^ vAxis;
 		wAxis.normalize();
 
 		// Now, we have a coordinate system.  We want to rotate our coordinate
@@ -4,6 +4,8 @@
 #include <iostream>
 #include <string.h>
 
+#include "real.h"
+
 //==========[ Forward References ]=============================================
 
 template <class T> class Vec;
@@ -150,6 +152,7 @@ public:
 typedef Mat3<int> Mat3i;
 typedef Mat3<float> Mat3f;
 typedef Mat3<double> Mat3d;
+typedef Mat3<Real> Mat3r;
 
 //==========[ class Mat4 ]=====================================================
 
@@ -236,7 +239,7 @@ public:
 	  mat[ 8]=n[ 2]; mat[ 9]=n[ 6]; mat[10]=n[10]; mat[11]=n[14];
 	  mat[12]=n[ 3]; mat[13]=n[ 7]; mat[14]=n[11]; mat[15]=n[15]; }
 
-	void getGLMatrixF( float* mat )
+	void getGLMatrixF( float* mat ) const
 	{ mat[ 0]=n[ 0]; mat[ 1]=n[ 4]; mat[ 2]=n[ 8]; mat[ 3]=n[12];
 	  mat[ 4]=n[ 1]; mat[ 5]=n[ 5]; mat[ 6]=n[ 9]; mat[ 7]=n[13];
 	  mat[ 8]=n[ 2]; mat[ 9]=n[ 6]; mat[10]=n[10]; mat[11]=n[14];
@@ -251,7 +254,7 @@ public:
 
 	//---[ Conversion ]------------------------------------
 
-	Mat3<T> upper33() {
+	Mat3<T> upper33() const {
 		return Mat3<T>(
 			n[0], n[1], n[2],
 			n[4], n[5], n[6],
@@ -335,6 +338,7 @@ public:
 typedef Mat4<int> Mat4i;
 typedef Mat4<float> Mat4f;
 typedef Mat4<double> Mat4d;
+typedef Mat4<Real> Mat4r;
 
 //==========[ Inline Method Definitions (Matrix) ]=============================
 
@@ -0,0 +1,14 @@
+#ifndef __REAL_HEADER__
+#define __REAL_HEADER__
+
+// The ray tracer computes in Real, and keeps its points, directions and
+// colors in the Vec*r and Mat*r types of vec.h and mat.h.  That is double
+// unless the program is built with RAY_FLOAT defined, which makes it float.
+
+#ifdef RAY_FLOAT
+typedef float Real;
+#else
+typedef double Real;
+#endif
+
+#endif
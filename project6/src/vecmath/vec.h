@@ -18,6 +18,8 @@ using std::max;
 
 #include <FL/gl.h>
 
+#include "real.h"
+
 //==========[ Forward References ]=========================
 
 template <class T> class Vec;
@@ -188,6 +190,7 @@ public:
 typedef Vec2<int> Vec2i;
 typedef Vec2<float> Vec2f;
 typedef Vec2<double> Vec2d;
+typedef Vec2<Real> Vec2r;
 
 //==========[ class Vec3 ]=================================
 
@@ -273,8 +276,8 @@ public:
 
 	void glTranslate() { glTranslated(n[0], n[1], n[2]); }
 	void glColor()  { glColor3d(n[0], n[1], n[2]); }
-	void glVertex()  { glVertex3d(n[0], n[1], n[2]); }
-	void glNormal()  { glNormal3d(n[0], n[1], n[2]); }
+	void glVertex() const { glVertex3d(n[0], n[1], n[2]); }
+	void glNormal() const { glNormal3d(n[0], n[1], n[2]); }
 
 	//---[ Friend Methods ]----------------------
 
@@ -302,6 +305,7 @@ public:
 typedef Vec3<int> Vec3i;
 typedef Vec3<float> Vec3f;
 typedef Vec3<double> Vec3d;
+typedef Vec3<Real> Vec3r;
 
 //==========[ class Vec4 ]=================================
 
@@ -394,6 +398,7 @@ public:
 typedef Vec4<int> Vec4i;
 typedef Vec4<float> Vec4f;
 typedef Vec4<double> Vec4d;
+typedef Vec4<Real> Vec4r;
 
 //==========[ Vec Methods ]================================
 